@@ -60,6 +60,9 @@ extern "C" {
 
 typedef struct moon_State moon_State;
 
+/* values in transit between independent states */
+typedef struct moon_Packet moon_Packet;
+
 
 /*
 ** basic types
@@ -165,6 +168,29 @@ typedef struct moon_Debug moon_Debug;
 typedef void (*moon_Hook) (moon_State *L, moon_Debug *ar);
 
 
+/*
+** Handles for interned string keys ('moon_tokey', 'moonL_internkey')
+*/
+typedef struct moon_Key moon_Key;
+
+
+/*
+** Plain C values for the bulk table functions ('moon_setarray' etc.)
+*/
+typedef struct moon_Value {
+  int type;  /* MOON_TNIL, MOON_TBOOLEAN, MOON_TNUMBER, MOON_TSTRING, ... */
+  int isinteger;  /* for numbers: whether the value is in 'u.i' */
+  size_t len;  /* for strings: length of 'u.s' */
+  union {
+    int b;  /* booleans */
+    moon_Integer i;  /* integers */
+    moon_Number n;  /* floats */
+    const char *s;  /* strings */
+    const void *p;  /* light userdata and, when reading, other objects */
+  } u;
+} moon_Value;
+
+
 /*
 ** generic extra include file
 */
@@ -183,6 +209,7 @@ extern const char moon_ident[];
 ** state manipulation
 */
 MOON_API moon_State *(moon_newstate) (moon_Alloc f, void *ud, unsigned seed);
+MOON_API moon_State *(moon_clonestate) (moon_State *from);
 MOON_API void       (moon_close) (moon_State *L);
 MOON_API moon_State *(moon_newthread) (moon_State *L);
 MOON_API int        (moon_closethread) (moon_State *L, moon_State *from);
@@ -206,6 +233,11 @@ MOON_API int   (moon_checkstack) (moon_State *L, int n);
 
 MOON_API void  (moon_xmove) (moon_State *from, moon_State *to, int n);
 
+/* transfer among independent states */
+MOON_API moon_Packet *(moon_xpack) (moon_State *L, int n);
+MOON_API int   (moon_xunpack) (moon_State *L, moon_Packet *p);
+MOON_API void  (moon_xfreepacket) (moon_Packet *p);
+
 
 /*
 ** access functions (stack -> C)
@@ -228,6 +260,7 @@ MOON_API moon_CFunction   (moon_tocfunction) (moon_State *L, int idx);
 MOON_API void	       *(moon_touserdata) (moon_State *L, int idx);
 MOON_API moon_State      *(moon_tothread) (moon_State *L, int idx);
 MOON_API const void     *(moon_topointer) (moon_State *L, int idx);
+MOON_API const moon_Key *(moon_tokey) (moon_State *L, int idx);
 
 
 /*
@@ -288,6 +321,9 @@ MOON_API int (moon_geti) (moon_State *L, int idx, moon_Integer n);
 MOON_API int (moon_rawget) (moon_State *L, int idx);
 MOON_API int (moon_rawgeti) (moon_State *L, int idx, moon_Integer n);
 MOON_API int (moon_rawgetp) (moon_State *L, int idx, const void *p);
+MOON_API void (moon_getarray) (moon_State *L, int idx, moon_Integer first,
+                               int n, moon_Value *v);
+MOON_API int (moon_getfieldk) (moon_State *L, int idx, const moon_Key *k);
 
 MOON_API void  (moon_createtable) (moon_State *L, int narr, int nrec);
 MOON_API void *(moon_newuserdatauv) (moon_State *L, size_t sz, int nuvalue);
@@ -305,9 +341,17 @@ MOON_API void  (moon_seti) (moon_State *L, int idx, moon_Integer n);
 MOON_API void  (moon_rawset) (moon_State *L, int idx);
 MOON_API void  (moon_rawseti) (moon_State *L, int idx, moon_Integer n);
 MOON_API void  (moon_rawsetp) (moon_State *L, int idx, const void *p);
+MOON_API void  (moon_setarray) (moon_State *L, int idx, moon_Integer first,
+                                int n, const moon_Value *v);
+MOON_API void  (moon_setfields) (moon_State *L, int idx, int keys, int n,
+                                 const moon_Value *v);
+MOON_API void  (moon_setfieldk) (moon_State *L, int idx, const moon_Key *k);
 MOON_API int   (moon_setmetatable) (moon_State *L, int objindex);
 MOON_API int   (moon_setiuservalue) (moon_State *L, int idx, int n);
 
+MOON_API void  (moon_freeze) (moon_State *L, int idx);
+MOON_API int   (moon_isfrozen) (moon_State *L, int idx);
+
 
 /*
 ** 'load' and 'call' functions (load and run Lua code)
@@ -324,6 +368,7 @@ MOON_API int   (moon_load) (moon_State *L, moon_Reader reader, void *dt,
                           const char *chunkname, const char *mode);
 
 MOON_API int (moon_dump) (moon_State *L, moon_Writer writer, void *data, int strip);
+MOON_API int (moon_setoptlevel) (moon_State *L, int level);
 
 
 /*
@@ -360,6 +405,8 @@ MOON_API void (moon_warning)  (moon_State *L, const char *msg, int tocont);
 #define MOON_GCGEN		7
 #define MOON_GCINC		8
 #define MOON_GCPARAM		9
+#define MOON_GCBGSWEEP		10
+#define MOON_GCRECYCLE		11
 
 
 /*
@@ -399,6 +446,8 @@ MOON_API size_t  (moon_stringtonumber) (moon_State *L, const char *s);
 
 MOON_API moon_Alloc (moon_getallocf) (moon_State *L, void **ud);
 MOON_API void      (moon_setallocf) (moon_State *L, moon_Alloc f, void *ud);
+MOON_API size_t    (moon_setmemlimit) (moon_State *L, size_t limit);
+MOON_API size_t    (moon_memusage) (moon_State *L, size_t *peak, int reset);
 
 MOON_API void (moon_toclose) (moon_State *L, int idx);
 MOON_API void (moon_closeslot) (moon_State *L, int idx);
@@ -505,6 +554,17 @@ MOON_API moon_Hook (moon_gethook) (moon_State *L);
 MOON_API int (moon_gethookmask) (moon_State *L);
 MOON_API int (moon_gethookcount) (moon_State *L);
 
+MOON_API int (moon_profstart) (moon_State *L, int interval);
+MOON_API void (moon_profstop) (moon_State *L);
+MOON_API int (moon_profdump) (moon_State *L, moon_Writer writer, void *data,
+                                           int lines);
+
+MOON_API int (moon_vmstats) (moon_State *L, int reset);
+
+MOON_API int (moon_heapstart) (moon_State *L);
+MOON_API void (moon_heapstop) (moon_State *L);
+MOON_API int (moon_heapdump) (moon_State *L, moon_Writer writer, void *data);
+
 
 struct moon_Debug {
   int event;
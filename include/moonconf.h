@@ -141,6 +141,16 @@
 /* #define MOON_32BITS */
 
 
+/*
+@@ MOON_NANBOXING packs every value into a single 64-bit word: floats
+** are stored as themselves and all other values go into the payload
+** of a NaN. Integers are then restricted to 32 bits, floats must be
+** 'double', and pointers (including light userdata) must fit in 47
+** bits. It needs a 64-bit platform.
+*/
+/* #define MOON_NANBOXING */
+
+
 /*
 @@ MOON_C89_NUMBERS ensures that Lua uses the largest types available for
 ** C89 ('long' and 'double'); Windows always has '__int64', so it does
@@ -153,7 +163,14 @@
 #endif
 
 
-#if defined(MOON_32BITS)	/* { */
+#if defined(MOON_NANBOXING)	/* { */
+/*
+** 32-bit integers and 'double', to fit in a NaN-boxed value
+*/
+#define MOON_INT_TYPE	MOON_INT_INT
+#define MOON_FLOAT_TYPE	MOON_FLOAT_DOUBLE
+
+#elif defined(MOON_32BITS)	/* }{ */
 /*
 ** 32-bit integers and 'float'
 */
@@ -59,6 +59,22 @@ MOONMOD_API int (moonopen_table) (moon_State *L);
 #define MOON_UTF8LIBK	(MOON_TABLIBK << 1)
 MOONMOD_API int (moonopen_utf8) (moon_State *L);
 
+#define MOON_PARALLELLIBNAME	"parallel"
+#define MOON_PARALLELLIBK	(MOON_UTF8LIBK << 1)
+MOONMOD_API int (moonopen_parallel) (moon_State *L);
+
+#define MOON_CHANLIBNAME	"channel"
+#define MOON_CHANLIBK	(MOON_PARALLELLIBK << 1)
+MOONMOD_API int (moonopen_channel) (moon_State *L);
+
+#define MOON_PROFLIBNAME	"profile"
+#define MOON_PROFLIBK	(MOON_CHANLIBK << 1)
+MOONMOD_API int (moonopen_profile) (moon_State *L);
+
+#define MOON_ARRAYLIBNAME	"array"
+#define MOON_ARRAYLIBK	(MOON_PROFLIBK << 1)
+MOONMOD_API int (moonopen_array) (moon_State *L);
+
 
 /* open selected libraries */
 MOONLIB_API void (moonL_openselectedlibs) (moon_State *L, int load, int preload);
@@ -9,11 +9,17 @@
 
 
 #include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
 
 
 /*
@@ -882,6 +888,179 @@ MOONLIB_API int moonL_loadstring (moon_State *L, const char *s) {
 // }======================================================
 
 
+/*
+** {======================================================
+** Parallel loading
+** Files are compiled by worker threads, each one into a private state
+** (so with its own string table), and dumped. The binary chunks are
+** then loaded into the target state in order, which re-creates their
+** constants there; only this last step is serialized.
+** =======================================================
+*/
+
+// maximum number of threads used by 'moonL_loadmany'
+#if !defined(MOONI_MAXLOADTHREADS)
+#define MOONI_MAXLOADTHREADS	16
+#endif
+
+
+namespace {
+
+struct Compiled {
+  int status = MOON_OK;
+  std::string out;  // binary chunk or error message
+};
+
+
+struct LoadJob {
+  const char *const *filenames;
+  const char *mode;
+  std::vector<Compiled> results;
+  std::atomic<int> next{0};  // next file to compile
+};
+
+}  // namespace
+
+
+static int stringwriter (moon_State *L, const void *b, size_t size,
+                         void *ud) {
+  (void)L;
+  try {
+    static_cast<std::string *>(ud)->append(static_cast<const char *>(b), size);
+    return 0;
+  }
+  catch (const std::bad_alloc &) {
+    return 1;
+  }
+}
+
+
+static void compileone (moon_State *W, const char *filename,
+                        const char *mode, Compiled &c) {
+  c.status = moonL_loadfilex(W, filename, mode);
+  if (c.status == MOON_OK) {
+    if (moon_dump(W, stringwriter, &c.out, 0) != 0) {
+      c.status = MOON_ERRMEM;
+      c.out = "not enough memory";
+    }
+  }
+  else {
+    const char *msg = moon_tostring(W, -1);
+    c.out = (msg != nullptr) ? msg : "(error object is not a string)";
+  }
+  moon_settop(W, 0);
+}
+
+
+// body of each worker: compile files until there are no more
+static void compileall (LoadJob *job) {
+  moon_State *W = moonL_newstate();
+  int n = static_cast<int>(job->results.size());
+  int i;
+  while ((i = job->next.fetch_add(1)) < n) {
+    Compiled &c = job->results[static_cast<size_t>(i)];
+    try {
+      if (W == nullptr) {
+        c.status = MOON_ERRMEM;
+        c.out = "not enough memory";
+      }
+      else
+        compileone(W, job->filenames[i], job->mode, c);
+    }
+    catch (const std::bad_alloc &) {
+      c.status = MOON_ERRMEM;
+      c.out.clear();  // no message
+    }
+  }
+  if (W != nullptr)
+    moon_close(W);
+}
+
+
+static int loadcompiled (moon_State *L, const char *filename,
+                         const Compiled &c) {
+  if (c.status != MOON_OK) {
+    if (c.out.empty())
+      moon_pushliteral(L, "not enough memory");
+    else
+      moon_pushlstring(L, c.out.data(), c.out.size());
+    return c.status;
+  }
+  moon_pushfstring(L, "@%s", filename);
+  int status = moonL_loadbufferx(L, c.out.data(), c.out.size(),
+                                    moon_tostring(L, -1), "b");
+  moon_remove(L, -2);  // remove chunk name
+  return status;
+}
+
+
+// keep only the error message on top of the stack above 'base'
+static int loaderror (moon_State *L, int base, int status) {
+  moon_copy(L, -1, base + 1);
+  moon_settop(L, base + 1);
+  return status;
+}
+
+
+/*
+** Load the 'n' files in 'filenames', compiling them in parallel. On
+** success, pushes the 'n' compiled chunks, in order, and returns
+** MOON_OK; otherwise, pushes only the error message of the first file
+** (in order) that failed and returns its status. With a single core,
+** files are loaded directly, as there is nothing to gain from dumping
+** and reloading them.
+*/
+MOONLIB_API int moonL_loadmany (moon_State *L, int n,
+                                const char *const *filenames,
+                                const char *mode) {
+  int base = moon_gettop(L);
+  moonL_checkstack(L, n + 2, "too many files");
+  unsigned hw = std::thread::hardware_concurrency();
+  int nthreads = std::min({n, static_cast<int>(hw > 0 ? hw : 1),
+                           MOONI_MAXLOADTHREADS});
+  if (nthreads <= 1) {
+    for (int i = 0; i < n; i++) {
+      int status = moonL_loadfilex(L, filenames[i], mode);
+      if (status != MOON_OK)
+        return loaderror(L, base, status);
+    }
+    return MOON_OK;
+  }
+  try {
+    LoadJob job;
+    job.filenames = filenames;
+    job.mode = mode;
+    job.results.resize(static_cast<size_t>(n));
+    std::vector<std::thread> workers;
+    for (int i = 1; i < nthreads; i++) {  // calling thread also works
+      try {
+        workers.emplace_back(compileall, &job);
+      }
+      catch (const std::system_error &) {
+        break;  // go on with the threads we have
+      }
+    }
+    compileall(&job);
+    for (std::thread &t : workers)
+      t.join();
+    for (int i = 0; i < n; i++) {
+      int status = loadcompiled(L, filenames[i],
+                                job.results[static_cast<size_t>(i)]);
+      if (status != MOON_OK)
+        return loaderror(L, base, status);
+    }
+    return MOON_OK;
+  }
+  catch (const std::bad_alloc &) {
+    moon_settop(L, base);
+    moon_pushliteral(L, "not enough memory");
+    return MOON_ERRMEM;
+  }
+}
+
+// }======================================================
+
+
 
 MOONLIB_API int moonL_getmetafield (moon_State *L, int obj, const char *event) {
   if (!moon_getmetatable(L, obj))  // no metatable?
@@ -996,6 +1175,23 @@ MOONLIB_API int moonL_getsubtable (moon_State *L, int idx, const char *fname) {
 }
 
 
+/*
+** Returns a handle for key 's' (see 'moon_getfieldk'). The string is
+** kept in the registry, so the handle is valid while the state lives.
+*/
+MOONLIB_API const moon_Key *moonL_internkey (moon_State *L, const char *s) {
+  moonL_getsubtable(L, MOON_REGISTRYINDEX, MOON_KEYS_TABLE);
+  moon_pushstring(L, s);
+  const moon_Key *k = moon_tokey(L, -1);
+  if (k == nullptr)
+    moonL_error(L, "key '%s' is too long to be interned", s);
+  moon_pushboolean(L, 1);
+  moon_rawset(L, -3);  // KEYS[s] = true
+  moon_pop(L, 1);  // remove KEYS table
+  return k;
+}
+
+
 /*
 ** Stripped-down 'require': After checking "loaded" table, calls 'openf'
 ** to open a module, registers the result in 'package.loaded' table and,
@@ -1185,6 +1381,22 @@ MOONLIB_API unsigned int moonL_makeseed (moon_State *L) {
 */
 MOONLIB_API moon_State *(moonL_newstate) (void) {
   moon_State *L = moon_newstate(l_alloc, nullptr, mooni_makeseed());
+  if (l_likely(L)) {
+    moon_atpanic(L, &panic);
+    moon_setwarnf(L, warnfoff, L);  // default is warnings off
+    moon_gc(L, MOON_GCBGSWEEP, 1);  // 'l_alloc' is thread safe
+    moon_gc(L, MOON_GCRECYCLE, 1);
+  }
+  return L;
+}
+
+
+/*
+** Create a copy of state 'from' (see 'moon_clonestate'), with the
+** same defaults as 'moonL_newstate'.
+*/
+MOONLIB_API moon_State *(moonL_clonestate) (moon_State *from) {
+  moon_State *L = moon_clonestate(from);
   if (l_likely(L)) {
     moon_atpanic(L, &panic);
     moon_setwarnf(L, warnfoff, L);  // default is warnings off
@@ -43,6 +43,10 @@ typedef struct moonL_Buffer moonL_Buffer;
 #define MOON_PRELOAD_TABLE	"_PRELOAD"
 
 
+/* key, in the registry, for table of pinned key handles */
+#define MOON_KEYS_TABLE	"_KEYS"
+
+
 typedef struct moonL_Reg {
   const char *name;
   moon_CFunction func;
@@ -105,8 +109,12 @@ MOONLIB_API int (moonL_loadfilex) (moon_State *L, const char *filename,
 MOONLIB_API int (moonL_loadbufferx) (moon_State *L, const char *buff, size_t sz,
                                    const char *name, const char *mode);
 MOONLIB_API int (moonL_loadstring) (moon_State *L, const char *s);
+MOONLIB_API int (moonL_loadmany) (moon_State *L, int n,
+                                  const char *const *filenames,
+                                  const char *mode);
 
 MOONLIB_API moon_State *(moonL_newstate) (void);
+MOONLIB_API moon_State *(moonL_clonestate) (moon_State *from);
 
 MOONLIB_API unsigned moonL_makeseed (moon_State *L);
 
@@ -121,6 +129,8 @@ MOONLIB_API void (moonL_setfuncs) (moon_State *L, const moonL_Reg *l, int nup);
 
 MOONLIB_API int (moonL_getsubtable) (moon_State *L, int idx, const char *fname);
 
+MOONLIB_API const moon_Key *(moonL_internkey) (moon_State *L, const char *s);
+
 MOONLIB_API void (moonL_traceback) (moon_State *L, moon_State *L1,
                                   const char *msg, int level);
 
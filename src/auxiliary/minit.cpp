@@ -34,6 +34,10 @@ static const moonL_Reg stdlibs[] = {
   {MOON_STRLIBNAME, moonopen_string},
   {MOON_TABLIBNAME, moonopen_table},
   {MOON_UTF8LIBNAME, moonopen_utf8},
+  {MOON_PARALLELLIBNAME, moonopen_parallel},
+  {MOON_CHANLIBNAME, moonopen_channel},
+  {MOON_PROFLIBNAME, moonopen_profile},
+  {MOON_ARRAYLIBNAME, moonopen_array},
   {nullptr, nullptr}
 };
 
@@ -55,7 +59,7 @@ MOONLIB_API void moonL_openselectedlibs (moon_State *L, int load, int preload) {
       moon_setfield(L, -2, lib->name);  // add library to PRELOAD table
     }
   }
-  moon_assert((mask >> 1) == MOON_UTF8LIBK);
+  moon_assert((mask >> 1) == MOON_ARRAYLIBK);
   moon_pop(L, 1);  // remove PRELOAD table
 }
 
@@ -133,6 +133,20 @@ lu_byte FuncState::nvarstack() {
 }
 
 
+/*
+** Check whether register 'reg' holds the control variable of an
+** integer loop, whose value is always an integer.
+*/
+bool FuncState::isintforreg(int reg) {
+  for (int vidx = getNumActiveVars() - 1; vidx >= 0; vidx--) {
+    Vardesc *vd = getlocalvardesc(vidx);
+    if (vd->isInReg() && vd->vd.registerIndex <= reg)
+      return vd->vd.registerIndex == reg && vd->vd.kind == RDKINTFOR;
+  }
+  return false;
+}
+
+
 /*
 ** Get the debug-information entry for current variable 'vidx'.
 */
@@ -1231,8 +1231,10 @@ void FuncState::dischargevars(ExpDesc& expr) {
       break;
     }
     case VINDEXED: {
-      freeRegisters(expr.getIndexedTableReg(), expr.getIndexedKeyIndex());
-      expr.setInfo(codeABC(OP_GETTABLE, 0, expr.getIndexedTableReg(), expr.getIndexedKeyIndex()));
+      int key = expr.getIndexedKeyIndex();
+      OpCode op = isintforreg(key) ? OP_GETFORI : OP_GETTABLE;
+      freeRegisters(expr.getIndexedTableReg(), key);
+      expr.setInfo(codeABC(op, 0, expr.getIndexedTableReg(), key));
       expr.setKind(VRELOC);
       break;
     }
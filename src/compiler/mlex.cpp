@@ -7,11 +7,16 @@
 
 #include "mprefix.h"
 
+#include <bit>
 #include <span>
 
 #include <clocale>
 #include <cstring>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "moon.h"
 
 #include "mctype.h"
@@ -61,6 +66,118 @@ void LexState::saveAndNext() {
   next();
 }
 
+
+// append 'n' bytes from 's' to the buffer
+void LexState::saveBlock(const char *s, size_t n) {
+  Mbuffer *b = getBuffer();
+  if (moonZ_bufflen(b) + n > moonZ_sizebuffer(b)) {
+    size_t newsize = moonZ_sizebuffer(b);
+    do {
+      if (newsize >= (MAX_SIZE/3 * 2))  // larger than MAX_SIZE/1.5 ?
+        lexError("lexical element too long", 0);
+      newsize += (newsize >> 1);  // grow 1.5 times, as in 'save'
+    } while (moonZ_bufflen(b) + n > newsize);
+    moonZ_resizebuffer(getLuaState(), b, newsize);
+  }
+  std::memcpy(b->buffer + moonZ_bufflen(b), s, n);
+  b->n += n;
+}
+
+
+/*
+** Consume the next 'n' bytes available in the input buffer (after the
+** current character), saving them if 'keep' is true. The current
+** character is not changed; callers must call 'next' afterwards.
+*/
+void LexState::takeInput(size_t n, bool keep) {
+  ZIO *z = getZIO();
+  moon_assert(n <= z->n);
+  if (keep)
+    saveBlock(z->p, n);
+  z->p += n;
+  z->n -= n;
+}
+
+
+/*
+** {======================================================
+** Block scanning
+** The scanner reads one character at a time through 'next'; for long
+** runs without special characters (names, strings, comments), these
+** functions look directly at the bytes already in the input buffer,
+** 16 at a time when SSE2 is available.
+** =======================================================
+*/
+
+/*
+** Length of the prefix of 'p' (with 'n' bytes) without any of the bytes
+** 'c1', 'c2', 'c3', or 'c4' (callers repeat a byte to look for fewer).
+*/
+static size_t spanUntil (const char *p, size_t n, char c1, char c2,
+                                                  char c3, char c4) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i v1 = _mm_set1_epi8(c1);
+  const __m128i v2 = _mm_set1_epi8(c2);
+  const __m128i v3 = _mm_set1_epi8(c3);
+  const __m128i v4 = _mm_set1_epi8(c4);
+  for (; i + 16 <= n; i += 16) {
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    __m128i m = _mm_or_si128(
+                  _mm_or_si128(_mm_cmpeq_epi8(b, v1), _mm_cmpeq_epi8(b, v2)),
+                  _mm_or_si128(_mm_cmpeq_epi8(b, v3), _mm_cmpeq_epi8(b, v4)));
+    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(m));
+    if (mask != 0)
+      return i + static_cast<size_t>(std::countr_zero(mask));
+  }
+#endif
+  for (; i < n; i++) {
+    char c = p[i];
+    if (c == c1 || c == c2 || c == c3 || c == c4)
+      break;
+  }
+  return i;
+}
+
+
+// number of '\n' in the 'n' bytes at 'p'
+static int countNewlines (const char *p, size_t n) {
+  size_t i = 0;
+  int count = 0;
+#if defined(__SSE2__)
+  const __m128i nl = _mm_set1_epi8('\n');
+  for (; i + 16 <= n; i += 16) {
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+    unsigned mask = static_cast<unsigned>(
+                      _mm_movemask_epi8(_mm_cmpeq_epi8(b, nl)));
+    count += std::popcount(mask);
+  }
+#endif
+  for (; i < n; i++)
+    count += (p[i] == '\n');
+  return count;
+}
+
+
+// length of the prefix of 'p' (with 'n' bytes) made of name characters
+static size_t spanName (const char *p, size_t n) {
+  size_t i = 0;
+  while (i < n && lislalnum(cast_uchar(p[i])))
+    i++;
+  return i;
+}
+
+
+// length of the prefix of 'p' (with 'n' bytes) made of blanks
+static size_t spanBlanks (const char *p, size_t n) {
+  size_t i = 0;
+  while (i < n && (p[i] == ' ' || p[i] == '\t'))
+    i++;
+  return i;
+}
+
+// }======================================================
+
 void moonX_init (moon_State *L) 
 {
   TString *envName = moonS_newliteral(L, MOON_ENV);
@@ -273,6 +390,25 @@ size_t LexState::skipSep() {
 }
 
 
+/*
+** Consume the bytes after the current character in a long string or
+** comment up to the next ']' or '\r', counting the '\n's among them.
+** A '\n' just before the stop is left for 'incLineNumber', which knows
+** whether a '\r' follows it.
+*/
+void LexState::skipLongRun(bool keep) {
+  ZIO *z = getZIO();
+  size_t k = spanUntil(z->p, z->n, ']', '\r', '\r', '\r');
+  if (k > 0 && z->p[k - 1] == '\n')
+    k--;
+  int lines = countNewlines(z->p, k);
+  if (lines >= std::numeric_limits<int>::max() - getLineNumber())
+    lexError("chunk has too many lines", 0);
+  getLineNumberRef() += lines;
+  takeInput(k, keep);
+}
+
+
 void LexState::readLongString(SemInfo *seminfo, size_t sep) {
   int line = getLineNumber();  // initial line (for error message)
   saveAndNext();  // skip 2nd '['
@@ -301,8 +437,9 @@ void LexState::readLongString(SemInfo *seminfo, size_t sep) {
         break;
       }
       default: {
-        if (seminfo) saveAndNext();
-        else next();
+        if (seminfo) save(getCurrentChar());
+        skipLongRun(seminfo != nullptr);
+        next();
       }
     }
   } endloop:
@@ -433,8 +570,13 @@ void LexState::readString(int del, SemInfo *seminfo) {
          // go through
        no_save: break;
       }
-      default:
-        saveAndNext();
+      default: {  // save it and all following ordinary characters
+        ZIO *z = getZIO();
+        save(getCurrentChar());
+        takeInput(spanUntil(z->p, z->n, cast_char(del), '\\', '\n', '\r'),
+                  true);
+        next();
+      }
     }
   }
   saveAndNext();  // skip delimiter
@@ -446,8 +588,10 @@ void LexState::readString(int del, SemInfo *seminfo) {
 // Read an identifier or reserved word, returning the corresponding token.
 int LexState::readName(SemInfo *seminfo) {
   do {
-    saveAndNext();
-  } while (lislalnum(getCurrentChar()));
+    save(getCurrentChar());
+    takeInput(spanName(getZIO()->p, getZIO()->n), true);  // rest of the run
+    next();
+  } while (lislalnum(getCurrentChar()));  // run crossed end of buffer?
   // find or create string
   TString *tstring = TString::create(getLuaState(), moonZ_buffer(getBuffer()),
                                      moonZ_bufflen(getBuffer()));
@@ -467,6 +611,7 @@ int LexState::lex(SemInfo *seminfo) {
         break;
       }
       case ' ': case '\f': case '\t': case '\v': {  // spaces
+        takeInput(spanBlanks(getZIO()->p, getZIO()->n), false);
         next();
         break;
       }
@@ -485,8 +630,11 @@ int LexState::lex(SemInfo *seminfo) {
           }
         }
         // else short comment
-        while (!currIsNewline() && getCurrentChar() != EOZ)
-          next();  // skip until end of line (or end of file)
+        while (!currIsNewline() && getCurrentChar() != EOZ) {
+          ZIO *z = getZIO();  // skip until end of line (or end of file)
+          takeInput(spanUntil(z->p, z->n, '\n', '\r', '\r', '\r'), false);
+          next();
+        }
         break;
       }
       case '[': {  // long string or simply '['
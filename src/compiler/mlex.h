@@ -245,6 +245,9 @@ private:
   // Lexer helper methods (converted from static functions)
   // Batch 1: Trivial functions
   void save(int c);
+  void saveBlock(const char *s, size_t n);
+  void takeInput(size_t n, bool keep);
+  void skipLongRun(bool keep);
   void incLineNumber();
   int checkNext1(int c);
   int checkNext2(const char *set);
@@ -36,6 +36,7 @@ MOONI_DDEF const OpModesArray moonP_opmodes = {
  ,opmode(0, 0, 0, 0, 1, OpMode::iABC)  // OP_GETTABLE
  ,opmode(0, 0, 0, 0, 1, OpMode::iABC)  // OP_GETI
  ,opmode(0, 0, 0, 0, 1, OpMode::iABC)  // OP_GETFIELD
+ ,opmode(0, 0, 0, 0, 1, OpMode::iABC)  // OP_GETFORI
  ,opmode(0, 0, 0, 0, 0, OpMode::iABC)  // OP_SETTABUP
  ,opmode(0, 0, 0, 0, 0, OpMode::iABC)  // OP_SETTABLE
  ,opmode(0, 0, 0, 0, 0, OpMode::iABC)  // OP_SETI
@@ -96,6 +97,7 @@ MOONI_DDEF const OpModesArray moonP_opmodes = {
  ,opmode(0, 0, 0, 0, 0, OpMode::iABC)  // OP_RETURN1
  ,opmode(0, 0, 0, 0, 1, OpMode::iABx)  // OP_FORLOOP
  ,opmode(0, 0, 0, 0, 1, OpMode::iABx)  // OP_FORPREP
+ ,opmode(0, 0, 0, 0, 1, OpMode::iABx)  // OP_FORLOOPI
  ,opmode(0, 0, 0, 0, 0, OpMode::iABx)  // OP_TFORPREP
  ,opmode(0, 0, 0, 0, 0, OpMode::iABC)  // OP_TFORCALL
  ,opmode(0, 0, 0, 0, 1, OpMode::iABx)  // OP_TFORLOOP
@@ -103,6 +105,16 @@ MOONI_DDEF const OpModesArray moonP_opmodes = {
  ,opmode(0, 0, 0, 0, 1, OpMode::iABx)  // OP_CLOSURE
  ,opmode(0, 1, 0, 0, 1, OpMode::iABC)  // OP_VARARG
  ,opmode(0, 0, 1, 0, 1, OpMode::iABC)  // OP_VARARGPREP
+ ,opmode(0, 0, 0, 0, 1, OpMode::iABC)  // OP_ADD_II
+ ,opmode(0, 0, 0, 0, 1, OpMode::iABC)  // OP_ADD_FF
+ ,opmode(0, 0, 0, 0, 1, OpMode::iABC)  // OP_SUB_II
+ ,opmode(0, 0, 0, 0, 1, OpMode::iABC)  // OP_SUB_FF
+ ,opmode(0, 0, 0, 0, 1, OpMode::iABC)  // OP_MUL_II
+ ,opmode(0, 0, 0, 0, 1, OpMode::iABC)  // OP_MUL_FF
+ ,opmode(0, 0, 0, 1, 0, OpMode::iABC)  // OP_LT_II
+ ,opmode(0, 0, 0, 1, 0, OpMode::iABC)  // OP_LT_FF
+ ,opmode(0, 0, 0, 1, 0, OpMode::iABC)  // OP_LE_II
+ ,opmode(0, 0, 0, 1, 0, OpMode::iABC)  // OP_LE_FF
  ,opmode(0, 0, 0, 0, 0, OpMode::iAx)  // OP_EXTRAARG
 };
 
@@ -138,3 +150,19 @@ int moonP_isIT (Instruction i) {
   }
 }
 
+
+/*
+** Return instruction 'i' with a quickened opcode replaced by its
+** generic form (see notes in 'mopcodes.h').
+*/
+Instruction moonP_generic (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_ADD_II: case OP_ADD_FF: SET_OPCODE(i, OP_ADD); break;
+    case OP_SUB_II: case OP_SUB_FF: SET_OPCODE(i, OP_SUB); break;
+    case OP_MUL_II: case OP_MUL_FF: SET_OPCODE(i, OP_MUL); break;
+    case OP_LT_II: case OP_LT_FF: SET_OPCODE(i, OP_LT); break;
+    case OP_LE_II: case OP_LE_FF: SET_OPCODE(i, OP_LE); break;
+    default: break;
+  }
+  return i;
+}
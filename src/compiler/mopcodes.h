@@ -384,6 +384,7 @@ OP_GETTABUP,  // A B C	R[A] := UpValue[B][K[C]:shortstring]
 OP_GETTABLE,  // A B C	R[A] := R[B][R[C]]
 OP_GETI,  // A B C	R[A] := R[B][C]
 OP_GETFIELD,  // A B C	R[A] := R[B][K[C]:shortstring]
+OP_GETFORI,  // A B C	R[A] := R[B][R[C]] (R[C] controls an integer loop)
 
 OP_SETTABUP,  // A B C	UpValue[A][K[B]:shortstring] := RK(C)
 OP_SETTABLE,  // A B C	R[A][R[B]] := RK(C)
@@ -463,6 +464,7 @@ OP_RETURN1,  // A	return R[A]
 OP_FORLOOP,  // A Bx	update counters; if loop continues then pc-=Bx;
 OP_FORPREP,/*	A Bx	<check values and prepare counters>;
                         if not to run then pc+=Bx+1;			*/
+OP_FORLOOPI,  // A Bx	OP_FORLOOP for a loop known to be integer
 
 OP_TFORPREP,  // A Bx	create upvalue for R[A + 3]; pc+=Bx
 OP_TFORCALL,  // A C	R[A+4], ... ,R[A+3+C] := R[A](R[A+1], R[A+2]);
@@ -476,6 +478,17 @@ OP_VARARG,  // A C	R[A], R[A+1], ..., R[A+C-2] = vararg
 
 OP_VARARGPREP,  // A	(adjust vararg parameters)
 
+OP_ADD_II,  // A B C	R[A] := R[B] + R[C]	(integers; see note)
+OP_ADD_FF,  // A B C	R[A] := R[B] + R[C]	(floats)
+OP_SUB_II,  // A B C	R[A] := R[B] - R[C]	(integers)
+OP_SUB_FF,  // A B C	R[A] := R[B] - R[C]	(floats)
+OP_MUL_II,  // A B C	R[A] := R[B] * R[C]	(integers)
+OP_MUL_FF,  // A B C	R[A] := R[B] * R[C]	(floats)
+OP_LT_II,  // A B k	if ((R[A] <  R[B]) ~= k) then pc++	(integers)
+OP_LT_FF,  // A B k	if ((R[A] <  R[B]) ~= k) then pc++	(floats)
+OP_LE_II,  // A B k	if ((R[A] <= R[B]) ~= k) then pc++	(integers)
+OP_LE_FF,  // A B k	if ((R[A] <= R[B]) ~= k) then pc++	(floats)
+
 OP_EXTRAARG  // Ax	extra (larger) argument for previous opcode
 } OpCode;
 
@@ -535,6 +548,19 @@ inline constexpr int NUM_OPCODES = ((int)(OP_EXTRAARG) + 1);
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) OP_FORLOOPI closes numerical loops whose initial value and step
+  are integer constants, so the loop is always an integer one.
+  OP_GETFORI indexes a table with the control variable of such a loop;
+  it goes straight to the array part, but still checks the key, as the
+  debug library can change the variable.
+
+  (*) Opcodes OP_ADD_II to OP_LE_FF are never generated by the compiler.
+  The interpreter rewrites ("quickens") an OP_ADD, OP_SUB, OP_MUL, OP_LT
+  or OP_LE in place when it sees both operands are integers (_II) or
+  floats (_FF); the specialized form checks just that, and turns back
+  into the generic opcode when the check fails. 'moonP_generic' undoes
+  the rewrite, so that quickened code is never saved in binary chunks.
+
 ===========================================================================*/
 
 
@@ -603,6 +629,7 @@ inline bool InstructionView::testMMMode() const noexcept {
 
 MOONI_FUNC int moonP_isOT (Instruction i);
 MOONI_FUNC int moonP_isIT (Instruction i);
+MOONI_FUNC Instruction moonP_generic (Instruction i);
 
 
 #endif
@@ -0,0 +1,1371 @@
+/*
+** Bytecode optimizer
+** See Copyright Notice in lua.h
+*/
+
+#define MOON_CORE
+
+#include "mprefix.h"
+
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include "moon.h"
+
+#include "mdebug.h"
+#include "mmem.h"
+#include "mobject.h"
+#include "mopcodes.h"
+#include "moptimizer.h"
+#include "mstate.h"
+#include "mvirtualmachine.h"
+#include "mvm.h"
+
+
+/*
+** The optimizer rewrites the code of a finished prototype, so it works
+** the same for chunks coming from the parser or from a binary file.
+** Each round builds the control-flow graph of the function, runs a
+** forward analysis of what each register holds (a constant, a copy of
+** another register, or unknown) and uses it to rewrite instructions,
+** fold tests and thread jumps; then it computes register liveness to
+** remove dead stores and drops unreachable blocks. Removed
+** instructions are first only marked; 'compact' squeezes them out and
+** fixes jump offsets, line information and the ranges of local
+** variables.
+**
+** Instructions that must stay together (a test and its jump, an
+** arithmetic opcode and its OP_MMBIN*, an opcode and its OP_EXTRAARG,
+** the instruction skipped by OP_LFALSESKIP) are only removed as a
+** whole. Registers captured by closures or marked to be closed can
+** change behind the function's back, so the analysis never tracks
+** them and always keeps them alive.
+**
+** Optimized functions behave the same except for what the debug
+** interface sees: removed stores do not happen, so 'debug.getlocal'
+** may show stale values and line hooks may skip lines.
+*/
+
+
+// maximum number of rounds over a function
+#if !defined(MOONI_MAXOPTROUNDS)
+#define MOONI_MAXOPTROUNDS	4
+#endif
+
+// maximum (blocks * registers) for the value analysis of a function
+#if !defined(MOONI_MAXOPTSTATE)
+#define MOONI_MAXOPTSTATE	(1 << 19)
+#endif
+
+// maximum number of jumps followed when threading a jump
+#define MAXTHREAD	64
+
+// limit for difference between lines in relative line info
+#define LIMLINEDIFF	0x80
+
+
+namespace {
+
+using RegSet = std::bitset<MAX_FSTACK + 1>;
+
+
+/*
+** Registers used and set by an instruction. 'def' are registers always
+** written, 'kill' those that may be written (including 'def'). Ranges
+** open up to the top of the stack start at 'usefrom'/'killfrom'.
+*/
+struct Effects {
+  RegSet use;
+  RegSet def;
+  RegSet kill;
+  int usefrom;
+  int killfrom;
+};
+
+
+/*
+** What the analysis knows about the contents of a register.
+*/
+struct Value {
+  enum Kind : lu_byte { Unknown, Nil, False, True, Int, Flt, Str, Copy };
+  Kind kind = Unknown;
+  int aux = -1;  // constant index (Int, Flt, Str) or source register (Copy)
+  moon_Integer i = 0;
+  moon_Number n = 0;
+
+  bool isconst () const noexcept { return Nil <= kind && kind <= Str; }
+  bool isnumber () const noexcept { return kind == Int || kind == Flt; }
+  bool istrue () const noexcept { return kind >= True; }  // for constants
+
+  bool sameas (const Value &v) const noexcept {
+    if (kind != v.kind) return false;
+    switch (kind) {
+      case Int: return i == v.i;
+      case Flt: return std::memcmp(&n, &v.n, sizeof(n)) == 0;  // -0.0
+      case Str: case Copy: return aux == v.aux;
+      default: return true;
+    }
+  }
+};
+
+
+struct Block {
+  int start, end;  // instructions in [start, end)
+  int succ[2];  // successor blocks (-1 if absent)
+};
+
+
+struct LocRange {
+  int startpc, endpc;
+};
+
+
+inline bool isarith (int op) noexcept {
+  return OP_ADDI <= op && op <= OP_SHR;
+}
+
+inline bool ismmbin (int op) noexcept {
+  return OP_MMBIN <= op && op <= OP_MMBINK;
+}
+
+inline bool isjumpop (int op) noexcept {
+  switch (op) {
+    case OP_JMP: case OP_FORLOOP: case OP_FORLOOPI: case OP_FORPREP:
+    case OP_TFORPREP: case OP_TFORLOOP: return true;
+    default: return false;
+  }
+}
+
+inline bool fitsBx (moon_Integer i) noexcept {
+  return (-OFFSET_sBx <= i && i <= MAXARG_Bx - OFFSET_sBx);
+}
+
+
+/*
+** Return false if folding can raise an error (the same rules the code
+** generator uses).
+*/
+bool validop (int op, const TValue *v1, const TValue *v2) {
+  switch (op) {
+    case MOON_OPBAND: case MOON_OPBOR: case MOON_OPBXOR:
+    case MOON_OPSHL: case MOON_OPSHR: case MOON_OPBNOT: {
+      moon_Integer i;
+      return (tointegerns(v1, &i) && tointegerns(v2, &i));
+    }
+    case MOON_OPDIV: case MOON_OPIDIV: case MOON_OPMOD:
+      return (nvalue(v2) != 0);
+    default: return true;
+  }
+}
+
+
+class Optimizer {
+private:
+  moon_State *L;
+  Proto *f;
+  int level;
+  int nregs;
+  bool haslines;
+  std::vector<Instruction> code;
+  std::vector<int> lines;  // absolute line of each instruction
+  std::vector<LocRange> locs;
+  std::vector<bool> dead;  // instructions to be removed
+  std::vector<Block> blocks;
+  std::vector<int> blockof;  // block of each leading instruction
+  RegSet escaping;  // registers captured by closures or to be closed
+  RegSet inframe;  // registers [0, nregs)
+
+  RegSet above (int r) const {
+    RegSet s;
+    if (r < nregs)
+      s = (~RegSet() << static_cast<size_t>(r)) & inframe;
+    return s;
+  }
+
+  static InstructionView view (Instruction i) { return InstructionView(i); }
+
+  int opat (int pc) const { return GET_OPCODE(code[pc]); }
+
+  // whether 'pc' is a jump that belongs to a (live) test
+  bool condjump (int pc) const {
+    return (pc > 0 && !dead[pc - 1] && testTMode(opat(pc - 1)));
+  }
+
+  int nactive (int pc) const;
+  bool effects (int pc, Effects &e) const;
+  int target (int pc) const;
+  void settarget (Instruction &i, int pc, int t) const;
+  int branches (int pc, int *dest) const;
+  bool validate () const;
+  void buildcfg ();
+  void kill (Value *s, const Effects &e) const;
+  void transfer (int pc, Value *s) const;
+  bool constant (const TValue *o, int k, Value &v) const;
+  bool operand (const Value &v, TValue *o) const;
+  bool foldarith (int pc, const Value *s, Value &v) const;
+  bool foldunary (int pc, const Value *s, Value &v) const;
+  int evalcond (int pc, const Value *s) const;
+  bool loadvalue (int pc, int a, const Value &v);
+  int substitute (int pc, const Value *s);
+  int finaltarget (int pc, const Value *s) const;
+  int jump (int pc, const Value *s);
+  int rewrite (int pc, Value *s);
+  int propagate ();
+  int threadjumps ();
+  int unreachable ();
+  void collectable (int pc, RegSet &gc) const;
+  int deadstores ();
+  void fixskips ();
+  void compact ();
+  void trimstack ();
+  void store ();
+
+public:
+  Optimizer (moon_State *l, Proto *p, int lv) : L(l), f(p), level(lv),
+      nregs(p->getMaxStackSize()), haslines(false) {}
+  bool load ();
+  void run ();
+};
+
+
+/*
+** {======================================================
+** Instruction properties
+** =======================================================
+*/
+
+bool Optimizer::effects (int pc, Effects &e) const {
+  InstructionView i = view(code[pc]);
+  int a = i.a();
+  e.use.reset(); e.def.reset(); e.kill.reset();
+  e.usefrom = e.killfrom = MAX_FSTACK + 1;
+  auto range = [](RegSet &s, int from, int to) {
+    for (int r = from; r < to && r <= MAX_FSTACK; r++) s.set(static_cast<size_t>(r));
+  };
+  auto use = [&](int r) { range(e.use, r, r + 1); };
+  auto def = [&](int r) { range(e.def, r, r + 1); };
+  switch (i.opcode()) {
+    case OP_MOVE: use(i.b()); def(a); break;
+    case OP_LOADI: case OP_LOADF: case OP_LOADK: case OP_LOADKX:
+    case OP_LOADFALSE: case OP_LFALSESKIP: case OP_LOADTRUE:
+    case OP_GETUPVAL: case OP_GETTABUP: case OP_NEWTABLE: case OP_CLOSURE:
+      def(a); break;
+    case OP_LOADNIL: range(e.def, a, a + i.b() + 1); break;
+    case OP_SETUPVAL: case OP_TBC: case OP_TEST: case OP_RETURN1:
+    case OP_EQK: case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI:
+    case OP_GEI: case OP_MMBINI: case OP_MMBINK:
+      use(a); break;
+    case OP_MMBIN: case OP_EQ: case OP_LT: case OP_LE:
+      use(a); use(i.b()); break;
+    case OP_GETTABLE: case OP_GETFORI: use(i.b()); use(i.c()); def(a); break;
+    case OP_GETI: case OP_GETFIELD:
+    case OP_ADDI: case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+    case OP_POWK: case OP_DIVK: case OP_IDIVK: case OP_BANDK: case OP_BORK:
+    case OP_BXORK: case OP_SHLI: case OP_SHRI:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+      use(i.b()); def(a); break;
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR:
+      use(i.b()); use(i.c()); def(a); break;
+    case OP_SETTABUP: if (!i.k()) use(i.c()); break;
+    case OP_SETTABLE: use(a); use(i.b()); if (!i.k()) use(i.c()); break;
+    case OP_SETI: case OP_SETFIELD: use(a); if (!i.k()) use(i.c()); break;
+    case OP_SELF: use(i.b()); def(a); def(a + 1); break;
+    case OP_CONCAT:
+      range(e.use, a, a + i.b()); range(e.kill, a, a + i.b()); def(a); break;
+    case OP_CLOSE: e.usefrom = a; break;
+    case OP_JMP: case OP_RETURN0: case OP_VARARGPREP: case OP_EXTRAARG:
+      break;
+    case OP_TESTSET: use(i.b()); range(e.kill, a, a + 1); break;
+    case OP_CALL: case OP_TAILCALL:
+      use(a);
+      if (i.b() != 0) range(e.use, a, a + i.b());
+      else e.usefrom = a;
+      if (i.opcode() == OP_CALL && i.c() != 0) range(e.def, a, a + i.c() - 1);
+      e.killfrom = a;
+      break;
+    case OP_RETURN:
+      if (i.b() != 0) range(e.use, a, a + i.b() - 1);
+      else e.usefrom = a;
+      break;
+    case OP_FORPREP: case OP_FORLOOP: case OP_FORLOOPI:
+      range(e.use, a, a + 3); range(e.kill, a, a + 3); break;
+    case OP_TFORPREP:
+      range(e.use, a, a + 4); range(e.kill, a, a + 4); break;
+    case OP_TFORCALL:
+      range(e.use, a, a + 4);
+      range(e.kill, a + 3, a + 6);
+      range(e.def, a + 3, a + 3 + i.c());
+      e.killfrom = a + 3;
+      break;
+    case OP_TFORLOOP: use(a + 3); break;
+    case OP_SETLIST:
+      use(a);
+      if (i.vb() != 0) range(e.use, a, a + i.vb() + 1);
+      else e.usefrom = a;
+      break;
+    case OP_VARARG:
+      if (i.c() != 0) range(e.def, a, a + i.c() - 1);
+      else def(a);
+      e.killfrom = a;
+      break;
+    default: return false;  // unknown opcode
+  }
+  e.kill |= e.def;
+  return true;
+}
+
+
+/*
+** Number of active local variables at 'pc', which occupy the first
+** registers of the frame.
+*/
+int Optimizer::nactive (int pc) const {
+  int n = 0;
+  for (const LocRange &l : locs)
+    if (l.startpc <= pc && pc < l.endpc) n++;
+  return n;
+}
+
+
+/*
+** Destination of the jump instruction at 'pc' (for OP_FORPREP, the
+** instruction after the loop).
+*/
+int Optimizer::target (int pc) const {
+  InstructionView i = view(code[pc]);
+  switch (i.opcode()) {
+    case OP_JMP: return pc + 1 + i.sj();
+    case OP_FORPREP: return pc + i.bx() + 2;
+    case OP_TFORPREP: return pc + 1 + i.bx();
+    default: return pc + 1 - i.bx();  // OP_FORLOOP(I), OP_TFORLOOP
+  }
+}
+
+
+void Optimizer::settarget (Instruction &i, int pc, int t) const {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: SETARG_sJ(i, t - pc - 1); break;
+    case OP_FORPREP: SETARG_Bx(i, cast_uint(t - pc - 2)); break;
+    case OP_TFORPREP: SETARG_Bx(i, cast_uint(t - pc - 1)); break;
+    default: SETARG_Bx(i, cast_uint(pc + 1 - t)); break;
+  }
+}
+
+
+/*
+** If the instruction at 'pc' ends a basic block, store its possible
+** destinations in 'dest' and return how many they are. Return -1 for
+** instructions that just fall through.
+*/
+int Optimizer::branches (int pc, int *dest) const {
+  switch (opat(pc)) {
+    case OP_JMP: {
+      int n = 0;
+      dest[n++] = target(pc);
+      if (condjump(pc)) dest[n++] = pc + 1;
+      return n;
+    }
+    case OP_LFALSESKIP: dest[0] = pc + 2; return 1;
+    case OP_FORPREP:  // the skip goes through OP_FORLOOP, which must stay
+      dest[0] = pc + 1; dest[1] = target(pc) - 1; return 2;
+    case OP_FORLOOP: case OP_FORLOOPI: case OP_TFORLOOP:
+      dest[0] = pc + 1; dest[1] = target(pc); return 2;
+    case OP_TFORPREP: dest[0] = target(pc); return 1;
+    case OP_RETURN: case OP_RETURN0: case OP_RETURN1: return 0;
+    default: return -1;
+  }
+}
+
+
+/*
+** Check the structural rules the optimizer relies on; code that does
+** not follow them (e.g., from a hand-made binary chunk) is left alone.
+*/
+bool Optimizer::validate () const {
+  int n = static_cast<int>(code.size());
+  if (n == 0 || nregs > MAX_FSTACK)
+    return false;
+  switch (opat(n - 1)) {  // code cannot fall off its end
+    case OP_RETURN: case OP_RETURN0: case OP_RETURN1: break;
+    default: return false;
+  }
+  std::vector<bool> inner(static_cast<size_t>(n), false);  // not a jump target
+  for (int pc = 0; pc < n; pc++) {
+    Effects e;
+    int op = opat(pc);
+    if (!effects(pc, e))
+      return false;
+    int next = (pc + 1 < n) ? opat(pc + 1) : -1;
+    if ((testTMode(op) && next != OP_JMP) ||
+        (isarith(op) && !ismmbin(next)) ||
+        ((op == OP_LOADKX || op == OP_NEWTABLE ||
+          (op == OP_SETLIST && view(code[pc]).k())) && next != OP_EXTRAARG) ||
+        (op == OP_TFORCALL && next != OP_TFORLOOP) ||
+        (op == OP_FORPREP && (target(pc) - 1 >= n ||
+                              (opat(target(pc) - 1) != OP_FORLOOP &&
+                               opat(target(pc) - 1) != OP_FORLOOPI))))
+      return false;
+    if (testTMode(op) || isarith(op) || next == OP_EXTRAARG)
+      inner[static_cast<size_t>(pc + 1)] = true;  // second half of a pair
+  }
+  for (int pc = 0; pc < n; pc++) {
+    int dest[2];
+    int nd = branches(pc, dest);
+    for (int d = 0; d < nd; d++) {
+      if (dest[d] < 0 || dest[d] >= n || (inner[static_cast<size_t>(dest[d])] &&
+                                          dest[d] != pc + 1))
+        return false;
+    }
+  }
+  return true;
+}
+
+
+void Optimizer::buildcfg () {
+  int n = static_cast<int>(code.size());
+  std::vector<bool> leader(static_cast<size_t>(n) + 1, false);
+  leader[0] = true;
+  for (int pc = 0; pc < n; pc++) {
+    int dest[2];
+    int nd = branches(pc, dest);
+    if (nd >= 0) {
+      leader[static_cast<size_t>(pc) + 1] = true;
+      for (int d = 0; d < nd; d++)
+        leader[static_cast<size_t>(dest[d])] = true;
+    }
+  }
+  blocks.clear();
+  blockof.assign(static_cast<size_t>(n), -1);
+  for (int pc = 0; pc < n; pc++) {
+    if (leader[static_cast<size_t>(pc)]) {
+      blockof[static_cast<size_t>(pc)] = static_cast<int>(blocks.size());
+      blocks.push_back(Block{pc, pc, {-1, -1}});
+    }
+    blocks.back().end = pc + 1;
+  }
+  for (Block &b : blocks) {
+    int last = b.end - 1;
+    int dest[2];
+    int nd = branches(last, dest);
+    if (nd < 0) {  // falls through to next block
+      nd = 1;
+      dest[0] = b.end;
+    }
+    for (int d = 0; d < nd; d++)
+      b.succ[d] = blockof[static_cast<size_t>(dest[d])];
+  }
+}
+
+// }======================================================
+
+
+/*
+** {======================================================
+** Constant and copy propagation
+** =======================================================
+*/
+
+/*
+** Forget what the instruction kills, including copies of the killed
+** registers.
+*/
+void Optimizer::kill (Value *s, const Effects &e) const {
+  RegSet k = e.kill | above(e.killfrom);
+  if (k.none()) return;
+  for (int r = 0; r < nregs; r++) {
+    Value &v = s[r];
+    if (k.test(static_cast<size_t>(r)) ||
+        (v.kind == Value::Copy && k.test(static_cast<size_t>(v.aux))))
+      v = Value();
+  }
+}
+
+
+bool Optimizer::constant (const TValue *o, int k, Value &v) const {
+  v = Value();
+  v.aux = k;
+  switch (ttypetag(o)) {
+    case MoonT::NIL: v.kind = Value::Nil; break;
+    case MoonT::VFALSE: v.kind = Value::False; break;
+    case MoonT::VTRUE: v.kind = Value::True; break;
+    case MoonT::NUMINT: v.kind = Value::Int; v.i = ivalue(o); break;
+    case MoonT::NUMFLT: v.kind = Value::Flt; v.n = fltvalue(o); break;
+    case MoonT::SHRSTR: case MoonT::LNGSTR:
+      if (k < 0) return false;
+      v.kind = Value::Str;
+      break;
+    default: return false;
+  }
+  return true;
+}
+
+
+// convert a known value into a TValue
+bool Optimizer::operand (const Value &v, TValue *o) const {
+  switch (v.kind) {
+    case Value::Nil: setnilvalue(o); return true;
+    case Value::False: setbfvalue(o); return true;
+    case Value::True: setbtvalue(o); return true;
+    case Value::Int: o->setInt(v.i); return true;
+    case Value::Flt: o->setFloat(v.n); return true;
+    case Value::Str: *o = f->getConstants()[v.aux]; return true;
+    default: return false;
+  }
+}
+
+
+/*
+** Try to compute the result of the arithmetic instruction at 'pc'.
+*/
+bool Optimizer::foldarith (int pc, const Value *s, Value &v) const {
+  InstructionView i = view(code[pc]);
+  int op = i.opcode();
+  TValue v1, v2, res;
+  int aop;
+  if (!s[i.b()].isnumber())
+    return false;
+  operand(s[i.b()], &v1);
+  if (OP_ADD <= op && op <= OP_SHR) {
+    if (!s[i.c()].isnumber()) return false;
+    operand(s[i.c()], &v2);
+    aop = op - OP_ADD + MOON_OPADD;
+  }
+  else if (OP_ADDK <= op && op <= OP_BXORK) {
+    v2 = f->getConstants()[i.c()];
+    if (!ttisnumber(&v2)) return false;
+    aop = op - OP_ADDK + MOON_OPADD;
+  }
+  else {  // OP_ADDI, OP_SHLI, OP_SHRI
+    v2.setInt(i.sc());
+    aop = (op == OP_ADDI) ? MOON_OPADD : (op == OP_SHRI) ? MOON_OPSHR : MOON_OPSHL;
+    if (op == OP_SHLI) {  // immediate is the first operand
+      TValue t;
+      t = v1; v1 = v2; v2 = t;
+    }
+  }
+  if (!validop(aop, &v1, &v2) || !moonO_rawarith(L, aop, &v1, &v2, &res))
+    return false;
+  if (ttisfloat(&res) && (mooni_numisnan(fltvalue(&res)) || fltvalue(&res) == 0))
+    return false;  // neither NaN nor 0.0 (to avoid problems with -0.0)
+  return constant(&res, -1, v);
+}
+
+
+bool Optimizer::foldunary (int pc, const Value *s, Value &v) const {
+  InstructionView i = view(code[pc]);
+  const Value &b = s[i.b()];
+  if (i.opcode() == OP_NOT) {
+    if (!b.isconst()) return false;
+    v = Value();
+    v.kind = b.istrue() ? Value::False : Value::True;
+    return true;
+  }
+  TValue v1, res;
+  int aop = (i.opcode() == OP_UNM) ? MOON_OPUNM : MOON_OPBNOT;
+  if (!b.isnumber()) return false;
+  operand(b, &v1);
+  if (!validop(aop, &v1, &v1) || !moonO_rawarith(L, aop, &v1, &v1, &res))
+    return false;
+  if (ttisfloat(&res) && (mooni_numisnan(fltvalue(&res)) || fltvalue(&res) == 0))
+    return false;
+  return constant(&res, -1, v);
+}
+
+
+/*
+** Compute the new values set by the instruction at 'pc'.
+*/
+void Optimizer::transfer (int pc, Value *s) const {
+  if (dead[static_cast<size_t>(pc)]) return;
+  InstructionView i = view(code[pc]);
+  int a = i.a();
+  Effects e;
+  Value v;
+  effects(pc, e);
+  switch (i.opcode()) {
+    case OP_MOVE: {
+      int b = i.b();
+      v = s[b];
+      if (v.kind == Value::Unknown || (v.kind == Value::Copy && v.aux == a)) {
+        v = Value();
+        if (!escaping.test(static_cast<size_t>(b))) {
+          v.kind = Value::Copy;
+          v.aux = b;
+        }
+      }
+      break;
+    }
+    case OP_LOADI: v.kind = Value::Int; v.i = i.sbx(); break;
+    case OP_LOADF: v.kind = Value::Flt; v.n = cast_num(i.sbx()); break;
+    case OP_LOADK: case OP_LOADKX: {
+      int k = (i.opcode() == OP_LOADK) ? i.bx() : view(code[pc + 1]).ax();
+      constant(&f->getConstants()[k], k, v);
+      break;
+    }
+    case OP_LOADFALSE: case OP_LFALSESKIP: v.kind = Value::False; break;
+    case OP_LOADTRUE: v.kind = Value::True; break;
+    case OP_LOADNIL: {
+      kill(s, e);
+      for (int r = a; r <= a + i.b(); r++)
+        if (!escaping.test(static_cast<size_t>(r))) s[r].kind = Value::Nil;
+      return;
+    }
+    case OP_UNM: case OP_BNOT: case OP_NOT:
+      foldunary(pc, s, v);
+      break;
+    default:
+      if (isarith(i.opcode()))
+        foldarith(pc, s, v);
+      break;
+  }
+  kill(s, e);
+  if (v.kind != Value::Unknown && e.def.test(static_cast<size_t>(a)) &&
+      !escaping.test(static_cast<size_t>(a)))
+    s[a] = v;
+}
+
+
+/*
+** Whether the jump after the test at 'pc' is taken: 1 (always),
+** 0 (never), or -1 (unknown).
+*/
+int Optimizer::evalcond (int pc, const Value *s) const {
+  InstructionView i = view(code[pc]);
+  const Value &va = s[i.a()];
+  int cond;
+  switch (i.opcode()) {
+    case OP_TEST:
+      if (!va.isconst()) return -1;
+      cond = va.istrue();
+      break;
+    case OP_TESTSET: {
+      const Value &vb = s[i.b()];
+      if (!vb.isconst()) return -1;
+      cond = vb.istrue();
+      break;
+    }
+    case OP_EQ: case OP_EQK: {
+      TValue v1, v2;
+      v1.setInt(0); v2.setInt(0);  // to avoid warnings
+      if (!operand(va, &v1)) return -1;
+      if (i.opcode() == OP_EQK)
+        v2 = f->getConstants()[i.b()];
+      else if (!operand(s[i.b()], &v2))
+        return -1;
+      cond = (v1 == v2);
+      break;
+    }
+    case OP_EQI: {
+      if (!va.isconst()) return -1;
+      cond = (va.kind == Value::Int) ? (va.i == i.sb())
+           : (va.kind == Value::Flt) ? mooni_numeq(va.n, cast_num(i.sb()))
+           : 0;
+      break;
+    }
+    case OP_LT: case OP_LE: {
+      const Value &vb = s[i.b()];
+      if (va.kind == Value::Int && vb.kind == Value::Int)
+        cond = (i.opcode() == OP_LT) ? (va.i < vb.i) : (va.i <= vb.i);
+      else if (va.kind == Value::Flt && vb.kind == Value::Flt)
+        cond = (i.opcode() == OP_LT) ? mooni_numlt(va.n, vb.n)
+                                     : mooni_numle(va.n, vb.n);
+      else
+        return -1;
+      break;
+    }
+    case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
+      if (!va.isnumber()) return -1;
+      moon_Number x = (va.kind == Value::Int) ? cast_num(va.i) : va.n;
+      moon_Number im = cast_num(i.sb());
+      if (va.kind == Value::Int) {  // exact integer comparison
+        moon_Integer y = i.sb();
+        switch (i.opcode()) {
+          case OP_LTI: cond = (va.i < y); break;
+          case OP_LEI: cond = (va.i <= y); break;
+          case OP_GTI: cond = (va.i > y); break;
+          default: cond = (va.i >= y); break;
+        }
+      }
+      else {
+        switch (i.opcode()) {
+          case OP_LTI: cond = mooni_numlt(x, im); break;
+          case OP_LEI: cond = mooni_numle(x, im); break;
+          case OP_GTI: cond = mooni_numlt(im, x); break;
+          default: cond = mooni_numle(im, x); break;
+        }
+      }
+      break;
+    }
+    default: return -1;
+  }
+  return (cond == i.k());
+}
+
+
+/*
+** Replace the instruction at 'pc' by one loading 'v' into register 'a',
+** if there is such an instruction.
+*/
+bool Optimizer::loadvalue (int pc, int a, const Value &v) {
+  Instruction &i = code[pc];
+  switch (v.kind) {
+    case Value::Nil: i = CREATE_ABCk(OP_LOADNIL, a, 0, 0, 0); return true;
+    case Value::False: i = CREATE_ABCk(OP_LOADFALSE, a, 0, 0, 0); return true;
+    case Value::True: i = CREATE_ABCk(OP_LOADTRUE, a, 0, 0, 0); return true;
+    case Value::Int:
+      if (fitsBx(v.i)) {
+        i = CREATE_ABx(OP_LOADI, a, cast_int(v.i) + OFFSET_sBx);
+        return true;
+      }
+      break;
+    case Value::Flt: {
+      moon_Integer fi;
+      if (VirtualMachine::flttointeger(v.n, &fi, F2Imod::F2Ieq) && fitsBx(fi) &&
+          !(v.n == 0 && std::signbit(v.n))) {
+        i = CREATE_ABx(OP_LOADF, a, cast_int(fi) + OFFSET_sBx);
+        return true;
+      }
+      break;
+    }
+    default: break;
+  }
+  if (v.isconst() && v.aux >= 0 && v.aux <= MAXARG_Bx) {
+    i = CREATE_ABx(OP_LOADK, a, v.aux);
+    return true;
+  }
+  return false;
+}
+
+
+/*
+** Read registers holding a copy of another register directly from
+** that register, so that the copy may become dead. Only operands that
+** do not need to be in consecutive registers are changed, and a local
+** variable is not replaced by a temporary (which would lose its name in
+** error messages).
+*/
+int Optimizer::substitute (int pc, const Value *s) {
+  Instruction &i = code[pc];
+  InstructionView v = view(i);
+  int op = v.opcode();
+  int nloc = nactive(pc);
+  int changes = 0;
+  auto source = [&](int r) {
+    if (s[r].kind != Value::Copy || (r < nloc && s[r].aux >= nloc))
+      return -1;
+    return s[r].aux;
+  };
+  auto subA = [&]() {
+    int c = source(v.a());
+    if (c >= 0) { SETARG_A(i, cast_uint(c)); changes++; }
+  };
+  auto subB = [&]() {
+    int c = source(v.b());
+    if (c >= 0) { SETARG_B(i, cast_uint(c)); changes++; }
+  };
+  auto subC = [&]() {
+    int c = source(v.c());
+    if (c >= 0) { SETARG_C(i, cast_uint(c)); changes++; }
+  };
+  switch (op) {
+    case OP_MOVE: case OP_GETI: case OP_GETFIELD: case OP_SELF:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN: case OP_TESTSET:
+      subB(); break;
+    case OP_GETTABLE: case OP_GETFORI: subB(); subC(); break;
+    case OP_SETTABLE: subA(); subB(); if (!v.k()) subC(); break;
+    case OP_SETI: case OP_SETFIELD: subA(); if (!v.k()) subC(); break;
+    case OP_SETTABUP: if (!v.k()) subC(); break;
+    case OP_SETUPVAL: case OP_TEST: case OP_RETURN1: case OP_EQK:
+    case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+      subA(); break;
+    case OP_EQ: case OP_LT: case OP_LE: subA(); subB(); break;
+    default:
+      if (isarith(op)) {  // keep the metamethod operands in sync
+        Instruction &mm = code[pc + 1];
+        InstructionView m = view(mm);
+        int b = source(v.b());
+        if (b >= 0 && m.a() == v.b()) {
+          SETARG_B(i, cast_uint(b)); SETARG_A(mm, cast_uint(b)); changes++;
+        }
+        if (OP_ADD <= op && op <= OP_SHR) {
+          int c = source(v.c());
+          if (c >= 0 && m.b() == v.c()) {
+            SETARG_C(i, cast_uint(c)); SETARG_B(mm, cast_uint(c)); changes++;
+          }
+        }
+      }
+      break;
+  }
+  return changes;
+}
+
+
+/*
+** Follow the jump at 'pc' through other jumps and through tests whose
+** outcome is known from 's' (when not null).
+*/
+int Optimizer::finaltarget (int pc, const Value *s) const {
+  int n = static_cast<int>(code.size());
+  int t = target(pc);
+  for (int count = 0; count < MAXTHREAD && t < n; count++) {
+    if (dead[static_cast<size_t>(t)])
+      t++;  // removed instructions do nothing
+    else if (opat(t) == OP_JMP)
+      t = target(t);
+    else if (s != nullptr && opat(t) == OP_TEST) {
+      InstructionView i = view(code[t]);
+      const Value &v = s[i.a()];
+      if (!v.isconst()) break;
+      t = (v.istrue() == static_cast<bool>(i.k())) ? target(t + 1) : t + 2;
+    }
+    else break;
+  }
+  return (t < n) ? t : target(pc);
+}
+
+
+int Optimizer::jump (int pc, const Value *s) {
+  bool cond = condjump(pc);
+  if (cond && opat(pc - 1) == OP_TESTSET)
+    s = nullptr;  // the jump also changes a register
+  int t = finaltarget(pc, s);
+  int changes = 0;
+  if (t != target(pc)) {
+    settarget(code[pc], pc, t);
+    changes++;
+  }
+  if (!cond) {
+    int op = opat(t);
+    if (t == pc + 1) {  // jump to next instruction?
+      dead[static_cast<size_t>(pc)] = true;
+      changes++;
+    }
+    else if ((op == OP_RETURN0 || op == OP_RETURN1) && !dead[static_cast<size_t>(t)]) {
+      code[pc] = code[t];  // jump to a return: return here
+      changes++;
+    }
+  }
+  return changes;
+}
+
+
+int Optimizer::rewrite (int pc, Value *s) {
+  if (dead[static_cast<size_t>(pc)]) return 0;
+  int changes = substitute(pc, s);
+  InstructionView i = view(code[pc]);
+  int op = i.opcode();
+  Value v;
+  if (op == OP_MOVE) {  // copying a local keeps its name for error messages
+    if (i.a() == i.b()) {
+      dead[static_cast<size_t>(pc)] = true;
+      changes++;
+    }
+    else if (s[i.b()].isconst() && i.b() >= nactive(pc) &&
+             loadvalue(pc, i.a(), s[i.b()]))
+      changes++;
+  }
+  else if (isarith(op)) {
+    if (foldarith(pc, s, v) && loadvalue(pc, i.a(), v)) {
+      dead[static_cast<size_t>(pc) + 1] = true;  // OP_MMBIN* is not needed
+      changes++;
+    }
+  }
+  else if (op == OP_UNM || op == OP_BNOT || op == OP_NOT) {
+    if (foldunary(pc, s, v) && loadvalue(pc, i.a(), v))
+      changes++;
+  }
+  else if (op == OP_JMP)
+    changes += jump(pc, s);
+  else if (testTMode(op)) {
+    int taken = evalcond(pc, s);
+    if (taken == 1) {  // test is useless; jump is unconditional
+      if (op == OP_TESTSET && i.a() != i.b())
+        code[pc] = CREATE_ABCk(OP_MOVE, i.a(), i.b(), 0, 0);
+      else
+        dead[static_cast<size_t>(pc)] = true;
+      changes++;
+    }
+    else if (taken == 0) {  // jump is never taken
+      dead[static_cast<size_t>(pc)] = dead[static_cast<size_t>(pc) + 1] = true;
+      changes++;
+    }
+  }
+  return changes;
+}
+
+
+int Optimizer::propagate () {
+  size_t nb = blocks.size();
+  size_t width = static_cast<size_t>(nregs);
+  if (nb * width > MOONI_MAXOPTSTATE)
+    return threadjumps();  // too large for the analysis
+  std::vector<Value> in(nb * width);
+  std::vector<bool> visited(nb, false), queued(nb, false);
+  std::vector<size_t> work;
+  std::vector<Value> s(width);
+  visited[0] = queued[0] = true;  // on entry nothing is known
+  work.push_back(0);
+  while (!work.empty()) {
+    size_t b = work.back();
+    work.pop_back();
+    queued[b] = false;
+    std::copy(in.begin() + static_cast<std::ptrdiff_t>(b * width),
+              in.begin() + static_cast<std::ptrdiff_t>((b + 1) * width), s.begin());
+    for (int pc = blocks[b].start; pc < blocks[b].end; pc++)
+      transfer(pc, s.data());
+    for (int succ : blocks[b].succ) {
+      if (succ < 0) continue;
+      size_t sb = static_cast<size_t>(succ);
+      Value *t = &in[sb * width];
+      bool changed = false;
+      if (!visited[sb]) {
+        std::copy(s.begin(), s.end(), t);
+        visited[sb] = changed = true;
+      }
+      else {
+        for (size_t r = 0; r < width; r++) {
+          if (t[r].kind != Value::Unknown && !t[r].sameas(s[r])) {
+            t[r] = Value();
+            changed = true;
+          }
+        }
+      }
+      if (changed && !queued[sb]) {
+        queued[sb] = true;
+        work.push_back(sb);
+      }
+    }
+  }
+  int changes = 0;
+  for (size_t b = 0; b < nb; b++) {
+    if (!visited[b]) continue;  // unreachable; will be removed
+    std::copy(in.begin() + static_cast<std::ptrdiff_t>(b * width),
+              in.begin() + static_cast<std::ptrdiff_t>((b + 1) * width), s.begin());
+    for (int pc = blocks[b].start; pc < blocks[b].end; pc++) {
+      changes += rewrite(pc, s.data());
+      transfer(pc, s.data());
+    }
+  }
+  return changes;
+}
+
+
+int Optimizer::threadjumps () {
+  int changes = 0;
+  for (int pc = 0; pc < static_cast<int>(code.size()); pc++) {
+    if (opat(pc) == OP_JMP && !dead[static_cast<size_t>(pc)])
+      changes += jump(pc, nullptr);
+  }
+  return changes;
+}
+
+// }======================================================
+
+
+/*
+** {======================================================
+** Removal of dead code
+** =======================================================
+*/
+
+int Optimizer::unreachable () {
+  size_t nb = blocks.size();
+  std::vector<bool> reached(nb, false);
+  std::vector<int> work{0};
+  reached[0] = true;
+  while (!work.empty()) {
+    const Block &b = blocks[static_cast<size_t>(work.back())];
+    work.pop_back();
+    for (int succ : b.succ) {
+      if (succ >= 0 && !reached[static_cast<size_t>(succ)]) {
+        reached[static_cast<size_t>(succ)] = true;
+        work.push_back(succ);
+      }
+    }
+  }
+  int changes = 0;
+  for (size_t b = 0; b < nb; b++) {
+    if (reached[b]) continue;
+    for (int pc = blocks[b].start; pc < blocks[b].end; pc++)
+      dead[static_cast<size_t>(pc)] = true;
+    changes++;
+  }
+  return changes;
+}
+
+
+/*
+** Update 'gc', the registers that may hold a collectable value, over
+** the instruction at 'pc'. Only constants are known not to be
+** collectable (constant strings are anchored by the prototype).
+*/
+void Optimizer::collectable (int pc, RegSet &gc) const {
+  Effects e;
+  if (dead[static_cast<size_t>(pc)]) return;
+  effects(pc, e);
+  InstructionView i = view(code[pc]);
+  switch (i.opcode()) {
+    case OP_LOADI: case OP_LOADF: case OP_LOADK: case OP_LOADKX:
+    case OP_LOADFALSE: case OP_LFALSESKIP: case OP_LOADTRUE:
+    case OP_LOADNIL: case OP_NOT:
+      gc &= ~e.def;
+      break;
+    case OP_MOVE:
+      gc.set(static_cast<size_t>(i.a()), gc.test(static_cast<size_t>(i.b())));
+      break;
+    default:
+      gc |= e.kill | above(e.killfrom);
+      break;
+  }
+}
+
+
+/*
+** Remove instructions without side effects whose results are never
+** used, using a backward liveness analysis over the blocks. A store
+** that drops or takes a reference to a collectable value is kept even
+** when dead: removing it would change what the collector sees, and so
+** when weak entries are cleared and finalizers run.
+*/
+int Optimizer::deadstores () {
+  size_t nb = blocks.size();
+  std::vector<RegSet> gcin(nb);
+  std::vector<bool> reached(nb, false);
+  // on entry, registers above the parameters hold only leftovers of
+  // earlier calls, which no variable refers to
+  gcin[0] = inframe & ~above(f->getNumParams());
+  reached[0] = true;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = 0; b < nb; b++) {
+      if (!reached[b]) continue;
+      RegSet gc = gcin[b];
+      for (int pc = blocks[b].start; pc < blocks[b].end; pc++)
+        collectable(pc, gc);
+      for (int succ : blocks[b].succ) {
+        if (succ < 0) continue;
+        size_t sb = static_cast<size_t>(succ);
+        if (!reached[sb] || (gc & ~gcin[sb]).any()) {
+          gcin[sb] |= gc;
+          reached[sb] = changed = true;
+        }
+      }
+    }
+  }
+  std::vector<RegSet> livein(nb);
+  auto step = [this](int pc, RegSet &live) {
+    Effects e;
+    if (dead[static_cast<size_t>(pc)]) return;
+    effects(pc, e);
+    live = (live & ~e.def) | e.use | above(e.usefrom) | escaping;
+  };
+  auto liveout = [&](const Block &b) {
+    RegSet live = escaping;
+    for (int succ : b.succ)
+      if (succ >= 0) live |= livein[static_cast<size_t>(succ)];
+    return live;
+  };
+  changed = true;
+  while (changed) {
+    changed = false;
+    for (size_t b = nb; b-- > 0; ) {
+      RegSet live = liveout(blocks[b]);
+      for (int pc = blocks[b].end; pc-- > blocks[b].start; )
+        step(pc, live);
+      if (live != livein[b]) {
+        livein[b] = live;
+        changed = true;
+      }
+    }
+  }
+  int changes = 0;
+  std::vector<RegSet> gcat;  // collectable registers before each instruction
+  for (size_t b = 0; b < nb; b++) {
+    RegSet live = liveout(blocks[b]);
+    RegSet gc = gcin[b];
+    gcat.clear();
+    for (int pc = blocks[b].start; pc < blocks[b].end; pc++) {
+      gcat.push_back(gc);
+      collectable(pc, gc);
+    }
+    gcat.push_back(gc);
+    for (int pc = blocks[b].end; pc-- > blocks[b].start; ) {
+      size_t upc = static_cast<size_t>(pc);
+      size_t k = static_cast<size_t>(pc - blocks[b].start);
+      int op = opat(pc);
+      bool pure;
+      switch (op) {
+        case OP_MOVE: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+        case OP_LOADKX: case OP_LOADFALSE: case OP_LOADTRUE: case OP_LOADNIL:
+        case OP_GETUPVAL: case OP_NOT:
+          pure = !(pc > 0 && !dead[upc - 1] && opat(pc - 1) == OP_LFALSESKIP);
+          break;
+        default: pure = false;
+      }
+      if (pure && !dead[upc]) {
+        Effects e;
+        effects(pc, e);
+        if ((e.def & (live | gcat[k] | gcat[k + 1])).none()) {
+          dead[upc] = true;
+          if (op == OP_LOADKX)
+            dead[upc + 1] = true;  // its OP_EXTRAARG
+          changes++;
+          continue;
+        }
+      }
+      step(pc, live);
+    }
+  }
+  return changes;
+}
+
+
+/*
+** An OP_LFALSESKIP whose skipped instruction was removed just loads
+** false.
+*/
+void Optimizer::fixskips () {
+  for (size_t pc = 0; pc + 1 < code.size(); pc++) {
+    if (!dead[pc] && dead[pc + 1] && GET_OPCODE(code[pc]) == OP_LFALSESKIP)
+      SET_OPCODE(code[pc], OP_LOADFALSE);
+  }
+}
+
+
+/*
+** Squeeze out removed instructions, correcting jumps, line information
+** and the ranges of local variables.
+*/
+void Optimizer::compact () {
+  size_t n = code.size();
+  std::vector<int> newpc(n + 1);
+  int m = 0;
+  for (size_t pc = 0; pc < n; pc++) {
+    newpc[pc] = m;
+    if (!dead[pc]) m++;
+  }
+  newpc[n] = m;
+  if (static_cast<size_t>(m) < n) {
+    std::vector<Instruction> ncode(static_cast<size_t>(m));
+    std::vector<int> nlines(static_cast<size_t>(m));
+    for (size_t pc = 0; pc < n; pc++) {
+      if (dead[pc]) continue;
+      Instruction i = code[pc];
+      int npc = newpc[pc];
+      if (isjumpop(GET_OPCODE(i)))
+        settarget(i, npc, newpc[static_cast<size_t>(target(static_cast<int>(pc)))]);
+      ncode[static_cast<size_t>(npc)] = i;
+      nlines[static_cast<size_t>(npc)] = lines[pc];
+    }
+    for (LocRange &l : locs) {
+      l.startpc = newpc[static_cast<size_t>(l.startpc)];
+      l.endpc = newpc[static_cast<size_t>(l.endpc)];
+    }
+    code.swap(ncode);
+    lines.swap(nlines);
+  }
+  dead.assign(code.size(), false);
+}
+
+
+/*
+** Shrink the frame to the registers the code still uses, keeping room
+** for parameters and for every local variable in the debug information.
+*/
+void Optimizer::trimstack () {
+  int need = 2;  // registers 0/1 are always valid
+  if (f->getNumParams() > need) need = f->getNumParams();
+  std::vector<int> delta(code.size() + 1, 0);
+  for (const LocRange &l : locs) {
+    if (l.startpc < l.endpc) {
+      delta[static_cast<size_t>(l.startpc)]++;
+      delta[static_cast<size_t>(l.endpc)]--;
+    }
+  }
+  int active = 0;
+  for (int d : delta) {
+    active += d;
+    if (active > need) need = active;
+  }
+  for (int pc = 0; pc < static_cast<int>(code.size()) && need < nregs; pc++) {
+    Effects e;
+    effects(pc, e);
+    RegSet all = e.use | e.kill;
+    for (int r = nregs - 1; r >= need; r--) {
+      if (all.test(static_cast<size_t>(r))) {
+        need = r + 1;
+        break;
+      }
+    }
+  }
+  if (need < nregs) {
+    nregs = need;
+    f->setMaxStackSize(cast_byte(need));
+  }
+}
+
+// }======================================================
+
+
+/*
+** {======================================================
+** Driver
+** =======================================================
+*/
+
+bool Optimizer::load () {
+  int n = f->getCodeSize();
+  if (f->getFlag() & PF_FIXED)
+    return false;  // code is not ours to change
+  code.assign(f->getCode(), f->getCode() + n);
+  dead.assign(static_cast<size_t>(n), false);
+  for (int r = 0; r < nregs; r++)
+    inframe.set(static_cast<size_t>(r));
+  haslines = (f->getLineInfoSize() == n && n > 0);
+  lines.assign(static_cast<size_t>(n), 0);
+  if (haslines) {
+    int line = f->getLineDefined();
+    int abs = 0;
+    for (int pc = 0; pc < n; pc++) {
+      ls_byte d = f->getLineInfo()[pc];
+      if (d != ABSLINEINFO)
+        line += d;
+      else if (abs < f->getAbsLineInfoSize())
+        line = f->getAbsLineInfo()[abs++].getLine();
+      else
+        return false;  // inconsistent line information
+      lines[static_cast<size_t>(pc)] = line;
+    }
+  }
+  for (const LocVar &lv : f->getDebugInfo().getLocVarsSpan()) {
+    if (lv.getStartPC() < 0 || lv.getEndPC() > n || lv.getStartPC() > lv.getEndPC())
+      return false;
+    locs.push_back(LocRange{lv.getStartPC(), lv.getEndPC()});
+  }
+  if (!validate())
+    return false;
+  for (int pc = 0; pc < n; pc++) {
+    InstructionView i = view(code[static_cast<size_t>(pc)]);
+    switch (i.opcode()) {
+      case OP_CLOSURE: {
+        if (i.bx() >= f->getProtosSize()) return false;
+        const Proto *p = f->getProtos()[i.bx()];
+        for (const Upvaldesc &uv : p->getUpvaluesSpan())
+          if (uv.isInStack()) escaping.set(uv.getIndex());
+        break;
+      }
+      case OP_TBC: escaping.set(static_cast<size_t>(i.a())); break;
+      case OP_TFORPREP:  // closing variable (before and after the swap)
+        escaping.set(static_cast<size_t>(i.a() + 2));
+        escaping.set(static_cast<size_t>(i.a() + 3));
+        break;
+      default: break;
+    }
+  }
+  return true;
+}
+
+
+void Optimizer::run () {
+  for (int round = 0; round < MOONI_MAXOPTROUNDS; round++) {
+    int changes;
+    buildcfg();
+    changes = (level >= 2) ? propagate() : threadjumps();
+    compact();
+    buildcfg();
+    changes += unreachable();
+    if (level >= 2)
+      changes += deadstores();
+    fixskips();
+    compact();
+    if (changes == 0) break;
+  }
+  if (level >= 2)
+    trimstack();
+  store();
+}
+
+
+/*
+** Write the optimized code back into the prototype. A memory error
+** here aborts the load, which discards the prototype; so each vector
+** must only keep a size that matches its block, and the new absolute
+** line information is allocated last, when nothing else can fail.
+*/
+void Optimizer::store () {
+  int n = f->getCodeSize();
+  int m = static_cast<int>(code.size());
+  std::vector<ls_byte> lineinfo;
+  std::vector<AbsLineInfo> abslines;
+  if (haslines) {
+    int previous = f->getLineDefined();
+    int iwthabs = 0;
+    lineinfo.resize(static_cast<size_t>(m));
+    for (int pc = 0; pc < m; pc++) {
+      int line = lines[static_cast<size_t>(pc)];
+      int linedif = line - previous;
+      if (std::abs(linedif) >= LIMLINEDIFF || iwthabs++ >= MAXIWTHABS) {
+        AbsLineInfo a;
+        a.setPC(pc);
+        a.setLine(line);
+        abslines.push_back(a);
+        linedif = ABSLINEINFO;
+        iwthabs = 1;
+      }
+      lineinfo[static_cast<size_t>(pc)] = static_cast<ls_byte>(linedif);
+      previous = line;
+    }
+  }
+  std::copy(code.begin(), code.end(), f->getCode());
+  if (m < n)
+    moonM_shrinkvector<Instruction>(L, f->getCodeRef(), f->getCodeSizeRef(), m);
+  if (haslines) {
+    std::copy(lineinfo.begin(), lineinfo.end(), f->getLineInfo());
+    if (m < n)
+      moonM_shrinkvector<ls_byte>(L, f->getDebugInfo().getLineInfoRef(),
+                                  f->getDebugInfo().getLineInfoSizeRef(), m);
+    AbsLineInfo *newabs = nullptr;
+    int nabs = static_cast<int>(abslines.size());
+    if (nabs > 0) {
+      newabs = moonM_newvector<AbsLineInfo>(L, static_cast<size_t>(nabs));
+      std::copy(abslines.begin(), abslines.end(), newabs);
+    }
+    moonM_freearray(L, f->getAbsLineInfo(), cast_sizet(f->getAbsLineInfoSize()));
+    f->setAbsLineInfo(newabs);
+    f->setAbsLineInfoSize(nabs);
+  }
+  LocVar *lv = f->getLocVars();
+  for (size_t l = 0; l < locs.size(); l++) {
+    lv[l].setStartPC(locs[l].startpc);
+    lv[l].setEndPC(locs[l].endpc);
+  }
+}
+
+// }======================================================
+
+}  // namespace
+
+
+void moonK_optimize (moon_State *L, Proto *f, int level) {
+  if (level <= 0) return;
+  if (level > MOON_OPTMAX) level = MOON_OPTMAX;
+  for (Proto *p : f->getProtosSpan())
+    moonK_optimize(L, p, level);
+  try {
+    Optimizer opt(L, f, level);
+    if (opt.load())
+      opt.run();
+  }
+  catch (const std::bad_alloc &) {
+    // not enough memory for the analysis; keep the code as it is
+  }
+}
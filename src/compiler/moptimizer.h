@@ -0,0 +1,26 @@
+/*
+** Bytecode optimizer
+** See Copyright Notice in lua.h
+*/
+
+#ifndef loptimizer_h
+#define loptimizer_h
+
+
+#include "mobject.h"
+#include "mstate.h"
+
+
+/*
+** Optimization levels: at level 1 the optimizer only threads jumps
+** and removes unreachable code; level 2 adds constant and copy
+** propagation, folding of tests with known outcome, removal of dead
+** stores and trimming of the stack frame.
+*/
+inline constexpr int MOON_OPTMAX = 2;
+
+
+MOONI_FUNC void moonK_optimize (moon_State *L, Proto *f, int level);
+
+
+#endif
@@ -150,13 +150,15 @@ public:
 };
 
 
-// kinds of variables
+// kinds of variables (upvalue kinds go into binary chunks, so new
+// kinds get new values instead of renumbering the others)
 inline constexpr lu_byte VDKREG = 0;  // regular local
 inline constexpr lu_byte RDKCONST = 1;  // local constant
 inline constexpr lu_byte RDKTOCLOSE = 2;  // to-be-closed
 inline constexpr lu_byte RDKCTC = 3;  // local compile-time constant
 inline constexpr lu_byte GDKREG = 4;  // regular global
 inline constexpr lu_byte GDKCONST = 5;  // global constant
+inline constexpr lu_byte RDKINTFOR = 6;  // control variable of an integer loop
 
 // description of an active variable
 class Vardesc {
@@ -177,12 +179,12 @@ public:
 
   // Check if variable is in register
   bool isInReg() const noexcept {
-    return vd.kind <= RDKTOCLOSE;
+    return vd.kind <= RDKTOCLOSE || vd.kind == RDKINTFOR;
   }
 
   // Check if variable is global
   bool isGlobal() const noexcept {
-    return vd.kind >= GDKREG;
+    return vd.kind == GDKREG || vd.kind == GDKCONST;
   }
 };
 
@@ -652,6 +654,7 @@ public:
   Vardesc *getlocalvardesc(int vidx);
   lu_byte reglevel(int nvar);
   lu_byte nvarstack();
+  bool isintforreg(int reg);
   LocVar *localdebuginfo(int vidx);
   void init_var(ExpDesc& e, int vidx);
   short registerlocalvar(TString& varname);
@@ -774,7 +777,7 @@ private:
   void labelstat(TString& name, int line);
   void whilestat(int line);
   void repeatstat(int line);
-  void exp1();
+  bool exp1();
   void forbody(int base, int line, int nvars, int isgen);
   void fornum(TString& varname, int line);
   void forlist(TString& indexname);
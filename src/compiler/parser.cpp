@@ -1086,14 +1086,17 @@ void Parser::repeatstat( int line) {
 
 /*
 ** Read an expression and generate code to put its results in next
-** stack slot.
+** stack slot. Return whether the expression was an integer constant.
 **
 */
-void Parser::exp1() {
+bool Parser::exp1() {
   ExpDesc e;
   expr(e);
+  bool isint = (e.getKind() == VKINT && e.getTrueList() == NO_JUMP &&
+                e.getFalseList() == NO_JUMP);
   funcState->exp2nextreg(e);
   moon_assert(e.getKind() == VNONRELOC);
+  return isint;
 }
 
 
@@ -1134,19 +1137,24 @@ void Parser::fornum(TString& varname, int line) {
   int base = funcstate->getFirstFreeRegister();
   new_localvarliteral("(for state)");
   new_localvarliteral("(for state)");
-  new_varkind(&varname, RDKCONST);  // control variable
+  int vidx = new_varkind(&varname, RDKCONST);  // control variable
   checknext( '=');
-  exp1();  // initial value
+  bool isint = exp1();  // initial value
   checknext( ',');
   exp1();  // limit
   if (testnext( ','))
-    exp1();  // optional step
+    isint = exp1() && isint;  // optional step
   else {  // default step = 1
     funcstate->intCode(funcstate->getFirstFreeRegister(), 1);
     funcstate->reserveregs(1);
   }
+  if (isint)  // integer initial value and step: an integer loop
+    funcstate->getlocalvardesc(vidx)->vd.kind = RDKINTFOR;
   adjustlocalvars(2);  // start scope for internal variables
   forbody(base, line, 1, 0);
+  if (isint)  // specialize the loop's back jump
+    SET_OPCODE(funcstate->getProto().getCode()[funcstate->getPC() - 1],
+               OP_FORLOOPI);
 }
 
 
@@ -8,9 +8,17 @@
 #include "mprefix.h"
 
 
+#include <algorithm>
+#include <atomic>
 #include <climits>
 #include <cstdarg>
+#include <cstddef>
 #include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "moon.h"
 
@@ -21,6 +29,7 @@
 #include "mgc.h"
 #include "mmem.h"
 #include "mobject.h"
+#include "moptimizer.h"
 #include "mstate.h"
 #include "mstring.h"
 #include "mtable.h"
@@ -434,6 +443,24 @@ MOON_API const void *moon_topointer (moon_State *L, int idx) {
 }
 
 
+/*
+** A key handle is the address of an interned (short) string. It is
+** valid while that string is alive, so the caller must anchor the
+** string somewhere (see 'moonL_internkey').
+*/
+static inline TString *key2ts (const moon_Key *k) {
+  return static_cast<TString*>(static_cast<void*>(const_cast<moon_Key*>(k)));
+}
+
+
+MOON_API const moon_Key *moon_tokey (moon_State *L, int idx) {
+  const TValue *o = L->getStackSubsystem().indexToValue(L,idx);
+  if (!ttisshrstring(o))
+    return nullptr;  // only short strings are interned
+  return static_cast<const moon_Key*>(static_cast<const void*>(tsvalue(o)));
+}
+
+
 
 /*
 ** push functions (C -> stack)
@@ -594,10 +621,18 @@ MOON_API int moon_pushthread (moon_State *L) {
 */
 
 
-static int auxgetstr (moon_State *L, const TValue *t, const char *k) {
+/*
+** t[str] onto the stack; 'isshort' tells that 'str' is known to be a
+** short string (a key handle), so that the lookup goes straight to
+** the short-string search.
+*/
+static int auxgetstr (moon_State *L, const TValue *t, TString *str,
+                      bool isshort = false) {
   MoonT tag;
-  TString *str = TString::create(L, k);
-  tag = L->getVM().fastget(t, str, s2v(L->getTop().p), [](Table* tbl, TString* strkey, TValue* res) { return tbl->getStr(strkey, res); });
+  if (isshort)
+    tag = L->getVM().fastget(t, str, s2v(L->getTop().p), [](Table* tbl, TString* strkey, TValue* res) { return tbl->getShortStr(strkey, res); });
+  else
+    tag = L->getVM().fastget(t, str, s2v(L->getTop().p), [](Table* tbl, TString* strkey, TValue* res) { return tbl->getStr(strkey, res); });
   if (!tagisempty(tag))
     api_incr_top(L);
   else {
@@ -627,7 +662,7 @@ MOON_API int moon_getglobal (moon_State *L, const char *name) {
   TValue gt;
   moon_lock(L);
   getGlobalTable(L, &gt);
-  return auxgetstr(L, &gt, name);
+  return auxgetstr(L, &gt, TString::create(L, name));
 }
 
 
@@ -645,7 +680,15 @@ MOON_API int moon_gettable (moon_State *L, int idx) {
 
 MOON_API int moon_getfield (moon_State *L, int idx, const char *k) {
   moon_lock(L);
-  return auxgetstr(L, L->getStackSubsystem().indexToValue(L,idx), k);
+  return auxgetstr(L, L->getStackSubsystem().indexToValue(L,idx),
+                   TString::create(L, k));
+}
+
+
+MOON_API int moon_getfieldk (moon_State *L, int idx, const moon_Key *k) {
+  moon_lock(L);
+  return auxgetstr(L, L->getStackSubsystem().indexToValue(L,idx), key2ts(k),
+                   true);
 }
 
 
@@ -772,12 +815,16 @@ MOON_API int moon_getiuservalue (moon_State *L, int idx, int n) {
 */
 
 /*
-** t[k] = value at the top of the stack (where 'k' is a string)
+** t[str] = value at the top of the stack ('isshort' as in 'auxgetstr')
 */
-static void auxsetstr (moon_State *L, const TValue *t, const char *k) {
-  TString *str = TString::create(L, k);
+static void auxsetstr (moon_State *L, const TValue *t, TString *str,
+                       bool isshort = false) {
   api_checkpop(L, 1);
-  int hres = L->getVM().fastset(t, str, s2v(L->getTop().p - 1), [](Table* tbl, TString* strkey, TValue* val) { return tbl->psetStr(strkey, val); });
+  int hres;
+  if (isshort)
+    hres = L->getVM().fastset(t, str, s2v(L->getTop().p - 1), [](Table* tbl, TString* strkey, TValue* val) { return tbl->psetShortStr(strkey, val); });
+  else
+    hres = L->getVM().fastset(t, str, s2v(L->getTop().p - 1), [](Table* tbl, TString* strkey, TValue* val) { return tbl->psetStr(strkey, val); });
   if (hres == HOK) {
     L->getVM().finishfastset(t, s2v(L->getTop().p - 1));
     L->getStackSubsystem().pop();  // pop value
@@ -796,7 +843,7 @@ MOON_API void moon_setglobal (moon_State *L, const char *name) {
   TValue gt;
   moon_lock(L);  // unlock done in 'auxsetstr'
   getGlobalTable(L, &gt);
-  auxsetstr(L, &gt, name);
+  auxsetstr(L, &gt, TString::create(L, name));
 }
 
 
@@ -816,7 +863,14 @@ MOON_API void moon_settable (moon_State *L, int idx) {
 
 MOON_API void moon_setfield (moon_State *L, int idx, const char *k) {
   moon_lock(L);  // unlock done in 'auxsetstr'
-  auxsetstr(L, L->getStackSubsystem().indexToValue(L,idx), k);
+  auxsetstr(L, L->getStackSubsystem().indexToValue(L,idx),
+            TString::create(L, k));
+}
+
+
+MOON_API void moon_setfieldk (moon_State *L, int idx, const moon_Key *k) {
+  moon_lock(L);  // unlock done in 'auxsetstr'
+  auxsetstr(L, L->getStackSubsystem().indexToValue(L,idx), key2ts(k), true);
 }
 
 
@@ -873,6 +927,169 @@ MOON_API void moon_rawseti (moon_State *L, int idx, moon_Integer n) {
 }
 
 
+/*
+** {======================================================
+** Bulk table access: move plain C values ('moon_Value') to and from
+** many slots of a table in a single call. Writes are raw.
+** =======================================================
+*/
+
+static void fromcvalue (moon_State *L, const moon_Value *v, TValue *o) {
+  switch (v->type) {
+    case MOON_TNIL: setnilvalue(o); break;
+    case MOON_TBOOLEAN: {
+      if (v->u.b) setbtvalue(o); else setbfvalue(o);
+      break;
+    }
+    case MOON_TNUMBER: {
+      if (v->isinteger) o->setInt(v->u.i); else o->setFloat(v->u.n);
+      break;
+    }
+    case MOON_TSTRING: {
+      TString *ts = (v->len == 0) ? TString::create(L, "")
+                                  : TString::create(L, v->u.s, v->len);
+      setsvalue(L, o, ts);
+      break;
+    }
+    case MOON_TLIGHTUSERDATA: setpvalue(o, cast_voidp(v->u.p)); break;
+    default: {
+      api_check(L, 0, "invalid type for a moon_Value");
+      setnilvalue(o);
+      break;
+    }
+  }
+}
+
+
+static void tocvalue (const TValue *o, moon_Value *v) {
+  v->type = ttype(o);
+  v->isinteger = 0;
+  v->len = 0;
+  switch (ttypetag(o)) {
+    case MoonT::VFALSE: v->u.b = 0; break;
+    case MoonT::VTRUE: v->u.b = 1; break;
+    case MoonT::NUMINT: v->isinteger = 1; v->u.i = ivalue(o); break;
+    case MoonT::NUMFLT: v->u.n = fltvalue(o); break;
+    case MoonT::SHRSTR: case MoonT::LNGSTR: {
+      const TString *ts = tsvalue(o);
+      v->u.s = getStringContents(ts);
+      v->len = ts->length();
+      break;
+    }
+    case MoonT::LCF: v->u.p = cast_voidp(cast_sizet(fvalue(o))); break;
+    case MoonT::USERDATA: case MoonT::LIGHTUSERDATA:
+      v->u.p = touserdata(o);
+      break;
+    default: v->u.p = iscollectable(o) ? gcvalue(o) : nullptr; break;
+  }
+}
+
+
+/*
+** Store 'val' in slot 'k' of the array part of 't', keeping the ARC
+** counts (as 'Table::setInt' does) but skipping its key lookup.
+*/
+static inline void setarrayslot (moon_State *L, Table *t, unsigned k,
+                                 TValue *val) {
+  TValue oldv;
+  arr2obj(t, k, &oldv);
+  if (iscollectable(val)) moonC_incref(gcvalue(val));
+  obj2arr(t, k, val);
+  if (iscollectable(&oldv)) moonC_decref(G(L), gcvalue(&oldv));
+}
+
+
+/*
+** Does 't[first + i] = v[i]' for 'i' in [0, n). The array part is
+** grown once to hold the whole range (see 'Table::reserveArray').
+*/
+MOON_API void moon_setarray (moon_State *L, int idx, moon_Integer first,
+                             int n, const moon_Value *v) {
+  moon_lock(L);
+  api_check(L, n >= 0, "negative count");
+  Table *t = gettable(L, idx);
+  if (l_unlikely(t->isFrozen()))
+    Table::frozenError(L);
+  if (n > 0)
+    t->reserveArray(L, first,
+                    l_castU2S(l_castS2U(first) + cast(moon_Unsigned, n) - 1u));
+  bool anycollectable = false;
+  for (int i = 0; i < n; i++) {
+    TValue val;
+    fromcvalue(L, &v[i], &val);
+    anycollectable |= iscollectable(&val);
+    moon_Integer key = l_castU2S(l_castS2U(first) + cast(moon_Unsigned, i));
+    moon_Unsigned k = l_castS2U(key) - 1u;
+    if (k < t->arraySize())
+      setarrayslot(L, t, cast_uint(k), &val);
+    else
+      t->setInt(L, key, &val);
+  }
+  if (anycollectable && isblack(t))  // one barrier for all new values
+    moonC_barrierback_(*L, obj2gco(t));
+  moonC_checkGC(L);
+  moon_unlock(L);
+}
+
+
+/*
+** Reads 't[first + i]' into 'v[i]' for 'i' in [0, n). Strings point
+** to the contents of the Lua strings, which stay valid only while
+** those strings are in the table.
+*/
+MOON_API void moon_getarray (moon_State *L, int idx, moon_Integer first,
+                             int n, moon_Value *v) {
+  moon_lock(L);
+  api_check(L, n >= 0, "negative count");
+  Table *t = gettable(L, idx);
+  for (int i = 0; i < n; i++) {
+    TValue o;
+    MoonT tag;
+    t->fastGeti(l_castU2S(l_castS2U(first) + cast(moon_Unsigned, i)), &o, tag);
+    if (tagisempty(tag))
+      setnilvalue(&o);
+    tocvalue(&o, &v[i]);
+  }
+  moon_unlock(L);
+}
+
+
+/*
+** Does 't[keys[i]] = v[i - 1]' for 'i' in [1, n], where 'keys' is a
+** sequence of keys at the given index (built once and reused, so its
+** strings are already interned). A table with no hash part gets one
+** big enough for all the fields.
+*/
+MOON_API void moon_setfields (moon_State *L, int idx, int keys, int n,
+                              const moon_Value *v) {
+  moon_lock(L);
+  api_check(L, n >= 0, "negative count");
+  Table *t = gettable(L, idx);
+  Table *kt = gettable(L, keys);
+  if (l_unlikely(t->isFrozen()))
+    Table::frozenError(L);
+  if (n > 0 && t->isDummy())
+    t->resize(L, t->arraySize(), cast_uint(n));
+  bool anycollectable = false;
+  for (int i = 0; i < n; i++) {
+    TValue key, val;
+    MoonT tag;
+    kt->fastGeti(i + 1, &key, tag);
+    api_check(L, !tagisempty(tag), "missing key");
+    fromcvalue(L, &v[i], &val);
+    anycollectable |= iscollectable(&val) || iscollectable(&key);
+    t->set(L, &key, &val);
+  }
+  invalidateTMcache(t);
+  if (anycollectable && isblack(t))  // one barrier for all new values
+    moonC_barrierback_(*L, obj2gco(t));
+  moonC_checkGC(L);
+  moon_unlock(L);
+}
+
+/* }====================================================== */
+
+
 MOON_API int moon_setmetatable (moon_State *L, int objindex) {
   moon_lock(L);
   api_checkpop(L, 1);
@@ -886,6 +1103,8 @@ MOON_API int moon_setmetatable (moon_State *L, int objindex) {
   }
   switch (ttype(obj)) {
     case MOON_TTABLE: {
+      if (l_unlikely(hvalue(obj)->isFrozen()))
+        Table::frozenError(L);
       hvalue(obj)->setMetatable(mt);
       if (mt) {
         moonC_objbarrier(L, gcvalue(obj), mt);
@@ -910,6 +1129,23 @@ MOON_API int moon_setmetatable (moon_State *L, int objindex) {
 }
 
 
+/*
+** Make the table at 'idx' immutable (see 'Table::freeze').
+*/
+MOON_API void moon_freeze (moon_State *L, int idx) {
+  moon_lock(L);
+  Table *t = gettable(L, idx);
+  t->freeze(L);
+  moon_unlock(L);
+}
+
+
+MOON_API int moon_isfrozen (moon_State *L, int idx) {
+  const TValue *o = L->getStackSubsystem().indexToValue(L, idx);
+  return ttistable(o) && hvalue(o)->isFrozen();
+}
+
+
 MOON_API int moon_setiuservalue (moon_State *L, int idx, int n) {
   int res;
   moon_lock(L);
@@ -1066,6 +1302,21 @@ MOON_API int moon_dump (moon_State *L, moon_Writer writer, void *data, int strip
 }
 
 
+/*
+** Set the optimization level for chunks loaded from now on; return
+** the previous level.
+*/
+MOON_API int moon_setoptlevel (moon_State *L, int level) {
+  int old;
+  moon_lock(L);
+  old = G(L)->getOptLevel();
+  api_check(L, 0 <= level, "invalid optimization level");
+  G(L)->setOptLevel(cast_byte(level < MOON_OPTMAX ? level : MOON_OPTMAX));
+  moon_unlock(L);
+  return old;
+}
+
+
 MOON_API int moon_status (moon_State *L) {
   return APIstatus(L->getStatus());
 }
@@ -1142,6 +1393,24 @@ MOON_API int moon_gc (moon_State *L, int what, ...) {
         g->setGCParam(param, moonO_codeparam(cast_uint(value)));
       break;
     }
+    case MOON_GCBGSWEEP: {
+      int on = va_arg(argp, int);
+      res = g->getGCBgSweep();
+      if (on == 0)
+        moonC_stopsweep(*L);
+      if (on >= 0)
+        g->setGCBgSweep(cast_byte(on != 0));
+      break;
+    }
+    case MOON_GCRECYCLE: {
+      int on = va_arg(argp, int);
+      res = g->getRecycle();
+      if (on == 0)
+        moonM_freerecycled(g);
+      if (on >= 0)
+        g->setRecycle(cast_byte(on != 0));
+      break;
+    }
     default: res = -1;  // invalid option
   }
   va_end(argp);
@@ -1230,12 +1499,48 @@ MOON_API moon_Alloc moon_getallocf (moon_State *L, void **ud) {
 
 MOON_API void moon_setallocf (moon_State *L, moon_Alloc f, void *ud) {
   moon_lock(L);
+  moonC_waitsweep(*L);  // pending frees go to the old allocator
+  moonM_freerecycled(G(L));  // and so do recycled blocks
   G(L)->setUd(ud);
   G(L)->setFrealloc(f);
   moon_unlock(L);
 }
 
 
+/*
+** Set the maximum number of bytes the state may have in use (0 for no
+** limit); returns the previous limit. Allocations that would go over
+** the limit first try an emergency collection, and then fail with a
+** memory error.
+*/
+MOON_API size_t moon_setmemlimit (moon_State *L, size_t limit) {
+  moon_lock(L);
+  GlobalState *g = G(L);
+  size_t old = cast_sizet(g->getGCMemLimit());
+  g->setGCMemLimit(static_cast<l_mem>(std::min(limit, cast_sizet(MAX_LMEM))));
+  moon_unlock(L);
+  return old;
+}
+
+
+/*
+** Bytes the state has in use now and (if 'peak' is not NULL) the
+** largest number of bytes it has had in use; 'reset' restarts the peak
+** from the current use.
+*/
+MOON_API size_t moon_memusage (moon_State *L, size_t *peak, int reset) {
+  moon_lock(L);
+  GlobalState *g = G(L);
+  l_mem inuse = g->getTotalBytes();
+  if (peak)
+    *peak = cast_sizet(g->getGCPeak());
+  if (reset)
+    g->setGCPeak(inuse);
+  moon_unlock(L);
+  return cast_sizet(inuse);
+}
+
+
 void moon_setwarnf (moon_State *L, moon_WarnFunction f, void *ud) {
   moon_lock(L);
   G(L)->setUdWarn(ud);
@@ -1372,3 +1677,301 @@ MOON_API void moon_upvaluejoin (moon_State *L, int fidx1, int n1,
 }
 
 
+
+
+/*
+** {======================================================
+** Cross-state transfer
+** A packet holds copies of values taken from one state in a form that
+** belongs to no state, so it can be unpacked into any other state,
+** possibly running in another thread. Long strings are not copied into
+** packets: their contents live in a reference-counted buffer, which
+** every receiving state uses directly as an external string. A string
+** is copied into such a buffer once per packet, and a string that came
+** from a packet is forwarded again without any copy. A table reached
+** more than once (along several paths or through a cycle) is packed
+** once; later occurrences refer to it, and unpacking rebuilds the same
+** sharing.
+** =======================================================
+*/
+
+// maximum nesting of tables in a packet
+#if !defined(MOONI_MAXPACKDEPTH)
+inline constexpr int MOONI_MAXPACKDEPTH = 200;
+#endif
+
+
+namespace {
+
+// contents of a long string shared among states
+struct SharedString {
+  std::atomic<size_t> refs;
+  size_t len;
+  char data[1];  // actually 'len + 1' bytes
+};
+
+
+SharedString *newsharedstring (const char *s, size_t len) {
+  void *mem = ::operator new(offsetof(SharedString, data) + len + 1);
+  SharedString *ss = static_cast<SharedString *>(mem);
+  new (&ss->refs) std::atomic<size_t>(1);
+  ss->len = len;
+  memcpy(ss->data, s, len);
+  ss->data[len] = '\0';
+  return ss;
+}
+
+
+void releasesharedstring (SharedString *ss) {
+  if (ss->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    ss->refs.~atomic();
+    ::operator delete(ss);
+  }
+}
+
+
+// 'moon_Alloc' of external strings over a shared buffer (only frees)
+void *freesharedstring (void *ud, void *ptr, size_t osize, size_t nsize) {
+  UNUSED(ptr); UNUSED(osize); UNUSED(nsize);
+  releasesharedstring(static_cast<SharedString *>(ud));
+  return nullptr;
+}
+
+
+enum class PacketTag : lu_byte {
+  Nil, False, True, Integer, Float, ShortString, SharedStr, Table, TableEnd,
+  TableRef
+};
+
+
+struct PacketItem {
+  PacketTag tag;
+  union {
+    moon_Integer i;
+    moon_Number n;
+    struct { size_t off, len; } str;  // short string in 'bytes'
+    SharedString *shared;  // nullptr once handed to a state
+    struct { int narr, nrec; bool refd; } size;  // sizes of a table
+    size_t ref;  // index of the item of a table packed before
+  } u;
+};
+
+
+// items already packed for each table and long string of a packet
+using PackMemo = std::unordered_map<const GCObject *, size_t>;
+
+
+/*
+** Raise an error while packing or unpacking. These functions run
+** outside the kernel, but errors must leave it locked.
+*/
+l_noret xerror (moon_State *L, const char *msg, const char *arg) {
+  moon_lock(L);
+  moonG_runerror(L, msg, arg);
+}
+
+}  // namespace
+
+
+struct moon_Packet {
+  std::vector<PacketItem> items;  // values, with tables in preorder
+  std::string bytes;  // contents of short strings
+  int n = 0;  // number of top-level values
+  bool hasrefs = false;  // whether there are TableRef items
+
+  moon_Packet () = default;
+  moon_Packet (const moon_Packet &) = delete;
+  moon_Packet &operator= (const moon_Packet &) = delete;
+  ~moon_Packet () {
+    for (PacketItem &item : items) {
+      if (item.tag == PacketTag::SharedStr && item.u.shared != nullptr)
+        releasesharedstring(item.u.shared);
+    }
+  }
+};
+
+
+static void packvalue (moon_State *L, moon_Packet *p, PackMemo &memo,
+                       int idx, int depth) {
+  PacketItem item;
+  const TValue *o = L->getStackSubsystem().indexToValue(L, idx);
+  switch (ttypetag(o)) {
+    case MoonT::NIL: item.tag = PacketTag::Nil; break;
+    case MoonT::VFALSE: item.tag = PacketTag::False; break;
+    case MoonT::VTRUE: item.tag = PacketTag::True; break;
+    case MoonT::NUMINT:
+      item.tag = PacketTag::Integer;
+      item.u.i = ivalue(o);
+      break;
+    case MoonT::NUMFLT:
+      item.tag = PacketTag::Float;
+      item.u.n = fltvalue(o);
+      break;
+    case MoonT::SHRSTR: {
+      TString *ts = tsvalue(o);
+      item.tag = PacketTag::ShortString;
+      item.u.str.off = p->bytes.size();
+      item.u.str.len = ts->length();
+      p->bytes.append(ts->c_str(), ts->length());
+      break;
+    }
+    case MoonT::LNGSTR: {
+      TString *ts = tsvalue(o);
+      item.tag = PacketTag::SharedStr;
+      auto seen = memo.find(obj2gco(ts));
+      SharedString *ss;
+      if (seen != memo.end())  // already in this packet?
+        ss = p->items[seen->second].u.shared;
+      else if (ts->getShrlen() == LSTRMEM &&
+               ts->getFalloc() == freesharedstring)  // came from a packet?
+        ss = static_cast<SharedString *>(ts->getUserData());
+      else {  // copy it (the new buffer starts with one reference)
+        item.u.shared = newsharedstring(ts->c_str(), ts->length());
+        memo.emplace(obj2gco(ts), p->items.size());
+        break;
+      }
+      ss->refs.fetch_add(1, std::memory_order_relaxed);
+      item.u.shared = ss;
+      memo.emplace(obj2gco(ts), p->items.size());
+      break;
+    }
+    case MoonT::TABLE: {
+      const GCObject *t = obj2gco(hvalue(o));  // ('o' dies with the stack)
+      auto seen = memo.find(t);
+      if (seen != memo.end()) {  // already in this packet?
+        p->items[seen->second].u.size.refd = true;
+        p->hasrefs = true;
+        item.tag = PacketTag::TableRef;
+        item.u.ref = seen->second;
+        break;
+      }
+      if (depth >= MOONI_MAXPACKDEPTH)
+        xerror(L, "table too deep to transfer", nullptr);
+      if (!moon_checkstack(L, 3))
+        xerror(L, "table too deep to transfer", nullptr);
+      idx = moon_absindex(L, idx);
+      size_t start = p->items.size();
+      memo.emplace(t, start);
+      item.tag = PacketTag::Table;
+      item.u.size.narr = item.u.size.nrec = 0;
+      item.u.size.refd = false;
+      p->items.push_back(item);
+      int narr = 0, nrec = 0;
+      moon_pushnil(L);
+      while (moon_next(L, idx)) {
+        if (moon_isinteger(L, -2) && moon_tointeger(L, -2) == narr + 1)
+          narr++;
+        else
+          nrec++;
+        packvalue(L, p, memo, -2, depth + 1);
+        packvalue(L, p, memo, -1, depth + 1);
+        moon_settop(L, -2);
+      }
+      p->items[start].u.size.narr = narr;
+      p->items[start].u.size.nrec = nrec;
+      item.tag = PacketTag::TableEnd;
+      break;
+    }
+    default:
+      xerror(L, "cannot transfer a %s value", moon_typename(L, ttype(o)));
+  }
+  p->items.push_back(item);
+}
+
+
+/*
+** Pops 'n' values from the stack of 'L' and returns a packet with
+** copies of them. Only nil, booleans, numbers, strings, and tables with
+** such values can be packed.
+*/
+MOON_API moon_Packet *moon_xpack (moon_State *L, int n) {
+  api_checkpop(L, n);
+  std::unique_ptr<moon_Packet> p(new moon_Packet());
+  PackMemo memo;
+  int first = moon_gettop(L) - n + 1;
+  for (int i = 0; i < n; i++)
+    packvalue(L, p.get(), memo, first + i, 0);
+  p->n = n;
+  moon_settop(L, first - 1);
+  return p.release();
+}
+
+
+/*
+** Push the value starting at item 'i' and return the index of the item
+** after it. Tables referred to by later items are kept in the table at
+** 'memo', indexed by their item indices (plus one).
+*/
+static size_t unpackvalue (moon_State *L, moon_Packet *p, int memo,
+                           size_t i) {
+  size_t start = i;
+  PacketItem &item = p->items[i++];
+  switch (item.tag) {
+    case PacketTag::Nil: moon_pushnil(L); break;
+    case PacketTag::False: moon_pushboolean(L, 0); break;
+    case PacketTag::True: moon_pushboolean(L, 1); break;
+    case PacketTag::Integer: moon_pushinteger(L, item.u.i); break;
+    case PacketTag::Float: moon_pushnumber(L, item.u.n); break;
+    case PacketTag::ShortString:
+      moon_pushlstring(L, p->bytes.data() + item.u.str.off, item.u.str.len);
+      break;
+    case PacketTag::SharedStr: {
+      SharedString *ss = item.u.shared;
+      item.u.shared = nullptr;  // new string takes this reference
+      moon_pushexternalstring(L, ss->data, ss->len, freesharedstring, ss);
+      break;
+    }
+    case PacketTag::Table: {
+      if (!moon_checkstack(L, 3))
+        xerror(L, "table too deep to transfer", nullptr);
+      moon_createtable(L, item.u.size.narr, item.u.size.nrec);
+      if (item.u.size.refd) {
+        moon_pushvalue(L, -1);
+        moon_rawseti(L, memo, static_cast<moon_Integer>(start) + 1);
+      }
+      while (p->items[i].tag != PacketTag::TableEnd) {
+        i = unpackvalue(L, p, memo, i);  // key
+        i = unpackvalue(L, p, memo, i);  // value
+        moon_rawset(L, -3);
+      }
+      i++;  // skip TableEnd
+      break;
+    }
+    case PacketTag::TableRef:
+      moon_rawgeti(L, memo, static_cast<moon_Integer>(item.u.ref) + 1);
+      break;
+    case PacketTag::TableEnd:
+      moon_assert(0);
+      break;
+  }
+  return i;
+}
+
+
+/*
+** Pushes onto the stack of 'L' the values in packet 'p' and frees the
+** packet. Returns the number of values pushed.
+*/
+MOON_API int moon_xunpack (moon_State *L, moon_Packet *p) {
+  std::unique_ptr<moon_Packet> owner(p);
+  if (!moon_checkstack(L, p->n + 1))
+    xerror(L, "too many values to transfer", nullptr);
+  int memo = 0;
+  if (p->hasrefs) {
+    moon_newtable(L);
+    memo = moon_gettop(L);
+  }
+  size_t i = 0;
+  for (int k = 0; k < p->n; k++)
+    i = unpackvalue(L, p, memo, i);
+  if (memo != 0)
+    moon_remove(L, memo);
+  return p->n;
+}
+
+
+MOON_API void moon_xfreepacket (moon_Packet *p) {
+  delete p;
+}
+
+// }======================================================
@@ -9,9 +9,16 @@
 
 
 #include <algorithm>
+#include <atomic>
 #include <cstdarg>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <map>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "moon.h"
 
@@ -122,7 +129,7 @@ static int getcurrentline (CallInfo *callInfo) {
 ** temporarily broken while inserting a new element. We simply assume it
 ** has no good reasons to do that.)
 */
-static void settraps (CallInfo *callInfo) {
+void moonG_settraps (CallInfo *callInfo) {
   for (; callInfo != nullptr; callInfo = callInfo->getPrevious())
     if (callInfo->isLua())
       callInfo->getTrap() = 1;
@@ -149,7 +156,7 @@ MOON_API void moon_sethook (moon_State *L, moon_Hook func, int mask, int count)
   L->resetHookCount();
   L->setHookMask(cast_byte(mask));
   if (mask)
-    settraps(L->getCI());  // to trace inside 'moonV_execute'
+    moonG_settraps(L->getCI());  // to trace inside 'moonV_execute'
 }
 
 
@@ -159,7 +166,7 @@ MOON_API moon_Hook moon_gethook (moon_State *L) {
 
 
 MOON_API int moon_gethookmask (moon_State *L) {
-  return L->getHookMask();
+  return L->getHookMask() & ~MOONI_MASKSAMPLE;
 }
 
 
@@ -594,7 +601,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
         kname(p, k, name);
         return isEnv(p, lastpc, i, 1);
       }
-      case OP_GETTABLE: {
+      case OP_GETTABLE: case OP_GETFORI: {
         int k = InstructionView(i).c();  // key index
         rname(p, lastpc, k, name);
         return isEnv(p, lastpc, i, 0);
@@ -629,7 +636,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
 static const char *funcnamefromcode (moon_State *L, const Proto *p,
                                      int pc, const char **name) {
   TMS metamethodEvent = (TMS)0;  // (initial value avoids warnings)
-  Instruction i = p->getCode()[pc];  // calling instruction
+  Instruction i = moonP_generic(p->getCode()[pc]);  // calling instruction
   switch (InstructionView(i).opcode()) {
     case OP_CALL:
     case OP_TAILCALL:
@@ -640,7 +647,7 @@ static const char *funcnamefromcode (moon_State *L, const Proto *p,
     }
     // other instructions can do calls through metamethods
     case OP_SELF: case OP_GETTABUP: case OP_GETTABLE:
-    case OP_GETI: case OP_GETFIELD:
+    case OP_GETI: case OP_GETFIELD: case OP_GETFORI:
       metamethodEvent = TMS::TM_INDEX;
       break;
     case OP_SETTABUP: case OP_SETTABLE: case OP_SETI: case OP_SETFIELD:
@@ -1006,6 +1013,8 @@ int moonG_tracecall (moon_State *L) {
 // moon_State method
 int moon_State::traceExec(const Instruction *pc) {
   CallInfo *ci_local = callInfo;
+  if (getHookMask() & MOONI_MASKSAMPLE)  // profiler asking for a sample?
+    moonG_profsample(this, pc);  // (also clears the request)
   lu_byte mask = cast_byte(getHookMask());
   const Proto *p = ci_local->getFunc()->getProto();
   if (!(mask & (MOON_MASKLINE | MOON_MASKCOUNT))) {  // no hooks?
@@ -1051,3 +1060,564 @@ int moonG_traceexec (moon_State *L, const Instruction *pc) {
   return L->traceExec(pc);
 }
 
+
+
+/*
+** {======================================================
+** Sampling profiler
+** A timer signal only marks the running thread: it sets the bit
+** MOONI_MASKSAMPLE in its hook mask (so that new calls check hooks)
+** and the 'trap' of its Lua frames. The VM then calls 'moonG_profsample'
+** at its next trap point, where it is safe to walk the CallInfo list.
+** Samples are aggregated by stack. Frames are identified by small
+** integers whose labels are computed when a function is first seen,
+** so that samples outlive the prototypes they refer to.
+** =======================================================
+*/
+
+// default interval between samples, in microseconds
+#if !defined(MOONI_PROFINTERVAL)
+#define MOONI_PROFINTERVAL	1000
+#endif
+
+
+#if defined(MOON_USE_POSIX)
+#include <pthread.h>
+#include <signal.h>
+#include <sys/time.h>
+#endif
+
+
+namespace {
+
+// a frame: function id in the high half, current line in the low half
+using ProfFrame = std::uint64_t;
+
+struct StackHash {
+  size_t operator() (const std::vector<ProfFrame> &v) const noexcept {
+    std::uint64_t h = 14695981039346656037ull;  // FNV-1a
+    for (ProfFrame f : v)
+      h = (h ^ f) * 1099511628211ull;
+    return static_cast<size_t>(h);
+  }
+};
+
+}  // namespace
+
+
+struct Profiler {
+  GlobalState *g;
+  bool running = false;
+  std::unordered_map<const Proto *, std::uint32_t> ids;  // live functions
+  std::vector<std::string> labels;  // function labels, by id
+  std::unordered_map<std::vector<ProfFrame>, size_t, StackHash> stacks;
+  std::vector<ProfFrame> frames;  // buffer for the current sample
+#if defined(MOON_USE_POSIX)
+  pthread_t owner;  // OS thread running the profiled state
+#endif
+};
+
+
+/*
+** Label for function 'f' running at 'callInfo', as "name (source:line)".
+** Semicolons separate frames in the output, so they are replaced.
+*/
+static std::string framelabel (moon_State *L, CallInfo *callInfo,
+                               const Proto *f) {
+  char buff[MOON_IDSIZE];
+  size_t srclen;
+  const char *src;
+  if (f->getSource())
+    src = getStringWithLength(f->getSource(), srclen);
+  else {
+    src = "=?";
+    srclen = LL("=?");
+  }
+  moonO_chunkid(buff, src, srclen);
+  std::string label;
+  const char *name = nullptr;
+  if (f->getLineDefined() == 0)
+    label = std::string("main chunk (") + buff + ")";
+  else {
+    if (getfuncname(L, callInfo, &name) == nullptr)
+      name = "function";
+    label = std::string(name) + " (" + buff + ":" +
+            std::to_string(f->getLineDefined()) + ")";
+  }
+  std::replace(label.begin(), label.end(), ';', ',');
+  return label;
+}
+
+
+static std::uint32_t frameid (moon_State *L, Profiler *pr,
+                              CallInfo *callInfo) {
+  const Proto *f = callInfo->getFunc()->getProto();
+  auto it = pr->ids.find(f);
+  if (it != pr->ids.end())
+    return it->second;
+  auto id = static_cast<std::uint32_t>(pr->labels.size());
+  pr->labels.push_back(framelabel(L, callInfo, f));
+  pr->ids.emplace(f, id);
+  return id;
+}
+
+
+/*
+** Take a sample of the Lua frames of 'L', which is about to execute
+** the instruction at 'pc'. Called by the VM (through 'traceExec').
+*/
+void moonG_profsample (moon_State *L, const Instruction *pc) {
+  L->setHookMask(L->getHookMask() & ~MOONI_MASKSAMPLE);
+  Profiler *pr = G(L)->getProfiler();
+  if (pr == nullptr || !pr->running)
+    return;
+  try {
+    pr->frames.clear();
+    for (CallInfo *ci = L->getCI(); ci != L->getBaseCI();
+                                    ci = ci->getPrevious()) {
+      if (!ci->isLua()) continue;
+      const Proto *f = ci->getFunc()->getProto();
+      const Instruction *cpc = (ci == L->getCI()) ? pc + 1 : ci->getSavedPC();
+      int line = moonG_getfuncline(f, f->getPCRelative(cpc));
+      pr->frames.push_back((static_cast<ProfFrame>(frameid(L, pr, ci)) << 32) |
+                           static_cast<std::uint32_t>(line));
+    }
+    std::reverse(pr->frames.begin(), pr->frames.end());  // root first
+    pr->stacks[pr->frames]++;
+  }
+  catch (const std::bad_alloc &) {
+    // drop this sample
+  }
+}
+
+
+// prototype 'p' is being freed; its address may be reused
+void moonG_profforget (moon_State *L, const Proto *p) {
+  Profiler *pr = G(L)->getProfiler();
+  if (pr != nullptr)
+    pr->ids.erase(p);
+}
+
+
+#if defined(MOON_USE_POSIX)  // {
+
+// profiler receiving the timer ticks (only one per process)
+static std::atomic<Profiler *> activeprofiler{nullptr};
+
+
+/*
+** Handler for SIGPROF. The timer counts the CPU time of the whole
+** process, so ticks arriving in other OS threads are ignored.
+*/
+static void profhandler (int sig) {
+  (void)sig;
+  Profiler *pr = activeprofiler.load(std::memory_order_acquire);
+  if (pr == nullptr || !pthread_equal(pthread_self(), pr->owner))
+    return;
+  moon_State *L = pr->g->getRunning();
+  L->setHookMask(L->getHookMask() | MOONI_MASKSAMPLE);
+  moonG_settraps(L->getCI());
+}
+
+
+static bool settimer (int interval) {
+  struct itimerval it;
+  it.it_interval.tv_sec = interval / 1000000;
+  it.it_interval.tv_usec = interval % 1000000;
+  it.it_value = it.it_interval;
+  return setitimer(ITIMER_PROF, &it, nullptr) == 0;
+}
+
+
+/*
+** The handler is installed once and never removed: a tick may still
+** be pending after the timer stops, and the default action for
+** SIGPROF would kill the process.
+*/
+static bool installhandler () {
+  static std::atomic<bool> installed{false};
+  if (installed.load())
+    return true;
+  struct sigaction sa;
+  sa.sa_handler = profhandler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, nullptr) != 0)
+    return false;
+  installed.store(true);
+  return true;
+}
+
+
+static bool starttimer (Profiler *pr, int interval) {
+  Profiler *expected = nullptr;
+  pr->owner = pthread_self();
+  if (!installhandler() ||
+      !activeprofiler.compare_exchange_strong(expected, pr))
+    return false;  // another state is being profiled
+  if (!settimer(interval)) {
+    activeprofiler.store(nullptr);
+    return false;
+  }
+  return true;
+}
+
+
+static void stoptimer (Profiler *pr) {
+  settimer(0);
+  Profiler *expected = pr;
+  activeprofiler.compare_exchange_strong(expected, nullptr);
+}
+
+#else  // }{
+
+// no timer signals; the profiler never starts
+static bool starttimer (Profiler *pr, int interval) {
+  (void)pr; (void)interval;
+  return false;
+}
+
+static void stoptimer (Profiler *pr) {
+  (void)pr;
+}
+
+#endif  // }
+
+
+static void stopprofiler (Profiler *pr) {
+  if (pr->running) {
+    stoptimer(pr);
+    pr->running = false;
+  }
+}
+
+
+/*
+** Start sampling 'L' every 'interval' microseconds of CPU time,
+** discarding previous samples. Returns 0 if the profiler cannot start
+** (e.g., another state in the process is being profiled).
+*/
+MOON_API int moon_profstart (moon_State *L, int interval) {
+  GlobalState *g = G(L);
+  Profiler *pr = g->getProfiler();
+  if (pr == nullptr) {
+    pr = new (std::nothrow) Profiler;
+    if (pr == nullptr) return 0;
+    pr->g = g;
+    g->setProfiler(pr);
+  }
+  stopprofiler(pr);
+  pr->stacks.clear();
+  if (!starttimer(pr, (interval > 0) ? interval : MOONI_PROFINTERVAL))
+    return 0;
+  pr->running = true;
+  return 1;
+}
+
+
+MOON_API void moon_profstop (moon_State *L) {
+  Profiler *pr = G(L)->getProfiler();
+  if (pr != nullptr)
+    stopprofiler(pr);
+}
+
+
+/*
+** Write the samples collected so far as folded stacks, one line per
+** distinct stack: frames from the root separated by semicolons, a
+** space, and the number of samples. With 'lines', each frame also
+** gets its current line, so different lines of a function are kept
+** apart. Returns the first non-zero result of 'writer'.
+*/
+MOON_API int moon_profdump (moon_State *L, moon_Writer writer, void *data,
+                                           int lines) {
+  Profiler *pr = G(L)->getProfiler();
+  if (pr == nullptr)
+    return 0;
+  std::map<std::string, size_t> folded;  // sorted output
+  for (const auto &[stack, count] : pr->stacks) {
+    std::string key;
+    for (ProfFrame f : stack) {
+      if (!key.empty()) key += ';';
+      key += pr->labels[static_cast<size_t>(f >> 32)];
+      if (lines) {
+        auto line = static_cast<std::int32_t>(f & 0xffffffffu);
+        key += ':';
+        key += (line >= 0) ? std::to_string(line) : std::string("?");
+      }
+    }
+    folded[key] += count;
+  }
+  for (const auto &[key, count] : folded) {
+    std::string line = key + ' ' + std::to_string(count) + '\n';
+    int status = writer(L, line.data(), line.size(), data);
+    if (status != 0)
+      return status;
+  }
+  return 0;
+}
+
+
+// stop and free the profiler of a state being closed
+void moonG_profclose (moon_State *L) {
+  Profiler *pr = G(L)->getProfiler();
+  if (pr != nullptr) {
+    stopprofiler(pr);
+    G(L)->setProfiler(nullptr);
+    delete pr;
+  }
+}
+
+// }======================================================
+
+
+/*
+** {======================================================
+** Heap profiler
+** Each object allocated while the profiler runs is charged to a site:
+** the stack of the allocating thread (Lua functions at their current
+** lines, and C functions) plus a leaf frame naming the object type.
+** Objects are remembered by address, so that their release, either
+** by the collector or by reference counting (both go through
+** 'freeobj'), is charged back to the same site. Only the object
+** itself is counted, not the arrays it owns (e.g., table parts).
+** =======================================================
+*/
+
+namespace {
+
+struct HeapSite {
+  std::vector<ProfFrame> stack;  // leaf first, as in pprof
+  std::uint64_t allocs = 0;
+  std::uint64_t allocbytes = 0;
+  std::uint64_t frees = 0;
+  std::uint64_t freebytes = 0;
+};
+
+struct HeapObject {
+  std::uint32_t site;
+  size_t size;
+};
+
+}  // namespace
+
+
+struct HeapProfiler {
+  bool running = false;
+  // frame ids, keyed by Proto, C function, or type name
+  std::unordered_map<const void *, std::uint32_t> ids;
+  std::vector<std::string> labels;  // frame labels, by id
+  std::unordered_map<std::vector<ProfFrame>, std::uint32_t, StackHash> index;
+  std::vector<HeapSite> sites;
+  std::unordered_map<const GCObject *, HeapObject> objects;  // tracked
+  std::vector<ProfFrame> frames;  // buffer for the current site
+};
+
+
+static ProfFrame heapframe (HeapProfiler *hp, const void *key,
+                            std::string (*mklabel)(moon_State *, CallInfo *,
+                                                   const void *),
+                            moon_State *L, CallInfo *callInfo, int line) {
+  std::uint32_t id;
+  auto it = hp->ids.find(key);
+  if (it != hp->ids.end())
+    id = it->second;
+  else {
+    id = static_cast<std::uint32_t>(hp->labels.size());
+    hp->labels.push_back(mklabel(L, callInfo, key));
+    hp->ids.emplace(key, id);
+  }
+  return (static_cast<ProfFrame>(id) << 32) | static_cast<std::uint32_t>(line);
+}
+
+
+static std::string lualabel (moon_State *L, CallInfo *callInfo,
+                             const void *key) {
+  return framelabel(L, callInfo, static_cast<const Proto *>(key));
+}
+
+
+static std::string clabel (moon_State *L, CallInfo *callInfo,
+                           const void *key) {
+  (void)key;
+  const char *name = nullptr;
+  if (getfuncname(L, callInfo, &name) == nullptr)
+    name = "?";
+  return std::string(name) + " [C]";
+}
+
+
+static std::string typelabel (moon_State *L, CallInfo *callInfo,
+                              const void *key) {
+  (void)L; (void)callInfo;
+  return std::string("[") + static_cast<const char *>(key) + "]";
+}
+
+
+/*
+** Record the allocation of 'o', with 'size' bytes, by 'L'. Called by
+** 'moonC_newobj' while the state has a heap profiler.
+*/
+void moonG_heapalloc (moon_State *L, GCObject *o, size_t size) {
+  HeapProfiler *hp = G(L)->getHeapProfiler();
+  if (!hp->running)
+    return;
+  try {
+    hp->frames.clear();
+    const char *tname = ttypename(novariant(static_cast<int>(o->getType())));
+    hp->frames.push_back(heapframe(hp, tname, typelabel, L, nullptr, -1));
+    for (CallInfo *ci = L->getCI(); ci != L->getBaseCI();
+                                    ci = ci->getPrevious()) {
+      if (ci->isLua()) {
+        const Proto *f = ci->getFunc()->getProto();
+        int line = moonG_getfuncline(f, currentpc(ci));
+        hp->frames.push_back(heapframe(hp, f, lualabel, L, ci, line));
+      }
+      else {
+        const TValue *func = s2v(ci->funcRef().p);
+        const void *key = ttislcf(func)
+            ? reinterpret_cast<const void *>(fvalue(func))
+            : reinterpret_cast<const void *>(clCvalue(func)->getFunction());
+        hp->frames.push_back(heapframe(hp, key, clabel, L, ci, -1));
+      }
+    }
+    auto [it, isnew] = hp->index.try_emplace(
+                           hp->frames,
+                           static_cast<std::uint32_t>(hp->sites.size()));
+    if (isnew) {
+      hp->sites.emplace_back();
+      hp->sites.back().stack = hp->frames;
+    }
+    HeapSite &site = hp->sites[it->second];
+    hp->objects[o] = HeapObject{it->second, size};
+    site.allocs++;
+    site.allocbytes += size;
+  }
+  catch (const std::bad_alloc &) {
+    // do not track this object
+  }
+}
+
+
+/*
+** Object 'o' is being freed; charge it back to its site. Tracked objects
+** are charged even after the profiler stops, so that its in-use counts
+** stay accurate.
+*/
+void moonG_heapfree (moon_State *L, GCObject *o) {
+  HeapProfiler *hp = G(L)->getHeapProfiler();
+  auto it = hp->objects.find(o);
+  if (it == hp->objects.end())
+    return;
+  HeapSite &site = hp->sites[it->second.site];
+  site.frees++;
+  site.freebytes += it->second.size;
+  hp->objects.erase(it);
+}
+
+
+// prototype 'p' is being freed; its address may be reused
+void moonG_heapforget (moon_State *L, const Proto *p) {
+  G(L)->getHeapProfiler()->ids.erase(p);
+}
+
+
+/*
+** Start recording allocations of 'L', discarding previous records.
+** Returns 0 if there is not enough memory for the profiler.
+*/
+MOON_API int moon_heapstart (moon_State *L) {
+  GlobalState *g = G(L);
+  HeapProfiler *hp = g->getHeapProfiler();
+  if (hp == nullptr) {
+    hp = new (std::nothrow) HeapProfiler;
+    if (hp == nullptr) return 0;
+    g->setHeapProfiler(hp);
+  }
+  hp->index.clear();
+  hp->sites.clear();
+  hp->objects.clear();
+  hp->running = true;
+  return 1;
+}
+
+
+MOON_API void moon_heapstop (moon_State *L) {
+  HeapProfiler *hp = G(L)->getHeapProfiler();
+  if (hp != nullptr)
+    hp->running = false;
+}
+
+
+static void addcounts (std::string &out, std::uint64_t inuse,
+                       std::uint64_t inusebytes, std::uint64_t allocs,
+                       std::uint64_t allocbytes) {
+  out += std::to_string(inuse) + ": " + std::to_string(inusebytes) + " [" +
+         std::to_string(allocs) + ": " + std::to_string(allocbytes) + "]";
+}
+
+
+// address of frame 'f' in the dump (never zero)
+static std::string frameaddr (ProfFrame f) {
+  char buff[24];
+  std::snprintf(buff, sizeof(buff), "0x%016llx",
+                static_cast<unsigned long long>(f + (1ull << 32)));
+  return buff;
+}
+
+
+/*
+** Write the allocation sites as a heap profile in the symbolized text
+** format of pprof: a symbol table mapping each frame address to its
+** label, followed by one line per site with its in-use and allocated
+** objects and bytes and its stack, leaf first. The whole profile is
+** built before calling 'writer', which may allocate. Returns the result
+** of 'writer'.
+*/
+MOON_API int moon_heapdump (moon_State *L, moon_Writer writer, void *data) {
+  HeapProfiler *hp = G(L)->getHeapProfiler();
+  std::string out = "--- symbol\nbinary=moon\n";
+  std::string body;
+  std::uint64_t totals[4] = {0, 0, 0, 0};
+  if (hp != nullptr) {
+    std::map<ProfFrame, std::string> symbols;  // sorted output
+    for (const HeapSite &site : hp->sites) {
+      std::uint64_t inuse = site.allocs - site.frees;
+      std::uint64_t inusebytes = site.allocbytes - site.freebytes;
+      totals[0] += inuse; totals[1] += inusebytes;
+      totals[2] += site.allocs; totals[3] += site.allocbytes;
+      addcounts(body, inuse, inusebytes, site.allocs, site.allocbytes);
+      body += " @";
+      for (ProfFrame f : site.stack) {
+        body += ' ' + frameaddr(f);
+        auto &sym = symbols[f];
+        if (sym.empty()) {
+          sym = hp->labels[static_cast<size_t>(f >> 32)];
+          auto line = static_cast<std::int32_t>(f & 0xffffffffu);
+          if (line >= 0)
+            sym += ':' + std::to_string(line);
+        }
+      }
+      body += '\n';
+    }
+    for (const auto &[f, sym] : symbols)
+      out += frameaddr(f) + ' ' + sym + '\n';
+  }
+  out += "---\n--- heap\nheap profile: ";
+  addcounts(out, totals[0], totals[1], totals[2], totals[3]);
+  out += " @ heap_v2/1\n";  // every allocation was recorded
+  out += body;
+  return writer(L, out.data(), out.size(), data);
+}
+
+
+// free the heap profiler of a state being closed
+void moonG_heapclose (moon_State *L) {
+  HeapProfiler *hp = G(L)->getHeapProfiler();
+  if (hp != nullptr) {
+    G(L)->setHeapProfiler(nullptr);
+    delete hp;
+  }
+}
+
+// }======================================================
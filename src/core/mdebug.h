@@ -26,6 +26,13 @@ inline constexpr int MAXIWTHABS = 128;
 #endif
 
 
+/*
+** Internal bit in 'hookmask' asking the running thread to take a
+** profiler sample at its next trap (see 'moonG_profsample').
+*/
+inline constexpr int MOONI_MASKSAMPLE = (1 << 6);
+
+
 MOONI_FUNC int moonG_getfuncline (const Proto *f, int pc);
 MOONI_FUNC const char *moonG_findlocal (moon_State *L, CallInfo *callInfo, int n,
                                                     StkId *pos);
@@ -49,6 +56,14 @@ MOONI_FUNC const char *moonG_addinfo (moon_State *L, const char *msg,
 MOONI_FUNC l_noret moonG_errormsg (moon_State *L);
 MOONI_FUNC int moonG_traceexec (moon_State *L, const Instruction *pc);
 MOONI_FUNC int moonG_tracecall (moon_State *L);
+MOONI_FUNC void moonG_settraps (CallInfo *callInfo);
+MOONI_FUNC void moonG_profsample (moon_State *L, const Instruction *pc);
+MOONI_FUNC void moonG_profforget (moon_State *L, const Proto *p);
+MOONI_FUNC void moonG_profclose (moon_State *L);
+MOONI_FUNC void moonG_heapalloc (moon_State *L, GCObject *o, size_t size);
+MOONI_FUNC void moonG_heapfree (moon_State *L, GCObject *o);
+MOONI_FUNC void moonG_heapforget (moon_State *L, const Proto *p);
+MOONI_FUNC void moonG_heapclose (moon_State *L);
 
 
 #endif
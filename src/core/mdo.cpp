@@ -21,6 +21,7 @@
 #include "mmem.h"
 #include "mobject.h"
 #include "mopcodes.h"
+#include "moptimizer.h"
 #include "mparser.h"
 #include "mstate.h"
 #include "mstring.h"
@@ -906,7 +907,10 @@ MOON_API int moon_resume (moon_State *L, moon_State *from, int nargs,
   L->getNumberOfCCallsRef()++;
   mooni_userstateresume(L, nargs);
   api_checkpop(L, (L->getStatus() == MOON_OK) ? nargs + 1 : nargs);
+  moon_State *running = G(L)->getRunning();
+  G(L)->setRunning(L);  // for the sampling profiler
   status = L->rawRunProtected( resume, &nargs);
+  G(L)->setRunning(running);
    // continue running after recoverable errors
   status = precover(L, status);
   if (l_likely(!errorstatus(status)))
@@ -1055,6 +1059,12 @@ static void f_parser (moon_State *L, void *ud) {
   LClosure *cl;
   SParser *p = static_cast<SParser*>(ud);
   const char *mode = p->mode ? p->mode : "bt";
+  int optlevel = G(L)->getOptLevel();
+  if (strchr(mode, 'O') != nullptr) {  // optimize this chunk?
+    optlevel = MOON_OPTMAX;
+    if (strpbrk(mode, "btB") == nullptr)  // only "O"?
+      mode = "bt";
+  }
   int c = zgetc(p->z);  // read first character
   if (c == MOON_SIGNATURE[0]) {
     int fixed = 0;
@@ -1069,6 +1079,8 @@ static void f_parser (moon_State *L, void *ud) {
     cl = moonY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
   }
   moon_assert(cl->getNumUpvalues() == cl->getProto()->getUpvaluesSize());
+  if (optlevel > 0)
+    moonK_optimize(L, cl->getProto(), optlevel);
   cl->initUpvals(L);
 }
 
@@ -11,6 +11,9 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "moon.h"
 
@@ -25,6 +28,7 @@
 #include "mstring.h"
 #include "mtable.h"
 #include "mtm.h"
+#include "mvmstats.h"
 #include "../vm/mvirtualmachine.h"
 
 
@@ -268,6 +272,9 @@ lu_mem moonE_threadsize (moon_State *L) {
 
 static void close_state (moon_State *L) {
   GlobalState *g = G(L);
+  moonG_profclose(L);  // stop sampling before anything goes away
+  moonG_heapclose(L);
+  moonV_freestats(L);
   if (!g->isComplete())  // closing a partially built state?
     moonC_freeallobjects(*L);  // just collect its objects
   else {  // closing a fully built state
@@ -277,27 +284,107 @@ static void close_state (moon_State *L) {
     moonC_freeallobjects(*L);  // collect all objects
     mooni_userstateclose(L);
   }
+  moonE_freethreadpool(L);
   moonM_freearray(L, G(L)->getStringTable()->getHash(), cast_sizet(G(L)->getStringTable()->getSize()));
   L->closeVM();  // Free VirtualMachine before freeing stack
   freestack(L);
+  moonM_freerecycled(g);
   moon_assert(g->getTotalBytes() == sizeof(GlobalState));
   (*g->getFrealloc())(g->getUd(), g, sizeof(GlobalState), 0);  // free main block
 }
 
 
+/*
+** {======================================================
+** Thread pool
+** =======================================================
+*/
+
+/*
+** Try to park a dead thread 'L1' in the pool instead of freeing it.
+** Its upvalues must be already closed. The thread keeps its VM and a
+** stack trimmed to MOONI_POOLSTACKSIZE slots; its CallInfo list is
+** freed. Returns 0 if 'L1' cannot be recycled (pool full, state being
+** closed or stack shrinking failed) and so must be freed.
+*/
+static int poolthread (moon_State *L, moon_State *L1) {
+  GlobalState *g = G(L);
+  if (g->getNThreadPool() >= MOONI_MAXTHREADPOOL ||
+      (g->getGCStp() & GCSTPCLS) || L1->getStack().p == nullptr)
+    return 0;
+  resetCI(L1);
+  freeCI(L1);
+  L1->getStackSubsystem().setTopPtr(L1->getStack().p + 1);
+  L1->setTbclist(L1->getStack());
+  if (L1->getStackSize() > MOONI_POOLSTACKSIZE &&
+      !L1->reallocStack(MOONI_POOLSTACKSIZE, 0))
+    return 0;
+  // erase old contents, so that no dead values survive in the pool
+  std::for_each_n(L1->getStack().p, L1->getStackSize() + EXTRA_STACK,
+                  [](StackValue& sv) { setnilvalue(s2v(&sv)); });
+  L1->setNext(obj2gco(g->getThreadPool()));
+  g->setThreadPool(L1);
+  g->setNThreadPool(g->getNThreadPool() + 1);
+  return 1;
+}
+
+
+/*
+** Take a thread from the pool (or return nullptr if it is empty) and
+** link it in 'allgc' as a new object, with the same state that
+** 'preinit_thread' plus 'stack_init' would give to a fresh one.
+*/
+static moon_State *unpoolthread (moon_State *L) {
+  GlobalState *g = G(L);
+  moon_State *L1 = g->getThreadPool();
+  if (L1 == nullptr)
+    return nullptr;
+  g->setThreadPool(L1->getNext() ? gco2th(L1->getNext()) : nullptr);
+  g->setNThreadPool(g->getNThreadPool() - 1);
+  L1->setMarked(g->getWhite());
+  L1->setRefcount(1);
+  L1->setNext(g->getAllGC());
+  g->setAllGC(obj2gco(L1));
+  L1->reinit(g);
+  L1->resetHookCount();
+  resetCI(L1);
+  L1->getStackSubsystem().setTopPtr(L1->getStack().p + 1);
+  return L1;
+}
+
+
+/*
+** Free all threads in the pool (when closing the state).
+*/
+void moonE_freethreadpool (moon_State *L) {
+  GlobalState *g = G(L);
+  while (g->getThreadPool() != nullptr) {
+    moon_State *L1 = g->getThreadPool();
+    g->setThreadPool(L1->getNext() ? gco2th(L1->getNext()) : nullptr);
+    L1->closeVM();
+    freestack(L1);
+    moonM_free(L, fromstate(L1));
+  }
+  g->setNThreadPool(0);
+}
+
+// }======================================================
+
+
 MOON_API moon_State *moon_newthread (moon_State *L) {
   GlobalState *g = G(L);
-  GCObject *o;
   moon_State *L1;
   moon_lock(L);
   moonC_checkGC(L);
-  // create new thread
-  o = moonC_newobjdt(*L, ctb(MoonT::THREAD), sizeof(LX), lxOffset());
-  L1 = gco2th(o);
+  L1 = unpoolthread(L);  // try to reuse a recycled thread
+  if (L1 == nullptr) {  // no recycled thread? create a new one
+    GCObject *o = moonC_newobjdt(*L, ctb(MoonT::THREAD), sizeof(LX), lxOffset());
+    L1 = gco2th(o);
+    preinit_thread(L1, g);
+  }
   // anchor it on L stack
   setthvalue2s(L, L->getTop().p, L1);
   api_incr_top(L);
-  preinit_thread(L1, g);
   L1->setHookMask(L->getHookMask());
   L1->setBaseHookCount(L->getBaseHookCount());
   L1->setHook(L->getHook());
@@ -306,8 +393,10 @@ MOON_API moon_State *moon_newthread (moon_State *L) {
   memcpy(moon_getextraspace(L1), moon_getextraspace(mainthread(g)),
          MOON_EXTRASPACE);
   mooni_userstatethread(L, L1);
-  stack_init(L1, L);  // init stack
-  L1->initVM();  // Allocate VirtualMachine for new thread
+  if (L1->getStack().p == nullptr) {  // not a recycled thread?
+    stack_init(L1, L);  // init stack
+    L1->initVM();  // Allocate VirtualMachine for new thread
+  }
   moon_unlock(L);
   return L1;
 }
@@ -318,6 +407,8 @@ void moonE_freethread (moon_State *L, moon_State *L1) {
   moonF_closeupval(L1, L1->getStack().p);  // close all upvalues
   moon_assert(L1->getOpenUpval() == nullptr);
   mooni_userstatefree(L, L1);
+  if (poolthread(L, L1))  // kept for reuse?
+    return;
   L1->closeVM();  // Free VirtualMachine before freeing stack
   freestack(L1);
   moonM_free(L, l);
@@ -367,8 +458,22 @@ MOON_API moon_State *moon_newstate (moon_Alloc f, void *ud, unsigned seed) {
   incnny(L);  // main thread is always non yieldable
   g->setFrealloc(f);
   g->setUd(ud);
+  for (int c = 0; c < MOONI_RECYCLECLASSES; c++)
+    g->setRecycled(c, nullptr);
+  g->setNRecycled(0);
+  g->setRecycle(0);
   g->setWarnF(nullptr);
   g->setUdWarn(nullptr);
+  g->setThreadPool(nullptr);
+  g->setNThreadPool(0);
+  g->setRunning(L);
+  g->setProfiler(nullptr);
+  g->setHeapProfiler(nullptr);
+  g->setVMStats(nullptr);
+  g->setMarkPool(nullptr);
+  g->setSweepThread(nullptr);
+  g->setARCQueue(nullptr);
+  g->setOptLevel(0);
   g->setSeed(seed);
   g->setGCStp(GCSTPGC);  // no GC while building state
   g->getStringTable()->setSize(0);
@@ -380,6 +485,7 @@ MOON_API moon_State *moon_newstate (moon_Alloc f, void *ud, unsigned seed) {
   g->setGCKind(GCKind::Incremental);
   g->setGCStopEm(0);
   g->setGCEmergency(0);
+  g->setGCBgSweep(0);
   g->setFinObj(nullptr); g->setToBeFnz(nullptr); g->setFixedGC(nullptr);
   g->setFirstOld1(nullptr); g->setSurvival(nullptr); g->setOld1(nullptr); g->setReallyOld(nullptr);
   g->setFinObjSur(nullptr); g->setFinObjOld1(nullptr); g->setFinObjROld(nullptr);
@@ -390,6 +496,8 @@ MOON_API moon_State *moon_newstate (moon_Alloc f, void *ud, unsigned seed) {
   g->setGCTotalBytes(sizeof(GlobalState));
   g->setGCMarked(0);
   g->setGCDebt(0);
+  g->setGCMemLimit(0);
+  g->setGCPeak(sizeof(GlobalState));
   g->getNilValue()->setInt(0);  // to signal that state is not yet built
   setgcparam(g, PAUSE, MOONI_GCPAUSE);
   setgcparam(g, STEPMUL, MOONI_GCMUL);
@@ -405,6 +513,8 @@ MOON_API moon_State *moon_newstate (moon_Alloc f, void *ud, unsigned seed) {
     close_state(L);
     L = nullptr;
   }
+  else
+    moonV_newstats(L);
   return L;
 }
 
@@ -416,6 +526,403 @@ MOON_API void moon_close (moon_State *L) {
 }
 
 
+/*
+** {======================================================
+** State cloning
+** =======================================================
+*/
+
+namespace {
+
+/*
+** Copies into a new state every object reachable from the registry
+** and the basic metatables of a template. Each object is copied once
+** ('copies' maps template objects to their copies). An object is
+** created empty when first reached and filled later from 'pending', so
+** copying never recurses. The collector is stopped all along, so the
+** partial copies need neither anchors nor barriers.
+*/
+class StateCloner {
+ public:
+  StateCloner (moon_State *tmpl, moon_State *L1) : from(tmpl), L(L1) {}
+  void copyValue (const TValue *o, TValue *res);
+  Table *copyTable (Table *t);
+  void run ();
+
+ private:
+  moon_State *from;  // template
+  moon_State *L;  // new state
+  std::unordered_map<const GCObject *, GCObject *> copies;
+  std::vector<std::pair<GCObject *, GCObject *>> pending;
+  std::vector<std::pair<GCObject *, Table *>> withmeta;  // to check '__gc'
+
+  GCObject *copyObject (GCObject *o);
+  GCObject *newObject (GCObject *o);
+  TString *copyString (TString *ts) {
+    return (ts == nullptr) ? nullptr : gco2ts(copyObject(obj2gco(ts)));
+  }
+  void setMetatable (GCObject *o, Table *mt);
+  void fillTable (Table *t, Table *c);
+  void fillProto (Proto *f, Proto *c);
+  void fill (GCObject *o, GCObject *c);
+};
+
+
+void StateCloner::copyValue (const TValue *o, TValue *res) {
+  if (iscollectable(o))
+    res->setGCTagged(copyObject(gcvalue(o)), o->getType());
+  else
+    *res = *o;
+}
+
+
+Table *StateCloner::copyTable (Table *t) {
+  return (t == nullptr) ? nullptr : gco2t(copyObject(obj2gco(t)));
+}
+
+
+GCObject *StateCloner::copyObject (GCObject *o) {
+  if (o->getType() == ctb(MoonT::SHRSTR)) {  // interned: no need to track
+    TString *ts = gco2ts(o);
+    return obj2gco(TString::create(L, getShortStringContents(ts),
+                                   getStringLength(ts)));
+  }
+  auto it = copies.find(o);
+  if (it != copies.end())
+    return it->second;
+  GCObject *c = newObject(o);
+  copies.emplace(o, c);
+  return c;
+}
+
+
+/*
+** Check whether metatable 'mt' has a field '__clone' equal to false,
+** which marks userdata whose memory cannot be copied byte by byte (for
+** instance, because it points to itself). The template must not be
+** changed, so the key is searched without creating the string.
+*/
+static bool noclone (moon_State *from, const Table *mt) {
+  static const char key[] = "__clone";
+  if (mt == nullptr || mt->isDummy())
+    return false;
+  for (unsigned i = 0; i < mt->nodeSize(); i++) {
+    const Node *n = gnode(mt, i);
+    if (n->isKeyNil() || n->isKeyDead())
+      continue;
+    TValue k;
+    n->getKey(from, &k);
+    if (ttisshrstring(&k)) {
+      TString *ts = tsvalue(&k);
+      if (getStringLength(ts) == sizeof(key) - 1 &&
+          memcmp(getShortStringContents(ts), key, sizeof(key) - 1) == 0)
+        return ttisfalse(gval(n));
+    }
+  }
+  return false;
+}
+
+
+/*
+** Create the copy of 'o', leaving its contents (if any) for later.
+*/
+GCObject *StateCloner::newObject (GCObject *o) {
+  GCObject *c;
+  switch (static_cast<int>(o->getType())) {
+    case static_cast<int>(ctb(MoonT::LNGSTR)): {
+      // (fixed contents are copied too: their buffer belongs to the
+      // template, which may be closed before its clones)
+      TString *ts = gco2ts(o);
+      c = obj2gco(TString::create(L, getLongStringContents(ts),
+                                  ts->getLnglen()));
+      return c;  // nothing left to fill
+    }
+    case static_cast<int>(ctb(MoonT::TABLE)): {
+      Table *t = gco2t(o);
+      Table *nt = Table::create(L);
+      nt->resize(L, t->arraySize(), t->isDummy() ? 0 : t->nodeSize());
+      c = obj2gco(nt);
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::CCL)): {
+      CClosure *cl = gco2ccl(o);
+      CClosure *ncl = CClosure::create(L, cl->getNumUpvalues());
+      ncl->setFunction(cl->getFunction());
+      c = obj2gco(ncl);
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::LCL)):
+      c = obj2gco(LClosure::create(L, gco2lcl(o)->getNumUpvalues()));
+      break;
+    case static_cast<int>(ctb(MoonT::USERDATA)): {
+      Udata *u = gco2u(o);
+      if (noclone(from, u->getMetatable()))
+        moonG_runerror(L, "cannot clone a userdata marked with '__clone'");
+      Udata *nu = moonS_newudata(L, u->getLen(), u->getNumUserValues());
+      if (u->getLen() > 0)
+        memcpy(nu->getMemory(), u->getMemory(), u->getLen());
+      c = obj2gco(nu);
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::UPVAL)): {
+      UpVal *uv = new (L, ctb(MoonT::UPVAL)) UpVal();
+      uv->setVP(uv->getValueSlot());  // copies are always closed
+      c = obj2gco(uv);
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::PROTO)):
+      c = obj2gco(moonF_newproto(L));
+      break;
+    case static_cast<int>(ctb(MoonT::THREAD)):
+      if (o == obj2gco(mainthread(G(from))))
+        return obj2gco(mainthread(G(L)));
+      moonG_runerror(L, "cannot clone a coroutine");
+    default:
+      moon_assert(0);
+      return nullptr;
+  }
+  pending.emplace_back(o, c);
+  return c;
+}
+
+
+void StateCloner::setMetatable (GCObject *o, Table *mt) {
+  if (mt != nullptr)
+    withmeta.emplace_back(o, mt);
+}
+
+
+/*
+** When every key in the hash part of 't' hashes to the same value in
+** both states (that is, it has no collectable keys other than strings,
+** whose hashes use the common seed), the copy can keep the node layout
+** of the original, and so needs no insertions. Otherwise, its entries
+** are inserted one by one.
+*/
+static bool samelayout (const Table *t) {
+  for (unsigned i = 0; i < t->nodeSize(); i++) {
+    const Node *n = gnode(t, i);
+    if (n->isKeyCollectable() && novariant(n->getKeyType()) != MOON_TSTRING)
+      return false;
+  }
+  return true;
+}
+
+
+void StateCloner::fillTable (Table *t, Table *c) {
+  for (unsigned k = 0; k < t->arraySize(); k++) {
+    TValue v, cv;
+    arr2obj(t, k, &v);
+    copyValue(&v, &cv);
+    if (iscollectable(&cv)) moonC_incref(gcvalue(&cv));
+    obj2arr(c, k, &cv);
+  }
+  if (t->arraySize() > 0)
+    *c->getLenHint() = *t->getLenHint();
+  if (!t->isDummy() && samelayout(t)) {
+    for (unsigned i = 0; i < t->nodeSize(); i++) {
+      Node *n = gnode(t, i);
+      Node *nc = gnode(c, i);
+      if (n->isKeyDead()) {  // keep it in its collision chain
+        Value nokey;
+        nokey.gc = nullptr;
+        nc->setKeyDead();
+        nc->setKeyValue(nokey);
+      }
+      else if (!n->isKeyNil()) {
+        TValue k, ck;
+        n->getKey(from, &k);
+        copyValue(&k, &ck);
+        copyValue(gval(n), gval(nc));
+        if (iscollectable(&ck)) moonC_incref(gcvalue(&ck));
+        if (iscollectable(gval(nc))) moonC_incref(gcvalue(gval(nc)));
+        nc->setKey(&ck);
+      }
+      gnext(nc) = gnext(n);
+    }
+  }
+  else if (!t->isDummy()) {
+    for (unsigned i = 0; i < t->nodeSize(); i++) {
+      Node *n = gnode(t, i);
+      if (!n->isKeyNil() && !n->isKeyDead() && !isempty(gval(n))) {
+        TValue k, ck, cv;
+        n->getKey(from, &k);
+        copyValue(&k, &ck);
+        copyValue(gval(n), &cv);
+        c->set(L, &ck, &cv);
+      }
+    }
+  }
+  c->setMetatable(copyTable(t->getMetatable()));
+  setMetatable(obj2gco(c), c->getMetatable());
+  // same metamethod cache and frozen mark (set last, as it blocks 'set')
+  c->setFlags(cast_byte((t->getFlags() & NOTBITDUMMY) |
+                        (c->getFlags() & BITDUMMY)));
+}
+
+
+void StateCloner::fillProto (Proto *f, Proto *c) {
+  c->setNumParams(f->getNumParams());
+  c->setFlag(f->getFlag() & PF_ISVARARG);  // the copy owns all its parts
+  c->setMaxStackSize(f->getMaxStackSize());
+  c->setLineDefined(f->getLineDefined());
+  c->setLastLineDefined(f->getLastLineDefined());
+  int n = f->getCodeSize();
+  c->setCode(moonM_newvectorchecked<Instruction>(L, cast_sizet(n)));
+  c->setCodeSize(n);
+  std::copy_n(f->getCode(), n, c->getCode());
+  n = f->getConstantsSize();
+  c->setConstants(moonM_newvectorchecked<TValue>(L, cast_sizet(n)));
+  c->setConstantsSize(n);
+  for (TValue &k : c->getConstantsSpan())
+    setnilvalue(&k);
+  for (int i = 0; i < n; i++)
+    copyValue(&f->getConstants()[i], &c->getConstants()[i]);
+  n = f->getUpvaluesSize();
+  c->setUpvalues(moonM_newvectorchecked<Upvaldesc>(L, cast_sizet(n)));
+  c->setUpvaluesSize(n);
+  for (int i = 0; i < n; i++) {
+    c->getUpvalues()[i] = f->getUpvalues()[i];
+    c->getUpvalues()[i].setName(copyString(f->getUpvalues()[i].getName()));
+  }
+  n = f->getProtosSize();
+  c->setProtos(moonM_newvectorchecked<Proto *>(L, cast_sizet(n)));
+  c->setProtosSize(n);
+  std::fill_n(c->getProtos(), n, nullptr);
+  for (int i = 0; i < n; i++)
+    c->getProtos()[i] = gco2p(copyObject(obj2gco(f->getProtos()[i])));
+  c->setSource(copyString(f->getSource()));
+  n = f->getLineInfoSize();
+  c->setLineInfo(moonM_newvectorchecked<ls_byte>(L, cast_sizet(n)));
+  c->setLineInfoSize(n);
+  std::copy_n(f->getLineInfo(), n, c->getLineInfo());
+  n = f->getAbsLineInfoSize();
+  c->setAbsLineInfo(moonM_newvectorchecked<AbsLineInfo>(L, cast_sizet(n)));
+  c->setAbsLineInfoSize(n);
+  std::copy_n(f->getAbsLineInfo(), n, c->getAbsLineInfo());
+  n = f->getLocVarsSize();
+  c->setLocVars(moonM_newvectorchecked<LocVar>(L, cast_sizet(n)));
+  c->setLocVarsSize(n);
+  for (int i = 0; i < n; i++) {
+    c->getLocVars()[i] = f->getLocVars()[i];
+    c->getLocVars()[i].setVarName(nullptr);
+  }
+  for (int i = 0; i < n; i++)
+    c->getLocVars()[i].setVarName(copyString(f->getLocVars()[i].getVarName()));
+}
+
+
+void StateCloner::fill (GCObject *o, GCObject *c) {
+  switch (static_cast<int>(o->getType())) {
+    case static_cast<int>(ctb(MoonT::TABLE)):
+      fillTable(gco2t(o), gco2t(c));
+      break;
+    case static_cast<int>(ctb(MoonT::CCL)): {
+      CClosure *cl = gco2ccl(o);
+      for (int i = 0; i < cl->getNumUpvalues(); i++)
+        copyValue(cl->getUpvalue(i), gco2ccl(c)->getUpvalue(i));
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::LCL)): {
+      LClosure *cl = gco2lcl(o);
+      LClosure *ncl = gco2lcl(c);
+      ncl->setProto(gco2p(copyObject(obj2gco(cl->getProto()))));
+      for (int i = 0; i < cl->getNumUpvalues(); i++) {
+        UpVal *uv = cl->getUpval(i);
+        if (uv != nullptr)
+          ncl->setUpval(i, gco2upv(copyObject(obj2gco(uv))));
+      }
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::USERDATA)): {
+      Udata *u = gco2u(o);
+      Udata *nu = gco2u(c);
+      for (int i = 0; i < u->getNumUserValues(); i++)
+        copyValue(&u->getUserValue(i)->value, &nu->getUserValue(i)->value);
+      nu->setMetatable(copyTable(u->getMetatable()));
+      setMetatable(c, nu->getMetatable());
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::UPVAL)):  // an open upvalue gives its current value
+      copyValue(gco2upv(o)->getVP(), gco2upv(c)->getVP());
+      break;
+    case static_cast<int>(ctb(MoonT::PROTO)):
+      fillProto(gco2p(o), gco2p(c));
+      break;
+    default: moon_assert(0);
+  }
+}
+
+
+/*
+** Fill all objects created so far (and the ones they reach), then
+** mark for finalization the copies whose metatables have '__gc'
+** (which can be checked only when the metatables are complete).
+*/
+void StateCloner::run () {
+  while (!pending.empty()) {
+    auto [o, c] = pending.back();
+    pending.pop_back();
+    fill(o, c);
+  }
+  for (auto [o, mt] : withmeta)
+    o->checkFinalizer(L, mt);
+}
+
+}  // namespace
+
+
+static void f_clone (moon_State *L, void *ud) {
+  moon_State *from = static_cast<moon_State *>(ud);
+  GlobalState *g = G(L);
+  GlobalState *gf = G(from);
+  StateCloner cloner(from, L);
+  unsigned int strsize = cast_uint(gf->getStringTable()->getSize());
+  if (cast_uint(g->getStringTable()->getSize()) < strsize)
+    TString::resize(L, strsize);  // avoid growing it step by step
+  cloner.copyValue(gf->getRegistry(), g->getRegistry());
+  for (int i = 0; i < MOON_NUMTYPES; i++)
+    g->setMetatable(i, cloner.copyTable(gf->getMetatable(i)));
+  cloner.run();
+}
+
+
+/*
+** Create a new state as a copy of the (idle) state 'from': same
+** allocator, panic function, hash seed, and collector parameters, and
+** copies of its registry (and so its globals and loaded modules) and of
+** the metatables of basic types. Full userdata are copied byte by byte.
+** Returns NULL on errors (including a coroutine reachable in 'from').
+** The new state has no warning function, as 'from' may use its own
+** state as the userdata of that function.
+*/
+MOON_API moon_State *moon_clonestate (moon_State *from) {
+  GlobalState *gf = G(from);
+  moon_State *L = moon_newstate(gf->getFrealloc(), gf->getUd(),
+                                gf->getSeed());
+  if (L == nullptr)
+    return nullptr;
+  GlobalState *g = G(L);
+  g->setPanic(gf->getPanic());
+  g->setOptLevel(gf->getOptLevel());
+  std::copy_n(gf->getGCParams(), MOON_GCPN, g->getGCParams());
+  g->setGCBgSweep(gf->getGCBgSweep());  // same allocator
+  g->setRecycle(gf->getRecycle());
+  g->setGCStp(GCSTPGC);  // no collections while copying
+  TStatus status = L->rawRunProtected(f_clone, from);
+  g->setGCStp(gf->getGCStp() & GCSTPUSR);  // stopped if 'from' is stopped
+  if (status != MOON_OK) {
+    moon_close(L);
+    return nullptr;
+  }
+  if (gf->getGCKind() != g->getGCKind())
+    moonC_changemode(*L, gf->getGCKind());
+  return L;
+}
+
+// }======================================================
+
+
 void moonE_warning (moon_State *L, const char *msg, int tocont) {
   moon_WarnFunction wf = G(L)->getWarnF();
   if (wf != nullptr)
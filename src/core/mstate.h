@@ -14,6 +14,12 @@
 typedef struct CallInfo CallInfo;
 class GlobalState;  // forward declaration
 class VirtualMachine;  // forward declaration
+struct Profiler;  // forward declaration
+struct HeapProfiler;  // forward declaration
+struct VMStats;  // forward declaration
+struct GCMarkPool;  // forward declaration
+struct GCSweepThread;  // forward declaration
+struct ARCQueue;  // forward declaration
 
 // Type of protected functions, to be run by 'runprotected'
 typedef void (*Pfunc) (moon_State *L, void *ud);
@@ -150,6 +156,41 @@ inline constexpr int STRCACHE_M = 2;
 inline constexpr int BASIC_STACK_SIZE = (2*MOON_MINSTACK);
 
 
+/*
+** Pool of recycled threads. When a coroutine is freed, up to
+** 'MOONI_MAXTHREADPOOL' of them are kept with their stack trimmed to
+** 'MOONI_POOLSTACKSIZE' slots, so that 'moon_newthread' can reuse them
+** without allocating a new stack, CallInfo list and VM.
+*/
+#if !defined(MOONI_MAXTHREADPOOL)
+inline constexpr int MOONI_MAXTHREADPOOL = 64;
+#endif
+
+#if !defined(MOONI_POOLSTACKSIZE)
+inline constexpr int MOONI_POOLSTACKSIZE = BASIC_STACK_SIZE;
+#endif
+
+
+/*
+** Recycling of small blocks. When enabled, freed blocks of up to
+** 'MOONI_RECYCLEMAX' bytes (with sizes multiple of a pointer) are kept
+** in per-size free lists, and new blocks of those sizes are taken from
+** there before calling the allocator. The lists keep up to as many
+** bytes as the heap has in use (but at least 'MOONI_RECYCLELIMIT'), so
+** that most blocks freed by a cycle can be reused by the next one.
+*/
+#if !defined(MOONI_RECYCLEMAX)
+inline constexpr size_t MOONI_RECYCLEMAX = 256;
+#endif
+
+#if !defined(MOONI_RECYCLELIMIT)
+inline constexpr size_t MOONI_RECYCLELIMIT = 256 * 1024;
+#endif
+
+inline constexpr int MOONI_RECYCLECLASSES =
+    cast_int(MOONI_RECYCLEMAX / sizeof(void*)) + 1;
+
+
 /*
 ** Possible states of the Garbage Collector
 */
@@ -584,6 +625,15 @@ public:
   void setNumberOfCallInfos(int n) noexcept { numberOfCallInfos = n; }
   int& getNumberOfCallInfosRef() noexcept { return numberOfCallInfos; }  // For increment/decrement
 
+  // Reinitialize a recycled thread, keeping its stack and VM
+  void reinit(GlobalState* g) noexcept {
+    MoonStack savedstack = stack_;
+    VirtualMachine* savedvm = vm_;
+    init(g);
+    stack_ = savedstack;
+    vm_ = savedvm;
+  }
+
   // Non-yieldable call management
   void incrementNonYieldable() noexcept { numberOfCCalls += 0x10000; }
   void decrementNonYieldable() noexcept { numberOfCCalls -= 0x10000; }
@@ -755,12 +805,22 @@ class MemoryAllocator {
 private:
   moon_Alloc frealloc;  // function to reallocate memory
   void *ud;  // auxiliary data to 'frealloc'
+  void *recycled[MOONI_RECYCLECLASSES];  // free lists of small blocks
+  size_t nrecycled;  // bytes kept in 'recycled'
+  lu_byte recycle;  // True if freed small blocks may be recycled
 
 public:
   inline moon_Alloc getFrealloc() const noexcept { return frealloc; }
   inline void setFrealloc(moon_Alloc f) noexcept { frealloc = f; }
   inline void* getUd() const noexcept { return ud; }
   inline void setUd(void* u) noexcept { ud = u; }
+
+  inline void* getRecycled(int c) const noexcept { return recycled[c]; }
+  inline void setRecycled(int c, void* b) noexcept { recycled[c] = b; }
+  inline size_t getNRecycled() const noexcept { return nrecycled; }
+  inline void setNRecycled(size_t n) noexcept { nrecycled = n; }
+  inline lu_byte getRecycle() const noexcept { return recycle; }
+  inline void setRecycle(lu_byte r) noexcept { recycle = r; }
 };
 
 
@@ -771,6 +831,8 @@ private:
   l_mem debt;  // Bytes counted but not yet allocated
   l_mem marked;  // Objects marked in current GC cycle
   l_mem majorminor;  // Counter to control major-minor shifts
+  l_mem memlimit;  // Maximum bytes in use (0 means no limit)
+  l_mem peak;  // Largest number of bytes in use so far
 
 public:
   inline l_mem getTotalBytes() const noexcept { return totalbytes; }
@@ -790,6 +852,12 @@ public:
   inline l_mem getMajorMinor() const noexcept { return majorminor; }
   inline void setMajorMinor(l_mem mm) noexcept { majorminor = mm; }
   inline l_mem& getMajorMinorRef() noexcept { return majorminor; }
+
+  inline l_mem getMemLimit() const noexcept { return memlimit; }
+  inline void setMemLimit(l_mem l) noexcept { memlimit = l; }
+
+  inline l_mem getPeak() const noexcept { return peak; }
+  inline void setPeak(l_mem p) noexcept { peak = p; }
 };
 
 
@@ -803,6 +871,7 @@ private:
   lu_byte stopem;  // Stops emergency collections
   lu_byte stp;  // Control whether GC is running
   lu_byte emergency;  // True if this is emergency collection
+  lu_byte bgsweep;  // True if dead objects may be freed by a helper thread
 
 public:
   inline lu_byte* getParams() noexcept { return params; }
@@ -828,6 +897,9 @@ public:
 
   inline lu_byte getEmergency() const noexcept { return emergency; }
   inline void setEmergency(lu_byte em) noexcept { emergency = em; }
+
+  inline lu_byte getBgSweep() const noexcept { return bgsweep; }
+  inline void setBgSweep(lu_byte b) noexcept { bgsweep = b; }
 };
 
 
@@ -981,6 +1053,16 @@ private:
   TString *memerrmsg;  // Memory error message
   moon_WarnFunction warnf;  // Warning function
   void *ud_warn;  // Auxiliary data for warning function
+  moon_State *threadpool;  // Recycled threads (linked by 'next')
+  int nthreadpool;  // Number of threads in 'threadpool'
+  moon_State *volatile running;  // Thread running now (read by signals)
+  Profiler *profiler;  // Sampling profiler, if any
+  HeapProfiler *heapprofiler;  // Allocation tracker, if any
+  VMStats *vmstats;  // VM counters (only with MOON_USE_VMSTATS)
+  GCMarkPool *markpool;  // Helper threads for parallel marking, if any
+  GCSweepThread *sweepthread;  // Helper thread freeing dead objects, if any
+  ARCQueue *arcqueue;  // Objects whose reference counts dropped to zero
+  lu_byte optlevel;  // optimization level for loaded chunks
   LX mainth;  // Main thread of this state
 
 public:
@@ -1000,6 +1082,35 @@ public:
   inline void* getUdWarn() const noexcept { return ud_warn; }
   inline void setUdWarn(void* uw) noexcept { ud_warn = uw; }
 
+  inline moon_State* getThreadPool() const noexcept { return threadpool; }
+  inline void setThreadPool(moon_State* th) noexcept { threadpool = th; }
+  inline int getNThreadPool() const noexcept { return nthreadpool; }
+  inline void setNThreadPool(int n) noexcept { nthreadpool = n; }
+
+  inline moon_State* getRunning() const noexcept { return running; }
+  inline void setRunning(moon_State* th) noexcept { running = th; }
+
+  inline Profiler* getProfiler() const noexcept { return profiler; }
+  inline void setProfiler(Profiler* p) noexcept { profiler = p; }
+
+  inline HeapProfiler* getHeapProfiler() const noexcept { return heapprofiler; }
+  inline void setHeapProfiler(HeapProfiler* p) noexcept { heapprofiler = p; }
+
+  inline VMStats* getVMStats() const noexcept { return vmstats; }
+  inline void setVMStats(VMStats* s) noexcept { vmstats = s; }
+
+  inline GCMarkPool* getMarkPool() const noexcept { return markpool; }
+  inline void setMarkPool(GCMarkPool* p) noexcept { markpool = p; }
+
+  inline GCSweepThread* getSweepThread() const noexcept { return sweepthread; }
+  inline void setSweepThread(GCSweepThread* s) noexcept { sweepthread = s; }
+
+  inline ARCQueue* getARCQueue() const noexcept { return arcqueue; }
+  inline void setARCQueue(ARCQueue* q) noexcept { arcqueue = q; }
+
+  inline lu_byte getOptLevel() const noexcept { return optlevel; }
+  inline void setOptLevel(lu_byte l) noexcept { optlevel = l; }
+
   inline LX* getMainThread() noexcept { return &mainth; }
   inline const LX* getMainThread() const noexcept { return &mainth; }
 };
@@ -1041,6 +1152,12 @@ public:
   inline void setFrealloc(moon_Alloc f) noexcept { memory.setFrealloc(f); }
   inline void* getUd() const noexcept { return memory.getUd(); }
   inline void setUd(void* u) noexcept { memory.setUd(u); }
+  inline void* getRecycled(int c) const noexcept { return memory.getRecycled(c); }
+  inline void setRecycled(int c, void* b) noexcept { memory.setRecycled(c, b); }
+  inline size_t getNRecycled() const noexcept { return memory.getNRecycled(); }
+  inline void setNRecycled(size_t n) noexcept { memory.setNRecycled(n); }
+  inline lu_byte getRecycle() const noexcept { return memory.getRecycle(); }
+  inline void setRecycle(lu_byte r) noexcept { memory.setRecycle(r); }
 
   // Delegating accessors for GCAccounting
   inline l_mem getGCTotalBytes() const noexcept { return gcAccounting.getTotalBytes(); }
@@ -1061,6 +1178,11 @@ public:
   inline void setGCMajorMinor(l_mem mm) noexcept { gcAccounting.setMajorMinor(mm); }
   inline l_mem& getGCMajorMinorRef() noexcept { return gcAccounting.getMajorMinorRef(); }
 
+  inline l_mem getGCMemLimit() const noexcept { return gcAccounting.getMemLimit(); }
+  inline void setGCMemLimit(l_mem l) noexcept { gcAccounting.setMemLimit(l); }
+  inline l_mem getGCPeak() const noexcept { return gcAccounting.getPeak(); }
+  inline void setGCPeak(l_mem p) noexcept { gcAccounting.setPeak(p); }
+
   // Delegating accessors for GCParameters
   inline lu_byte* getGCParams() noexcept { return gcParams.getParams(); }
   inline const lu_byte* getGCParams() const noexcept { return gcParams.getParams(); }
@@ -1089,6 +1211,9 @@ public:
   inline lu_byte getGCEmergency() const noexcept { return gcParams.getEmergency(); }
   inline void setGCEmergency(lu_byte em) noexcept { gcParams.setEmergency(em); }
 
+  inline lu_byte getGCBgSweep() const noexcept { return gcParams.getBgSweep(); }
+  inline void setGCBgSweep(lu_byte b) noexcept { gcParams.setBgSweep(b); }
+
   // Delegating accessors for GCObjectLists (incremental)
   inline GCObject* getAllGC() const noexcept { return gcLists.getAllGC(); }
   inline void setAllGC(GCObject* gc) noexcept { gcLists.setAllGC(gc); }
@@ -1202,6 +1327,31 @@ public:
   inline void* getUdWarn() const noexcept { return runtime.getUdWarn(); }
   inline void setUdWarn(void* uw) noexcept { runtime.setUdWarn(uw); }
 
+  inline moon_State* getThreadPool() const noexcept { return runtime.getThreadPool(); }
+  inline void setThreadPool(moon_State* th) noexcept { runtime.setThreadPool(th); }
+  inline int getNThreadPool() const noexcept { return runtime.getNThreadPool(); }
+  inline void setNThreadPool(int n) noexcept { runtime.setNThreadPool(n); }
+
+  inline moon_State* getRunning() const noexcept { return runtime.getRunning(); }
+  inline void setRunning(moon_State* th) noexcept { runtime.setRunning(th); }
+
+  inline Profiler* getProfiler() const noexcept { return runtime.getProfiler(); }
+  inline void setProfiler(Profiler* p) noexcept { runtime.setProfiler(p); }
+
+  inline HeapProfiler* getHeapProfiler() const noexcept { return runtime.getHeapProfiler(); }
+  inline void setHeapProfiler(HeapProfiler* p) noexcept { runtime.setHeapProfiler(p); }
+
+  inline VMStats* getVMStats() const noexcept { return runtime.getVMStats(); }
+  inline void setVMStats(VMStats* s) noexcept { runtime.setVMStats(s); }
+  inline GCMarkPool* getMarkPool() const noexcept { return runtime.getMarkPool(); }
+  inline void setMarkPool(GCMarkPool* p) noexcept { runtime.setMarkPool(p); }
+  inline GCSweepThread* getSweepThread() const noexcept { return runtime.getSweepThread(); }
+  inline void setSweepThread(GCSweepThread* s) noexcept { runtime.setSweepThread(s); }
+  inline ARCQueue* getARCQueue() const noexcept { return runtime.getARCQueue(); }
+  inline void setARCQueue(ARCQueue* q) noexcept { runtime.setARCQueue(q); }
+  inline lu_byte getOptLevel() const noexcept { return runtime.getOptLevel(); }
+  inline void setOptLevel(lu_byte l) noexcept { runtime.setOptLevel(l); }
+
   inline LX* getMainThread() noexcept { return runtime.getMainThread(); }
   inline const LX* getMainThread() const noexcept { return runtime.getMainThread(); }
 
@@ -1306,6 +1456,7 @@ inline GCObject* obj2gco(const void* v) noexcept {
 
 MOONI_FUNC void moonE_setdebt (GlobalState *g, l_mem debt);
 MOONI_FUNC void moonE_freethread (moon_State *L, moon_State *L1);
+MOONI_FUNC void moonE_freethreadpool (moon_State *L);
 MOONI_FUNC lu_mem moonE_threadsize (moon_State *L);
 MOONI_FUNC CallInfo *moonE_extendCI (moon_State *L);
 MOONI_FUNC void moonE_shrinkCI (moon_State *L);
@@ -246,17 +246,29 @@ void moonT_adjustvarargs (moon_State *L, int nfixparams, CallInfo *callInfo,
 }
 
 
-void moonT_getvarargs (moon_State *L, CallInfo *callInfo, StkId where, int wanted) {
+/*
+** Copy the extra arguments from the 'first'-th one (counting from 0)
+** on to 'where'. 'wanted' < 0 means all of them, setting 'top'.
+*/
+void moonT_getvarargsfrom (moon_State *L, CallInfo *callInfo, StkId where,
+                           int first, int wanted) {
   int i;
-  int nextra = callInfo->getExtraArgs();
+  int nextra = callInfo->getExtraArgs() - first;  // available from 'first'
+  moon_assert(nextra >= 0);
   if (wanted < 0) {
     wanted = nextra;  // get all extra arguments available
     checkstackp(L, nextra, where);  // ensure stack space
     L->getStackSubsystem().setTopPtr(where + nextra);  // next instruction will need top
   }
+  StkId from = callInfo->funcRef().p - callInfo->getExtraArgs() + first;
   for (i = 0; i < wanted && i < nextra; i++)
-    *s2v(where + i) = *s2v(callInfo->funcRef().p - nextra + i);  /* use operator= */
+    *s2v(where + i) = *s2v(from + i);  /* use operator= */
   for (; i < wanted; i++)  // complete required results with nil
     setnilvalue(s2v(where + i));
 }
 
+
+void moonT_getvarargs (moon_State *L, CallInfo *callInfo, StkId where, int wanted) {
+  moonT_getvarargsfrom(L, callInfo, where, 0, wanted);
+}
+
@@ -111,6 +111,8 @@ MOONI_FUNC void moonT_adjustvarargs (moon_State *L, int nfixparams,
                                    struct CallInfo *callInfo, const Proto *p);
 MOONI_FUNC void moonT_getvarargs (moon_State *L, struct CallInfo *callInfo,
                                               StkId where, int wanted);
+MOONI_FUNC void moonT_getvarargsfrom (moon_State *L, struct CallInfo *callInfo,
+                                      StkId where, int first, int wanted);
 
 
 #endif
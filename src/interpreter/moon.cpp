@@ -29,11 +29,19 @@
 
 #define MOON_INITVARVERSION	MOON_INIT_VAR MOON_VERSUFFIX
 
+#if !defined(MOON_VMSTATS_VAR)
+#define MOON_VMSTATS_VAR	"MOON_VMSTATS"
+#endif
+
 
 static moon_State *globalL = nullptr;
 
 static const char *progname = MOON_PROGNAME;
 
+static const char *profname = nullptr;  // file for option '-p'
+
+static const char *statsname = nullptr;  // file from MOON_VMSTATS
+
 
 #if defined(MOON_USE_POSIX)  // {
 
@@ -80,7 +88,7 @@ static void laction (int i) {
 
 static void print_usage (const char *badoption) {
   moon_writestringerror("%s: ", progname);
-  if (badoption[1] == 'e' || badoption[1] == 'l')
+  if (badoption[1] == 'e' || badoption[1] == 'l' || badoption[1] == 'p')
     moon_writestringerror("'%s' needs argument\n", badoption);
   else
     moon_writestringerror("unrecognized option '%s'\n", badoption);
@@ -91,7 +99,9 @@ static void print_usage (const char *badoption) {
   "  -i        enter interactive mode after executing 'script'\n"
   "  -l mod    require library 'mod' into global 'mod'\n"
   "  -l g=mod  require library 'mod' into global 'g'\n"
+  "  -p file   write a profile of the run to 'file' (folded stacks)\n"
   "  -v        show version information\n"
+  "  -O[n]     optimize loaded chunks at level 'n' (default 2)\n"
   "  -E        ignore environment variables\n"
   "  -W        turn warnings on\n"
   "  --        stop handling options\n"
@@ -270,6 +280,7 @@ static int handle_script (moon_State *L, char **argv) {
 #define has_v		4  // -v
 #define has_e		8  // -e
 #define has_E		16  // -E
+#define has_p		32  // -p
 
 
 /*
@@ -312,6 +323,11 @@ static int collectargs (char **argv, int *first) {
         if (argv[i][2] != '\0')  // extra characters?
           return has_error;  // invalid option
         break;
+      case 'O':
+        if (argv[i][2] != '\0' &&  // level given?
+            !('0' <= argv[i][2] && argv[i][2] <= '9' && argv[i][3] == '\0'))
+          return has_error;  // invalid option
+        break;
       case 'i':
         args |= has_i;  /* (-i implies -v) *//* FALLTHROUGH */
       case 'v':
@@ -321,7 +337,9 @@ static int collectargs (char **argv, int *first) {
         break;
       case 'e':
         args |= has_e;  // FALLTHROUGH
-      case 'l':  // both options need an argument
+      case 'l':  case 'p':  // these options need an argument
+        if (argv[i][1] == 'p')
+          args |= has_p;
         if (argv[i][2] == '\0') {  // no concatenated argument?
           i++;  // try next 'argv'
           if (argv[i] == nullptr || argv[i][0] == '-')
@@ -339,7 +357,7 @@ static int collectargs (char **argv, int *first) {
 
 /*
 ** Processes options 'e' and 'l', which involve running Lua code, and
-** 'W', which also affects the state.
+** 'W' and 'O', which also affect the state.
 ** Returns 0 if some code raises an error.
 */
 static int runargs (moon_State *L, char **argv, int n) {
@@ -360,6 +378,12 @@ static int runargs (moon_State *L, char **argv, int n) {
       case 'W':
         moon_warning(L, "@on", 0);  // warnings on
         break;
+      case 'O':  // optimization level for chunks loaded from now on
+        moon_setoptlevel(L, (argv[i][2] == '\0') ? 2 : argv[i][2] - '0');
+        break;
+      case 'p':  // already handled; skip its argument
+        if (argv[i][2] == '\0') i++;
+        break;
     }
   }
   return 1;
@@ -689,6 +713,144 @@ static void doREPL (moon_State *L) {
 #endif
 
 
+/*
+** Starts the profiler for option '-p' (the last one, if repeated).
+** The profile is written by 'dumpprofile' when the run ends.
+*/
+static void startprofile (moon_State *L, char **argv, int n) {
+  for (int i = 1; i < n; i++) {
+    if (argv[i][1] == 'p') {
+      profname = (argv[i][2] != '\0') ? argv[i] + 2 : argv[++i];
+    }
+    else if ((argv[i][1] == 'e' || argv[i][1] == 'l') && argv[i][2] == '\0')
+      i++;  // skip argument of other options
+  }
+  if (!moon_profstart(L, 0)) {
+    l_message(progname, "cannot start profiler");
+    profname = nullptr;
+  }
+}
+
+
+static int profwriter (moon_State *L, const void *b, size_t size, void *ud) {
+  (void)L;
+  return (fwrite(b, 1, size, static_cast<FILE *>(ud)) != size);
+}
+
+
+static void dumpprofile (moon_State *L) {
+  moon_profstop(L);
+  FILE *f = fopen(profname, "w");
+  int ok = (f != nullptr && moon_profdump(L, profwriter, f, 0) == 0);
+  if (f != nullptr && fclose(f) != 0)
+    ok = 0;
+  if (!ok) {
+    moon_writestringerror("%s: ", progname);
+    moon_writestringerror("cannot write profile to '%s'\n", profname);
+  }
+}
+
+
+/*
+** Writes the VM counters (see 'moon_vmstats') as JSON. Tables with
+** a positive length are written as arrays, others as objects.
+*/
+static void writejson (moon_State *L, FILE *f, int idx) {
+  switch (moon_type(L, idx)) {
+    case MOON_TTABLE: {
+      moon_Unsigned n = moon_rawlen(L, idx);
+      if (n > 0) {
+        fputc('[', f);
+        for (moon_Unsigned i = 1; i <= n; i++) {
+          if (i > 1) fputc(',', f);
+          moon_rawgeti(L, idx, static_cast<moon_Integer>(i));
+          writejson(L, f, moon_gettop(L));
+          moon_pop(L, 1);
+        }
+        fputc(']', f);
+      }
+      else {
+        int first = 1;
+        fputc('{', f);
+        moon_pushnil(L);
+        while (moon_next(L, idx)) {
+          if (!first) fputc(',', f);
+          first = 0;
+          moon_pushvalue(L, -2);  // copy key ('tostring' would change it)
+          writejson(L, f, moon_gettop(L));
+          fputc(':', f);
+          writejson(L, f, moon_gettop(L) - 1);
+          moon_pop(L, 2);  // pop value and key copy
+        }
+        fputc('}', f);
+      }
+      break;
+    }
+    case MOON_TSTRING: {
+      size_t l;
+      const char *s = moon_tolstring(L, idx, &l);
+      fputc('"', f);
+      for (size_t i = 0; i < l; i++) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c == '"' || c == '\\')
+          fprintf(f, "\\%c", c);
+        else if (c < 0x20)
+          fprintf(f, "\\u%04x", c);
+        else
+          fputc(c, f);
+      }
+      fputc('"', f);
+      break;
+    }
+    case MOON_TNUMBER: {
+      moon_pushvalue(L, idx);
+      fputs(moon_tostring(L, -1), f);
+      moon_pop(L, 1);
+      break;
+    }
+    case MOON_TBOOLEAN:
+      fputs(moon_toboolean(L, idx) ? "true" : "false", f);
+      break;
+    default:
+      fputs("null", f);
+      break;
+  }
+}
+
+
+static int dumpstats (moon_State *L) {
+  FILE *f = static_cast<FILE *>(moon_touserdata(L, 1));
+  if (moon_vmstats(L, 0)) {
+    writejson(L, f, moon_gettop(L));
+    fputc('\n', f);
+  }
+  else
+    fputs("null\n", f);  // counters not compiled in
+  return 0;
+}
+
+
+/*
+** Writes the VM counters to the file named by MOON_VMSTATS, if the
+** interpreter was built with them.
+*/
+static void dumpvmstats (moon_State *L) {
+  FILE *f = fopen(statsname, "w");
+  int ok = (f != nullptr);
+  if (ok) {
+    moon_pushcfunction(L, dumpstats);
+    moon_pushlightuserdata(L, f);
+    ok = (moon_pcall(L, 1, 0, 0) == MOON_OK);
+    if (fclose(f) != 0)
+      ok = 0;
+  }
+  if (!ok) {
+    moon_writestringerror("%s: ", progname);
+    moon_writestringerror("cannot write VM statistics to '%s'\n", statsname);
+  }
+}
+
+
 /*
 ** Main body of stand-alone interpreter (to be called in protected mode).
 ** Reads the options and handles them all.
@@ -715,9 +877,12 @@ static int pmain (moon_State *L) {
   moon_gc(L, MOON_GCRESTART);  // start GC...
   moon_gc(L, MOON_GCGEN);  // ...in generational mode
   if (!(args & has_E)) {  // no option '-E'?
+    statsname = getenv(MOON_VMSTATS_VAR);
     if (handle_luainit(L) != MOON_OK)  // run MOON_INIT
       return 0;  // error running MOON_INIT
   }
+  if (args & has_p)  // option '-p'?
+    startprofile(L, argv, optlim);
   if (!runargs(L, argv, optlim))  // execute arguments -e and -l
     return 0;  // something failed
   if (script > 0) {  // execute main script (if there is one)
@@ -753,6 +918,10 @@ int main (int argc, char **argv) {
   status = moon_pcall(L, 2, 1, 0);  // do the call
   result = moon_toboolean(L, -1);  // get result
   report(L, status);
+  if (profname != nullptr)  // was profiling?
+    dumpprofile(L);
+  if (statsname != nullptr && *statsname != '\0')
+    dumpvmstats(L);
   moon_close(L);
   return (result && status == MOON_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
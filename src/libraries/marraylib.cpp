@@ -0,0 +1,760 @@
+/*
+** Array Library
+** Contiguous arrays of machine numbers with bulk operations.
+** See Copyright Notice in lua.h
+*/
+
+#define MOON_LIB
+
+#include "mprefix.h"
+
+
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "moon.h"
+
+#include "mauxlib.h"
+#include "moonlib.h"
+#include "mlimits.h"
+
+
+#define ARRAY		"array.Array"
+
+
+/*
+** {======================================================
+** Arrays
+** An array keeps its elements right after its header or, for arrays
+** created from a string, inside that string (which the userdata keeps
+** alive as its user value). Those arrays are read-only.
+** =======================================================
+*/
+
+enum ElemType { AT_DOUBLE, AT_FLOAT, AT_INT64, AT_INT32 };
+
+static const char *const typenames[] = {
+  "double", "float", "int64", "int32", nullptr
+};
+
+static const size_t typesizes[] = {
+  sizeof(double), sizeof(float), sizeof(int64_t), sizeof(int32_t)
+};
+
+
+struct Array {
+  char *data;  // elements
+  size_t n;  // number of elements
+  lu_byte type;  // an ElemType
+  lu_byte readonly;
+};
+
+
+template <typename T> static T *elems (Array *a) {
+  return reinterpret_cast<T *>(a->data);
+}
+
+
+static Array *checkarray (moon_State *L, int arg) {
+  return static_cast<Array *>(moonL_checkudata(L, arg, ARRAY));
+}
+
+
+static Array *checkwritable (moon_State *L, int arg) {
+  Array *a = checkarray(L, arg);
+  if (a->readonly)
+    moonL_error(L, "array is read-only");
+  return a;
+}
+
+
+static Array *newarray (moon_State *L, int type, size_t n) {
+  size_t size = typesizes[type];
+  if (n > (MAX_SIZE - sizeof(Array)) / size)
+    moonL_error(L, "array too large");
+  Array *a = static_cast<Array *>(
+               moon_newuserdatauv(L, sizeof(Array) + n * size, 0));
+  a->data = reinterpret_cast<char *>(a + 1);
+  a->n = n;
+  a->type = cast_byte(type);
+  a->readonly = 0;
+  moonL_setmetatable(L, ARRAY);
+  return a;
+}
+
+
+static size_t checksize (moon_State *L, int arg) {
+  moon_Integer n = moonL_checkinteger(L, arg);
+  moonL_argcheck(L, 0 <= n, arg, "size out of range");
+  return static_cast<size_t>(n);
+}
+
+
+static int checktype (moon_State *L, int arg) {
+  return moonL_checkoption(L, arg, nullptr, typenames);
+}
+
+
+static bool isint (const Array *a) {
+  return (a->type == AT_INT64 || a->type == AT_INT32);
+}
+
+
+/*
+** Convert the value at 'arg' to an element of 'a'. Integer elements
+** must have an exact representation.
+*/
+static moon_Integer checkint (moon_State *L, const Array *a, int arg) {
+  moon_Integer i = moonL_checkinteger(L, arg);
+  if (a->type == AT_INT32)
+    moonL_argcheck(L, INT32_MIN <= i && i <= INT32_MAX, arg,
+                      "value out of range for int32");
+  return i;
+}
+
+
+static void setelem (moon_State *L, Array *a, size_t i, int arg) {
+  switch (a->type) {
+    case AT_DOUBLE: elems<double>(a)[i] = moonL_checknumber(L, arg); break;
+    case AT_FLOAT:
+      elems<float>(a)[i] = static_cast<float>(moonL_checknumber(L, arg));
+      break;
+    case AT_INT64: elems<int64_t>(a)[i] = checkint(L, a, arg); break;
+    default:
+      elems<int32_t>(a)[i] = static_cast<int32_t>(checkint(L, a, arg));
+      break;
+  }
+}
+
+
+static void pushelem (moon_State *L, Array *a, size_t i) {
+  switch (a->type) {
+    case AT_DOUBLE: moon_pushnumber(L, elems<double>(a)[i]); break;
+    case AT_FLOAT: moon_pushnumber(L, elems<float>(a)[i]); break;
+    case AT_INT64:
+      moon_pushinteger(L, static_cast<moon_Integer>(elems<int64_t>(a)[i]));
+      break;
+    default: moon_pushinteger(L, elems<int32_t>(a)[i]); break;
+  }
+}
+
+// }======================================================
+
+
+/*
+** {======================================================
+** Kernels
+** Element-wise loops are plain loops over contiguous memory, which the
+** compiler vectorizes. Floating-point reductions cannot be reordered
+** by the compiler, so they use explicit vector code when available
+** (as well as several accumulators otherwise); their results may
+** differ in the last bits from a sequential sum.
+** =======================================================
+*/
+
+// integer arithmetic wraps around, as in Lua
+template <typename T> static T wrapadd (T x, T y) {
+  using U = std::make_unsigned_t<T>;
+  return static_cast<T>(static_cast<U>(x) + static_cast<U>(y));
+}
+
+template <typename T> static T wrapmul (T x, T y) {
+  using U = std::make_unsigned_t<T>;
+  return static_cast<T>(static_cast<U>(x) * static_cast<U>(y));
+}
+
+static double wrapadd (double x, double y) { return x + y; }
+static float wrapadd (float x, float y) { return x + y; }
+static double wrapmul (double x, double y) { return x * y; }
+static float wrapmul (float x, float y) { return x * y; }
+
+
+template <typename T> static void addv (T *a, const T *b, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] = wrapadd(a[i], b[i]);
+}
+
+template <typename T> static void adds (T *a, T s, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] = wrapadd(a[i], s);
+}
+
+template <typename T> static void mulv (T *a, const T *b, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] = wrapmul(a[i], b[i]);
+}
+
+template <typename T> static void muls (T *a, T s, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] = wrapmul(a[i], s);
+}
+
+template <typename T> static void axpy (T *a, T alpha, const T *x, size_t n) {
+  for (size_t i = 0; i < n; i++) a[i] = wrapadd(a[i], wrapmul(alpha, x[i]));
+}
+
+
+// sum and dot product of integers (in wrapping 64-bit arithmetic)
+template <typename T> static moon_Integer isum (const T *a, size_t n) {
+  uint64_t s = 0;
+  for (size_t i = 0; i < n; i++) s += static_cast<uint64_t>(a[i]);
+  return l_castU2S(static_cast<moon_Unsigned>(s));
+}
+
+template <typename T> static moon_Integer idot (const T *a, const T *b,
+                                                size_t n) {
+  uint64_t s = 0;
+  for (size_t i = 0; i < n; i++)
+    s += static_cast<uint64_t>(a[i]) * static_cast<uint64_t>(b[i]);
+  return l_castU2S(static_cast<moon_Unsigned>(s));
+}
+
+
+// sum and dot product of floats, accumulated in doubles
+template <typename T> static double fsum (const T *a, size_t n) {
+  double s[4] = {0, 0, 0, 0};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    for (int k = 0; k < 4; k++) s[k] += static_cast<double>(a[i + k]);
+  }
+  for (; i < n; i++) s[0] += static_cast<double>(a[i]);
+  return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+template <typename T> static double fdot (const T *a, const T *b, size_t n) {
+  double s[4] = {0, 0, 0, 0};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    for (int k = 0; k < 4; k++)
+      s[k] += static_cast<double>(a[i + k]) * static_cast<double>(b[i + k]);
+  }
+  for (; i < n; i++)
+    s[0] += static_cast<double>(a[i]) * static_cast<double>(b[i]);
+  return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+#if defined(__SSE2__)
+
+template <> double fsum<double> (const double *a, size_t n) {
+  __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+    s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+  }
+  double r[2];
+  _mm_storeu_pd(r, _mm_add_pd(s0, s1));
+  double s = r[0] + r[1];
+  for (; i < n; i++) s += a[i];
+  return s;
+}
+
+template <> double fdot<double> (const double *a, const double *b, size_t n) {
+  __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2),
+                                   _mm_loadu_pd(b + i + 2)));
+  }
+  double r[2];
+  _mm_storeu_pd(r, _mm_add_pd(s0, s1));
+  double s = r[0] + r[1];
+  for (; i < n; i++) s += a[i] * b[i];
+  return s;
+}
+
+#endif
+
+
+/*
+** Minimum ('ismax' false) or maximum of the 'n' > 0 elements in 'a'.
+** (x < m ? x : m) is the scalar form of _mm_min_pd(x, m).
+*/
+template <typename T> static T extremum (const T *a, size_t n, bool ismax) {
+  T m = a[0];
+  if (ismax) {
+    for (size_t i = 1; i < n; i++) m = (m < a[i]) ? a[i] : m;
+  }
+  else {
+    for (size_t i = 1; i < n; i++) m = (a[i] < m) ? a[i] : m;
+  }
+  return m;
+}
+
+#if defined(__SSE2__)
+
+template <> double extremum<double> (const double *a, size_t n, bool ismax) {
+  size_t i = 0;
+  double m = a[0];
+  if (n >= 4) {
+    __m128d m0 = _mm_loadu_pd(a), m1 = _mm_loadu_pd(a + 2);
+    for (i = 4; i + 4 <= n; i += 4) {
+      __m128d x0 = _mm_loadu_pd(a + i), x1 = _mm_loadu_pd(a + i + 2);
+      if (ismax) {
+        m0 = _mm_max_pd(x0, m0); m1 = _mm_max_pd(x1, m1);
+      }
+      else {
+        m0 = _mm_min_pd(x0, m0); m1 = _mm_min_pd(x1, m1);
+      }
+    }
+    double r[4];
+    _mm_storeu_pd(r, m0);
+    _mm_storeu_pd(r + 2, m1);
+    m = r[0];
+    for (int k = 1; k < 4; k++)
+      m = ismax ? ((m < r[k]) ? r[k] : m) : ((r[k] < m) ? r[k] : m);
+  }
+  for (; i < n; i++)
+    m = ismax ? ((m < a[i]) ? a[i] : m) : ((a[i] < m) ? a[i] : m);
+  return m;
+}
+
+#endif
+
+// }======================================================
+
+
+/*
+** {======================================================
+** Lua interface
+** =======================================================
+*/
+
+/*
+** Call 'f' with the elements of 'a' as a pointer to their real type.
+*/
+template <typename F> static void visit (Array *a, F f) {
+  switch (a->type) {
+    case AT_DOUBLE: f(elems<double>(a)); break;
+    case AT_FLOAT: f(elems<float>(a)); break;
+    case AT_INT64: f(elems<int64_t>(a)); break;
+    default: f(elems<int32_t>(a)); break;
+  }
+}
+
+template <typename P>
+using ElemOf = std::remove_pointer_t<P>;
+
+
+/*
+** Set all elements of 'a' to the value at 'arg'.
+*/
+static void fill (moon_State *L, Array *a, int arg) {
+  if (a->n == 0) {  // still check the value
+    if (isint(a)) checkint(L, a, arg);
+    else moonL_checknumber(L, arg);
+    return;
+  }
+  setelem(L, a, 0, arg);
+  visit(a, [a](auto *p) {
+    auto v = p[0];
+    for (size_t i = 1; i < a->n; i++) p[i] = v;
+  });
+}
+
+
+/*
+** Check that argument 'arg' is an array with the same type and size
+** as 'a'.
+*/
+static Array *checkpeer (moon_State *L, const Array *a, int arg) {
+  Array *b = checkarray(L, arg);
+  moonL_argcheck(L, b->type == a->type, arg, "arrays have different types");
+  moonL_argcheck(L, b->n == a->n, arg, "arrays have different sizes");
+  return b;
+}
+
+
+static int arr_new (moon_State *L) {
+  int type = checktype(L, 1);
+  size_t n = checksize(L, 2);
+  bool zero = moon_isnoneornil(L, 3);
+  moon_settop(L, 3);
+  Array *a = newarray(L, type, n);
+  if (zero)
+    std::memset(a->data, 0, n * typesizes[type]);
+  else
+    fill(L, a, 3);
+  return 1;
+}
+
+
+static int arr_fromtable (moon_State *L) {
+  int type = checktype(L, 1);
+  moonL_checktype(L, 2, MOON_TTABLE);
+  size_t n = static_cast<size_t>(moonL_len(L, 2));
+  Array *a = newarray(L, type, n);
+  for (size_t i = 0; i < n; i++) {
+    moon_geti(L, 2, static_cast<moon_Integer>(i) + 1);
+    setelem(L, a, i, -1);
+    moon_pop(L, 1);
+  }
+  return 1;
+}
+
+
+/*
+** Array over the bytes [i, j] of string 's', in native byte order.
+** The array uses the string's memory when it is properly aligned.
+*/
+static int arr_fromstring (moon_State *L) {
+  int type = checktype(L, 1);
+  size_t len;
+  const char *s = moonL_checklstring(L, 2, &len);
+  moon_Integer i = moonL_optinteger(L, 3, 1);
+  moon_Integer j = moonL_optinteger(L, 4, static_cast<moon_Integer>(len));
+  size_t size = typesizes[type];
+  moonL_argcheck(L, 1 <= i && i <= static_cast<moon_Integer>(len) + 1, 3,
+                    "initial position out of bounds");
+  moonL_argcheck(L, j <= static_cast<moon_Integer>(len), 4,
+                    "final position out of bounds");
+  size_t nbytes = (j >= i) ? static_cast<size_t>(j - i) + 1 : 0;
+  moonL_argcheck(L, nbytes % size == 0, 2,
+                    "length is not a multiple of the element size");
+  const char *p = s + (i - 1);
+  Array *a;
+  if (reinterpret_cast<uintptr_t>(p) % size == 0) {
+    a = static_cast<Array *>(moon_newuserdatauv(L, sizeof(Array), 1));
+    a->data = const_cast<char *>(p);
+    a->n = nbytes / size;
+    a->type = cast_byte(type);
+    moonL_setmetatable(L, ARRAY);
+    moon_pushvalue(L, 2);
+    moon_setiuservalue(L, -2, 1);  // keep the string alive
+  }
+  else {  // misaligned; copy it
+    a = newarray(L, type, nbytes / size);
+    std::memcpy(a->data, p, nbytes);
+  }
+  a->readonly = 1;
+  return 1;
+}
+
+
+static int arr_index (moon_State *L) {
+  Array *a = checkarray(L, 1);
+  int isnum;
+  moon_Integer i = moon_tointegerx(L, 2, &isnum);
+  if (isnum) {  // element access?
+    if (l_castS2U(i) - 1u < a->n)  // 1 <= i <= n?
+      pushelem(L, a, static_cast<size_t>(i - 1));
+    else
+      moon_pushnil(L);
+  }
+  else {  // look for a method
+    moon_pushvalue(L, 2);
+    moon_rawget(L, moon_upvalueindex(1));
+  }
+  return 1;
+}
+
+
+static int arr_newindex (moon_State *L) {
+  Array *a = checkwritable(L, 1);
+  int isnum;
+  moon_Integer i = moon_tointegerx(L, 2, &isnum);
+  moonL_argcheck(L, isnum && l_castS2U(i) - 1u < a->n, 2,
+                    "index out of bounds");
+  setelem(L, a, static_cast<size_t>(i - 1), 3);
+  return 0;
+}
+
+
+static int arr_len (moon_State *L) {
+  moon_pushinteger(L, static_cast<moon_Integer>(checkarray(L, 1)->n));
+  return 1;
+}
+
+
+static int arr_tostr (moon_State *L) {
+  Array *a = checkarray(L, 1);
+  moon_pushfstring(L, "array<%s>[%I]%s: %p", typenames[a->type],
+                      static_cast<moon_Integer>(a->n),
+                      a->readonly ? " (read-only)" : "",
+                      static_cast<void *>(a));
+  return 1;
+}
+
+
+static int arr_type (moon_State *L) {
+  moon_pushstring(L, typenames[checkarray(L, 1)->type]);
+  return 1;
+}
+
+
+/*
+** Common part of 'add' and 'mul': the operand is an array or a number.
+*/
+static int arith (moon_State *L, bool isadd) {
+  Array *a = checkwritable(L, 1);
+  if (moon_isuserdata(L, 2)) {
+    Array *b = checkpeer(L, a, 2);
+    visit(a, [a, b, isadd](auto *p) {
+      const auto *q = reinterpret_cast<decltype(p)>(b->data);
+      if (isadd) addv(p, q, a->n);
+      else mulv(p, q, a->n);
+    });
+  }
+  else {
+    moon_Integer i = 0;
+    moon_Number x = 0;
+    if (isint(a)) i = checkint(L, a, 2);
+    else x = moonL_checknumber(L, 2);
+    visit(a, [a, i, x, isadd](auto *p) {
+      using T = ElemOf<decltype(p)>;
+      T s = std::is_integral_v<T> ? static_cast<T>(i) : static_cast<T>(x);
+      if (isadd) adds(p, s, a->n);
+      else muls(p, s, a->n);
+    });
+  }
+  moon_settop(L, 1);
+  return 1;
+}
+
+
+static int arr_add (moon_State *L) {
+  return arith(L, true);
+}
+
+
+static int arr_mul (moon_State *L) {
+  return arith(L, false);
+}
+
+
+// a:axpy(alpha, x): a = a + alpha * x
+static int arr_axpy (moon_State *L) {
+  Array *a = checkwritable(L, 1);
+  Array *x = checkpeer(L, a, 3);
+  moon_Integer i = 0;
+  moon_Number f = 0;
+  if (isint(a)) i = checkint(L, a, 2);
+  else f = moonL_checknumber(L, 2);
+  visit(a, [a, x, i, f](auto *p) {
+    using T = ElemOf<decltype(p)>;
+    T alpha = std::is_integral_v<T> ? static_cast<T>(i) : static_cast<T>(f);
+    axpy(p, alpha, reinterpret_cast<const T *>(x->data), a->n);
+  });
+  moon_settop(L, 1);
+  return 1;
+}
+
+
+static int arr_sum (moon_State *L) {
+  Array *a = checkarray(L, 1);
+  switch (a->type) {
+    case AT_DOUBLE: moon_pushnumber(L, fsum(elems<double>(a), a->n)); break;
+    case AT_FLOAT: moon_pushnumber(L, fsum(elems<float>(a), a->n)); break;
+    case AT_INT64: moon_pushinteger(L, isum(elems<int64_t>(a), a->n)); break;
+    default: moon_pushinteger(L, isum(elems<int32_t>(a), a->n)); break;
+  }
+  return 1;
+}
+
+
+static int arr_dot (moon_State *L) {
+  Array *a = checkarray(L, 1);
+  Array *b = checkpeer(L, a, 2);
+  switch (a->type) {
+    case AT_DOUBLE:
+      moon_pushnumber(L, fdot(elems<double>(a), elems<double>(b), a->n));
+      break;
+    case AT_FLOAT:
+      moon_pushnumber(L, fdot(elems<float>(a), elems<float>(b), a->n));
+      break;
+    case AT_INT64:
+      moon_pushinteger(L, idot(elems<int64_t>(a), elems<int64_t>(b), a->n));
+      break;
+    default:
+      moon_pushinteger(L, idot(elems<int32_t>(a), elems<int32_t>(b), a->n));
+      break;
+  }
+  return 1;
+}
+
+
+static int minmax (moon_State *L, bool ismax) {
+  Array *a = checkarray(L, 1);
+  if (a->n == 0)
+    moonL_pushfail(L);
+  else {
+    switch (a->type) {
+      case AT_DOUBLE:
+        moon_pushnumber(L, extremum(elems<double>(a), a->n, ismax));
+        break;
+      case AT_FLOAT:
+        moon_pushnumber(L, extremum(elems<float>(a), a->n, ismax));
+        break;
+      case AT_INT64:
+        moon_pushinteger(L, static_cast<moon_Integer>(
+                              extremum(elems<int64_t>(a), a->n, ismax)));
+        break;
+      default:
+        moon_pushinteger(L, extremum(elems<int32_t>(a), a->n, ismax));
+        break;
+    }
+  }
+  return 1;
+}
+
+
+static int arr_min (moon_State *L) {
+  return minmax(L, false);
+}
+
+
+static int arr_max (moon_State *L) {
+  return minmax(L, true);
+}
+
+
+enum MapOp { M_ABS, M_NEG, M_SQRT, M_EXP, M_LOG, M_FLOOR, M_CEIL, M_SIN, M_COS };
+
+static const char *const mapnames[] = {
+  "abs", "neg", "sqrt", "exp", "log", "floor", "ceil", "sin", "cos", nullptr
+};
+
+
+template <typename T> static void mapfloat (T *a, size_t n, int op) {
+  switch (op) {
+    case M_ABS: for (size_t i = 0; i < n; i++) a[i] = std::fabs(a[i]); break;
+    case M_NEG: for (size_t i = 0; i < n; i++) a[i] = -a[i]; break;
+    case M_SQRT: for (size_t i = 0; i < n; i++) a[i] = std::sqrt(a[i]); break;
+    case M_EXP: for (size_t i = 0; i < n; i++) a[i] = std::exp(a[i]); break;
+    case M_LOG: for (size_t i = 0; i < n; i++) a[i] = std::log(a[i]); break;
+    case M_FLOOR: for (size_t i = 0; i < n; i++) a[i] = std::floor(a[i]); break;
+    case M_CEIL: for (size_t i = 0; i < n; i++) a[i] = std::ceil(a[i]); break;
+    case M_SIN: for (size_t i = 0; i < n; i++) a[i] = std::sin(a[i]); break;
+    default: for (size_t i = 0; i < n; i++) a[i] = std::cos(a[i]); break;
+  }
+}
+
+
+template <typename T> static void mapint (T *a, size_t n, int op) {
+  using U = std::make_unsigned_t<T>;
+  switch (op) {
+    case M_ABS:  // (abs of the minimum integer wraps around)
+      for (size_t i = 0; i < n; i++)
+        a[i] = (a[i] < 0) ? static_cast<T>(0u - static_cast<U>(a[i])) : a[i];
+      break;
+    case M_NEG:
+      for (size_t i = 0; i < n; i++)
+        a[i] = static_cast<T>(0u - static_cast<U>(a[i]));
+      break;
+    default:  // floor and ceil do not change integers
+      break;
+  }
+}
+
+
+static int arr_map (moon_State *L) {
+  Array *a = checkwritable(L, 1);
+  int op = moonL_checkoption(L, 2, nullptr, mapnames);
+  switch (a->type) {
+    case AT_DOUBLE: mapfloat(elems<double>(a), a->n, op); break;
+    case AT_FLOAT: mapfloat(elems<float>(a), a->n, op); break;
+    default:
+      moonL_argcheck(L, op <= M_NEG || op == M_FLOOR || op == M_CEIL, 2,
+                        "operation not valid for integer arrays");
+      if (a->type == AT_INT64) mapint(elems<int64_t>(a), a->n, op);
+      else mapint(elems<int32_t>(a), a->n, op);
+      break;
+  }
+  moon_settop(L, 1);
+  return 1;
+}
+
+
+static int arr_fill (moon_State *L) {
+  fill(L, checkwritable(L, 1), 2);
+  moon_settop(L, 1);
+  return 1;
+}
+
+
+static int arr_copy (moon_State *L) {
+  Array *a = checkarray(L, 1);
+  Array *c = newarray(L, a->type, a->n);
+  std::memcpy(c->data, a->data, a->n * typesizes[a->type]);
+  return 1;
+}
+
+
+static int arr_totable (moon_State *L) {
+  Array *a = checkarray(L, 1);
+  moonL_argcheck(L, a->n < static_cast<size_t>(INT_MAX), 1, "array too large");
+  moon_createtable(L, static_cast<int>(a->n), 0);
+  for (size_t i = 0; i < a->n; i++) {
+    pushelem(L, a, i);
+    moon_rawseti(L, -2, static_cast<moon_Integer>(i) + 1);
+  }
+  return 1;
+}
+
+
+// the elements as a string, in native byte order
+static int arr_tostring (moon_State *L) {
+  Array *a = checkarray(L, 1);
+  moon_pushlstring(L, a->data, a->n * typesizes[a->type]);
+  return 1;
+}
+
+
+static const moonL_Reg arr_funcs[] = {
+  {"new", arr_new},
+  {"fromtable", arr_fromtable},
+  {"fromstring", arr_fromstring},
+  {nullptr, nullptr}
+};
+
+
+static const moonL_Reg arr_meth[] = {
+  {"type", arr_type},
+  {"add", arr_add},
+  {"mul", arr_mul},
+  {"axpy", arr_axpy},
+  {"sum", arr_sum},
+  {"dot", arr_dot},
+  {"min", arr_min},
+  {"max", arr_max},
+  {"map", arr_map},
+  {"fill", arr_fill},
+  {"copy", arr_copy},
+  {"totable", arr_totable},
+  {"tostring", arr_tostring},
+  {nullptr, nullptr}
+};
+
+
+static const moonL_Reg arr_metameth[] = {
+  {"__newindex", arr_newindex},
+  {"__len", arr_len},
+  {"__tostring", arr_tostr},
+  {nullptr, nullptr}
+};
+
+
+static void createmeta (moon_State *L) {
+  moonL_newmetatable(L, ARRAY);
+  moonL_setfuncs(L, arr_metameth, 0);  // add metamethods to new metatable
+  moon_pushboolean(L, 0);  // arrays point to their own memory or strings,
+  moon_setfield(L, -2, "__clone");  // so 'moon_clonestate' cannot copy them
+  moonL_newlibtable(L, arr_meth);  // create method table
+  moonL_setfuncs(L, arr_meth, 0);  // add methods to method table
+  moon_pushcclosure(L, arr_index, 1);  // methods are an upvalue of __index
+  moon_setfield(L, -2, "__index");
+  moon_pop(L, 1);  // pop metatable
+}
+
+
+MOONMOD_API int moonopen_array (moon_State *L) {
+  createmeta(L);
+  moonL_newlib(L, arr_funcs);
+  return 1;
+}
+
+// }======================================================
@@ -18,6 +18,7 @@
 #include "mauxlib.h"
 #include "moonlib.h"
 #include "mlimits.h"
+#include "mvm.h"
 
 
 static int moonB_print (moon_State *L) {
@@ -260,7 +261,11 @@ static int moonB_type (moon_State *L) {
 }
 
 
-static int moonB_next (moon_State *L) {
+/*
+** Not static: the VM runs generic 'for' loops over this function
+** inline (OP_TFORCALL), so it must keep its behavior in sync.
+*/
+int moonB_next (moon_State *L) {
   moonL_checktype(L, 1, MOON_TTABLE);
   moon_settop(L, 2);  // create a 2nd argument if there isn't one
   if (moon_next(L, 1))
@@ -293,9 +298,10 @@ static int moonB_pairs (moon_State *L) {
 
 
 /*
-** Traversal function for 'ipairs'
+** Traversal function for 'ipairs'. Not static: the VM runs generic
+** 'for' loops over this function inline (OP_TFORCALL).
 */
-static int ipairsaux (moon_State *L) {
+int moonB_ipairsaux (moon_State *L) {
   moon_Integer i = moonL_checkinteger(L, 2);
   i = moonL_intop(+, i, 1);
   moon_pushinteger(L, i);
@@ -309,7 +315,7 @@ static int ipairsaux (moon_State *L) {
 */
 static int moonB_ipairs (moon_State *L) {
   moonL_checkany(L, 1);
-  moon_pushcfunction(L, ipairsaux);  // iteration function
+  moon_pushcfunction(L, moonB_ipairsaux);  // iteration function
   moon_pushvalue(L, 1);  // state
   moon_pushinteger(L, 0);  // initial value
   return 3;
@@ -439,7 +445,11 @@ static int moonB_assert (moon_State *L) {
 }
 
 
-static int moonB_select (moon_State *L) {
+/*
+** Not static: the VM runs 'select(n, ...)' over the varargs of a Lua
+** function without calling it (OP_VARARG).
+*/
+int moonB_select (moon_State *L) {
   int n = moon_gettop(L);
   if (moon_type(L, 1) == MOON_TSTRING && *moon_tostring(L, 1) == '#') {
     moon_pushinteger(L, n-1);
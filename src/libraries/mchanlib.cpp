@@ -0,0 +1,417 @@
+/*
+** Channel Library
+** Named message queues shared by independent states (and threads).
+** See Copyright Notice in lua.h
+*/
+
+#define MOON_LIB
+
+#include "mprefix.h"
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "moon.h"
+
+#include "mauxlib.h"
+#include "moonlib.h"
+#include "mlimits.h"
+
+
+#define CHANNEL		"channel.Channel"
+
+
+// default and maximum number of messages buffered in a channel
+#if !defined(MOONI_CHANCAPACITY)
+#define MOONI_CHANCAPACITY	64
+#endif
+
+#if !defined(MOONI_MAXCHANCAPACITY)
+#define MOONI_MAXCHANCAPACITY	(1 << 20)
+#endif
+
+// attempts before a blocked sender/receiver goes to sleep
+#if !defined(MOONI_CHANSPIN)
+#define MOONI_CHANSPIN		64
+#endif
+
+
+/*
+** {======================================================
+** Ring buffer
+** Bounded multi-producer/multi-consumer queue of packets. Each slot
+** carries a sequence number telling whether it is ready to be written
+** (seq == pos) or read (seq == pos + 1), so producers and consumers
+** only contend on their own index and never take a lock.
+** =======================================================
+*/
+
+class Ring {
+private:
+  struct Slot {
+    std::atomic<size_t> seq;
+    moon_Packet *p;
+  };
+
+  std::unique_ptr<Slot[]> slots;
+  size_t mask;  // capacity - 1 (capacity is a power of 2)
+  alignas(64) std::atomic<size_t> head{0};  // next position to write
+  alignas(64) std::atomic<size_t> tail{0};  // next position to read
+
+  static std::ptrdiff_t diff (size_t a, size_t b) noexcept {
+    return static_cast<std::ptrdiff_t>(a - b);
+  }
+
+public:
+  explicit Ring (size_t capacity)
+    : slots(new Slot[capacity]), mask(capacity - 1) {
+    for (size_t i = 0; i < capacity; i++) {
+      slots[i].seq.store(i, std::memory_order_relaxed);
+      slots[i].p = nullptr;
+    }
+  }
+
+  size_t capacity () const noexcept { return mask + 1; }
+
+  // approximate number of packets in the buffer
+  size_t count () const noexcept {
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_relaxed);
+    return (h > t) ? h - t : 0;
+  }
+
+  bool push (moon_Packet *p) noexcept {
+    size_t pos = head.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot &s = slots[pos & mask];
+      std::ptrdiff_t d = diff(s.seq.load(std::memory_order_acquire), pos);
+      if (d == 0) {  // slot free?
+        if (head.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          s.p = p;
+          s.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (d < 0)  // buffer full
+        return false;
+      else  // another producer took this slot
+        pos = head.load(std::memory_order_relaxed);
+    }
+  }
+
+  bool pop (moon_Packet *&p) noexcept {
+    size_t pos = tail.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot &s = slots[pos & mask];
+      std::ptrdiff_t d = diff(s.seq.load(std::memory_order_acquire), pos + 1);
+      if (d == 0) {  // slot filled?
+        if (tail.compare_exchange_weak(pos, pos + 1,
+                                       std::memory_order_relaxed)) {
+          p = s.p;
+          s.seq.store(pos + mask + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (d < 0)  // buffer empty
+        return false;
+      else  // another consumer took this slot
+        pos = tail.load(std::memory_order_relaxed);
+    }
+  }
+};
+
+// }======================================================
+
+
+/*
+** {======================================================
+** Channels
+** =======================================================
+*/
+
+class Channel {
+private:
+  Ring ring;
+  std::atomic<bool> closed{false};
+  std::atomic<int> sleeping{0};  // threads waiting on 'cv'
+  std::mutex mtx;
+  std::condition_variable cv;
+
+  // wake up sleeping threads after a change in the buffer
+  void wakeup () {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lk(mtx);
+      cv.notify_all();
+    }
+  }
+
+  /*
+  ** Retry 'op' until it succeeds or the channel is closed: first spin
+  ** for a while, as the other side is usually about to act, then sleep.
+  */
+  template<typename Op>
+  bool wait (Op op) {
+    for (int i = 0; i < MOONI_CHANSPIN; i++) {
+      if (op()) return true;
+      if (isclosed()) return op();  // last chance
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lk(mtx);
+    sleeping++;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool ok = false;
+    cv.wait(lk, [&] { return (ok = op()) || isclosed(); });
+    sleeping--;
+    return ok;
+  }
+
+public:
+  const std::string name;
+
+  Channel (std::string n, size_t capacity)
+    : ring(capacity), name(std::move(n)) {}
+
+  ~Channel () {
+    moon_Packet *p;
+    while (ring.pop(p))
+      moon_xfreepacket(p);
+  }
+
+  bool isclosed () const noexcept {
+    return closed.load(std::memory_order_acquire);
+  }
+
+  size_t count () const noexcept { return ring.count(); }
+  size_t capacity () const noexcept { return ring.capacity(); }
+
+  bool trysend (moon_Packet *p) {
+    if (isclosed() || !ring.push(p)) return false;
+    wakeup();
+    return true;
+  }
+
+  // returns false if channel is (or gets) closed
+  bool send (moon_Packet *p) {
+    if (!wait([this, p] { return !isclosed() && ring.push(p); }))
+      return false;
+    wakeup();
+    return true;
+  }
+
+  bool tryreceive (moon_Packet *&p) {
+    if (!ring.pop(p)) return false;
+    wakeup();
+    return true;
+  }
+
+  // returns false if channel is closed and empty
+  bool receive (moon_Packet *&p) {
+    if (!wait([this, &p] { return ring.pop(p); }))
+      return false;
+    wakeup();
+    return true;
+  }
+
+  void close () {
+    closed.store(true, std::memory_order_release);
+    std::lock_guard<std::mutex> lk(mtx);
+    cv.notify_all();
+  }
+};
+
+
+using ChannelPtr = std::shared_ptr<Channel>;
+
+// open channels, by name; shared by all states in the process
+static std::mutex registrymtx;
+static std::unordered_map<std::string, ChannelPtr> registry;
+
+
+static ChannelPtr openchannel (const std::string &name, size_t capacity) {
+  std::lock_guard<std::mutex> lk(registrymtx);
+  ChannelPtr &ch = registry[name];
+  if (!ch)
+    ch = std::make_shared<Channel>(name, capacity);
+  return ch;
+}
+
+
+static void closechannel (const ChannelPtr &ch) {
+  {
+    std::lock_guard<std::mutex> lk(registrymtx);
+    auto it = registry.find(ch->name);
+    if (it != registry.end() && it->second == ch)
+      registry.erase(it);  // a later 'open' creates a new channel
+  }
+  ch->close();
+}
+
+// }======================================================
+
+
+/*
+** {======================================================
+** Lua interface
+** =======================================================
+*/
+
+static Channel &tochannel (moon_State *L) {
+  return **static_cast<ChannelPtr *>(moonL_checkudata(L, 1, CHANNEL));
+}
+
+
+static moon_Packet *packmessage (moon_State *L) {
+  return moon_xpack(L, moon_gettop(L) - 1);
+}
+
+
+// round 'n' up to a power of 2
+static size_t ceilpow2 (size_t n) {
+  size_t c = 1;
+  while (c < n) c <<= 1;
+  return c;
+}
+
+
+static int chan_open (moon_State *L) {
+  size_t len;
+  const char *name = moonL_checklstring(L, 1, &len);
+  moon_Integer cap = moonL_optinteger(L, 2, MOONI_CHANCAPACITY);
+  moonL_argcheck(L, 1 <= cap && cap <= MOONI_MAXCHANCAPACITY, 2,
+                    "capacity out of range");
+  void *ud = moon_newuserdatauv(L, sizeof(ChannelPtr), 0);
+  new (ud) ChannelPtr(openchannel(std::string(name, len),
+                                  ceilpow2(static_cast<size_t>(cap))));
+  moonL_setmetatable(L, CHANNEL);
+  return 1;
+}
+
+
+static int chan_send (moon_State *L) {
+  Channel &ch = tochannel(L);
+  moon_Packet *p = packmessage(L);
+  if (!ch.send(p)) {
+    moon_xfreepacket(p);
+    return moonL_error(L, "channel is closed");
+  }
+  return 0;
+}
+
+
+static int chan_trysend (moon_State *L) {
+  Channel &ch = tochannel(L);
+  moon_Packet *p = packmessage(L);
+  bool ok = ch.trysend(p);
+  if (!ok)
+    moon_xfreepacket(p);
+  moon_pushboolean(L, ok);
+  return 1;
+}
+
+
+static int pushmessage (moon_State *L, bool ok, moon_Packet *p) {
+  moon_pushboolean(L, ok);
+  if (!ok)
+    return 1;
+  return 1 + moon_xunpack(L, p);
+}
+
+
+static int chan_receive (moon_State *L) {
+  moon_Packet *p = nullptr;
+  bool ok = tochannel(L).receive(p);
+  return pushmessage(L, ok, p);
+}
+
+
+static int chan_tryreceive (moon_State *L) {
+  moon_Packet *p = nullptr;
+  bool ok = tochannel(L).tryreceive(p);
+  return pushmessage(L, ok, p);
+}
+
+
+static int chan_close (moon_State *L) {
+  closechannel(*static_cast<ChannelPtr *>(moonL_checkudata(L, 1, CHANNEL)));
+  return 0;
+}
+
+
+static int chan_isclosed (moon_State *L) {
+  moon_pushboolean(L, tochannel(L).isclosed());
+  return 1;
+}
+
+
+static int chan_len (moon_State *L) {
+  moon_pushinteger(L, static_cast<moon_Integer>(tochannel(L).count()));
+  return 1;
+}
+
+
+static int chan_tostring (moon_State *L) {
+  Channel &ch = tochannel(L);
+  moon_pushfstring(L, "channel (%s)%s", ch.name.c_str(),
+                      ch.isclosed() ? " (closed)" : "");
+  return 1;
+}
+
+
+static int chan_gc (moon_State *L) {
+  static_cast<ChannelPtr *>(moonL_checkudata(L, 1, CHANNEL))->~ChannelPtr();
+  return 0;
+}
+
+
+static const moonL_Reg chan_funcs[] = {
+  {"open", chan_open},
+  {nullptr, nullptr}
+};
+
+
+static const moonL_Reg chan_meth[] = {
+  {"send", chan_send},
+  {"trysend", chan_trysend},
+  {"receive", chan_receive},
+  {"tryreceive", chan_tryreceive},
+  {"close", chan_close},
+  {"isclosed", chan_isclosed},
+  {nullptr, nullptr}
+};
+
+
+static const moonL_Reg chan_metameth[] = {
+  {"__index", nullptr},  // placeholder
+  {"__len", chan_len},
+  {"__tostring", chan_tostring},
+  {"__gc", chan_gc},
+  {nullptr, nullptr}
+};
+
+
+static void createmeta (moon_State *L) {
+  moonL_newmetatable(L, CHANNEL);
+  moonL_setfuncs(L, chan_metameth, 0);  // add metamethods to new metatable
+  moonL_newlibtable(L, chan_meth);  // create method table
+  moonL_setfuncs(L, chan_meth, 0);  // add methods to method table
+  moon_setfield(L, -2, "__index");  // metatable.__index = method table
+  moon_pop(L, 1);  // pop metatable
+}
+
+
+MOONMOD_API int moonopen_channel (moon_State *L) {
+  createmeta(L);
+  moonL_newlib(L, chan_funcs);
+  return 1;
+}
+
+// }======================================================
@@ -8,6 +8,7 @@
 #include "mprefix.h"
 
 
+#include <climits>
 #include <cstdlib>
 
 #include "moon.h"
@@ -90,10 +91,36 @@ static int moonB_auxwrap (moon_State *L) {
 }
 
 
+/*
+** Reads the optional table of creation hints at index 2. Currently
+** the only hint is 'stacksize', the number of stack slots to
+** preallocate for the new coroutine. Returns that number (0 if absent).
+*/
+static int getstackhint (moon_State *L) {
+  moon_Integer n = 0;
+  if (!moon_isnoneornil(L, 2)) {
+    moonL_checktype(L, 2, MOON_TTABLE);
+    if (moon_getfield(L, 2, "stacksize") != MOON_TNIL) {
+      int isnum;
+      n = moon_tointegerx(L, -1, &isnum);
+      moonL_argcheck(L, isnum && n >= 0, 2,
+                     "field 'stacksize' must be a non-negative integer");
+      moonL_argcheck(L, n <= INT_MAX, 2, "stack size too large");
+    }
+    moon_pop(L, 1);
+  }
+  return static_cast<int>(n);
+}
+
+
 static int moonB_cocreate (moon_State *L) {
   moon_State *NL;
+  int stacksize;
   moonL_checktype(L, 1, MOON_TFUNCTION);
+  stacksize = getstackhint(L);
   NL = moon_newthread(L);
+  if (stacksize > 0 && l_unlikely(!moon_checkstack(NL, stacksize)))
+    return moonL_error(L, "stack size too large");
   moon_pushvalue(L, 1);  // move function to top
   moon_xmove(L, NL, 1);  // move function from L to NL
   return 1;
@@ -447,9 +447,57 @@ static int db_traceback (moon_State *L) {
 }
 
 
+/*
+** Execution counters of the virtual machine (only available when the
+** interpreter is built with them); 'reset' clears them after reading.
+*/
+static int db_vmstats (moon_State *L) {
+  int reset = moon_toboolean(L, 1);
+  if (!moon_vmstats(L, reset))
+    moonL_pushfail(L);  // counters not compiled in
+  return 1;
+}
+
+
+static int heapwriter (moon_State *L, const void *b, size_t size, void *ud) {
+  (void)L;
+  moonL_addlstring(static_cast<moonL_Buffer *>(ud),
+                   static_cast<const char *>(b), size);
+  return 0;
+}
+
+
+/*
+** debug.heapprofile(["dump" | "start" | "stop"]): control the heap
+** profiler, or return its allocation sites in pprof text format.
+*/
+static int db_heapprofile (moon_State *L) {
+  static const char *const opts[] = {"dump", "start", "stop", nullptr};
+  switch (moonL_checkoption(L, 1, "dump", opts)) {
+    case 0: {
+      moonL_Buffer b;
+      moonL_buffinit(L, &b);
+      moon_heapdump(L, heapwriter, &b);
+      moonL_pushresult(&b);
+      return 1;
+    }
+    case 1: {
+      if (!moon_heapstart(L))
+        return moonL_error(L, "cannot start heap profiler");
+      return 0;
+    }
+    default: {
+      moon_heapstop(L);
+      return 0;
+    }
+  }
+}
+
+
 static const moonL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
+  {"heapprofile", db_heapprofile},
   {"gethook", db_gethook},
   {"getinfo", db_getinfo},
   {"getlocal", db_getlocal},
@@ -464,6 +512,7 @@ static const moonL_Reg dblib[] = {
   {"setmetatable", db_setmetatable},
   {"setupvalue", db_setupvalue},
   {"traceback", db_traceback},
+  {"vmstats", db_vmstats},
   {nullptr, nullptr}
 };
 
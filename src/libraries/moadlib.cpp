@@ -12,9 +12,13 @@
 #include "mprefix.h"
 
 
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "moon.h"
 
@@ -414,6 +418,38 @@ static int ll_loadlib (moon_State *L) {
 }
 
 
+/*
+** package.loadmany(files [, mode]): compile the files in list 'files'
+** in parallel and return a list with their chunks.
+*/
+static int ll_loadmany (moon_State *L) {
+  moonL_checktype(L, 1, MOON_TTABLE);
+  const char *mode = moonL_optstring(L, 2, nullptr);
+  moon_Integer n = moonL_len(L, 1);
+  moonL_argcheck(L, 0 <= n && n <= INT_MAX / 2, 1, "too many files");
+  std::vector<const char *> names(static_cast<size_t>(n));
+  for (moon_Integer i = 1; i <= n; i++) {
+    if (moon_geti(L, 1, i) != MOON_TSTRING)
+      return moonL_error(L, "file name at index %d is not a string",
+                            static_cast<int>(i));
+    names[static_cast<size_t>(i - 1)] = moon_tostring(L, -1);
+    moon_pop(L, 1);  // string is still anchored by the table
+  }
+  int top = moon_gettop(L);
+  if (moonL_loadmany(L, static_cast<int>(n), names.data(), mode) != MOON_OK) {
+    moonL_pushfail(L);
+    moon_insert(L, -2);
+    return 2;  // return fail plus error message
+  }
+  moon_createtable(L, static_cast<int>(n), 0);
+  for (int i = 1; i <= static_cast<int>(n); i++) {
+    moon_pushvalue(L, top + i);
+    moon_rawseti(L, -2, i);
+  }
+  return 1;
+}
+
+
 
 /*
 ** {======================================================
@@ -533,12 +569,335 @@ static int checkload (moon_State *L, int stat, const char *filename) {
 }
 
 
+/*
+** {======================================================
+** Bytecode cache
+** When 'package.bytecodecache' is a directory, 'searcher_Lua' keeps
+** there a precompiled copy of each Lua module it loads, tagged with
+** the size and modification time of its source. A valid copy is
+** mapped into memory and loaded in fixed mode ("B"), so that the
+** strings and code of the module stay in the mapped pages instead of
+** being copied. Mappings are released only when the state closes.
+** =======================================================
+*/
+
+/*
+** MOON_BCCACHE_VAR is the name of the environment variable that sets
+** the initial value of 'package.bytecodecache'.
+*/
+#if !defined(MOON_BCCACHE_VAR)
+#define MOON_BCCACHE_VAR	"MOON_BYTECODECACHE"
+#endif
+
+
+/*
+** key for table in the registry that keeps the mapped cache files
+*/
+static const char *const BCMAPS = "_BCMAPS";
+
+
+/*
+** Set 'package.bytecodecache' from the environment, if present there
+*/
+static void setbccache (moon_State *L) {
+  const char *dir = getenv(MOON_BCCACHE_VAR);
+  if (dir != nullptr && !noenv(L)) {
+    moon_pushstring(L, dir);
+    moon_setfield(L, -2, "bytecodecache");
+  }
+}
+
+
+#if defined(MOON_USE_POSIX)  // {
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BC_MAGIC	"\x1bMoonBC2"
+
+// alignment of the dump inside a cache file
+#define BC_ALIGN	16
+
+/*
+** Header of a cache file. It is followed by the full name of the
+** source file (to detect hash collisions) and then, at 'dumpoffset',
+** by the dump itself.
+*/
+struct BCHeader {
+  char magic[sizeof(BC_MAGIC)];
+  long long srcsize;
+  long long srcmtime;
+  long long srcmtimens;  // nanoseconds of 'srcmtime'
+  unsigned long long srcdev;
+  unsigned long long srcino;
+  size_t pathlen;
+  size_t dumpoffset;
+};
+
+
+struct BCMapping {
+  void *addr;
+  size_t len;
+};
+
+
+/*
+** Deallocate function for mapping strings: unmap the cache file
+** associated with the string being deallocated (unless it was already
+** unmapped). As with library strings, the string itself is irrelevant.
+*/
+static void *freemapping (void *ud, void *ptr, size_t osize, size_t nsize) {
+  BCMapping *m = static_cast<BCMapping *>(ud);
+  (void)ptr; (void)osize; (void)nsize;
+  if (m->addr != nullptr)
+    munmap(m->addr, m->len);
+  free(m);
+  return nullptr;
+}
+
+
+/*
+** Push a string that owns mapping 'm', unmapping it when collected.
+*/
+static void pushmapping (moon_State *L, BCMapping *m) {
+  static const char dummy[] = "bytecode";
+  moon_pushexternalstring(L, dummy, sizeof(dummy) - 1, freemapping, m);
+}
+
+
+/*
+** Keep the mapping string on the top of the stack (popping it) alive
+** until registry.BCMAPS is collected, as strings and code of loaded
+** functions may point into its mapping.
+*/
+static void anchormapping (moon_State *L) {
+  moonL_getsubtable(L, MOON_REGISTRYINDEX, BCMAPS);
+  moon_insert(L, -2);  // put BCMAPS below the mapping string
+  moonL_ref(L, -2);  // keep mapping string in BCMAPS
+  moon_pop(L, 1);  // pop BCMAPS table
+}
+
+
+/*
+** Name of the cache file for source 'key' (an absolute file name):
+** 'dir/<hash of key>.mbc'. Leaves the name on the stack.
+*/
+static const char *cachename (moon_State *L, const char *dir,
+                                             const char *key) {
+  unsigned long long h = 14695981039346656037ull;  // FNV-1a
+  for (const char *p = key; *p != '\0'; p++)
+    h = (h ^ static_cast<unsigned char>(*p)) * 1099511628211ull;
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", h);
+  return moon_pushfstring(L, "%s" MOON_DIRSEP "%s.mbc", dir, hex);
+}
+
+
+/*
+** Nanoseconds of the modification time in 'st', so that an edit in the
+** same second as the previous one still invalidates the entry.
+*/
+static long long mtimensec (const struct stat *st) {
+#if defined(__APPLE__)
+  return static_cast<long long>(st->st_mtimespec.tv_nsec);
+#else
+  return static_cast<long long>(st->st_mtim.tv_nsec);
+#endif
+}
+
+
+static void setheader (BCHeader *h, const char *key, const struct stat *src) {
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, BC_MAGIC, sizeof(BC_MAGIC));
+  h->srcsize = static_cast<long long>(src->st_size);
+  h->srcmtime = static_cast<long long>(src->st_mtime);
+  h->srcmtimens = mtimensec(src);
+  h->srcdev = static_cast<unsigned long long>(src->st_dev);
+  h->srcino = static_cast<unsigned long long>(src->st_ino);
+  h->pathlen = strlen(key);
+  h->dumpoffset = (sizeof(BCHeader) + h->pathlen + BC_ALIGN - 1)
+                  / BC_ALIGN * BC_ALIGN;
+}
+
+
+/*
+** An entry is valid when its header matches the one the source file
+** would get now (apart from the dump offset, which is only checked to
+** be within the file).
+*/
+static bool validheader (const BCHeader *h, size_t len, const char *key,
+                         const struct stat *src) {
+  BCHeader e;
+  setheader(&e, key, src);
+  size_t klen = e.pathlen;
+  return (memcmp(h->magic, e.magic, sizeof(e.magic)) == 0 &&
+          h->srcsize == e.srcsize &&
+          h->srcmtime == e.srcmtime && h->srcmtimens == e.srcmtimens &&
+          h->srcdev == e.srcdev && h->srcino == e.srcino &&
+          h->pathlen == klen &&
+          sizeof(BCHeader) + klen <= h->dumpoffset &&
+          h->dumpoffset % BC_ALIGN == 0 && h->dumpoffset < len &&
+          memcmp(h + 1, key, klen) == 0);
+}
+
+
+/*
+** Try to load 'filename' from cache file 'cfile'. Returns true with
+** the loaded function on the stack, or false (with nothing pushed)
+** if there is no valid entry.
+*/
+static bool loadcached (moon_State *L, const char *cfile,
+                        const char *filename, const char *key,
+                        const struct stat *src) {
+  int fd = open(cfile, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void *addr = MAP_FAILED;
+  size_t len = 0;
+  if (fstat(fd, &st) == 0 &&
+      static_cast<size_t>(st.st_size) > sizeof(BCHeader)) {
+    len = static_cast<size_t>(st.st_size);
+    addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) return false;
+  const BCHeader *h = static_cast<const BCHeader *>(addr);
+  BCMapping *m;
+  if (!validheader(h, len, key, src) ||
+      (m = static_cast<BCMapping *>(malloc(sizeof(BCMapping)))) == nullptr) {
+    munmap(addr, len);
+    return false;
+  }
+  m->addr = addr; m->len = len;
+  pushmapping(L, m);  // anchor it on the stack while loading
+  const char *chunkname = moon_pushfstring(L, "@%s", filename);
+  int status = moonL_loadbufferx(L, static_cast<const char *>(addr) + h->dumpoffset,
+                                    len - h->dumpoffset, chunkname, "B");
+  moon_remove(L, -2);  // remove chunk name
+  if (status != MOON_OK) {  // corrupted entry?
+    moon_pop(L, 2);  // remove error message and mapping string
+    munmap(m->addr, m->len);  // nothing loaded points into it
+    m->addr = nullptr;  // (the string just frees 'm' when collected)
+    return false;
+  }
+  moon_insert(L, -2);  // put function below the mapping string
+  anchormapping(L);  // keep the mapping as long as the state
+  return true;
+}
+
+
+static int bcwriter (moon_State *L, const void *b, size_t size, void *ud) {
+  (void)L;
+  static_cast<std::string *>(ud)->append(static_cast<const char *>(b), size);
+  return 0;
+}
+
+
+static bool writeall (int fd, const void *b, size_t size) {
+  const char *p = static_cast<const char *>(b);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n <= 0) return false;
+    p += n; size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+
+/*
+** Save the function on the top of the stack as the cache entry for
+** 'key'. The entry is written to a temporary file and then renamed,
+** so that concurrent readers never see a partial entry. Each writer
+** gets its own temporary file ('mkstemp'), as several states (in
+** threads of one process or in other processes) may save the same
+** module at once. Failures are silently ignored: the cache is only an
+** optimization.
+*/
+static void savecached (moon_State *L, const char *cfile, const char *key,
+                        const struct stat *src) {
+  std::string dump;
+  if (moon_dump(L, bcwriter, &dump, 0) != 0) return;
+  BCHeader h;
+  setheader(&h, key, src);
+  std::string tmp(cfile);
+  tmp += ".XXXXXX";
+  int fd = mkstemp(&tmp[0]);
+  if (fd < 0) return;
+  static const char zeros[BC_ALIGN] = {0};
+  bool ok = fchmod(fd, 0644) == 0 &&  // 'mkstemp' makes it private
+            writeall(fd, &h, sizeof(h)) &&
+            writeall(fd, key, h.pathlen) &&
+            writeall(fd, zeros, h.dumpoffset - sizeof(h) - h.pathlen) &&
+            writeall(fd, dump.data(), dump.size());
+  ok = (close(fd) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), cfile) != 0)
+    remove(tmp.c_str());
+}
+
+
+/*
+** Load the Lua file 'filename' going through the bytecode cache in
+** directory 'dir'. Behaves like 'moonL_loadfile'.
+*/
+static int loadwithcache (moon_State *L, const char *filename,
+                                         const char *dir) {
+  struct stat src;
+  // freed on every exit, including errors raised by the calls below
+  std::unique_ptr<char, decltype(&free)> key(realpath(filename, nullptr),
+                                             &free);
+  if (key == nullptr || stat(key.get(), &src) != 0 || !S_ISREG(src.st_mode))
+    return moonL_loadfile(L, filename);  // let it report any error
+  const char *cfile = cachename(L, dir, key.get());
+  int status = MOON_OK;
+  if (!loadcached(L, cfile, filename, key.get(), &src)) {
+    mkdir(dir, 0755);  // in case it does not exist yet
+    status = moonL_loadfile(L, filename);
+    if (status == MOON_OK)
+      savecached(L, cfile, key.get(), &src);
+  }
+  moon_remove(L, -2);  // remove cache file name
+  return status;
+}
+
+#else  // }{
+
+// no portable way to map files; ignore the cache
+static int loadwithcache (moon_State *L, const char *filename,
+                                         const char *dir) {
+  (void)dir;
+  return moonL_loadfile(L, filename);
+}
+
+#endif  // }
+
+
+/*
+** Load the Lua file 'filename' for a module, using the bytecode
+** cache when 'package.bytecodecache' is set.
+*/
+static int loadluafile (moon_State *L, const char *filename) {
+  int status;
+  moon_getfield(L, moon_upvalueindex(1), "bytecodecache");
+  const char *dir = moon_tostring(L, -1);
+  if (dir == nullptr || *dir == '\0')  // no cache?
+    status = moonL_loadfile(L, filename);
+  else
+    status = loadwithcache(L, filename, dir);
+  moon_remove(L, -2);  // remove directory name
+  return status;
+}
+
+// }======================================================
+
+
 static int searcher_Lua (moon_State *L) {
   const char *filename;
   const char *name = moonL_checkstring(L, 1);
   filename = findfile(L, name, "path", MOON_LSUBSEP);
   if (filename == nullptr) return 1;  // module not found in this path
-  return checkload(L, (moonL_loadfile(L, filename) == MOON_OK), filename);
+  return checkload(L, (loadluafile(L, filename) == MOON_OK), filename);
 }
 
 
@@ -677,6 +1036,7 @@ static int ll_require (moon_State *L) {
 
 static const moonL_Reg pk_funcs[] = {
   {"loadlib", ll_loadlib},
+  {"loadmany", ll_loadmany},
   {"searchpath", ll_searchpath},
   // placeholders
   {"preload", nullptr},
@@ -722,6 +1082,7 @@ MOONMOD_API int moonopen_package (moon_State *L) {
   // set paths
   setpath(L, "path", MOON_PATH_VAR, MOON_PATH_DEFAULT);
   setpath(L, "cpath", MOON_CPATH_VAR, MOON_CPATH_DEFAULT);
+  setbccache(L);
   // store config information
   moon_pushliteral(L, MOON_DIRSEP "\n" MOON_PATH_SEP "\n" MOON_PATH_MARK "\n"
                      MOON_EXEC_DIR "\n" MOON_IGMARK "\n");
@@ -0,0 +1,532 @@
+/*
+** Parallel Library
+** Work-stealing scheduler that runs tasks on worker threads, each one
+** owning an independent moon_State.
+** See Copyright Notice in lua.h
+*/
+
+#define MOON_LIB
+
+#include "mprefix.h"
+
+
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "moon.h"
+
+#include "mauxlib.h"
+#include "moonlib.h"
+#include "mlimits.h"
+
+
+#define SCHEDULER	"parallel.Scheduler"
+#define FUTURE		"parallel.Future"
+
+
+// maximum number of worker threads in a scheduler
+#if !defined(MOONI_MAXWORKERS)
+#define MOONI_MAXWORKERS	256
+#endif
+
+/*
+** Values cross states inside packets (see 'moon_xpack'); a packet is
+** owned by exactly one task or future at a time.
+*/
+struct PacketDeleter {
+  void operator() (moon_Packet *p) const noexcept { moon_xfreepacket(p); }
+};
+
+using PacketPtr = std::unique_ptr<moon_Packet, PacketDeleter>;
+
+/*
+** {======================================================
+** Scheduler
+** =======================================================
+*/
+
+// result of a task, shared between the worker and its futures
+struct FutureState {
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool done = false;
+  bool ok = false;
+  PacketPtr results;  // results, if 'ok'
+  std::string error;  // error message, if not 'ok'
+};
+
+
+struct Task {
+  std::string modname;  // module where the function lives
+  std::string funcname;  // function field in the module
+  PacketPtr args;
+  std::shared_ptr<FutureState> future;
+};
+
+
+/*
+** Each worker owns a deque of tasks: it takes work from the back of
+** its own deque and, when it runs dry, steals from the front of the
+** others'.
+*/
+struct Worker {
+  std::mutex mtx;
+  std::deque<Task> tasks;
+  std::thread thread;
+};
+
+
+class Scheduler {
+private:
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::mutex mtx;  // protects 'stopping' and sleeping on 'cv'
+  std::condition_variable cv;
+  std::atomic<size_t> pending{0};  // tasks submitted but not taken
+  std::atomic<unsigned> nextworker{0};  // round-robin submission
+  bool stopping = false;
+  std::string path, cpath;  // 'package' paths for the workers
+  std::vector<std::string> modules;  // modules preloaded by each worker
+
+  bool take (size_t self, Task &t);
+  void run (moon_State *L, Task &t);
+  void loop (size_t self);
+
+public:
+  Scheduler (std::string p, std::string cp, std::vector<std::string> mods)
+    : path(std::move(p)), cpath(std::move(cp)), modules(std::move(mods)) {}
+
+  void start (int n);
+  void submit (Task t);
+  void stop ();
+  int size () const noexcept { return static_cast<int>(workers.size()); }
+};
+
+
+bool Scheduler::take (size_t self, Task &t) {
+  size_t n = workers.size();
+  for (size_t i = 0; i < n; i++) {
+    Worker &w = *workers[(self + i) % n];
+    std::lock_guard<std::mutex> lk(w.mtx);
+    if (!w.tasks.empty()) {
+      if (i == 0) {  // own deque?
+        t = std::move(w.tasks.back());
+        w.tasks.pop_back();
+      }
+      else {  // steal the oldest task of another worker
+        t = std::move(w.tasks.front());
+        w.tasks.pop_front();
+      }
+      pending--;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+/*
+** Body of a task, run in protected mode inside a worker state:
+** 'require' the module, call the function with the unpacked
+** arguments and pack its results.
+*/
+static int runtask (moon_State *L) {
+  Task *t = static_cast<Task *>(moon_touserdata(L, 1));
+  PacketPtr *out = static_cast<PacketPtr *>(moon_touserdata(L, 2));
+  moon_settop(L, 0);
+  moon_getglobal(L, "require");
+  moon_pushlstring(L, t->modname.data(), t->modname.size());
+  moon_call(L, 1, 1);
+  if (moon_getfield(L, 1, t->funcname.c_str()) != MOON_TFUNCTION)
+    return moonL_error(L, "module '%s' has no function '%s'",
+                          t->modname.c_str(), t->funcname.c_str());
+  int nargs = moon_xunpack(L, t->args.release());
+  moon_call(L, nargs, MOON_MULTRET);
+  out->reset(moon_xpack(L, moon_gettop(L) - 1));
+  return 0;
+}
+
+
+void Scheduler::run (moon_State *L, Task &t) {
+  PacketPtr results;
+  std::string error;
+  moon_pushcfunction(L, runtask);
+  moon_pushlightuserdata(L, &t);
+  moon_pushlightuserdata(L, &results);
+  bool ok = (moon_pcall(L, 2, 1, 0) == MOON_OK);
+  if (!ok) {
+    const char *msg = moon_tostring(L, -1);
+    error = msg ? msg : "(error object is not a string)";
+  }
+  moon_settop(L, 0);
+  FutureState &f = *t.future;
+  {
+    std::lock_guard<std::mutex> lk(f.mtx);
+    f.ok = ok;
+    f.results = std::move(results);
+    f.error = std::move(error);
+    f.done = true;
+  }
+  f.cv.notify_all();
+}
+
+
+// open a worker state, with the same paths and preloaded modules
+static int initworker (moon_State *L) {
+  const std::string *path = static_cast<const std::string *>(moon_touserdata(L, 1));
+  const std::string *cpath = static_cast<const std::string *>(moon_touserdata(L, 2));
+  const auto *mods = static_cast<const std::vector<std::string> *>(moon_touserdata(L, 3));
+  moonL_openlibs(L);
+  moon_getglobal(L, MOON_LOADLIBNAME);
+  if (!path->empty()) {
+    moon_pushlstring(L, path->data(), path->size());
+    moon_setfield(L, -2, "path");
+  }
+  if (!cpath->empty()) {
+    moon_pushlstring(L, cpath->data(), cpath->size());
+    moon_setfield(L, -2, "cpath");
+  }
+  for (const std::string &m : *mods) {
+    moon_getglobal(L, "require");
+    moon_pushlstring(L, m.data(), m.size());
+    moon_call(L, 1, 0);
+  }
+  return 0;
+}
+
+
+void Scheduler::loop (size_t self) {
+  /* The parentheses bypass the test-mode 'moonL_newstate' macro, whose
+     debug allocator keeps global counters and is not thread safe. */
+  moon_State *L = (moonL_newstate)();
+  std::string initerror;
+  if (L == nullptr)
+    initerror = "cannot create worker state";
+  else {
+    moon_pushcfunction(L, initworker);
+    moon_pushlightuserdata(L, &path);
+    moon_pushlightuserdata(L, &cpath);
+    moon_pushlightuserdata(L, &modules);
+    if (moon_pcall(L, 3, 0, 0) != MOON_OK) {
+      const char *msg = moon_tostring(L, -1);
+      initerror = msg ? msg : "error initializing worker";
+    }
+    moon_settop(L, 0);
+  }
+  for (;;) {
+    Task t;
+    if (take(self, t)) {
+      if (initerror.empty())
+        run(L, t);
+      else {  // a broken worker fails every task it takes
+        FutureState &f = *t.future;
+        {
+          std::lock_guard<std::mutex> lk(f.mtx);
+          f.error = initerror;
+          f.done = true;
+        }
+        f.cv.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lk(mtx);
+    cv.wait(lk, [this] { return stopping || pending > 0; });
+    if (stopping && pending == 0)
+      break;
+  }
+  if (L != nullptr)
+    moon_close(L);
+}
+
+
+void Scheduler::start (int n) {
+  for (int i = 0; i < n; i++)
+    workers.push_back(std::make_unique<Worker>());
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i]->thread = std::thread(&Scheduler::loop, this, i);
+}
+
+
+/*
+** Queue a task. 'pending' counts it before any worker can see it, so
+** that a worker taking it (and decrementing the count) never makes the
+** count wrap around.
+*/
+void Scheduler::submit (Task t) {
+  Worker &w = *workers[nextworker++ % workers.size()];
+  {
+    std::lock_guard<std::mutex> lk(mtx);
+    pending++;
+  }
+  {
+    std::lock_guard<std::mutex> lk(w.mtx);
+    w.tasks.push_back(std::move(t));
+  }
+  cv.notify_one();
+}
+
+
+/*
+** Stop the scheduler. Workers finish all tasks already submitted
+** before exiting, so that no future is left pending forever.
+*/
+void Scheduler::stop () {
+  {
+    std::lock_guard<std::mutex> lk(mtx);
+    stopping = true;
+  }
+  cv.notify_all();
+  for (auto &w : workers) {
+    if (w->thread.joinable())
+      w->thread.join();
+  }
+}
+
+// }======================================================
+
+
+/*
+** {======================================================
+** Lua interface
+** =======================================================
+*/
+
+struct LScheduler {
+  Scheduler *s;  // nullptr when closed
+};
+
+
+static Scheduler *tosched (moon_State *L) {
+  LScheduler *ls = static_cast<LScheduler *>(moonL_checkudata(L, 1, SCHEDULER));
+  if (l_unlikely(ls->s == nullptr))
+    moonL_error(L, "attempt to use a closed scheduler");
+  return ls->s;
+}
+
+
+static std::shared_ptr<FutureState> &tofuture (moon_State *L) {
+  return *static_cast<std::shared_ptr<FutureState> *>(
+                                       moonL_checkudata(L, 1, FUTURE));
+}
+
+
+// get 'package[field]' from the calling state ("" if absent)
+static std::string getpath (moon_State *L, const char *field) {
+  std::string res;
+  int top = moon_gettop(L);
+  if (moon_getglobal(L, MOON_LOADLIBNAME) == MOON_TTABLE &&
+      moon_getfield(L, -1, field) == MOON_TSTRING) {
+    size_t len;
+    const char *s = moon_tolstring(L, -1, &len);
+    res.assign(s, len);
+  }
+  moon_settop(L, top);
+  return res;
+}
+
+
+static int par_scheduler (moon_State *L) {
+  unsigned hw = std::thread::hardware_concurrency();
+  moon_Integer n = moonL_optinteger(L, 1, hw > 0 ? hw : 1);
+  std::vector<std::string> mods;
+  moonL_argcheck(L, 1 <= n && n <= MOONI_MAXWORKERS, 1,
+                    "number of workers out of range");
+  if (!moon_isnoneornil(L, 2)) {
+    moonL_checktype(L, 2, MOON_TTABLE);
+    for (moon_Integer i = 1; moon_geti(L, 2, i) != MOON_TNIL; i++) {
+      size_t len;
+      const char *m = moon_tolstring(L, -1, &len);
+      moonL_argcheck(L, m != nullptr, 2, "module names must be strings");
+      mods.emplace_back(m, len);
+      moon_pop(L, 1);
+    }
+    moon_pop(L, 1);
+  }
+  LScheduler *ls = static_cast<LScheduler *>(
+                       moon_newuserdatauv(L, sizeof(LScheduler), 0));
+  ls->s = nullptr;
+  moonL_setmetatable(L, SCHEDULER);
+  std::string path = getpath(L, "path");
+  std::string cpath = getpath(L, "cpath");
+  ls->s = new Scheduler(std::move(path), std::move(cpath), std::move(mods));
+  ls->s->start(static_cast<int>(n));
+  return 1;
+}
+
+
+static int sched_submit (moon_State *L) {
+  Scheduler *s = tosched(L);
+  Task t;
+  size_t len;
+  const char *m = moonL_checklstring(L, 2, &len);
+  t.modname.assign(m, len);
+  const char *f = moonL_checklstring(L, 3, &len);
+  t.funcname.assign(f, len);
+  t.args.reset(moon_xpack(L, moon_gettop(L) - 3));
+  t.future = std::make_shared<FutureState>();
+  void *ud = moon_newuserdatauv(L, sizeof(std::shared_ptr<FutureState>), 1);
+  new (ud) std::shared_ptr<FutureState>(t.future);
+  moonL_setmetatable(L, FUTURE);
+  s->submit(std::move(t));
+  return 1;
+}
+
+
+static int sched_size (moon_State *L) {
+  moon_pushinteger(L, tosched(L)->size());
+  return 1;
+}
+
+
+static int sched_close (moon_State *L) {
+  LScheduler *ls = static_cast<LScheduler *>(moonL_checkudata(L, 1, SCHEDULER));
+  if (ls->s != nullptr) {
+    Scheduler *s = ls->s;
+    ls->s = nullptr;
+    s->stop();
+    delete s;
+  }
+  return 0;
+}
+
+
+static int sched_tostring (moon_State *L) {
+  LScheduler *ls = static_cast<LScheduler *>(moonL_checkudata(L, 1, SCHEDULER));
+  if (ls->s == nullptr)
+    moon_pushliteral(L, "scheduler (closed)");
+  else
+    moon_pushfstring(L, "scheduler (%p)", static_cast<void *>(ls->s));
+  return 1;
+}
+
+
+static int fut_ready (moon_State *L) {
+  FutureState &f = *tofuture(L);
+  std::lock_guard<std::mutex> lk(f.mtx);
+  moon_pushboolean(L, f.done);
+  return 1;
+}
+
+
+/*
+** Wait for the result of a future. Inside a coroutine, a pending
+** future yields itself (so that the caller can resume the coroutine
+** later) and is checked again when resumed; outside a coroutine it
+** blocks until the task finishes. Returns the task results or raises
+** its error.
+*/
+static int fut_awaitk (moon_State *L, int status, moon_KContext ctx) {
+  FutureState &f = *tofuture(L);
+  UNUSED(status); UNUSED(ctx);
+  {
+    std::unique_lock<std::mutex> lk(f.mtx);
+    if (!f.done) {
+      if (moon_isyieldable(L)) {
+        lk.unlock();
+        moon_settop(L, 1);
+        moon_pushvalue(L, 1);
+        return moon_yieldk(L, 1, 0, fut_awaitk);
+      }
+      f.cv.wait(lk, [&f] { return f.done; });
+    }
+  }
+  moon_settop(L, 1);
+  if (!f.ok) {
+    moon_pushlstring(L, f.error.data(), f.error.size());
+    return moon_error(L);
+  }
+  if (f.results) {  // first 'await'? keep results as the future's user value
+    int n = moon_xunpack(L, f.results.release());
+    moon_createtable(L, n, 1);
+    moon_insert(L, 2);
+    for (int i = n; i >= 1; i--)
+      moon_rawseti(L, 2, i);
+    moon_pushinteger(L, n);
+    moon_setfield(L, 2, "n");
+    moon_setiuservalue(L, 1, 1);
+  }
+  moon_getiuservalue(L, 1, 1);
+  moon_getfield(L, 2, "n");
+  int n = static_cast<int>(moon_tointeger(L, -1));
+  moon_pop(L, 1);
+  moonL_checkstack(L, n, "too many results");
+  for (int i = 1; i <= n; i++)
+    moon_rawgeti(L, 2, i);
+  return n;
+}
+
+
+static int fut_await (moon_State *L) {
+  return fut_awaitk(L, MOON_OK, 0);
+}
+
+
+static int fut_gc (moon_State *L) {
+  tofuture(L).~shared_ptr();
+  return 0;
+}
+
+
+static const moonL_Reg par_funcs[] = {
+  {"scheduler", par_scheduler},
+  {nullptr, nullptr}
+};
+
+
+static const moonL_Reg sched_meth[] = {
+  {"submit", sched_submit},
+  {"size", sched_size},
+  {"close", sched_close},
+  {nullptr, nullptr}
+};
+
+
+static const moonL_Reg sched_metameth[] = {
+  {"__index", nullptr},  // placeholder
+  {"__gc", sched_close},
+  {"__close", sched_close},
+  {"__tostring", sched_tostring},
+  {nullptr, nullptr}
+};
+
+
+static const moonL_Reg fut_meth[] = {
+  {"ready", fut_ready},
+  {"await", fut_await},
+  {nullptr, nullptr}
+};
+
+
+static const moonL_Reg fut_metameth[] = {
+  {"__index", nullptr},  // placeholder
+  {"__gc", fut_gc},
+  {nullptr, nullptr}
+};
+
+
+static void createmeta (moon_State *L, const char *tname,
+                        const moonL_Reg *metameth, const moonL_Reg *meth) {
+  moonL_newmetatable(L, tname);
+  moonL_setfuncs(L, metameth, 0);  // add metamethods to new metatable
+  moon_newtable(L);  // create method table
+  moonL_setfuncs(L, meth, 0);  // add methods to method table
+  moon_setfield(L, -2, "__index");  // metatable.__index = method table
+  moon_pop(L, 1);  // pop metatable
+}
+
+
+MOONMOD_API int moonopen_parallel (moon_State *L) {
+  createmeta(L, SCHEDULER, sched_metameth, sched_meth);
+  createmeta(L, FUTURE, fut_metameth, fut_meth);
+  moonL_newlib(L, par_funcs);
+  return 1;
+}
+
+// }======================================================
@@ -0,0 +1,97 @@
+/*
+** Profile Library
+** Interface to the sampling profiler of the VM.
+** See Copyright Notice in lua.h
+*/
+
+#define MOON_LIB
+
+#include "mprefix.h"
+
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+
+#include "moon.h"
+
+#include "mauxlib.h"
+#include "moonlib.h"
+#include "mlimits.h"
+
+
+static int prof_start (moon_State *L) {
+  moon_Integer interval = moonL_optinteger(L, 1, 0);
+  moonL_argcheck(L, 0 <= interval && interval <= INT_MAX, 1,
+                    "interval out of range");
+  if (!moon_profstart(L, static_cast<int>(interval)))
+    return moonL_error(L, "cannot start profiler");
+  return 0;
+}
+
+
+static int prof_stop (moon_State *L) {
+  moon_profstop(L);
+  return 0;
+}
+
+
+static int bufferwriter (moon_State *L, const void *b, size_t size,
+                         void *ud) {
+  (void)L;
+  moonL_addlstring(static_cast<moonL_Buffer *>(ud),
+                   static_cast<const char *>(b), size);
+  return 0;
+}
+
+
+static int filewriter (moon_State *L, const void *b, size_t size, void *ud) {
+  (void)L;
+  return (fwrite(b, 1, size, static_cast<FILE *>(ud)) != size);
+}
+
+
+/*
+** profile.dump([filename [, mode]]): write the samples as folded
+** stacks to 'filename', or return them as a string.
+*/
+static int prof_dump (moon_State *L) {
+  static const char *const modes[] = {"function", "line", nullptr};
+  const char *fname = moonL_optstring(L, 1, nullptr);
+  int lines = moonL_checkoption(L, 2, "function", modes);
+  if (fname == nullptr) {
+    moonL_Buffer b;
+    moonL_buffinit(L, &b);
+    moon_profdump(L, bufferwriter, &b, lines);
+    moonL_pushresult(&b);
+    return 1;
+  }
+  else {
+    FILE *f = fopen(fname, "w");
+    if (f == nullptr)
+      return moonL_fileresult(L, 0, fname);
+    int status = moon_profdump(L, filewriter, f, lines);
+    int en = errno;
+    if (fclose(f) != 0 && status == 0) {
+      status = 1;
+      en = errno;
+    }
+    errno = en;
+    return moonL_fileresult(L, status == 0, fname);
+  }
+}
+
+
+static const moonL_Reg prof_funcs[] = {
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {"dump", prof_dump},
+  {nullptr, nullptr}
+};
+
+
+MOONMOD_API int moonopen_profile (moon_State *L) {
+  moonL_newlib(L, prof_funcs);
+  return 1;
+}
+
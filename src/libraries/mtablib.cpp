@@ -223,6 +223,29 @@ static int tunpack (moon_State *L) {
 // }======================================================
 
 
+/*
+** {======================================================
+** Frozen tables
+** =======================================================
+*/
+
+static int tfreeze (moon_State *L) {
+  moonL_checktype(L, 1, MOON_TTABLE);
+  moon_settop(L, 1);
+  moon_freeze(L, 1);
+  return 1;  // return the table itself
+}
+
+
+static int tisfrozen (moon_State *L) {
+  moonL_checktype(L, 1, MOON_TTABLE);
+  moon_pushboolean(L, moon_isfrozen(L, 1));
+  return 1;
+}
+
+// }======================================================
+
+
 
 /*
 ** {======================================================
@@ -241,11 +264,11 @@ typedef unsigned int IdxT;
 
 
 // Versions of moon_seti/moon_geti specialized for IdxT
-inline void geti(moon_State* L, int idt, IdxT idx) noexcept {
+inline void geti(moon_State* L, int idt, IdxT idx) {
     moon_geti(L, idt, l_castU2S(idx));
 }
 
-inline void seti(moon_State* L, int idt, IdxT idx) noexcept {
+inline void seti(moon_State* L, int idt, IdxT idx) {
     moon_seti(L, idt, l_castU2S(idx));
 }
 
@@ -417,6 +440,8 @@ static int sort (moon_State *L) {
 static const moonL_Reg tab_funcs[] = {
   {"concat", tconcat},
   {"create", tcreate},
+  {"freeze", tfreeze},
+  {"isfrozen", tisfrozen},
   {"insert", tinsert},
   {"pack", tpack},
   {"unpack", tunpack},
@@ -11,6 +11,7 @@
 #include "gc_core.h"
 #include "gc_marking.h"
 #include "gc_sweeping.h"
+#include "gc_sweeper.h"
 #include "gc_finalizer.h"
 #include "gc_weak.h"
 #include "../mgc.h"
@@ -44,6 +45,7 @@ void GCCollector::atomic(moon_State* L) {
   moon_assert(g->getEphemeron() == nullptr && g->getWeak() == nullptr);
   moon_assert(!iswhite(mainthread(g)));
   g->setGCState(GCState::Atomic);
+  moonC_arcpurge(*g);  // what follows may free objects queued by ARC
   markobject(*g, L);  // mark running thread
   // registry and global metatables may be changed by API
   markvalue(*g, g->getRegistry());
@@ -82,6 +84,7 @@ void GCCollector::atomic(moon_State* L) {
 ** Completes a young-generation collection.
 */
 void GCCollector::finishgencycle(moon_State* L, GlobalState* g) {
+  GCSweeper::flush(L);  // dead objects still waiting in the batch
   g->correctGrayLists();
   GCFinalizer::checkSizes(L, *g);
   g->setGCState(GCState::Propagate);  // skip restart
@@ -297,6 +300,7 @@ l_mem GCCollector::singlestep(moon_State* L, int fast) {
       break;
     }
     case GCState::SweepEnd: {  // finish sweeps
+      GCSweeper::flush(L);  // dead objects still waiting in the batch
       GCFinalizer::checkSizes(L, *g);
       g->setGCState(GCState::CallFin);
       stepresult = GCSWEEPMAX;
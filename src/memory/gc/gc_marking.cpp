@@ -10,6 +10,7 @@
 #include <cstring>
 
 #include "gc_marking.h"
+#include "gc_parallel.h"
 #include "gc_weak.h"
 #include "../mgc.h"
 #include "../../core/mdo.h"
@@ -39,6 +40,12 @@
 ** =======================================================
 */
 
+/*
+** Maximum number of gray objects traversed serially between two
+** parallel drains (see 'propagateall').
+*/
+#define GCPARSERIAL	1000
+
 // Note: maskcolors, makewhite, set2gray, set2black are now in lgc.h
 
 // Note: clearkey is now in GCCore module
@@ -277,11 +284,21 @@ l_mem GCMarking::propagatemark(GlobalState& g) {
 }
 
 /*
-** Process all gray objects (used in atomic phase)
+** Process all gray objects (used in atomic phase). Large heaps are
+** drained by the helper threads; the objects they hand back are then
+** traversed here, and whatever those mark goes back to the helpers.
 */
 void GCMarking::propagateall(GlobalState& g) {
-    while (g.getGray())
-        propagatemark(g);
+    while (g.getGray()) {
+        if (!GCParallel::drain(g)) {  // serial marking?
+            while (g.getGray())
+                propagatemark(g);
+            return;
+        }
+        // traverse (at least) the objects handed back
+        for (l_mem n = 0; g.getGray() && n < GCPARSERIAL; n++)
+            propagatemark(g);
+    }
 }
 
 
@@ -0,0 +1,495 @@
+/*
+** Garbage Collector - Parallel Marking Module
+** See Copyright Notice in lua.h
+*/
+
+#define MOON_CORE
+
+#include "mprefix.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "gc_parallel.h"
+#include "gc_core.h"
+#include "../mgc.h"
+#include "../../objects/mfunc.h"
+#include "../../objects/mstring.h"
+#include "../../objects/mtable.h"
+#include "../../core/mtm.h"
+
+
+/*
+** Size of a private stack above which a worker publishes half of it
+** for the others to steal.
+*/
+#define SHAREMIN	64
+
+
+/*
+** Number of helper threads to start: by default, one less than the
+** number of hardware threads (the main thread also marks).
+*/
+#if !defined(mooni_gcparhelpers)
+#define mooni_gcparhelpers()  \
+	std::min(MOONI_GCPARTHREADS, \
+	         static_cast<int>(std::thread::hardware_concurrency()) - 1)
+#endif
+
+
+/*
+** One participant in a drain. Worker 0 is the main thread.
+*/
+struct GCMarkWorker {
+  std::vector<GCObject*> local;  // private gray stack
+  std::mutex lock;  // protects 'shared'
+  std::vector<GCObject*> shared;  // gray objects other workers may steal
+  std::atomic<size_t> nshared{0};  // size of 'shared', read without lock
+  std::vector<GCObject*> handback;  // gray objects left to the main thread
+  l_mem marked = 0;  // bytes marked by this worker in current drain
+};
+
+
+struct GCMarkPool {
+  int nworkers;  // helpers + 1
+  std::unique_ptr<GCMarkWorker[]> workers;
+  std::vector<std::thread> threads;
+  std::mutex m;
+  std::condition_variable start;  // signals a new drain (or 'quit')
+  std::condition_variable done;  // signals a helper finished its part
+  unsigned long epoch = 0;  // number of drains posted so far
+  int finished = 0;  // helpers done with current drain
+  bool quit = false;
+  std::atomic<int> active{0};  // workers that are not idle
+  l_mem ndrains = 0;
+
+  explicit GCMarkPool (int n) : nworkers(n), workers(new GCMarkWorker[n]) {}
+  void helper (int self);
+  void work (int self);
+};
+
+
+/*
+** {======================================================
+** Marking
+** =======================================================
+*/
+
+static inline std::atomic_ref<lu_byte> markbits (GCObject* o) {
+  return std::atomic_ref<lu_byte>(o->getMarkedRef());
+}
+
+
+static inline bool istouched (GCObject* o) {
+  GCAge age = getage(o);
+  return age == GCAge::Touched1 || age == GCAge::Touched2;
+}
+
+
+/*
+** Color a white object, returning false if it was not white (or if
+** another worker colored it first). Objects without pending work go
+** directly to black; others become gray.
+*/
+static bool trymark (GCObject* o, bool toblack) {
+  auto bits = markbits(o);
+  lu_byte old = bits.load(std::memory_order_relaxed);
+  lu_byte nw;
+  do {
+    if (!(old & WHITEBITS))
+      return false;
+    nw = cast_byte(old & ~maskcolors);
+    if (toblack)
+      nw = cast_byte(nw | bitmask(BLACKBIT));
+  } while (!bits.compare_exchange_weak(old, nw, std::memory_order_acq_rel,
+                                                std::memory_order_relaxed));
+  return true;
+}
+
+
+static void markobj (GCMarkWorker& w, GCObject* o);
+
+static inline void markval (GCMarkWorker& w, const TValue* v) {
+  if (iscollectable(v))
+    markobj(w, gcvalue(v));
+}
+
+template<typename T>
+static inline void markN (GCMarkWorker& w, const T* t) {
+  if (t != nullptr)
+    markobj(w, obj2gco(t));
+}
+
+
+/*
+** Parallel counterpart of 'GCMarking::reallymarkobject'.
+*/
+static void markobj (GCMarkWorker& w, GCObject* o) {
+  if (!(markbits(o).load(std::memory_order_relaxed) & WHITEBITS))
+    return;  // cheap test before the compare-and-swap
+  switch (static_cast<int>(o->getType())) {
+    case static_cast<int>(ctb(MoonT::SHRSTR)):
+    case static_cast<int>(ctb(MoonT::LNGSTR)): {
+      if (trymark(o, true))
+        w.marked += GCCore::objsize(o);
+      return;
+    }
+    case static_cast<int>(ctb(MoonT::UPVAL)): {
+      UpVal* uv = gco2upv(o);
+      if (trymark(o, !uv->isOpen())) {  // open upvalues are kept gray
+        w.marked += GCCore::objsize(o);
+        markval(w, uv->getVP());
+      }
+      return;
+    }
+    case static_cast<int>(ctb(MoonT::USERDATA)): {
+      Udata* u = gco2u(o);
+      if (u->getNumUserValues() == 0) {
+        if (trymark(o, true)) {
+          w.marked += GCCore::objsize(o);
+          markN(w, u->getMetatable());
+        }
+        return;
+      }
+      break;
+    }
+    default: break;
+  }
+  if (trymark(o, false)) {
+    w.marked += GCCore::objsize(o);
+    if (o->getType() == ctb(MoonT::THREAD))
+      w.handback.push_back(o);  // stacks are traversed by the main thread
+    else
+      w.local.push_back(o);
+  }
+}
+
+
+static inline void blacken (GCObject* o) {
+  markbits(o).fetch_or(bitmask(BLACKBIT), std::memory_order_relaxed);
+}
+
+
+/*
+** A table can be traversed in parallel when its metatable is known not
+** to have a '__mode' field. (Checking the field through 'gfasttm' could
+** update the cache in the metatable, so a table whose metatable has
+** not cached that absence yet goes to the main thread.)
+*/
+static bool isstrong (Table* h) {
+  return checknoTM(h->getMetatable(), TMS::TM_MODE);
+}
+
+
+static void traversetable (GCMarkWorker& w, Table* h) {
+  blacken(obj2gco(h));
+  markN(w, h->getMetatable());
+  unsigned asize = h->arraySize();
+  for (unsigned i = 0; i < asize; i++) {
+    if (iscollectable(*h->getArrayTag(i)))
+      markobj(w, h->getArrayVal(i)->gc);
+  }
+  Node* limit = gnode(h, h->nodeSize());
+  for (Node* n = gnode(h, 0); n < limit; n++) {
+    if (isempty(gval(n)))
+      GCCore::clearkey(n);  // table is owned by this worker
+    else {
+      if (n->isKeyCollectable())
+        markobj(w, n->getKeyGC());
+      markval(w, gval(n));
+    }
+  }
+}
+
+
+static void traverseproto (GCMarkWorker& w, Proto* f) {
+  blacken(obj2gco(f));
+  markN(w, f->getSource());
+  for (auto& constant : f->getConstantsSpan())
+    markval(w, &constant);
+  for (const auto& upval : f->getUpvaluesSpan())
+    markN(w, upval.getName());
+  for (Proto* nested : f->getProtosSpan())
+    markN(w, nested);
+  for (const auto& locvar : f->getDebugInfo().getLocVarsSpan())
+    markN(w, locvar.getVarName());
+}
+
+
+/*
+** Traverse one gray object, or hand it back to the main thread.
+*/
+static void traverse (GCMarkWorker& w, GCObject* o) {
+  switch (static_cast<int>(o->getType())) {
+    case static_cast<int>(ctb(MoonT::TABLE)): {
+      Table* h = gco2t(o);
+      if (istouched(o) || !isstrong(h))
+        w.handback.push_back(o);
+      else
+        traversetable(w, h);
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::LCL)): {
+      LClosure* cl = gco2lcl(o);
+      blacken(o);
+      markN(w, cl->getProto());
+      for (int i = 0; i < cl->getNumUpvalues(); i++)
+        markN(w, cl->getUpval(i));
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::CCL)): {
+      CClosure* cl = gco2ccl(o);
+      blacken(o);
+      for (int i = 0; i < cl->getNumUpvalues(); i++)
+        markval(w, cl->getUpvalue(i));
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::PROTO)):
+      traverseproto(w, gco2p(o));
+      break;
+    case static_cast<int>(ctb(MoonT::USERDATA)): {
+      Udata* u = gco2u(o);
+      if (istouched(o))
+        w.handback.push_back(o);
+      else {
+        blacken(o);
+        markN(w, u->getMetatable());
+        for (int i = 0; i < u->getNumUserValues(); i++)
+          markval(w, &u->getUserValue(i)->value);
+      }
+      break;
+    }
+    default:  // threads (from the initial gray list)
+      w.handback.push_back(o);
+      break;
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Work stealing
+** =======================================================
+*/
+
+/*
+** Move the older half of the private stack to the shared one. (The
+** bottom of a stack tends to hold objects closer to the roots, with
+** larger subgraphs behind them.)
+*/
+static void share (GCMarkWorker& w) {
+  size_t half = w.local.size() / 2;
+  std::lock_guard<std::mutex> lk(w.lock);
+  w.shared.insert(w.shared.end(), w.local.begin(), w.local.begin() + half);
+  w.local.erase(w.local.begin(), w.local.begin() + half);
+  w.nshared.store(w.shared.size(), std::memory_order_release);
+}
+
+
+/*
+** Take half of the shared stack of 'v' (at least one object) into the
+** private stack of 'w'.
+*/
+static bool takefrom (GCMarkWorker& w, GCMarkWorker& v) {
+  if (v.nshared.load(std::memory_order_acquire) == 0)
+    return false;
+  std::lock_guard<std::mutex> lk(v.lock);
+  size_t n = v.shared.size();
+  if (n == 0)
+    return false;
+  size_t k = (&w == &v) ? n : (n + 1) / 2;
+  w.local.insert(w.local.end(), v.shared.end() - k, v.shared.end());
+  v.shared.resize(n - k);
+  v.nshared.store(v.shared.size(), std::memory_order_release);
+  return true;
+}
+
+
+/*
+** Look for work: first in the own shared stack, then in the others'.
+*/
+static bool steal (GCMarkPool& p, int self) {
+  GCMarkWorker& w = p.workers[self];
+  if (takefrom(w, w))
+    return true;
+  for (int i = 1; i < p.nworkers; i++) {
+    if (takefrom(w, p.workers[(self + i) % p.nworkers]))
+      return true;
+  }
+  return false;
+}
+
+
+static bool anyshared (GCMarkPool& p) {
+  for (int i = 0; i < p.nworkers; i++) {
+    if (p.workers[i].nshared.load(std::memory_order_acquire) > 0)
+      return true;
+  }
+  return false;
+}
+
+
+/*
+** Main loop of a worker. A worker only publishes work while active and
+** empties its own shared stack before going idle, so when no worker is
+** active there is no gray object left anywhere.
+*/
+void GCMarkPool::work (int self) {
+  GCMarkWorker& w = workers[self];
+  for (;;) {
+    while (!w.local.empty()) {
+      GCObject* o = w.local.back();
+      w.local.pop_back();
+      traverse(w, o);
+      if (w.local.size() > SHAREMIN && w.nshared.load(std::memory_order_relaxed) == 0)
+        share(w);
+    }
+    if (steal(*this, self))
+      continue;
+    active.fetch_sub(1);  // go idle
+    for (;;) {
+      if (anyshared(*this)) {
+        active.fetch_add(1);
+        if (steal(*this, self))
+          break;  // back to work
+        active.fetch_sub(1);
+      }
+      else if (active.load() == 0)
+        return;  // no work anywhere
+      std::this_thread::yield();
+    }
+  }
+}
+
+
+void GCMarkPool::helper (int self) {
+  unsigned long seen = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lk(m);
+      start.wait(lk, [&] { return quit || epoch != seen; });
+      if (quit)
+        return;
+      seen = epoch;
+    }
+    work(self);
+    std::lock_guard<std::mutex> lk(m);
+    finished++;
+    done.notify_one();
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** Create the pool for 'g', if possible. Thread creation failures (as
+** any failure here) just leave the collector in serial mode.
+*/
+static GCMarkPool* getpool (GlobalState& g) {
+  GCMarkPool* p = g.getMarkPool();
+  if (p != nullptr)
+    return p;
+  int n = mooni_gcparhelpers();
+  if (n <= 0)
+    return nullptr;
+  try {
+    p = new GCMarkPool(n + 1);
+    p->threads.reserve(static_cast<size_t>(n));
+    for (int i = 1; i <= n; i++)
+      p->threads.emplace_back(&GCMarkPool::helper, p, i);
+  }
+  catch (...) {
+    if (p != nullptr) {
+      p->nworkers = static_cast<int>(p->threads.size()) + 1;
+      if (p->nworkers == 1) {  // no helper at all?
+        delete p;
+        return nullptr;
+      }
+    }
+    else
+      return nullptr;
+  }
+  g.setMarkPool(p);
+  return p;
+}
+
+
+bool GCParallel::drain(GlobalState& g) {
+  if (MOONI_GCPARTHREADS <= 0 || g.getTotalBytes() < MOONI_GCPARMIN ||
+      g.getGray() == nullptr)
+    return false;
+  GCMarkPool* p = getpool(g);
+  if (p == nullptr)
+    return false;
+  int i = 0;
+  GCObject* o = g.getGray();
+  while (o != nullptr) {  // deal the gray list among the workers
+    GCObject* next = *GCCore::getgclist(o);
+    p->workers[i].local.push_back(o);
+    i = (i + 1) % p->nworkers;
+    o = next;
+  }
+  g.setGray(nullptr);
+  p->active.store(p->nworkers);
+  {
+    std::lock_guard<std::mutex> lk(p->m);
+    p->finished = 0;
+    p->epoch++;
+  }
+  p->start.notify_all();
+  p->work(0);
+  {
+    std::unique_lock<std::mutex> lk(p->m);
+    p->done.wait(lk, [p] { return p->finished == p->nworkers - 1; });
+  }
+  p->ndrains++;
+  for (i = 0; i < p->nworkers; i++) {
+    GCMarkWorker& w = p->workers[i];
+    moon_assert(w.local.empty() && w.shared.empty());
+    g.setGCMarked(g.getGCMarked() + w.marked);
+    w.marked = 0;
+    for (GCObject* h : w.handback) {  // link them back for 'propagatemark'
+      moon_assert(!iswhite(h));
+      *GCCore::getgclist(h) = g.getGray();
+      g.setGray(h);
+    }
+    w.handback.clear();
+  }
+  return true;
+}
+
+
+void GCParallel::freepool(GlobalState& g) {
+  GCMarkPool* p = g.getMarkPool();
+  if (p == nullptr)
+    return;
+  {
+    std::lock_guard<std::mutex> lk(p->m);
+    p->quit = true;
+  }
+  p->start.notify_all();
+  for (auto& t : p->threads)
+    t.join();
+  delete p;
+  g.setMarkPool(nullptr);
+}
+
+
+int GCParallel::nhelpers(GlobalState& g) {
+  GCMarkPool* p = g.getMarkPool();
+  return (p == nullptr) ? 0 : p->nworkers - 1;
+}
+
+
+l_mem GCParallel::ndrains(GlobalState& g) {
+  GCMarkPool* p = g.getMarkPool();
+  return (p == nullptr) ? 0 : p->ndrains;
+}
@@ -0,0 +1,76 @@
+/*
+** Garbage Collector - Parallel Marking Module
+** See Copyright Notice in lua.h
+*/
+
+#ifndef gc_parallel_h
+#define gc_parallel_h
+
+#include "../../core/mstate.h"
+#include "../mgc.h"
+#include "../../objects/mobject.h"
+
+
+/*
+** Maximum number of helper threads that join the main thread when
+** draining the gray list. (The actual number is also limited by the
+** number of hardware threads.) Zero disables parallel marking.
+*/
+#if !defined(MOONI_GCPARTHREADS)
+inline constexpr int MOONI_GCPARTHREADS = 7;
+#endif
+
+/*
+** Heaps smaller than this many bytes are always marked serially, as
+** waking the helpers would cost more than it saves.
+*/
+#if !defined(MOONI_GCPARMIN)
+inline constexpr l_mem MOONI_GCPARMIN = 16 * 1024 * 1024;
+#endif
+
+
+/*
+** GCParallel - Drains the gray list with several threads
+**
+** The mutator is stopped while the helpers run, so this is parallel but
+** not concurrent marking: the main thread posts the current gray list
+** to a pool of helper threads and works along with them until all gray
+** objects reachable from it are traversed.
+**
+** Each worker keeps its gray objects in a private stack instead of the
+** intrusive 'gclist' links, and publishes part of it in a shared stack
+** when it grows, from where idle workers steal. Objects change color
+** with an atomic compare-and-swap on 'marked', so each object is grayed
+** (and later traversed) by exactly one worker.
+**
+** Only the common, self-contained cases run in parallel: strong tables,
+** closures, prototypes, upvalues, strings and userdata. Objects whose
+** traversal touches shared collector lists (threads, weak tables,
+** tables whose mode is not cached yet, and touched objects of the
+** generational mode) are left gray and handed back to the main thread,
+** which traverses them with the serial code after the helpers stop.
+*/
+class GCParallel {
+public:
+    /*
+    ** Traverse gray objects with the helper threads. Returns false
+    ** (doing nothing) when parallel marking is disabled, unavailable,
+    ** or not worthwhile for the current heap; otherwise returns true
+    ** with the objects handed back linked in the 'gray' list.
+    */
+    static bool drain(GlobalState& g);
+
+    /*
+    ** Stop the helper threads and free the pool (when closing a state).
+    */
+    static void freepool(GlobalState& g);
+
+    /*
+    ** Number of helper threads and of parallel drains done so far
+    ** (for tests and statistics).
+    */
+    static int nhelpers(GlobalState& g);
+    static l_mem ndrains(GlobalState& g);
+};
+
+#endif  // gc_parallel_h
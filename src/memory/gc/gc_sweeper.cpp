@@ -0,0 +1,207 @@
+/*
+** Garbage Collector - Background Sweeper Module
+** See Copyright Notice in lua.h
+*/
+
+#define MOON_CORE
+
+#include "mprefix.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gc_sweeper.h"
+#include "gc_core.h"
+#include "../mgc.h"
+#include "../mmem.h"
+#include "../../objects/mfunc.h"
+#include "../../objects/mstring.h"
+#include "../../objects/mtable.h"
+
+
+struct GCSweepThread {
+  GlobalState *g;
+  std::vector<GCObject*> batch;  // being filled by the mutator
+  std::mutex m;
+  std::condition_variable work;  // signals a new batch (or 'quit')
+  std::condition_variable idle;  // signals that 'queue' got shorter
+  std::deque<std::vector<GCObject*>> queue;  // batches waiting for the helper
+  bool busy = false;  // helper is freeing a batch
+  bool quit = false;
+  l_mem nfreed = 0;  // objects freed by the helper
+  std::thread th;
+
+  explicit GCSweepThread (GlobalState *gs) : g(gs) {}
+  void run ();
+};
+
+
+/*
+** Free a dead object on the helper thread. Mirrors 'freeobj' for the
+** types that 'defer' accepts; frees are not counted ('moonM_uncounted'),
+** as 'defer' already did it.
+*/
+static void freedeferred (moon_State *L, GCObject *o) {
+  switch (static_cast<int>(o->getType())) {
+    case static_cast<int>(ctb(MoonT::TABLE)):
+      gco2t(o)->destroy(L);
+      break;
+    case static_cast<int>(ctb(MoonT::LCL)): {
+      LClosure *cl = gco2lcl(o);
+      cl->~LClosure();
+      moonM_freemem(L, cl, sizeLclosure(cl->getNumUpvalues()));
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::CCL)): {
+      CClosure *cl = gco2ccl(o);
+      cl->~CClosure();
+      moonM_freemem(L, cl, sizeCclosure(cl->getNumUpvalues()));
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::USERDATA)): {
+      Udata *u = gco2u(o);
+      u->~Udata();
+      moonM_freemem(L, o, sizeudata(u->getNumUserValues(), u->getLen()));
+      break;
+    }
+    case static_cast<int>(ctb(MoonT::LNGSTR)): {
+      TString *ts = gco2ts(o);
+      ts->~TString();
+      moonM_freemem(L, ts, TString::calculateLongStringSize(ts->getLnglen(),
+                                                            ts->getShrlen()));
+      break;
+    }
+    default: moon_assert(0);
+  }
+}
+
+
+void GCSweepThread::run () {
+  moon_State *L = mainthread(g);  // only used to reach 'g' and its allocator
+  moonM_uncounted = true;
+  std::unique_lock<std::mutex> lk(m);
+  for (;;) {
+    work.wait(lk, [this] { return quit || !queue.empty(); });
+    if (queue.empty())  // 'quit' and nothing left?
+      return;
+    std::vector<GCObject*> b = std::move(queue.front());
+    queue.pop_front();
+    busy = true;
+    idle.notify_all();
+    lk.unlock();
+    for (GCObject *o : b)
+      freedeferred(L, o);
+    lk.lock();
+    busy = false;
+    nfreed += static_cast<l_mem>(b.size());
+    idle.notify_all();
+  }
+}
+
+
+static bool deferrable (GCObject *o) {
+  switch (static_cast<int>(o->getType())) {
+    case static_cast<int>(ctb(MoonT::TABLE)):
+    case static_cast<int>(ctb(MoonT::LCL)):
+    case static_cast<int>(ctb(MoonT::CCL)):
+    case static_cast<int>(ctb(MoonT::USERDATA)):
+      return true;
+    case static_cast<int>(ctb(MoonT::LNGSTR)):  // external strings call 'falloc'
+      return gco2ts(o)->getShrlen() != LSTRMEM;
+    default:
+      return false;
+  }
+}
+
+
+/*
+** Get the helper of 'g', starting it if needed. Returns nullptr if
+** the thread cannot be created (objects are then freed in place).
+*/
+static GCSweepThread *getsweeper (GlobalState& g) {
+  GCSweepThread *s = g.getSweepThread();
+  if (s == nullptr) {
+    try {
+      s = new GCSweepThread(&g);
+      s->batch.reserve(MOONI_SWEEPBATCH);
+      s->th = std::thread(&GCSweepThread::run, s);
+    }
+    catch (...) {
+      delete s;
+      return nullptr;
+    }
+    g.setSweepThread(s);
+  }
+  return s;
+}
+
+
+bool GCSweeper::defer(moon_State* L, GCObject* o) {
+  GlobalState *g = G(L);
+  if (!g->getGCBgSweep() || g->getHeapProfiler() != nullptr ||
+      !deferrable(o))
+    return false;
+  if (g->getRecycle() && cast_sizet(GCCore::objsize(o)) <= MOONI_RECYCLEMAX)
+    return false;  // small objects are cheaper to recycle in place
+  GCSweepThread *s = getsweeper(*g);
+  if (s == nullptr)
+    return false;
+  g->getGCDebtRef() += GCCore::objsize(o);  // as if it were freed now
+  s->batch.push_back(o);
+  if (s->batch.size() >= MOONI_SWEEPBATCH)
+    flush(L);
+  return true;
+}
+
+
+void GCSweeper::flush(moon_State* L) {
+  GCSweepThread *s = G(L)->getSweepThread();
+  if (s == nullptr || s->batch.empty())
+    return;
+  std::vector<GCObject*> b;
+  b.reserve(MOONI_SWEEPBATCH);
+  std::swap(b, s->batch);
+  std::unique_lock<std::mutex> lk(s->m);
+  s->idle.wait(lk, [s] { return s->queue.size() < MOONI_SWEEPQUEUE; });
+  s->queue.push_back(std::move(b));
+  s->work.notify_one();
+}
+
+
+void GCSweeper::wait(GlobalState& g) {
+  GCSweepThread *s = g.getSweepThread();
+  if (s == nullptr)
+    return;
+  flush(mainthread(&g));
+  std::unique_lock<std::mutex> lk(s->m);
+  s->idle.wait(lk, [s] { return s->queue.empty() && !s->busy; });
+}
+
+
+void GCSweeper::stop(GlobalState& g) {
+  GCSweepThread *s = g.getSweepThread();
+  if (s == nullptr)
+    return;
+  flush(mainthread(&g));
+  {
+    std::lock_guard<std::mutex> lk(s->m);
+    s->quit = true;  // helper still empties the queue before leaving
+  }
+  s->work.notify_one();
+  s->th.join();
+  g.setSweepThread(nullptr);
+  delete s;
+}
+
+
+l_mem GCSweeper::nfreed(GlobalState& g) {
+  GCSweepThread *s = g.getSweepThread();
+  if (s == nullptr)
+    return 0;
+  std::lock_guard<std::mutex> lk(s->m);
+  return s->nfreed;
+}
@@ -0,0 +1,81 @@
+/*
+** Garbage Collector - Background Sweeper Module
+** See Copyright Notice in lua.h
+*/
+
+#ifndef gc_sweeper_h
+#define gc_sweeper_h
+
+#include "../../core/mstate.h"
+#include "../mgc.h"
+#include "../../objects/mobject.h"
+
+
+/*
+** Number of dead objects handed to the helper thread at a time.
+*/
+#if !defined(MOONI_SWEEPBATCH)
+inline constexpr size_t MOONI_SWEEPBATCH = 512;
+#endif
+
+/*
+** Maximum number of batches waiting for the helper. When the mutator
+** gets that far ahead, it waits for the helper to catch up.
+*/
+#if !defined(MOONI_SWEEPQUEUE)
+inline constexpr size_t MOONI_SWEEPQUEUE = 256;
+#endif
+
+
+/*
+** GCSweeper - Frees dead objects on a helper thread
+**
+** The sweep itself (unlinking dead objects from 'allgc' and whitening
+** the survivors) stays on the mutator: those lists and mark bits are
+** shared with barriers, finalizer separation and string interning.
+** What moves to the helper is the release of the memory of dead
+** objects, which for tables, closures and the like means destructors
+** and several calls to the allocator per object.
+**
+** The mutator accounts for the freed bytes (with 'objsize') when it
+** defers an object, so collector statistics do not depend on when the
+** helper actually runs. Only objects whose release has no effect on
+** the rest of the state are deferred: tables, closures, userdata and
+** (internal) long strings. Short strings (in the string table),
+** upvalues, threads and prototypes (known to profilers) are freed in
+** place, as always. So are small objects when the state recycles small
+** blocks ('MOON_GCRECYCLE'), as their blocks go back to the mutator.
+**
+** Background sweeping is enabled per state with 'MOON_GCBGSWEEP', and
+** only for allocators that can be called from another thread.
+*/
+class GCSweeper {
+public:
+    /*
+    ** Hand dead object 'o' to the helper. Returns false (doing nothing)
+    ** if 'o' must be freed in place.
+    */
+    static bool defer(moon_State* L, GCObject* o);
+
+    /*
+    ** Send the pending batch (if any) to the helper.
+    */
+    static void flush(moon_State* L);
+
+    /*
+    ** Wait until the helper has freed everything sent to it.
+    */
+    static void wait(GlobalState& g);
+
+    /*
+    ** Free everything pending and stop the helper thread.
+    */
+    static void stop(GlobalState& g);
+
+    /*
+    ** Number of objects freed by the helper so far (for tests).
+    */
+    static l_mem nfreed(GlobalState& g);
+};
+
+#endif  // gc_sweeper_h
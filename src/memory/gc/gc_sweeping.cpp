@@ -16,6 +16,7 @@
 #include "../../objects/mfunc.h"
 #include "../../objects/mstring.h"
 #include "gc_marking.h"
+#include "gc_sweeper.h"
 
 /*
 ** GC Sweeping Module Implementation
@@ -51,6 +52,14 @@ static void linkgclist_(GCObject* o, GCObject** pnext, GCObject** list) {
     set2gray(o);  // now it is
 }
 
+/*
+** Free a dead object, or hand it to the background sweeper
+*/
+static inline void freedead(moon_State* L, GCObject* o) {
+    if (!GCSweeper::defer(L, o))
+        freeobj(*L, o);
+}
+
 // Link moon_State into GC list
 static inline void linkgclistThread(moon_State* th, GCObject*& p) {
     linkgclist_(obj2gco(th), th->getGclistPtr(), &p);
@@ -84,7 +93,7 @@ GCObject** GCSweeping::sweeplist(moon_State* L, GCObject** p, l_mem countin) {
 
         if (isdeadm(ow, marked)) {  // is 'curr' dead?
             *p = curr->getNext();  /* remove 'curr' from list */
-            freeobj(*L, curr);  // erase 'curr'
+            freedead(L, curr);  // erase 'curr'
         }
         else {  // change mark to 'white' and age to 'new'
             curr->setMarked(cast_byte((marked & ~maskgcbits) |
@@ -130,7 +139,7 @@ void GCSweeping::sweep2old(moon_State* L, GCObject** p) {
         if (iswhite(curr)) {  // is 'curr' dead?
             moon_assert(isdead(g, curr));
             *p = curr->getNext();  /* remove 'curr' from list */
-            freeobj(*L, curr);  // erase 'curr'
+            freedead(L, curr);  // erase 'curr'
         }
         else {  // all surviving objects become old
             setage(curr, GCAge::Old);
@@ -183,7 +192,7 @@ GCObject** GCSweeping::sweepgen(moon_State* L, GlobalState& g, GCObject** p,
         if (iswhite(curr)) {  // is 'curr' dead?
             moon_assert(!isold(curr) && isdead(&g, curr));
             *p = curr->getNext();  /* remove 'curr' from list */
-            freeobj(*L, curr);  // erase 'curr'
+            freedead(L, curr);  // erase 'curr'
         }
         else {  // correct mark and age
             GCAge age = getage(curr);
@@ -222,6 +231,7 @@ GCObject** GCSweeping::sweepgen(moon_State* L, GlobalState& g, GCObject** p,
 void GCSweeping::entersweep(moon_State* L) {
     GlobalState* g = G(L);
     g->setGCState(GCState::SweepAllGC);
+    moonC_arcpurge(*g);  // sweep may free objects queued by ARC
     moon_assert(g->getSweepGC() == nullptr);
     g->setSweepGC(sweeptolive(L, g->getAllGCPtr()));
 }
@@ -22,6 +22,8 @@
 #include "gc/gc_sweeping.h"
 #include "gc/gc_finalizer.h"
 #include "gc/gc_weak.h"
+#include "gc/gc_parallel.h"
+#include "gc/gc_sweeper.h"
 #include "gc/gc_collector.h"
 #include "mmem.h"
 #include "mobject.h"
@@ -210,9 +212,11 @@ GCObject *moonC_newobjdt (moon_State& L, MoonT tt, size_t sz, size_t offset) {
   GCObject *o = reinterpret_cast<GCObject*>(p + offset);
   o->setMarked(g->getWhite());
   o->setType(tt);
-  o->setRefcount(1);  // ARC: born with one owning reference (dormant in Phase 0)
+  o->setRefcount(1);  // ARC: born with one owning reference (dormant)
   o->setNext(g->getAllGC());
   g->setAllGC(o);
+  if (l_unlikely(g->getHeapProfiler() != nullptr))
+    moonG_heapalloc(&L, o, sz);
   return o;
 }
 
@@ -331,20 +335,10 @@ void traverseweakvalue (GlobalState& g, Table *h) {
 ** are now in GCMarking module and called from GCMarking::propagatemark() */
 
 
-/*
-** traverse one gray object, turning it to black. Return an estimate
-** of the number of slots traversed.
-*/
-// Wrapper for GCMarking::propagatemark() - now in gc_marking module
-static l_mem propagatemark(GlobalState& g) {
-  return GCMarking::propagatemark(g);
-}
-
-
 // Made non-static for use by GCCollector module
+// Wrapper for GCMarking::propagateall() (which may mark in parallel)
 void propagateall (GlobalState& g) {
-  while (g.getGray())
-    propagatemark(g);
+  GCMarking::propagateall(g);
 }
 
 
@@ -376,6 +370,8 @@ static void freeupval(moon_State* L, UpVal* upvalue) {
 // Made non-static for use by gc_sweeping module
 void freeobj (moon_State& L, GCObject *o) {
   assert_code(l_mem newmem = G(L)->getTotalBytes() - objsize(o));
+  if (l_unlikely(G(L)->getHeapProfiler() != nullptr))
+    moonG_heapfree(&L, o);
   switch (static_cast<int>(o->getType())) {
     case static_cast<int>(ctb(MoonT::PROTO)): {
       Proto *p = gco2p(o);
@@ -408,6 +404,7 @@ void freeobj (moon_State& L, GCObject *o) {
     }
     case static_cast<int>(ctb(MoonT::THREAD)):
       moonE_freethread(&L, gco2th(o));
+      assert_code(newmem = G(L)->getTotalBytes());  // may be kept in the pool
       break;
     case static_cast<int>(ctb(MoonT::USERDATA)): {
       Udata *u = gco2u(o);
@@ -446,7 +443,7 @@ void freeobj (moon_State& L, GCObject *o) {
 ** is reclaimed deterministically: its GC children are released first (which may
 ** cascade), it is unlinked from the global 'allgc' list, and its memory is
 ** freed via freeobj(). A reference cycle never reaches zero from an external
-** release, so cycles leak by design (broken later with weak refs).
+** release; cycles are left to the tracing collector.
 **
 ** This is the reclamation CORE. Wiring retain/release into every TValue slot
 ** write across the VM/stack is a later increment; for now retain is wired into
@@ -454,79 +451,100 @@ void freeobj (moon_State& L, GCObject *o) {
 ** =======================================================
 */
 
-static unsigned long long arc_deinit_count = 0;  // objects reclaimed (debug)
+thread_local static unsigned long long arc_deinit_count = 0;  // objects reclaimed (debug)
 
-// Deferred-free queue. moonC_decref drops a reference WITHOUT needing a
-// moon_State (so it can be called from the L-free table write primitives); when
-// a count hits zero the object is queued here, and moonC_drain() reclaims the
-// queue at a safe point where L is available. This decouples the cheap decrement
-// from the actual free, avoids deep recursion, and avoids freeing mid-write.
-// (A single global queue assumes objects from at most one live state are pending
-// at a time — sufficient for the fork's single-state usage; revisit for
-// multi-state embedding.)
-static std::vector<GCObject*> arc_pending;
+// Deferred-free queue. When moonC_decref drops a count to zero the object is
+// queued here, and moonC_drain() reclaims the queue at a safe point. This
+// decouples the cheap decrement from the actual free, avoids deep recursion,
+// and avoids freeing mid-write. There is one queue per global state (created
+// on first use), as a drain walks the 'allgc' list of the queued objects.
+struct ARCQueue {
+  std::vector<GCObject*> q;
+};
 
 unsigned long long moonC_deinitcount() noexcept { return arc_deinit_count; }
 void moonC_resetdeinitcount() noexcept { arc_deinit_count = 0; }
 
-void moonC_decref(GCObject* o) noexcept {
-  if (o != nullptr && o->release() == 0)  // last reference dropped?
-    arc_pending.push_back(o);             // queue for reclamation at next drain
+void moonC_decref(GlobalState* g, GCObject* o) noexcept {
+  if (o != nullptr && o->release() == 0) {  // last reference dropped?
+    ARCQueue* aq = g->getARCQueue();
+    if (aq == nullptr) {
+      aq = new ARCQueue;
+      g->setARCQueue(aq);
+    }
+    aq->q.push_back(o);  // queue for reclamation at next drain
+  }
 }
 
-static void arc_decrefvalue(const TValue* v) noexcept {
-  if (iscollectable(v)) moonC_decref(gcvalue(v));
+// Forget all queued objects. Called before the tracing collector frees
+// anything (atomic phase, sweeps, closing the state), as it may free queued
+// objects. Objects that were dead are then reclaimed by that collector; live
+// ones simply miss their prompt release.
+void moonC_arcpurge(GlobalState& g) noexcept {
+  ARCQueue* aq = g.getARCQueue();
+  if (aq != nullptr)
+    aq->q.clear();
+}
+
+// Free the queue of 'g' (when the state is closed).
+static void arc_freequeue(GlobalState* g) {
+  delete g->getARCQueue();
+  g->setARCQueue(nullptr);
+}
+
+static void arc_decrefvalue(GlobalState* g, const TValue* v) noexcept {
+  if (iscollectable(v)) moonC_decref(g, gcvalue(v));
 }
 
 // Queue every GC child of 'o' for decref (a decref-instead-of-mark mirror of the
 // marking traversal). Leaf types (strings, numbers) have no children. Threads
 // and open upvalues are intentionally skipped for now (handled in a later
 // increment); skipping only leaks, it is never unsafe.
-static void arc_decrefchildren(GCObject* o) {
+static void arc_decrefchildren(GlobalState* g, GCObject* o) {
   switch (static_cast<int>(o->getType())) {
     case static_cast<int>(ctb(MoonT::TABLE)): {
       Table* h = gco2t(o);
       if (h->getMetatable() != nullptr)
-        moonC_decref(obj2gco(h->getMetatable()));
+        moonC_decref(g, obj2gco(h->getMetatable()));
       for (unsigned i = 0; i < h->arraySize(); i++)
-        moonC_decref(gcvalarr(h, i));
+        moonC_decref(g, gcvalarr(h, i));
       Node* limit = gnodelast(h);
       for (Node* n = gnode(h, 0); n < limit; n++) {
         if (!isempty(gval(n))) {
           if (n->isKeyCollectable())
-            moonC_decref(n->getKeyGC());
-          arc_decrefvalue(gval(n));
+            moonC_decref(g, n->getKeyGC());
+          arc_decrefvalue(g, gval(n));
         }
       }
       break;
     }
     case static_cast<int>(ctb(MoonT::LCL)): {
       LClosure* cl = gco2lcl(o);
-      if (cl->getProto() != nullptr) moonC_decref(obj2gco(cl->getProto()));
+      if (cl->getProto() != nullptr) moonC_decref(g, obj2gco(cl->getProto()));
       for (int i = 0; i < cl->getNumUpvalues(); i++)
-        if (cl->getUpval(i) != nullptr) moonC_decref(obj2gco(cl->getUpval(i)));
+        if (cl->getUpval(i) != nullptr) moonC_decref(g, obj2gco(cl->getUpval(i)));
       break;
     }
     case static_cast<int>(ctb(MoonT::CCL)): {
       CClosure* cl = gco2ccl(o);
       for (int i = 0; i < cl->getNumUpvalues(); i++)
-        arc_decrefvalue(cl->getUpvalue(i));
+        arc_decrefvalue(g, cl->getUpvalue(i));
       break;
     }
     case static_cast<int>(ctb(MoonT::PROTO)): {
       Proto* p = gco2p(o);
-      if (p->getSource() != nullptr) moonC_decref(obj2gco(p->getSource()));
+      if (p->getSource() != nullptr) moonC_decref(g, obj2gco(p->getSource()));
       for (auto& constant : p->getConstantsSpan())
-        arc_decrefvalue(&constant);
+        arc_decrefvalue(g, &constant);
       for (Proto* nested : p->getProtosSpan())
-        if (nested != nullptr) moonC_decref(obj2gco(nested));
+        if (nested != nullptr) moonC_decref(g, obj2gco(nested));
       break;
     }
     case static_cast<int>(ctb(MoonT::USERDATA)): {
       Udata* u = gco2u(o);
-      if (u->getMetatable() != nullptr) moonC_decref(obj2gco(u->getMetatable()));
+      if (u->getMetatable() != nullptr) moonC_decref(g, obj2gco(u->getMetatable()));
       for (int i = 0; i < u->getNumUserValues(); i++)
-        arc_decrefvalue(&u->getUserValue(i)->value);
+        arc_decrefvalue(g, &u->getUserValue(i)->value);
       break;
     }
     default:
@@ -534,32 +552,68 @@ static void arc_decrefchildren(GCObject* o) {
   }
 }
 
-// Unlink 'o' from the global 'allgc' list (O(n); a list-free design or a
-// doubly-linked list is a later performance increment).
-static void arc_unlink(moon_State& L, GCObject* o) {
-  GCObject** p = G(L)->getAllGCPtr();
-  while (*p != nullptr) {
-    if (*p == o) { *p = o->getNext(); return; }
-    p = (*p)->getNextPtr();
+// Refcount given to objects taken by a drain, which identifies them in the
+// unlink pass (a live object never gets anywhere near this count).
+inline constexpr std::uint32_t ARC_DEAD = ~std::uint32_t(0);
+
+// Can 'o' be reclaimed here? Only objects that are nowhere but in 'allgc':
+// objects in a gray list (gray, or touched in generational mode) and
+// objects marked for finalization are left to the tracing collector.
+static bool arc_freeable(GCObject* o) {
+  if (isgray(o) || tofinalize(o))
+    return false;
+  GCAge age = getage(o);
+  return (age != GCAge::Touched1 && age != GCAge::Touched2);
+}
+
+// Unlink all objects taken by the current drain ('n' of them) from 'allgc'
+// in a single pass and free them. Like the removal of objects with
+// finalizers, this keeps the generational boundaries and the sweep
+// position valid.
+static void arc_unlinkall(moon_State& L, size_t n) {
+  GlobalState* g = G(L);
+  GCObject** p = g->getAllGCPtr();
+  while (n > 0 && *p != nullptr) {
+    GCObject* curr = *p;
+    if (curr->getRefcount() != ARC_DEAD)
+      p = curr->getNextPtr();
+    else {
+      if (g->getSweepGC() == curr->getNextPtr())
+        g->setSweepGC(p);  // sweep position must not point into 'curr'
+      GCFinalizer::correctpointers(*g, curr);
+      *p = curr->getNext();  // remove 'curr' from 'allgc' list
+      n--;
+      ++arc_deinit_count;
+      freeobj(L, curr);
+    }
   }
 }
 
-// Reclaim all queued (zero-refcount) objects. Processing is iterative: releasing
-// an object's children may queue more, which this loop drains in turn. Cycles
-// never enter the queue (their counts never reach zero), so they are not freed.
+// Reclaim all queued (zero-refcount) objects. Releasing an object's children
+// may queue more, which this loop drains in turn; each object taken is tagged
+// with ARC_DEAD, and all of them are then unlinked from 'allgc' in one pass,
+// instead of one list walk per object. Cycles never enter the queue (their
+// counts never reach zero), so they are not freed. Objects revived or queued
+// twice before the drain are seen with a nonzero count and skipped.
 void moonC_drain(moon_State& L) {
-  while (!arc_pending.empty()) {
-    GCObject* o = arc_pending.back();
-    arc_pending.pop_back();
-    arc_decrefchildren(o);   // queue children (cascade)
-    arc_unlink(L, o);        // remove from the global object list
-    ++arc_deinit_count;
-    freeobj(L, o);           // reclaim memory
+  GlobalState* g = G(L);
+  ARCQueue* aq = g->getARCQueue();
+  size_t n = 0;
+  while (aq != nullptr && !aq->q.empty()) {
+    GCObject* o = aq->q.back();
+    aq->q.pop_back();
+    if (o->getRefcount() != 0 || !arc_freeable(o))
+      continue;  // revived, already taken, or not reclaimable here
+    o->setRefcount(ARC_DEAD);
+    arc_decrefchildren(g, o);   // queue children (cascade)
+    n++;
   }
+  if (n > 0)
+    arc_unlinkall(L, n);  // remove from the global object list and free
 }
 
 void moonC_release(moon_State& L, GCObject* o) {
-  moonC_decref(o);
+  moonC_decref(G(L), o);
   moonC_drain(L);
 }
 
@@ -828,6 +882,7 @@ static void deletelist (moon_State& L, GCObject *p, GCObject *limit) {
 void moonC_freeallobjects (moon_State& L) {
   GlobalState *g = G(L);
   g->setGCStp(GCSTPCLS);  // no extra finalizers after here
+  moonC_arcpurge(*g);
   moonC_changemode(L, GCKind::Incremental);
   separatetobefnz(*g, 1);  // separate all objects with finalizers
   moon_assert(g->getFinObj() == nullptr);
@@ -836,6 +891,9 @@ void moonC_freeallobjects (moon_State& L) {
   moon_assert(g->getFinObj() == nullptr);  // no new finalizers
   deletelist(L, g->getFixedGC(), nullptr);  // collect fixed objects
   moon_assert(g->getStringTable()->getNumElements() == 0);
+  GCParallel::freepool(*g);  // no more collections
+  GCSweeper::stop(*g);
+  arc_freequeue(g);
 }
 
 
@@ -890,14 +948,6 @@ static void incstep (moon_State& L, GlobalState& g) {
 ** at every single check.)
 */
 void moonC_step (moon_State& L) {
-  // === moon fork, Phase 0: tracing collector NEUTERED ===
-  // ARC (reference counting) will replace the tracing GC. For now the collector
-  // never marks/sweeps/frees; objects leak by design (acyclic frees arrive in
-  // Phase 1). Push the debt far out so the per-allocation condGC check does not
-  // call us on every allocation.
-  moonE_setdebt(G(L), 1000000);
-  return;
-  // ---- original tracing step below is unreachable in Phase 0 ----
   GlobalState *g = G(L);
   moon_assert(!g->getGCEmergency());
   if (!g->isGCRunning()) {  // not running?
@@ -934,11 +984,6 @@ static void fullinc (moon_State& L, GlobalState& g) {
 ** unexpected ways (running finalizers and shrinking some structures).
 */
 void moonC_fullgc (moon_State& L, int isemergency) {
-  // === moon fork, Phase 0: tracing collector NEUTERED (see moonC_step) ===
-  // A full collection is now a no-op. collectgarbage() therefore reclaims
-  // nothing; objects live until the state is closed (moonC_freeallobjects).
-  return;
-  // ---- original full collection below is unreachable in Phase 0 ----
   GlobalState *g = G(L);
   moon_assert(!g->getGCEmergency());
   g->setGCEmergency(cast_byte(isemergency));  // set flag
@@ -951,9 +996,30 @@ void moonC_fullgc (moon_State& L, int isemergency) {
       g->setGCKind(GCKind::GenerationalMajor);
       break;
   }
+  if (isemergency)  // memory must be really free before trying again
+    GCSweeper::wait(*g);
+  moonM_freerecycled(g);  // give recycled blocks back to the allocator
   g->setGCEmergency(0);
 }
 
+
+/*
+** Wait until the background sweeper (if any) has freed all objects
+** handed to it, e.g. before changing the allocator.
+*/
+void moonC_waitsweep (moon_State& L) {
+  GCSweeper::wait(*G(L));
+}
+
+
+/*
+** Stop the background sweeper (if any), after it frees all objects
+** handed to it.
+*/
+void moonC_stopsweep (moon_State& L) {
+  GCSweeper::stop(*G(L));
+}
+
 // }======================================================
 
 
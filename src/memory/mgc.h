@@ -433,17 +433,20 @@ inline void moonC_barrierback(moon_State* L, GCObject* p, const TValue* v) noexc
 
 // Use GCObject::fix() method instead of moonC_fix
 MOONI_FUNC void moonC_freeallobjects (moon_State& L);
+MOONI_FUNC void moonC_waitsweep (moon_State& L);
+MOONI_FUNC void moonC_stopsweep (moon_State& L);
 
 // ARC (automatic reference counting) reclamation engine — moon fork, Phase 1.
-// Deferred model: moonC_incref/moonC_decref adjust an object's refcount without
-// needing a moon_State (decref queues zero-count objects); moonC_drain(L)
-// reclaims the queue at a safe point, recursively releasing children. Cycles
-// never reach zero and so leak by design. moonC_release(L,o) is decref+drain for
-// convenience. The deinit counter is a debug aid for tests.
+// Deferred model: moonC_incref/moonC_decref adjust an object's refcount (decref
+// queues zero-count objects in the global state); moonC_drain(L) reclaims the
+// queue at a safe point, recursively releasing children. Cycles
+// never reach zero and are left to the tracing collector. moonC_release(L,o)
+// is decref+drain for convenience. The deinit counter is a debug aid for tests.
 inline void moonC_incref (GCObject *o) noexcept { o->retain(); }
-MOONI_FUNC void moonC_decref (GCObject *o) noexcept;
+MOONI_FUNC void moonC_decref (GlobalState *g, GCObject *o) noexcept;
 MOONI_FUNC void moonC_drain (moon_State& L);
 MOONI_FUNC void moonC_release (moon_State& L, GCObject *o);
+MOONI_FUNC void moonC_arcpurge (GlobalState& g) noexcept;
 inline void moonC_retain (GCObject *o) noexcept { o->retain(); }  // alias of incref
 MOONI_FUNC unsigned long long moonC_deinitcount() noexcept;
 MOONI_FUNC void moonC_resetdeinitcount() noexcept;
@@ -524,8 +527,7 @@ inline void* Table::operator new(size_t size, moon_State* L, MoonT tt) {
 ** Use this for stack-to-stack assignments or when you know barriers aren't needed.
 */
 inline TValue& TValue::operator=(const TValue& other) noexcept {
-	value_ = other.value_;
-	tt_ = other.tt_;
+	copy(&other);
 	return *this;
 }
 
@@ -8,6 +8,7 @@
 #include "mprefix.h"
 
 
+#include <algorithm>
 #include <cstddef>
 
 #include "moon.h"
@@ -142,26 +143,133 @@ l_noret moonM_toobig (moon_State *L) {
 }
 
 
+MOONI_DDEF thread_local constinit bool moonM_uncounted = false;
+
+
+/*
+** {==================================================================
+** Recycling of small blocks
+** ===================================================================
+*/
+
+/*
+** Free list for blocks of 'size' bytes, or 0 if blocks of that size
+** are not recycled. Sizes must match exactly, as the allocator gets
+** the block size back when the block is freed or reallocated.
+*/
+static inline int recycleclass (size_t size) noexcept {
+  if (size <= MOONI_RECYCLEMAX && size % sizeof(void*) == 0)
+    return cast_int(size / sizeof(void*));
+  else
+    return 0;
+}
+
+
+/*
+** Try to keep a freed block for reuse. The block is counted as freed
+** all the same, so the collector sees the same debt as without
+** recycling.
+*/
+static bool recycleblock (GlobalState *g, void *block, size_t size) {
+  int c = recycleclass(size);
+  if (c == 0 || !g->getRecycle())
+    return false;
+  size_t limit = cast_sizet(g->getTotalBytes());
+  if (g->getNRecycled() + size > std::max(limit, MOONI_RECYCLELIMIT))
+    return false;
+  *static_cast<void**>(block) = g->getRecycled(c);
+  g->setRecycled(c, block);
+  g->setNRecycled(g->getNRecycled() + size);
+  return true;
+}
+
+
+/*
+** Take a recycled block of 'size' bytes, if there is one.
+*/
+static inline void *reuseblock (GlobalState *g, size_t size) {
+  int c = recycleclass(size);
+  void *block = g->getRecycled(c);
+  if (block != nullptr) {
+    g->setRecycled(c, *static_cast<void**>(block));
+    g->setNRecycled(g->getNRecycled() - size);
+  }
+  return block;
+}
+
+
+/*
+** Give all recycled blocks back to the allocator. (They were already
+** counted as freed.)
+*/
+void moonM_freerecycled (GlobalState *g) {
+  for (int c = 1; c < MOONI_RECYCLECLASSES; c++) {
+    size_t size = cast_sizet(c) * sizeof(void*);
+    void *block = g->getRecycled(c);
+    while (block != nullptr) {
+      void *next = *static_cast<void**>(block);
+      callfrealloc(g, block, size, 0);
+      block = next;
+    }
+    g->setRecycled(c, nullptr);
+  }
+  g->setNRecycled(0);
+}
+
+// }==================================================================
+
+
 /*
 ** Free memory
 */
 void moonM_free_ (moon_State *L, void *block, size_t osize) {
   GlobalState *g = G(L);
   moon_assert((osize == 0) == (block == nullptr));
-  callfrealloc(g, block, osize, 0);
+  if (l_unlikely(moonM_uncounted)) {  // background sweeper?
+    callfrealloc(g, block, osize, 0);  // (recycled lists are not shared)
+    return;
+  }
+  if (!recycleblock(g, block, osize))
+    callfrealloc(g, block, osize, 0);
   g->getGCDebtRef() += static_cast<l_mem>(osize);
 }
 
 
 /*
-** In case of allocation fail, this function will do an emergency
-** collection to free some memory and then try the allocation again.
+** Would an allocation that grows the memory in use by 'delta' bytes
+** go over the limit set by 'moon_setmemlimit'?
+*/
+static inline bool overlimit (GlobalState *g, l_mem delta) noexcept {
+  l_mem limit = g->getGCMemLimit();
+  return (l_unlikely(limit > 0) && delta > 0 &&
+          g->getTotalBytes() + delta > limit);
+}
+
+
+/*
+** Count 'delta' new bytes in use (which may be negative), keeping the
+** peak up to date.
+*/
+static inline void addinuse (GlobalState *g, l_mem delta) noexcept {
+  g->getGCDebtRef() -= delta;
+  l_mem inuse = g->getTotalBytes();
+  if (inuse > g->getGCPeak())
+    g->setGCPeak(inuse);
+}
+
+
+/*
+** In case of allocation fail (or of an allocation over the limit),
+** this function will do an emergency collection to free some memory
+** and then try the allocation again.
 */
 static void *tryagain (moon_State *L, void *block,
-                       size_t osize, size_t nsize) {
+                       size_t osize, size_t nsize, l_mem delta) {
   GlobalState *g = G(L);
   if (cantryagain(g)) {
     moonC_fullgc(*L, 1);  // try to free some memory...
+    if (overlimit(g, delta))  // still over the limit?
+      return nullptr;
     return callfrealloc(g, block, osize, nsize);  // try again
   }
   else return nullptr;  // cannot run an emergency collection
@@ -172,17 +280,23 @@ static void *tryagain (moon_State *L, void *block,
 ** Generic allocation routine.
 */
 void *moonM_realloc_ (moon_State *L, void *block, size_t osize, size_t nsize) {
-  void *newblock;
+  void *newblock = nullptr;
   GlobalState *g = G(L);
+  l_mem delta = static_cast<l_mem>(nsize) - static_cast<l_mem>(osize);
   moon_assert((osize == 0) == (block == nullptr));
-  newblock = firsttry(g, block, osize, nsize);
+  if (!overlimit(g, delta)) {
+    if (block == nullptr)
+      newblock = reuseblock(g, nsize);
+    if (newblock == nullptr)
+      newblock = firsttry(g, block, osize, nsize);
+  }
   if (l_unlikely(newblock == nullptr && nsize > 0)) {
-    newblock = tryagain(L, block, osize, nsize);
+    newblock = tryagain(L, block, osize, nsize, delta);
     if (newblock == nullptr)  // still no memory?
       return nullptr;  // do not update 'GCdebt'
   }
   moon_assert((nsize == 0) == (newblock == nullptr));
-  g->getGCDebtRef() -= static_cast<l_mem>(nsize) - static_cast<l_mem>(osize);
+  addinuse(g, delta);
   return newblock;
 }
 
@@ -201,13 +315,19 @@ void *moonM_malloc_ (moon_State *L, size_t size, int tag) {
     return nullptr;  // that's all
   else {
     GlobalState *g = G(L);
-    void *newblock = firsttry(g, nullptr, cast_sizet(tag), size);
+    void *newblock = nullptr;
+    if (!overlimit(g, static_cast<l_mem>(size))) {
+      newblock = reuseblock(g, size);
+      if (newblock == nullptr)
+        newblock = firsttry(g, nullptr, cast_sizet(tag), size);
+    }
     if (l_unlikely(newblock == nullptr)) {
-      newblock = tryagain(L, nullptr, cast_sizet(tag), size);
+      newblock = tryagain(L, nullptr, cast_sizet(tag), size,
+                          static_cast<l_mem>(size));
       if (newblock == nullptr)
         moonM_error(L);
     }
-    g->getGCDebtRef() -= static_cast<l_mem>(size);
+    addinuse(g, static_cast<l_mem>(size));
     return newblock;
   }
 }
@@ -23,6 +23,16 @@ MOONI_FUNC l_noret moonM_toobig (moon_State *L);
 [[nodiscard]] MOONI_FUNC void *moonM_saferealloc_ (moon_State *L, void *block, size_t oldsize,
                                                               size_t size);
 MOONI_FUNC void moonM_free_ (moon_State *L, void *block, size_t osize);
+
+/*
+** Frees done by a thread with this flag set are not counted in 'GCdebt'.
+** (The background sweeper sets it; the collector counts those frees in
+** advance. See gc_sweeper.cpp.)
+*/
+MOONI_DDEC(thread_local constinit bool moonM_uncounted;)
+
+class GlobalState;
+MOONI_FUNC void moonM_freerecycled (GlobalState *g);
 [[nodiscard]] MOONI_FUNC void *moonM_growaux_ (moon_State *L, void *block, int nelems,
                                int *size, unsigned size_elem, int limit,
                                const char *what);
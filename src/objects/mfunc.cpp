@@ -20,6 +20,7 @@
 #include "mmem.h"
 #include "mobject.h"
 #include "mstate.h"
+#include "mvmstats.h"
 
 
 
@@ -287,6 +288,12 @@ lu_mem moonF_protosize (Proto *p) {
 
 
 void Proto::free(moon_State* L) {
+  if (l_unlikely(G(L)->getProfiler() != nullptr))
+    moonG_profforget(L, this);  // its address may be reused
+  if (l_unlikely(G(L)->getHeapProfiler() != nullptr))
+    moonG_heapforget(L, this);
+  if (l_unlikely(G(L)->getVMStats() != nullptr))
+    moonV_statsforget(L, this);
   if (!(getFlag() & PF_FIXED)) {
     moonM_freearray(L, getCode(), cast_sizet(getCodeSize()));
     moonM_freearray(L, getLineInfo(), cast_sizet(getLineInfoSize()));
@@ -78,8 +78,7 @@ public:
   UpVal() noexcept
     : v{nullptr}, u{} {
     // Initialize u union as closed upvalue with nil
-    u.value.valueField().n = 0;  // Zero-initialize Value union
-    u.value.setType(MOON_TNIL);
+    u.value.setTagged(Value{}, MoonT::NIL);
   }
 
   // Destructor - trivial (GC handles deallocation)
@@ -108,64 +108,67 @@ inline void TValue::setFalse() noexcept { setType(MoonT::VFALSE); }
 inline void TValue::setTrue() noexcept { setType(MoonT::VTRUE); }
 
 inline void TValue::setInt(moon_Integer i) noexcept {
-  value_.i = i;
-  setType(MoonT::NUMINT);
+  Value v;
+  v.i = i;
+  setTagged(v, MoonT::NUMINT);
 }
 
 inline void TValue::setFloat(moon_Number n) noexcept {
-  value_.n = n;
-  setType(MoonT::NUMFLT);
+  Value v;
+  v.n = n;
+  setTagged(v, MoonT::NUMFLT);
 }
 
 inline void TValue::setPointer(void* p) noexcept {
-  value_.p = p;
-  setType(MoonT::LIGHTUSERDATA);
+  Value v;
+  v.p = p;
+  setTagged(v, MoonT::LIGHTUSERDATA);
 }
 
 inline void TValue::setFunction(moon_CFunction f) noexcept {
-  value_.f = f;
-  setType(MoonT::LCF);
+  Value v;
+  v.f = f;
+  setTagged(v, MoonT::LCF);
 }
 
-inline void TValue::setString(moon_State* L, TString* s) noexcept {
-  value_.gc = reinterpret_cast<GCObject*>(s);
-  tt_ = ctb(s->getType());
+inline void TValue::setGCTagged(GCObject* gc, MoonT t) noexcept {
+  Value v;
+  v.gc = gc;
+  setTagged(v, t);
+}
+
+inline void TValue::setGCObject(moon_State* L, GCObject* gc) noexcept {
+  setGCTagged(gc, ctb(gc->getType()));
   (void)L; // checkliveness removed - needs lstate.h
 }
 
+inline void TValue::setString(moon_State* L, TString* s) noexcept {
+  setGCTagged(reinterpret_cast<GCObject*>(s), ctb(s->getType()));
+  (void)L;
+}
+
 inline void TValue::setUserdata(moon_State* L, Udata* u) noexcept {
-  value_.gc = reinterpret_cast<GCObject*>(u);
-  tt_ = ctb(MoonT::USERDATA);
+  setGCTagged(reinterpret_cast<GCObject*>(u), ctb(MoonT::USERDATA));
   (void)L;
 }
 
 inline void TValue::setTable(moon_State* L, Table* t) noexcept {
-  value_.gc = reinterpret_cast<GCObject*>(t);
-  tt_ = ctb(MoonT::TABLE);
+  setGCTagged(reinterpret_cast<GCObject*>(t), ctb(MoonT::TABLE));
   (void)L;
 }
 
 inline void TValue::setLClosure(moon_State* L, LClosure* cl) noexcept {
-  value_.gc = reinterpret_cast<GCObject*>(cl);
-  tt_ = ctb(MoonT::LCL);
+  setGCTagged(reinterpret_cast<GCObject*>(cl), ctb(MoonT::LCL));
   (void)L;
 }
 
 inline void TValue::setCClosure(moon_State* L, CClosure* cl) noexcept {
-  value_.gc = reinterpret_cast<GCObject*>(cl);
-  tt_ = ctb(MoonT::CCL);
+  setGCTagged(reinterpret_cast<GCObject*>(cl), ctb(MoonT::CCL));
   (void)L;
 }
 
 inline void TValue::setThread(moon_State* L, moon_State* th) noexcept {
-  value_.gc = reinterpret_cast<GCObject*>(th);
-  tt_ = ctb(MoonT::THREAD);
-  (void)L;
-}
-
-inline void TValue::setGCObject(moon_State* L, GCObject* gc) noexcept {
-  value_.gc = gc;
-  tt_ = ctb(gc->getType());
+  setGCTagged(reinterpret_cast<GCObject*>(th), ctb(MoonT::THREAD));
   (void)L;
 }
 
@@ -501,7 +504,8 @@ inline void Table::fastSeti(moon_Integer k, TValue* val, int& hres) noexcept {
   moon_Unsigned u = l_castS2U(k) - 1u;
   if (u < this->arraySize()) {
     MoonT* tag = this->getArrayTag(u);
-    if (checknoTM(this->getMetatable(), TMS::TM_NEWINDEX) || !tagisempty(*tag)) {
+    if (l_likely(!isFrozen()) &&
+        (checknoTM(this->getMetatable(), TMS::TM_NEWINDEX) || !tagisempty(*tag))) {
       fval2arr(this, u, tag, val);
       hres = HOK;
     } else {
@@ -160,7 +160,7 @@ constexpr bool TValue::isInteger() const noexcept { return checktag(this, MoonT:
 
 // TValue::numberValue() implementation (needs NUMINT constant)
 inline moon_Number TValue::numberValue() const noexcept {
-  return (tt_ == MoonT::NUMINT) ? static_cast<moon_Number>(value_.i) : value_.n;
+  return (getType() == MoonT::NUMINT) ? static_cast<moon_Number>(intValue()) : floatValue();
 }
 
 inline moon_Number nvalue(const TValue* o) noexcept { return o->numberValue(); }
@@ -206,11 +206,11 @@ protected:
   lu_byte gcHeaderReserved_[sizeof(GCObject*) - 2 * sizeof(lu_byte)
                             - sizeof(std::uint32_t)];
   /*
-  ** ARC (automatic reference counting) reference count. Phase 0 of the moon
-  ** fork: this field is DORMANT — it is initialised to 1 at allocation but no
-  ** retain/release traffic exists yet (the tracing GC is neutered, so nothing is
-  ** freed). Phase 1 wires retain/release and deterministic frees. Carved out of
-  ** the header's reserved padding so the object header stays exactly two words.
+  ** ARC (automatic reference counting) reference count. This field is DORMANT:
+  ** it is initialised to 1 at allocation but no retain/release traffic exists
+  ** yet, so the tracing collector (see mgc.cpp) is what reclaims objects,
+  ** cycles included. Carved out of the header's reserved padding so the object
+  ** header stays exactly two words.
   */
   mutable std::uint32_t refcount;
 
@@ -241,7 +241,7 @@ public:
   // Marked field bit manipulation helpers (for backward compatibility)
   lu_byte& getMarkedRef() const noexcept { return marked; }  // const - marked is mutable
 
-  // ARC reference count (dormant in Phase 0; see field declaration above).
+  // ARC reference count (dormant; see field declaration above).
   std::uint32_t getRefcount() const noexcept { return refcount; }
   void setRefcount(std::uint32_t rc) const noexcept { refcount = rc; }
   void retain() const noexcept { ++refcount; }            // increment (not yet wired)
@@ -338,7 +338,7 @@ public:
 constexpr bool iscollectable(const TValue* o) noexcept { return (static_cast<int>(rawtt(o)) & BIT_ISCOLLECTABLE) != 0; }
 constexpr bool iscollectable(MoonT tag) noexcept { return (static_cast<int>(tag) & BIT_ISCOLLECTABLE) != 0; }
 
-constexpr bool TValue::isCollectable() const noexcept { return (static_cast<int>(tt_) & BIT_ISCOLLECTABLE) != 0; }
+constexpr bool TValue::isCollectable() const noexcept { return (static_cast<int>(getType()) & BIT_ISCOLLECTABLE) != 0; }
 
 inline GCObject* gcvalue(const TValue* o) noexcept { return o->gcValue(); }
 
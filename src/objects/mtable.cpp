@@ -1085,7 +1085,7 @@ static int retpsetcode (Table& t, const TValue *slot) {
 
 
 static int finishnodeset (Table& t, TValue *slot, TValue *val) {
-  if (!ttisnil(slot)) {
+  if (!ttisnil(slot) && l_likely(!t.isFrozen())) {
     *slot = *val;
     return HOK;  // success
   }
@@ -1293,6 +1293,8 @@ int Table::psetInt(moon_Integer key, TValue* val) {
 
 int Table::psetShortStr(TString* key, TValue* val) {
   TValue *slot = HgetShortStr(key);
+  if (l_unlikely(isFrozen()))
+    return retpsetcode(*this, slot);  // caller raises the error
   if (!ttisnil(slot)) {  // key already has a value? (all too common)
     *slot = *val;  /* update it */
     return HOK;  // done
@@ -1328,6 +1330,8 @@ void Table::set(moon_State* L, const TValue* key, TValue* value) {
   // also owns its (collectable) key. Capture the old value, retain the new
   // value/key before the write, release the old value after. 'resize' moves
   // entries via insertkey and bypasses this path, so moves are not recounted.
+  if (l_unlikely(isFrozen()))
+    frozenError(L);
   TValue oldv; oldv.setNil(); (void)get(key, &oldv);
   const bool newentry = ttisnil(&oldv);
   if (iscollectable(value)) moonC_incref(gcvalue(value));
@@ -1335,11 +1339,13 @@ void Table::set(moon_State* L, const TValue* key, TValue* value) {
   int hres = pset(key, value);
   if (hres != HOK)
     finishSet(L, key, value, hres);
-  if (iscollectable(&oldv)) moonC_decref(gcvalue(&oldv));
+  if (iscollectable(&oldv)) moonC_decref(G(L), gcvalue(&oldv));
 }
 
 void Table::setInt(moon_State* L, moon_Integer key, TValue* value) {
   // ARC accounting (see Table::set). Integer keys are not collectable.
+  if (l_unlikely(isFrozen()))
+    frozenError(L);
   TValue oldv; oldv.setNil(); (void)getInt(key, &oldv);
   if (iscollectable(value)) moonC_incref(gcvalue(value));
   unsigned ik = ikeyinarray(this, key);
@@ -1353,11 +1359,13 @@ void Table::setInt(moon_State* L, moon_Integer key, TValue* value) {
       moonH_newkey(L, *this, &k, value);
     }
   }
-  if (iscollectable(&oldv)) moonC_decref(gcvalue(&oldv));
+  if (iscollectable(&oldv)) moonC_decref(G(L), gcvalue(&oldv));
 }
 
 void Table::finishSet(moon_State* L, const TValue* key, TValue* value, int hres) {
   moon_assert(hres != HOK);
+  if (l_unlikely(isFrozen()))
+    frozenError(L);
   if (hres == HNOTFOUND) {
     TValue aux;
     if (l_unlikely(ttisnil(key)))
@@ -1429,6 +1437,58 @@ void Table::resizeArray(moon_State* L, unsigned newArraySize) {
   this->resize(L, newArraySize, nsize);
 }
 
+/*
+** Grow the array part to hold the keys in [first, last], when that
+** range starts inside (or right after) the array part and fits in an
+** array; otherwise, leave the table as it is. Bulk writes call this
+** once instead of letting each new key trigger a rehash. The part at
+** least doubles, so that appending in chunks stays linear (and the
+** array is still more than half full).
+*/
+void Table::reserveArray(moon_State* L, moon_Integer first, moon_Integer last) {
+  unsigned oldsize = this->arraySize();
+  if (1 <= first && first <= last && l_castS2U(first) - 1u <= oldsize &&
+      l_castS2U(last) > oldsize && l_castS2U(last) <= MAXASIZE) {
+    unsigned newsize = cast_uint(last);
+    if (oldsize <= MAXASIZE / 2 && newsize < 2 * oldsize)
+      newsize = 2 * oldsize;
+    this->resizeArray(L, newsize);
+  }
+}
+
+/*
+** Make the table immutable. As a frozen table never grows, its parts
+** are first shrunk to the smallest sizes that hold its current
+** contents (dropping the slack left by growth and deletions).
+*/
+void Table::freeze(moon_State* L) {
+  if (isFrozen())
+    return;
+  Counters counters;
+  std::fill_n(counters.nums, MAXABITS + 1, 0);
+  counters.arrayCount = 0;
+  counters.deleted = 0;
+  counters.total = 0;
+  numusearray(*this, &counters);
+  if (!isDummy()) {  // count live keys in hash part ('numusehash' expects a full one)
+    for (unsigned i = 0; i < nodeSize(); i++) {
+      const Node *n = getNode(i);
+      if (!isempty(gval(n))) {
+        counters.total++;
+        if (n->isKeyInteger())
+          countint(n->getKeyIntValue(), &counters);
+      }
+    }
+  }
+  unsigned newArraySize = computesizes(&counters);
+  resize(L, newArraySize, counters.total - counters.arrayCount);
+  setFlagBits(BITFROZEN);
+}
+
+void Table::frozenError(moon_State* L) {
+  moonG_runerror(L, "attempt to modify a frozen table");
+}
+
 lu_mem Table::size() const {
   lu_mem sz = static_cast<lu_mem>(sizeof(Table)) + concretesize(this->arraySize());
   if (!this->isDummy())
@@ -1436,28 +1496,62 @@ lu_mem Table::size() const {
   return sz;
 }
 
-int Table::tableNext(moon_State* L, StkId key) const {
-  unsigned int arraysize = this->arraySize();
-  unsigned int i = findindex(L, *this, s2v(key), arraysize);  // find original key
+/*
+** Traversal step from index 'i' (as returned by 'findindex'): puts the
+** next non-empty entry in 'key' and 'key + 1' and returns its index
+** (plus one), or 0 if there are no more elements.
+*/
+static unsigned nextfrom (moon_State *L, const Table& t, StkId key,
+                          unsigned i) {
+  unsigned int arraysize = t.arraySize();
   for (; i < arraysize; i++) {  // try first array part
-    MoonT tag = *this->getArrayTag(i);
+    MoonT tag = *t.getArrayTag(i);
     if (!tagisempty(tag)) {  // a non-empty entry?
       s2v(key)->setInt(cast_int(i) + 1);
-      farr2val(this, i, tag, s2v(key + 1));
-      return 1;
+      farr2val(&t, i, tag, s2v(key + 1));
+      return i + 1;
     }
   }
-  for (i -= arraysize; i < this->nodeSize(); i++) {  // hash part
-    if (!isempty(gval(gnode(this, i)))) {  // a non-empty entry?
-      Node *n = gnode(this, i);
+  for (i -= arraysize; i < t.nodeSize(); i++) {  // hash part
+    if (!isempty(gval(gnode(&t, i)))) {  // a non-empty entry?
+      Node *n = gnode(&t, i);
       n->getKey(L, s2v(key));
       L->getStackSubsystem().setSlot(key + 1, gval(n));
-      return 1;
+      return (i + 1) + arraysize;
     }
   }
   return 0;  // no more elements
 }
 
+int Table::tableNext(moon_State* L, StkId key) const {
+  unsigned int i = findindex(L, *this, s2v(key), this->arraySize());
+  return nextfrom(L, *this, key, i) != 0;
+}
+
+/*
+** Like 'tableNext', but 'hint' is the index returned by the previous
+** step of this traversal (0 if unknown). The hint is trusted only if
+** it still names 'key' in the current layout of the table, so a table
+** resized (or a key changed) in the middle of a traversal just costs
+** a regular lookup. Returns the index of the new key, or 0 at the end.
+*/
+unsigned Table::tableNextHint(moon_State* L, StkId key, unsigned hint) const {
+  const TValue *k = s2v(key);
+  unsigned int arraysize = this->arraySize();
+  unsigned int i;
+  if (ttisnil(k))
+    i = 0;  // first iteration
+  else if (hint != 0 && hint <= arraysize && ttisinteger(k) &&
+           l_castS2U(ivalue(k)) == hint)
+    i = hint;  // array entry still in place
+  else if (hint > arraysize && hint - arraysize <= this->nodeSize() &&
+           equalkey(k, gnode(this, hint - arraysize - 1), 1))
+    i = hint;  // node entry still in place
+  else
+    i = findindex(L, *this, s2v(key), arraysize);
+  return nextfrom(L, *this, key, i);
+}
+
 moon_Unsigned Table::getn(moon_State* L) {
   unsigned arraysize = this->arraySize();
   if (arraysize > 0) {  // is there an array part?
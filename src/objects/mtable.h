@@ -39,6 +39,15 @@ inline Table* hvalue(const TValue* o) noexcept { return o->tableValue(); }
 */
 class Node {
 private:
+#if defined(MOON_NANBOXING)
+  // a NaN-boxed value is a proper 'TValue' in a single word
+  struct {
+    TValue i_val;  // value
+    MoonT key_tt;  // key type
+    int next;  // for chaining
+    Value key_val;  // key value
+  } u;
+#else
   union {
     struct {
       Value value_;  // value
@@ -49,14 +58,24 @@ private:
     } u;
     TValue i_val;  // direct access to node's value as a proper 'TValue'
   };
+#endif
 
 public:
+#if defined(MOON_NANBOXING)
+  // Default constructor
+  constexpr Node() noexcept : u{TValue({0}, MoonT::NIL), static_cast<MoonT>(MOON_TNIL), 0, {0}} {}
+
+  // Constructor for initializing with explicit values
+  constexpr Node(Value val, MoonT val_tt, MoonT key_tt, int next_val, Value key_val) noexcept
+    : u{TValue(val, val_tt), key_tt, next_val, key_val} {}
+#else
   // Default constructor
   constexpr Node() noexcept : u{{0}, MoonT::NIL, static_cast<MoonT>(MOON_TNIL), 0, {0}} {}
 
   // Constructor for initializing with explicit values
   constexpr Node(Value val, MoonT val_tt, MoonT key_tt, int next_val, Value key_val) noexcept
     : u{val, val_tt, key_tt, next_val, key_val} {}
+#endif
 
   // Copy assignment operator (needed because union contains TValue with user-declared operator=)
   Node& operator=(const Node& other) noexcept {
@@ -65,8 +84,13 @@ public:
   }
 
   // Value access
+#if defined(MOON_NANBOXING)
+  TValue* getValue() noexcept { return &u.i_val; }
+  const TValue* getValue() const noexcept { return &u.i_val; }
+#else
   TValue* getValue() noexcept { return &i_val; }
   const TValue* getValue() const noexcept { return &i_val; }
+#endif
 
   // Next chain access
   int& getNext() noexcept { return u.next; }
@@ -137,8 +161,7 @@ public:
 
   // Copy key to TValue
   void getKey(moon_State* L, TValue* obj) const noexcept {
-    obj->valueField() = u.key_val;
-    obj->setType(u.key_tt);
+    obj->setTagged(u.key_val, u.key_tt);
     (void)L; // checkliveness removed to avoid forward declaration issues
   }
 };
@@ -220,6 +243,8 @@ public:
   bool isDummy() const noexcept { return (flags & (1 << 6)) != 0; }
   void setDummy() noexcept { flags |= (1 << 6); }
   void setNoDummy() noexcept { flags &= cast_byte(~(1 << 6)); }
+  // Note: BITFROZEN = (1 << 7), defined below
+  bool isFrozen() const noexcept { return (flags & (1 << 7)) != 0; }
   // invalidateTMCache uses maskflags from ltm.h, so can't inline here - use macro instead
 
   // Additional table helper methods
@@ -276,9 +301,13 @@ public:
   void finishSet(moon_State* L, const TValue* key, TValue* value, int hres);
 
   void resize(moon_State* L, unsigned newArraySize, unsigned newHashSize);
+  void freeze(moon_State* L);
+  [[noreturn]] static void frozenError(moon_State* L);
   void resizeArray(moon_State* L, unsigned newArraySize);
+  void reserveArray(moon_State* L, moon_Integer first, moon_Integer last);
   [[nodiscard]] lu_mem size() const;
   [[nodiscard]] int tableNext(moon_State* L, StkId key) const;  // renamed from next() to avoid conflict with GC field
+  [[nodiscard]] unsigned tableNextHint(moon_State* L, StkId key, unsigned hint) const;
   [[nodiscard]] moon_Unsigned getn(moon_State* L);
 
   // Factory and helper methods
@@ -324,6 +353,13 @@ inline constexpr lu_byte BITDUMMY = (1 << 6);
 inline constexpr lu_byte NOTBITDUMMY = cast_byte(~BITDUMMY);
 
 
+/*
+** Bit BITFROZEN set in 'flags' means the table is immutable: every write
+** to it (raw or not) raises an error, and so does changing its metatable.
+*/
+inline constexpr lu_byte BITFROZEN = (1 << 7);
+
+
 
 // Definitions moved after farr2val and fval2arr are defined (see below)
 
@@ -385,8 +421,7 @@ inline constexpr int HFIRSTNODE = 3;
 ** Move TValues to/from arrays, using C indices
 */
 inline void arr2obj(const Table* h, moon_Unsigned k, TValue* val) noexcept {
-  val->setType(*h->getArrayTag(k));
-  val->valueField() = *h->getArrayVal(k);
+  val->setTagged(*h->getArrayVal(k), *h->getArrayTag(k));
 }
 
 inline void obj2arr(Table* h, moon_Unsigned k, const TValue* val) noexcept {
@@ -400,8 +435,7 @@ inline void obj2arr(Table* h, moon_Unsigned k, const TValue* val) noexcept {
 ** precomputed tag value or address as an extra argument.
 */
 inline void farr2val(const Table* h, moon_Unsigned k, MoonT tag, TValue* res) noexcept {
-  res->setType(tag);
-  res->valueField() = *h->getArrayVal(k);
+  res->setTagged(*h->getArrayVal(k), tag);
 }
 
 inline void fval2arr(Table* h, moon_Unsigned k, MoonT* tag, const TValue* val) noexcept {
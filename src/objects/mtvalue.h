@@ -11,6 +11,12 @@
 
 #include <utility>
 
+#if defined(MOON_NANBOXING)
+#include <array>
+#include <bit>
+#include <cstdint>
+#endif
+
 /*
 ** tags for Tagged Values have the following use of bits:
 ** bits 0-3: actual tag (a MOON_T* constant)
@@ -119,10 +125,47 @@ class GCObject;
 */
 class TValue {
 private:
+#if defined(MOON_NANBOXING)
+  uint64_t bits_;  // a float or a NaN boxing any other value (see below)
+
+  static constexpr uint64_t box(const Value& v, MoonT t) noexcept;
+#else
   Value value_;
   MoonT tt_;
+#endif
 
 public:
+#if defined(MOON_NANBOXING)
+  // Constexpr constructor for static initialization
+  constexpr TValue(Value v, MoonT t) noexcept : bits_(box(v, t)) {}
+  constexpr TValue(Value v, lu_byte t) noexcept : bits_(box(v, static_cast<MoonT>(t))) {}  // for compatibility
+
+  // Default constructor
+  TValue() = default;
+
+  // Inline accessors for hot-path access (defined below, after the tag codes)
+  constexpr MoonT getType() const noexcept;
+  lu_byte getRawType() const noexcept { return static_cast<lu_byte>(getType()); }  // for legacy code
+  Value getValue() const noexcept;
+
+  // Value accessors
+  moon_Integer intValue() const noexcept {
+    return static_cast<moon_Integer>(static_cast<int32_t>(static_cast<uint32_t>(bits_)));
+  }
+  moon_Number floatValue() const noexcept { return std::bit_cast<moon_Number>(bits_); }
+  void* pointerValue() const noexcept;
+  GCObject* gcValue() const noexcept { return static_cast<GCObject*>(pointerValue()); }
+  moon_CFunction functionValue() const noexcept;
+
+  // Type-specific value accessors
+  TString* stringValue() const noexcept { return static_cast<TString*>(pointerValue()); }
+  Udata* userdataValue() const noexcept { return static_cast<Udata*>(pointerValue()); }
+  Table* tableValue() const noexcept { return static_cast<Table*>(pointerValue()); }
+  Closure* closureValue() const noexcept { return static_cast<Closure*>(pointerValue()); }
+  LClosure* lClosureValue() const noexcept { return static_cast<LClosure*>(pointerValue()); }
+  CClosure* cClosureValue() const noexcept { return static_cast<CClosure*>(pointerValue()); }
+  moon_State* threadValue() const noexcept { return static_cast<moon_State*>(pointerValue()); }
+#else
   // Constexpr constructor for static initialization
   constexpr TValue(Value v, MoonT t) noexcept : value_(v), tt_(t) {}
   constexpr TValue(Value v, lu_byte t) noexcept : value_(v), tt_(static_cast<MoonT>(t)) {}  // for compatibility
@@ -131,10 +174,9 @@ public:
   TValue() = default;
 
   // Inline accessors for hot-path access
-  MoonT getType() const noexcept { return tt_; }
+  constexpr MoonT getType() const noexcept { return tt_; }
   lu_byte getRawType() const noexcept { return static_cast<lu_byte>(tt_); }  // for legacy code
   const Value& getValue() const noexcept { return value_; }
-  Value& getValue() noexcept { return value_; }
 
   // Value accessors
   // Integer value (for VKINT/VNUMINT types)
@@ -160,6 +202,7 @@ public:
   LClosure* lClosureValue() const noexcept { return reinterpret_cast<LClosure*>(value_.gc); }
   CClosure* cClosureValue() const noexcept { return reinterpret_cast<CClosure*>(value_.gc); }
   moon_State* threadValue() const noexcept { return reinterpret_cast<moon_State*>(value_.gc); }
+#endif
 
   // Number value (returns int or float depending on type)
   // Note: Actual conversion logic is in nvalue() wrapper below (needs type constants)
@@ -182,9 +225,18 @@ public:
   void setThread(moon_State* L, moon_State* th) noexcept;
   void setGCObject(moon_State* L, GCObject* gc) noexcept;
 
+  // Set value and tag at once (e.g., from the split parts of a table)
+  void setTagged(const Value& v, MoonT t) noexcept;
+  void setGCTagged(GCObject* gc, MoonT t) noexcept;
+
   // Change value (no type change - for optimization)
+#if defined(MOON_NANBOXING)
+  void changeInt(moon_Integer i) noexcept { setInt(i); }
+  void changeFloat(moon_Number n) noexcept { setFloat(n); }
+#else
   void changeInt(moon_Integer i) noexcept { value_.i = i; }
   void changeFloat(moon_Number n) noexcept { value_.n = n; }
+#endif
 
   // Conversion methods (formerly moonV_tonumber_, moonV_tointeger, moonV_tointegerns)
   // Return 1 on success, 0 on failure
@@ -193,16 +245,22 @@ public:
   int toIntegerNoString(moon_Integer* p, F2Imod mode) const;
 
   // Copy from another TValue
+#if defined(MOON_NANBOXING)
+  void copy(const TValue* other) noexcept { bits_ = other->bits_; }
+
+  // Low-level tag access; with NaN boxing, only for tags without a value
+  void setType(MoonT t) noexcept;
+  void setType(lu_byte t) noexcept { setType(static_cast<MoonT>(t)); }  // for legacy code
+#else
   void copy(const TValue* other) noexcept {
     value_ = other->getValue();
     tt_ = other->getType();
   }
 
   // Low-level field access (for macros during transition)
-  Value& valueField() noexcept { return value_; }
-  const Value& valueField() const noexcept { return value_; }
   void setType(MoonT t) noexcept { tt_ = t; }
   void setType(lu_byte t) noexcept { tt_ = static_cast<MoonT>(t); }  // for legacy code
+#endif
 
   // Type checking methods (implementations below after constants are defined)
   // Nil checks
@@ -252,7 +310,7 @@ public:
   bool hasRightType() const noexcept; // GC object has same tag as value
 
   // Low-level type accessors
-  constexpr MoonT rawType() const noexcept { return tt_; }
+  constexpr MoonT rawType() const noexcept { return getType(); }
   constexpr int baseType() const noexcept;
   constexpr MoonT typeTag() const noexcept;
 
@@ -287,8 +345,8 @@ constexpr MoonT ttypetag(const TValue* o) noexcept { return withvariant(rawtt(o)
 constexpr int ttype(const TValue* o) noexcept { return novariant(rawtt(o)); }
 
 // TValue low-level type accessor implementations
-constexpr int TValue::baseType() const noexcept { return novariant(tt_); }
-constexpr MoonT TValue::typeTag() const noexcept { return withvariant(tt_); }
+constexpr int TValue::baseType() const noexcept { return novariant(getType()); }
+constexpr MoonT TValue::typeTag() const noexcept { return withvariant(getType()); }
 
 // Macros to test type
 constexpr bool checktag(const TValue* o, MoonT t) noexcept { return rawtt(o) == t; }
@@ -312,4 +370,118 @@ constexpr MoonT ctb(MoonT t) noexcept { return static_cast<MoonT>(static_cast<in
 inline void settt_(TValue* o, MoonT t) noexcept { o->setType(t); }
 
 
+#if defined(MOON_NANBOXING)
+
+/*
+** {==================================================================
+** NaN boxing (see MOON_NANBOXING in 'moonconf.h')
+** ===================================================================
+** A TValue is a single 64-bit word. A float is stored as itself. Any
+** other value goes into a negative NaN: bits 52-63 are all ones, bits
+** 47-51 hold a small code for the tag (see 'nbtags'), and bits 0-46
+** hold the payload (a pointer or a 32-bit integer). Float NaNs are
+** stored as the canonical positive NaN, so that no float is mistaken
+** for a boxed value; code 0 is never used, as it would be -inf.
+*/
+
+static_assert(sizeof(moon_Integer) <= 4 && sizeof(moon_Number) == 8 &&
+              sizeof(void*) == 8,
+              "NaN boxing needs 32-bit integers, doubles and 64-bit pointers");
+
+inline constexpr int NBCODESHIFT = 47;
+inline constexpr uint64_t NBPAYLOAD = (uint64_t(1) << NBCODESHIFT) - 1;
+inline constexpr uint64_t NBBOXED = uint64_t(0xFFF) << 52;  // sign and exponent
+inline constexpr uint64_t NBCANONICALNAN = uint64_t(0x7FF8) << 48;
+
+// tags of boxed values, indexed by their codes
+inline constexpr std::array<MoonT, 32> nbtags = {
+  MoonT::NUMFLT,  // (code 0 is not a boxed value)
+  MoonT::NIL, MoonT::EMPTY, MoonT::ABSTKEY, MoonT::NOTABLE,
+  MoonT::VFALSE, MoonT::VTRUE, MoonT::NUMINT,
+  MoonT::LIGHTUSERDATA, MoonT::LCF,
+  ctb(MoonT::SHRSTR), ctb(MoonT::LNGSTR), ctb(MoonT::TABLE),
+  ctb(MoonT::LCL), ctb(MoonT::CCL), ctb(MoonT::USERDATA),
+  ctb(MoonT::THREAD), ctb(MoonT::UPVAL), ctb(MoonT::PROTO),
+  static_cast<MoonT>(MOON_NUMTYPES + 2)  // dead keys
+};
+
+// codes of tags (0 for tags that cannot be boxed)
+inline constexpr std::array<lu_byte, 128> nbcodes = [] {
+  std::array<lu_byte, 128> codes{};
+  for (size_t c = 1; c < nbtags.size(); c++)
+    if (nbtags[c] != MoonT::NUMFLT)
+      codes[static_cast<size_t>(nbtags[c])] = static_cast<lu_byte>(c);
+  return codes;
+}();
+
+// high bits of a boxed value with tag 't'
+constexpr uint64_t nbhead(MoonT t) noexcept {
+  return NBBOXED | (uint64_t(nbcodes[static_cast<size_t>(t)]) << NBCODESHIFT);
+}
+
+// bits of a float (NaNs are made canonical)
+inline uint64_t nbfloat(moon_Number n) noexcept {
+  return (n == n) ? std::bit_cast<uint64_t>(n) : NBCANONICALNAN;
+}
+
+constexpr uint64_t TValue::box(const Value& v, MoonT t) noexcept {
+  switch (novariant(t)) {
+    case MOON_TNIL: case MOON_TBOOLEAN:
+      return nbhead(t);
+    case MOON_TNUMBER:
+      if (t == MoonT::NUMINT)
+        return nbhead(t) | static_cast<uint32_t>(v.i);
+      return (v.n == v.n) ? std::bit_cast<uint64_t>(v.n) : NBCANONICALNAN;
+    default:
+      if (t == MoonT::LCF)
+        return nbhead(t) | reinterpret_cast<uintptr_t>(v.f);
+      moon_assert(nbcodes[static_cast<size_t>(t)] != 0 &&
+                  reinterpret_cast<uintptr_t>(v.p) <= NBPAYLOAD);
+      return nbhead(t) | reinterpret_cast<uintptr_t>(v.p);
+  }
+}
+
+constexpr MoonT TValue::getType() const noexcept {
+  uint64_t hi = bits_ >> NBCODESHIFT;
+  return (hi > (NBBOXED >> NBCODESHIFT)) ? nbtags[hi & 0x1F] : MoonT::NUMFLT;
+}
+
+inline void* TValue::pointerValue() const noexcept {
+  return reinterpret_cast<void*>(static_cast<uintptr_t>(bits_ & NBPAYLOAD));
+}
+
+inline moon_CFunction TValue::functionValue() const noexcept {
+  return reinterpret_cast<moon_CFunction>(static_cast<uintptr_t>(bits_ & NBPAYLOAD));
+}
+
+inline Value TValue::getValue() const noexcept {
+  Value v;
+  switch (getType()) {
+    case MoonT::NUMFLT: v.n = floatValue(); break;
+    case MoonT::NUMINT: v.i = intValue(); break;
+    case MoonT::LCF: v.f = functionValue(); break;
+    default: v.p = pointerValue(); break;
+  }
+  return v;
+}
+
+inline void TValue::setTagged(const Value& v, MoonT t) noexcept { bits_ = box(v, t); }
+
+inline void TValue::setType(MoonT t) noexcept {
+  moon_assert(novariant(t) == MOON_TNIL || novariant(t) == MOON_TBOOLEAN);
+  bits_ = nbhead(t);
+}
+
+// }==================================================================
+
+#else
+
+inline void TValue::setTagged(const Value& v, MoonT t) noexcept {
+  value_ = v;
+  tt_ = t;
+}
+
+#endif
+
+
 #endif
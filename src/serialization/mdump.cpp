@@ -17,6 +17,7 @@
 #include "mapi.h"
 #include "mgc.h"
 #include "mobject.h"
+#include "mopcodes.h"
 #include "mstate.h"
 #include "mtable.h"
 #include "mundump.h"
@@ -169,12 +170,26 @@ static void dumpString (DumpState *D, TString *tstring) {
 }
 
 
+/*
+** Dump the code of a function. Instructions quickened by the interpreter
+** go back to their generic form, passing through a small buffer.
+*/
 static void dumpCode (DumpState *D, const Proto& f) {
   auto code = f.getCodeSpan();
   dumpInt(D, static_cast<int>(code.size()));
   dumpAlign(D, sizeof(code[0]));
   moon_assert(code.data() != nullptr);
-  dumpVector(D, code.data(), cast_uint(code.size()));
+  Instruction buff[128];
+  size_t n = 0;
+  for (Instruction i : code) {
+    buff[n++] = moonP_generic(i);
+    if (n == sizeof(buff) / sizeof(buff[0])) {
+      dumpVector(D, buff, n);
+      n = 0;
+    }
+  }
+  if (n > 0)
+    dumpVector(D, buff, n);
 }
 
 
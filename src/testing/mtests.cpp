@@ -13,6 +13,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
+#include <vector>
 
 #include "moon.h"
 
@@ -39,6 +41,8 @@
 #include "moonlib.h"
 #include "MoonVector.h"
 #include "../memory/mgc.h"
+#include "../memory/gc/gc_parallel.h"
+#include "../memory/gc/gc_sweeper.h"
 
 
 
@@ -216,10 +220,17 @@ static void freeblock (Memcontrol *mc, memHeader *block) {
 }
 
 
+/*
+** The allocator may be called from other threads (background sweepers
+** and states of the 'parallel' library), so it runs under a lock.
+*/
+static std::mutex memlock;
+
 void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
   Memcontrol *mc = static_cast<Memcontrol*>(ud);
   memHeader *block = static_cast<memHeader*>(b);
   int type;
+  std::lock_guard<std::mutex> lk(memlock);
   if (mc->memlimit == 0) {  // first time?
     char *limit = getenv("MEMLIMIT");  // initialize memory limit
     mc->memlimit = limit ? strtoul(limit, nullptr, 10) : ULONG_MAX;
@@ -278,6 +289,14 @@ void *debug_realloc (void *ud, void *b, size_t oldsize, size_t size) {
 }
 
 
+moon_State *debug_newstate (void) {
+  moon_State *L = moon_newstate(debug_realloc, &l_memcontrol,
+                                moonL_makeseed(nullptr));
+  if (L)
+    moon_gc(L, MOON_GCBGSWEEP, 1);  // 'debug_realloc' is thread safe
+  return L;
+}
+
 // }======================================================================
 
 
@@ -927,6 +946,7 @@ static int get_sizes (moon_State *L) {
 
 
 static int mem_query (moon_State *L) {
+  moonC_waitsweep(*L);  // counts must include pending frees
   if (moon_isnone(L, 1)) {
     moon_pushinteger(L, cast_Integer(l_memcontrol.total));
     moon_pushinteger(L, cast_Integer(l_memcontrol.numblocks));
@@ -1054,6 +1074,99 @@ static int gc_state (moon_State *L) {
 }
 
 
+/*
+** Turn background sweeping on or off (if a boolean is given); returns
+** its previous setting and the number of objects the helper freed.
+*/
+static int gc_bgsweep (moon_State *L) {
+  int on = moon_isnoneornil(L, 1) ? -1 : moon_toboolean(L, 1);
+  GlobalState *g = G(L);
+  l_mem n = GCSweeper::nfreed(*g);
+  moon_pushboolean(L, moon_gc(L, MOON_GCBGSWEEP, on));
+  moon_pushinteger(L, static_cast<moon_Integer>(n));
+  return 2;
+}
+
+
+/*
+** Turn recycling of small blocks on or off (or just query it); returns
+** the previous setting and the number of bytes kept for reuse.
+*/
+static int gc_recycle (moon_State *L) {
+  int on = moon_isnoneornil(L, 1) ? -1 : moon_toboolean(L, 1);
+  size_t n = G(L)->getNRecycled();
+  moon_pushboolean(L, moon_gc(L, MOON_GCRECYCLE, on));
+  moon_pushinteger(L, static_cast<moon_Integer>(n));
+  return 2;
+}
+
+
+/*
+** T.memlimit(n): sets the memory limit of the state (see
+** 'moon_setmemlimit'); returns the previous one.
+** T.memusage([reset]): returns the bytes in use and their peak.
+*/
+static int mem_limit (moon_State *L) {
+  size_t limit = cast_sizet(moonL_checkinteger(L, 1));
+  moon_pushinteger(L, cast(moon_Integer, moon_setmemlimit(L, limit)));
+  return 1;
+}
+
+
+static int mem_usage (moon_State *L) {
+  size_t peak;
+  size_t inuse = moon_memusage(L, &peak, moon_toboolean(L, 1));
+  moon_pushinteger(L, cast(moon_Integer, inuse));
+  moon_pushinteger(L, cast(moon_Integer, peak));
+  return 2;
+}
+
+
+/*
+** Number of helper threads for parallel marking (0 while the state has
+** not needed them yet) and number of parallel drains done.
+*/
+static int gc_markpool (moon_State *L) {
+  GlobalState *g = G(L);
+  moon_pushinteger(L, GCParallel::nhelpers(*g));
+  moon_pushinteger(L, static_cast<moon_Integer>(GCParallel::ndrains(*g)));
+  return 2;
+}
+
+
+/*
+** Reclaim 'n' small object graphs (a table holding a table and a long
+** string) through the ARC engine, releasing each creator reference, and
+** return how many objects the drain freed.
+*/
+static int arc_free (moon_State *L) {
+  int n = cast_int(moonL_checkinteger(L, 1));
+  int running = moon_gc(L, MOON_GCISRUNNING);
+  unsigned long long c0 = moonC_deinitcount();
+  std::vector<GCObject*> objs;
+  moon_gc(L, MOON_GCSTOP);  // graphs are held only by their counts
+  for (int i = 0; i < n; i++) {
+    moon_newtable(L);
+    objs.push_back(gcvalue(s2v(L->getTop().p - 1)));
+    moon_newtable(L);
+    objs.push_back(gcvalue(s2v(L->getTop().p - 1)));
+    moon_rawseti(L, -2, 1);
+    moon_pushfstring(L, "a long string (not interned) held by graph %d", i);
+    objs.push_back(gcvalue(s2v(L->getTop().p - 1)));
+    moon_rawseti(L, -2, 2);
+    moon_pop(L, 1);
+  }
+  moon_settop(L, 3);  // clear stale copies of the graphs above the top
+  moon_settop(L, 1);
+  for (size_t i = objs.size(); i > 0; i--)  // children first
+    moonC_decref(G(L), objs[i - 1]);
+  moonC_drain(*L);
+  if (running) moon_gc(L, MOON_GCRESTART);
+  moon_pushinteger(L, cast(moon_Integer, moonC_deinitcount() - c0));
+  return 1;
+}
+
+
 static int tracinggc = 0;
 void mooni_tracegctest (moon_State *L, int first) {
   if (!tracinggc) return;
@@ -1356,6 +1469,15 @@ static int loadlib (moon_State *L) {
   return 0;
 }
 
+static int clonestate (moon_State *L) {
+  moon_State *L1 = moon_clonestate(getstate(L));
+  if (L1)
+    moon_pushlightuserdata(L, L1);
+  else
+    moon_pushnil(L);
+  return 1;
+}
+
 static int closestate (moon_State *L) {
   moon_State *L1 = getstate(L);
   moon_close(L1);
@@ -1667,6 +1789,12 @@ static int runC (moon_State *L, moon_State *L1, const char *pc) {
       int tp = moon_getfield(L1, t, getstring);
       moon_assert(tp == moon_type(L1, -1));
     }
+    else if EQ("getfieldk") {
+      int t = moon_absindex(L1, getindex);
+      const moon_Key *k = moonL_internkey(L1, getstring);
+      int tp = moon_getfieldk(L1, t, k);
+      moon_assert(tp == moon_type(L1, -1));
+    }
     else if EQ("getglobal") {
       moon_getglobal(L1, getstring);
     }
@@ -1897,6 +2025,11 @@ static int runC (moon_State *L, moon_State *L1, const char *pc) {
       const char *s = getstring;
       moon_setfield(L1, t, s);
     }
+    else if EQ("setfieldk") {
+      int t = moon_absindex(L1, getindex);
+      const moon_Key *k = moonL_internkey(L1, getstring);
+      moon_setfieldk(L1, t, k);
+    }
     else if EQ("seti") {
       int t = getindex;
       moon_seti(L1, t, getnum);
@@ -2150,6 +2283,180 @@ static int nonblock (moon_State *L) {
 // }======================================================
 
 
+/*
+** {======================================================
+** Bulk table access ('moon_setarray', 'moon_getarray', 'moon_setfields')
+** =======================================================
+*/
+
+static void checkcvalues (moon_State *L, int first, int n,
+                          std::vector<moon_Value> &vs) {
+  vs.resize(cast_sizet(n));
+  for (int i = 0; i < n; i++) {
+    moon_Value &v = vs[cast_sizet(i)];
+    int arg = first + i;
+    v.type = moon_type(L, arg);
+    v.isinteger = moon_isinteger(L, arg);
+    switch (v.type) {
+      case MOON_TBOOLEAN: v.u.b = moon_toboolean(L, arg); break;
+      case MOON_TNUMBER: {
+        if (v.isinteger) v.u.i = moon_tointeger(L, arg);
+        else v.u.n = moon_tonumber(L, arg);
+        break;
+      }
+      case MOON_TSTRING: v.u.s = moon_tolstring(L, arg, &v.len); break;
+      case MOON_TLIGHTUSERDATA: v.u.p = moon_touserdata(L, arg); break;
+      case MOON_TNIL: break;
+      default: moonL_argerror(L, arg, "plain value expected");
+    }
+  }
+}
+
+
+static void pushcvalue (moon_State *L, const moon_Value &v) {
+  switch (v.type) {
+    case MOON_TNIL: moon_pushnil(L); break;
+    case MOON_TBOOLEAN: moon_pushboolean(L, v.u.b); break;
+    case MOON_TNUMBER: {
+      if (v.isinteger) moon_pushinteger(L, v.u.i);
+      else moon_pushnumber(L, v.u.n);
+      break;
+    }
+    case MOON_TSTRING: moon_pushlstring(L, v.u.s, v.len); break;
+    case MOON_TLIGHTUSERDATA: moon_pushlightuserdata(L, cast_voidp(v.u.p)); break;
+    default: moon_pushfstring(L, "<%s>", moon_typename(L, v.type)); break;
+  }
+}
+
+
+/* T.setarray(t, first, ...) */
+static int setarray (moon_State *L) {
+  std::vector<moon_Value> vs;
+  moonL_checktype(L, 1, MOON_TTABLE);
+  moon_Integer first = moonL_checkinteger(L, 2);
+  checkcvalues(L, 3, moon_gettop(L) - 2, vs);
+  moon_setarray(L, 1, first, cast_int(vs.size()), vs.data());
+  return 0;
+}
+
+
+/* T.getarray(t, first, n) */
+static int getarray (moon_State *L) {
+  moonL_checktype(L, 1, MOON_TTABLE);
+  moon_Integer first = moonL_checkinteger(L, 2);
+  int n = cast_int(moonL_checkinteger(L, 3));
+  std::vector<moon_Value> vs(cast_sizet(n));
+  moon_getarray(L, 1, first, n, vs.data());
+  moonL_checkstack(L, n, "too many results");
+  for (const moon_Value &v : vs) pushcvalue(L, v);
+  return n;
+}
+
+
+/* T.setfields(t, keys, ...) */
+static int setfields (moon_State *L) {
+  std::vector<moon_Value> vs;
+  moonL_checktype(L, 1, MOON_TTABLE);
+  moonL_checktype(L, 2, MOON_TTABLE);
+  checkcvalues(L, 3, moon_gettop(L) - 2, vs);
+  moon_setfields(L, 1, 2, cast_int(vs.size()), vs.data());
+  return 0;
+}
+
+
+/*
+** T.bulkfill(n, bulk, records): builds either a column {0.5, 1.0, ...}
+** or a list of records {id = i, score = i/2, ok = true}, one slot at
+** a time or with the bulk functions (for 'bench_bulk.lua').
+*/
+static int bulkfill (moon_State *L) {
+  constexpr int CHUNK = 256;
+  moon_Integer n = moonL_checkinteger(L, 1);
+  bool bulk = moon_toboolean(L, 2);
+  bool records = moon_toboolean(L, 3);
+  moon_Value vs[CHUNK];
+  moon_settop(L, 0);
+  moon_createtable(L, 0, 0);  // 1: result
+  if (!records) {
+    for (moon_Integer i = 1; i <= n; ) {
+      if (bulk) {
+        int c = cast_int((n - i + 1 < CHUNK) ? n - i + 1 : CHUNK);
+        for (int j = 0; j < c; j++) {
+          vs[j].type = MOON_TNUMBER; vs[j].isinteger = 0;
+          vs[j].u.n = cast_num(i + j) * 0.5;
+        }
+        moon_setarray(L, 1, i, c, vs);
+        i += c;
+      }
+      else {
+        moon_pushnumber(L, cast_num(i) * 0.5);
+        moon_rawseti(L, 1, i);
+        i++;
+      }
+    }
+    return 1;
+  }
+  moon_createtable(L, 3, 0);  // 2: keys
+  const char *const names[] = {"id", "score", "ok"};
+  for (int i = 0; i < 3; i++) {
+    moon_pushstring(L, names[i]);
+    moon_rawseti(L, 2, i + 1);
+  }
+  for (moon_Integer i = 1; i <= n; i++) {
+    moon_createtable(L, 0, 3);
+    if (bulk) {
+      vs[0].type = MOON_TNUMBER; vs[0].isinteger = 1; vs[0].u.i = i;
+      vs[1].type = MOON_TNUMBER; vs[1].isinteger = 0;
+      vs[1].u.n = cast_num(i) * 0.5;
+      vs[2].type = MOON_TBOOLEAN; vs[2].u.b = 1;
+      moon_setfields(L, -1, 2, 3, vs);
+    }
+    else {
+      moon_pushinteger(L, i); moon_setfield(L, -2, "id");
+      moon_pushnumber(L, cast_num(i) * 0.5); moon_setfield(L, -2, "score");
+      moon_pushboolean(L, 1); moon_setfield(L, -2, "ok");
+    }
+    moon_rawseti(L, 1, i);
+  }
+  moon_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** T.fieldloop(n, usekeys): does 'n' rounds of reading and writing the
+** fields of a record, with 'moon_getfield'/'moon_setfield' or with key
+** handles (for 'bench_keys.lua'). Returns the record.
+*/
+static int fieldloop (moon_State *L) {
+  moon_Integer n = moonL_checkinteger(L, 1);
+  bool usekeys = moon_toboolean(L, 2);
+  const char *const names[] = {"id", "score", "count"};
+  const moon_Key *keys[3];
+  for (int i = 0; i < 3; i++)
+    keys[i] = moonL_internkey(L, names[i]);
+  moon_createtable(L, 0, 3);
+  for (int i = 0; i < 3; i++) {
+    moon_pushinteger(L, 0);
+    moon_setfield(L, -2, names[i]);
+  }
+  for (moon_Integer r = 0; r < n; r++) {
+    for (int i = 0; i < 3; i++) {
+      if (usekeys) moon_getfieldk(L, -1, keys[i]);
+      else moon_getfield(L, -1, names[i]);
+      moon_Integer v = moon_tointeger(L, -1);
+      moon_pop(L, 1);
+      moon_pushinteger(L, v + i + 1);
+      if (usekeys) moon_setfieldk(L, -2, keys[i]);
+      else moon_setfield(L, -2, names[i]);
+    }
+  }
+  return 1;
+}
+
+// }======================================================
+
+
 /*
 ** Test MoonVector - demonstrates std::vector with MoonAllocator
 ** Usage: testvector(n)
@@ -2199,6 +2506,7 @@ static int testvector (moon_State *L) {
 
 static const struct moonL_Reg tests_funcs[] = {
   {"checkmemory", moon_checkmemory},
+  {"clonestate", clonestate},
   {"closestate", closestate},
   {"d2s", d2s},
   {"doonnewstack", doonnewstack},
@@ -2206,6 +2514,12 @@ static const struct moonL_Reg tests_funcs[] = {
   {"gccolor", gc_color},
   {"gcage", gc_age},
   {"gcstate", gc_state},
+  {"markpool", gc_markpool},
+  {"arcfree", arc_free},
+  {"bgsweep", gc_bgsweep},
+  {"recycle", gc_recycle},
+  {"memlimit", mem_limit},
+  {"memusage", mem_usage},
   {"tracegc", tracegc},
   {"pobj", gc_printobj},
   {"getref", getref},
@@ -2248,6 +2562,11 @@ static const struct moonL_Reg tests_funcs[] = {
   {"externKstr", externKstr},
   {"externstr", externstr},
   {"testvector", testvector},
+  {"setarray", setarray},
+  {"getarray", getarray},
+  {"setfields", setfields},
+  {"bulkfill", bulkfill},
+  {"fieldloop", fieldloop},
   {"nonblock", nonblock},
   {nullptr, nullptr}
 };
@@ -124,9 +124,10 @@ MOON_API int moonB_opentests (moon_State *L);
 MOON_API void *debug_realloc (void *ud, void *block,
                              size_t osize, size_t nsize);
 
+MOON_API moon_State *debug_newstate (void);
 
-#define moonL_newstate()  \
-	moon_newstate(debug_realloc, &l_memcontrol, moonL_makeseed(nullptr))
+
+#define moonL_newstate()	debug_newstate()
 #define mooni_openlibs(L)  \
   {  moonL_openlibs(L); \
      moonL_requiref(L, "T", moonB_opentests, 1); \
@@ -160,6 +161,14 @@ MOON_API void *debug_realloc (void *ud, void *block,
 #define MOONI_MAXSTACK   68000
 
 
+/*
+** Mark every heap in parallel, with a few helper threads even on a
+** single processor, so that the tests exercise the helpers.
+*/
+#define MOONI_GCPARMIN	0
+#define mooni_gcparhelpers()	3
+
+
 // test mode uses more stack space
 #undef MOONI_MAXCCALLS
 #define MOONI_MAXCCALLS	180
@@ -38,6 +38,7 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_GETTABLE,
 &&L_OP_GETI,
 &&L_OP_GETFIELD,
+&&L_OP_GETFORI,
 &&L_OP_SETTABUP,
 &&L_OP_SETTABLE,
 &&L_OP_SETI,
@@ -98,6 +99,7 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_RETURN1,
 &&L_OP_FORLOOP,
 &&L_OP_FORPREP,
+&&L_OP_FORLOOPI,
 &&L_OP_TFORPREP,
 &&L_OP_TFORCALL,
 &&L_OP_TFORLOOP,
@@ -105,6 +107,16 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_CLOSURE,
 &&L_OP_VARARG,
 &&L_OP_VARARGPREP,
+&&L_OP_ADD_II,
+&&L_OP_ADD_FF,
+&&L_OP_SUB_II,
+&&L_OP_SUB_FF,
+&&L_OP_MUL_II,
+&&L_OP_MUL_FF,
+&&L_OP_LT_II,
+&&L_OP_LT_FF,
+&&L_OP_LE_II,
+&&L_OP_LE_FF,
 &&L_OP_EXTRAARG
 
 };
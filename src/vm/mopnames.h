@@ -12,7 +12,7 @@
 
 // ORDER OP
 
-static constexpr std::array<const char*, 84> opnames = {
+static constexpr std::array<const char*, 96> opnames = {
   "MOVE",
   "LOADI",
   "LOADF",
@@ -28,6 +28,7 @@ static constexpr std::array<const char*, 84> opnames = {
   "GETTABLE",
   "GETI",
   "GETFIELD",
+  "GETFORI",
   "SETTABUP",
   "SETTABLE",
   "SETI",
@@ -88,6 +89,7 @@ static constexpr std::array<const char*, 84> opnames = {
   "RETURN1",
   "FORLOOP",
   "FORPREP",
+  "FORLOOPI",
   "TFORPREP",
   "TFORCALL",
   "TFORLOOP",
@@ -95,6 +97,16 @@ static constexpr std::array<const char*, 84> opnames = {
   "CLOSURE",
   "VARARG",
   "VARARGPREP",
+  "ADD_II",
+  "ADD_FF",
+  "SUB_II",
+  "SUB_FF",
+  "MUL_II",
+  "MUL_FF",
+  "LT_II",
+  "LT_FF",
+  "LE_II",
+  "LE_FF",
   "EXTRAARG",
   nullptr
 };
@@ -22,6 +22,7 @@
 #include "mtable.h"
 #include "mtm.h"
 #include "mvm.h"
+#include "mvmstats.h"
 
 /*
 ** Full implementations moved from the former moonV_* functions.
@@ -97,6 +98,9 @@ void VirtualMachine::execute(CallInfo *callInfo) {
   StkId stackFrameBase;
   const Instruction *programCounter;
   int hooksEnabled;
+#if defined(MOON_USE_VMSTATS)
+  VMStats *vmstats = G(L)->getVMStats();
+#endif
 #if MOON_USE_JUMPTABLE
 #include "mjumptab.h"
 #endif
@@ -379,6 +383,49 @@ void VirtualMachine::execute(CallInfo *callInfo) {
     performConditionalJump(cond, callInfo, i);
   };
 
+  // Lambda: Rewrite the current instruction into 'op' (quickening);
+  // fixed prototypes keep their code in buffers that are not ours to
+  // change (and may be read-only)
+  auto setOpcode = [&](OpCode op) {
+    if (!(currentClosure->getProto()->getFlag() & PF_FIXED))
+      SET_OPCODE(*const_cast<Instruction*>(programCounter - 1), op);
+  };
+
+  // Lambda: Quicken the current instruction into 'opii' when both
+  // operands are integers or into 'opff' when both are floats
+  auto quicken = [&](const TValue *v1, const TValue *v2, OpCode opii, OpCode opff) {
+    if (ttisinteger(v1) && ttisinteger(v2))
+      setOpcode(opii);
+    else if (ttisfloat(v1) && ttisfloat(v2))
+      setOpcode(opff);
+  };
+
+  // Lambda: Quickened arithmetic over integers; back to 'op' otherwise
+  auto op_arithII = [&](auto iop, auto fop, OpCode op, Instruction i) {
+    TValue *v1 = getValueB(i);
+    TValue *v2 = getValueC(i);
+    if (l_likely(ttisinteger(v1) && ttisinteger(v2))) {
+      programCounter++; getValueA(i)->setInt(iop(L, ivalue(v1), ivalue(v2)));
+    }
+    else {
+      setOpcode(op);
+      op_arith_aux(v1, v2, iop, fop, i);
+    }
+  };
+
+  // Lambda: Quickened arithmetic over floats; back to 'op' otherwise
+  auto op_arithFF = [&](auto iop, auto fop, OpCode op, Instruction i) {
+    TValue *v1 = getValueB(i);
+    TValue *v2 = getValueC(i);
+    if (l_likely(ttisfloat(v1) && ttisfloat(v2))) {
+      programCounter++; getValueA(i)->setFloat(fop(L, fltvalue(v1), fltvalue(v2)));
+    }
+    else {
+      setOpcode(op);
+      op_arith_aux(v1, v2, iop, fop, i);
+    }
+  };
+
   // Comparator function objects for op_order (operators cannot be passed as template params)
   auto cmp_lt = [](const TValue* a, const TValue* b) { return *a < *b; };
   auto cmp_le = [](const TValue* a, const TValue* b) { return *a <= *b; };
@@ -393,6 +440,9 @@ void VirtualMachine::execute(CallInfo *callInfo) {
 
  startfunc:
   hooksEnabled = L->getHookMask();
+#if defined(MOON_USE_VMSTATS)
+  moonV_statsenter(L, callInfo);
+#endif
  returning:  // hooksEnabled already set
   currentClosure = callInfo->getFunc();
   constants = currentClosure->getProto()->getConstants();
@@ -410,6 +460,10 @@ void VirtualMachine::execute(CallInfo *callInfo) {
       updateStackBase(callInfo);  // correct stack
     }
     i = *(programCounter++);
+#if defined(MOON_USE_VMSTATS)
+    if (vmstats != nullptr)
+      vmstats->count(static_cast<int>(InstructionView(i).opcode()));
+#endif
   };
 
   // main loop of interpreter
@@ -524,6 +578,31 @@ void VirtualMachine::execute(CallInfo *callInfo) {
         }
         break;
       }
+      case OP_GETFORI: {
+        auto ra = getRegisterA(i);
+        auto *rb = getValueB(i);
+        auto *rc = getValueC(i);
+        MoonT tag;
+        if (l_likely(ttistable(rb) && ttisinteger(rc))) {
+          Table *h = hvalue(rb);
+          moon_Unsigned u = l_castS2U(ivalue(rc)) - 1u;
+          if (u < h->arraySize()) {  // key in the array part?
+            tag = *h->getArrayTag(u);
+            if (l_likely(!tagisempty(tag))) {
+              farr2val(h, u, tag, s2v(ra));
+              break;
+            }
+          }
+        }
+        /* not a present array entry: do a regular table access */
+        if (ttisinteger(rc))
+          fastgeti(rb, ivalue(rc), s2v(ra), tag);
+        else
+          tag = fastget(rb, rc, s2v(ra), [](Table* tbl, const TValue* key, TValue* res) { return tbl->get(key, res); });
+        if (tagisempty(tag))
+          protectCall([&]() { tag = finishGet(rb, rc, ra, tag); });
+        break;
+      }
       case OP_GETFIELD: {
         auto ra = getRegisterA(i);
         auto *rb = getValueB(i);
@@ -604,6 +683,7 @@ void VirtualMachine::execute(CallInfo *callInfo) {
         }
         programCounter++;  // skip extra argument
         L->getStackSubsystem().setTopPtr(ra + 1);  // correct top in case of emergency GC
+        saveProgramCounter(callInfo);  // allocation site (for heap profiles)
         auto *t = Table::create(L);  // memory allocation
         sethvalue2s(L, ra, t);
         if (b != 0 || c != 0)
@@ -690,14 +770,17 @@ void VirtualMachine::execute(CallInfo *callInfo) {
         break;
       }
       case OP_ADD: {
+        quicken(getValueB(i), getValueC(i), OP_ADD_II, OP_ADD_FF);
         op_arith(l_addi, mooni_numadd, i);
         break;
       }
       case OP_SUB: {
+        quicken(getValueB(i), getValueC(i), OP_SUB_II, OP_SUB_FF);
         op_arith(l_subi, mooni_numsub, i);
         break;
       }
       case OP_MUL: {
+        quicken(getValueB(i), getValueC(i), OP_MUL_II, OP_MUL_FF);
         op_arith(l_muli, mooni_nummul, i);
         break;
       }
@@ -843,13 +926,83 @@ void VirtualMachine::execute(CallInfo *callInfo) {
         break;
       }
       case OP_LT: {
+        quicken(getValueA(i), getValueB(i), OP_LT_II, OP_LT_FF);
         op_order(cmp_lt, other_lt, i);
         break;
       }
       case OP_LE: {
+        quicken(getValueA(i), getValueB(i), OP_LE_II, OP_LE_FF);
         op_order(cmp_le, other_le, i);
         break;
       }
+      case OP_ADD_II: {
+        op_arithII(l_addi, mooni_numadd, OP_ADD, i);
+        break;
+      }
+      case OP_ADD_FF: {
+        op_arithFF(l_addi, mooni_numadd, OP_ADD, i);
+        break;
+      }
+      case OP_SUB_II: {
+        op_arithII(l_subi, mooni_numsub, OP_SUB, i);
+        break;
+      }
+      case OP_SUB_FF: {
+        op_arithFF(l_subi, mooni_numsub, OP_SUB, i);
+        break;
+      }
+      case OP_MUL_II: {
+        op_arithII(l_muli, mooni_nummul, OP_MUL, i);
+        break;
+      }
+      case OP_MUL_FF: {
+        op_arithFF(l_muli, mooni_nummul, OP_MUL, i);
+        break;
+      }
+      case OP_LT_II: {
+        TValue *ra = getValueA(i);
+        TValue *rb = getValueB(i);
+        if (l_likely(ttisinteger(ra) && ttisinteger(rb)))
+          performConditionalJump(ivalue(ra) < ivalue(rb), callInfo, i);
+        else {
+          setOpcode(OP_LT);
+          op_order(cmp_lt, other_lt, i);
+        }
+        break;
+      }
+      case OP_LT_FF: {
+        TValue *ra = getValueA(i);
+        TValue *rb = getValueB(i);
+        if (l_likely(ttisfloat(ra) && ttisfloat(rb)))
+          performConditionalJump(mooni_numlt(fltvalue(ra), fltvalue(rb)), callInfo, i);
+        else {
+          setOpcode(OP_LT);
+          op_order(cmp_lt, other_lt, i);
+        }
+        break;
+      }
+      case OP_LE_II: {
+        TValue *ra = getValueA(i);
+        TValue *rb = getValueB(i);
+        if (l_likely(ttisinteger(ra) && ttisinteger(rb)))
+          performConditionalJump(ivalue(ra) <= ivalue(rb), callInfo, i);
+        else {
+          setOpcode(OP_LE);
+          op_order(cmp_le, other_le, i);
+        }
+        break;
+      }
+      case OP_LE_FF: {
+        TValue *ra = getValueA(i);
+        TValue *rb = getValueB(i);
+        if (l_likely(ttisfloat(ra) && ttisfloat(rb)))
+          performConditionalJump(mooni_numle(fltvalue(ra), fltvalue(rb)), callInfo, i);
+        else {
+          setOpcode(OP_LE);
+          op_order(cmp_le, other_le, i);
+        }
+        break;
+      }
       case OP_EQK: {
         auto ra = getRegisterA(i);
         auto *rb = getConstantB(i);
@@ -1012,10 +1165,17 @@ void VirtualMachine::execute(CallInfo *callInfo) {
           }
         }
        ret:  // return from a Lua function
-        if (callInfo->getCallStatus() & CIST_FRESH)
+        if (callInfo->getCallStatus() & CIST_FRESH) {
+#if defined(MOON_USE_VMSTATS)
+          moonV_statsleave(L, callInfo);
+#endif
           return;  // end this frame
+        }
         else {
           callInfo = callInfo->getPrevious();
+#if defined(MOON_USE_VMSTATS)
+          moonV_statsenter(L, callInfo);
+#endif
           goto returning;  // continue running caller in this frame
         }
       }
@@ -1044,6 +1204,18 @@ void VirtualMachine::execute(CallInfo *callInfo) {
           programCounter += InstructionView(i).bx() + 1;  // skip the loop
         break;
       }
+      case OP_FORLOOPI: {  // same as the integer case of OP_FORLOOP
+        auto ra = getRegisterA(i);
+        auto count = l_castS2U(ivalue(s2v(ra)));
+        if (count > 0) {  // still more iterations?
+          s2v(ra)->changeInt(l_castU2S(count - 1));  // update counter
+          s2v(ra + 2)->changeInt(intop(+, ivalue(s2v(ra + 2)),
+                                          ivalue(s2v(ra + 1))));
+          programCounter -= InstructionView(i).bx();  // jump back
+        }
+        updateTrap(callInfo);  // allows a signal to break the loop
+        break;
+      }
       case OP_TFORPREP: {
        /* before: 'ra' has the iterator function, 'ra + 1' has the state,
           'ra + 2' has the initial value for the control variable, and
@@ -1072,6 +1244,46 @@ void VirtualMachine::execute(CallInfo *callInfo) {
            return will be the new value for the control variable.
         */
         auto ra = getRegisterA(i);
+        if (ttislcf(s2v(ra)) && ttistable(s2v(ra + 1)) &&
+            !(L->getHookMask() & (MOON_MASKCALL | MOON_MASKRET))) {
+          moon_CFunction f = fvalue(s2v(ra));
+          Table *h = hvalue(s2v(ra + 1));
+          /* 'pairs' loop ('next' over a table)? Run the traversal
+             inline, keeping the index of the current key in the closing
+             variable (which a loop over 'next' leaves nil) so that each
+             step does not have to look the key up again. */
+          if (f == moonB_next &&
+              (ttisnil(s2v(ra + 2)) || ttisinteger(s2v(ra + 2)))) {
+            moon_Integer hint = ttisinteger(s2v(ra + 2)) ? ivalue(s2v(ra + 2)) : 0;
+            if (hint < 0 || l_castS2U(hint) > UINT_MAX)
+              hint = 0;  // not an index (set through the debug library?)
+            saveInterpreterState(L, callInfo);  // in case of errors
+            unsigned idx = h->tableNextHint(L, ra + 3, cast_uint(hint));
+            if (idx == 0) {  // no more elements?
+              setnilvalue(s2v(ra + 3));
+              setnilvalue(s2v(ra + 2));
+            }
+            else
+              s2v(ra + 2)->setInt(cast(moon_Integer, idx));
+            goto l_tforinline;
+          }
+          /* 'ipairs' loop over a table? Entries present in the table
+             are read directly; absent ones end the loop, unless there
+             is an '__index' metamethod, which needs the real call. */
+          else if (f == moonB_ipairsaux && ttisinteger(s2v(ra + 3))) {
+            moon_Integer n = intop(+, ivalue(s2v(ra + 3)), 1);
+            MoonT tag;
+            h->fastGeti(n, s2v(ra + 4), tag);
+            if (!tagisempty(tag)) {
+              s2v(ra + 3)->setInt(n);
+              goto l_tforinline;
+            }
+            else if (fasttm(L, h->getMetatable(), TMS::TM_INDEX) == nullptr) {
+              setnilvalue(s2v(ra + 3));
+              goto l_tforinline;
+            }
+          }
+        }
         *s2v(ra + 5) = *s2v(ra + 3);  /* copy the control variable (operator=) */
         *s2v(ra + 4) = *s2v(ra + 1);  /* copy state (operator=) */
         *s2v(ra + 3) = *s2v(ra);  /* copy function (operator=) */
@@ -1081,6 +1293,12 @@ void VirtualMachine::execute(CallInfo *callInfo) {
         i = *(programCounter++);  // go to next instruction
         moon_assert(InstructionView(i).opcode() == OP_TFORLOOP && ra == getRegisterA(i));
         goto l_tforloop;
+       l_tforinline:  // results of an inline step are in 'ra + 3', 'ra + 4'
+        for (int n = InstructionView(i).c(); n > 2; n--)
+          setnilvalue(s2v(ra + 2 + n));  // other variables are nil
+        i = *(programCounter++);  // go to next instruction
+        moon_assert(InstructionView(i).opcode() == OP_TFORLOOP && ra == getRegisterA(i));
+        goto l_tforloop;
       }}
       case OP_TFORLOOP: {
        l_tforloop: {
@@ -1127,6 +1345,46 @@ void VirtualMachine::execute(CallInfo *callInfo) {
       case OP_VARARG: {
         auto ra = getRegisterA(i);
         auto n = InstructionView(i).c() - 1;  // required results
+        /* last argument of a call to 'select'? (With the selector
+           in the register before 'ra' and the function before it.) */
+        Instruction ni = *programCounter;
+        if (n < 0 && InstructionView(i).a() >= 2 && InstructionView(ni).b() == 0 &&
+            (InstructionView(ni).opcode() == OP_CALL ||
+             InstructionView(ni).opcode() == OP_TAILCALL) &&
+            InstructionView(ni).a() == InstructionView(i).a() - 2 &&
+            ttislcf(s2v(ra - 2)) && fvalue(s2v(ra - 2)) == moonB_select &&
+            !L->getHookMask()) {
+          const TValue *sel = s2v(ra - 1);
+          StkId res = ra - 2;
+          int nextra = callInfo->getExtraArgs();
+          /* a tail call leaves its results on the top for the
+             following OP_RETURN */
+          int wanted = (InstructionView(ni).opcode() == OP_CALL)
+                     ? InstructionView(ni).c() - 1 : -1;
+          int first = -1;  // first vararg to select
+          if (ttisstring(sel) && tsvalue(sel)->c_str()[0] == '#') {
+            s2v(res)->setInt(nextra);  // select('#', ...)
+            if (wanted < 0)
+              L->getStackSubsystem().setTopPtr(res + 1);
+            for (int k = 1; k < wanted; k++)
+              setnilvalue(s2v(res + k));
+            programCounter++;  // skip the call
+            break;
+          }
+          else if (ttisinteger(sel)) {  // select(i, ...)
+            moon_Integer k = ivalue(sel);
+            if (k < 0 && k >= -static_cast<moon_Integer>(nextra))
+              first = nextra + cast_int(k);
+            else if (k > 0)
+              first = (k > nextra) ? nextra : cast_int(k) - 1;
+          }
+          if (first >= 0) {  // otherwise let 'select' handle (and complain)
+            protectCall([&]() {
+              moonT_getvarargsfrom(L, callInfo, res, first, wanted); });
+            programCounter++;  // skip the call
+            break;
+          }
+        }
         protectCall([&]() { moonT_getvarargs(L, callInfo, ra, n); });
         break;
       }
@@ -1150,7 +1408,7 @@ void VirtualMachine::execute(CallInfo *callInfo) {
 void VirtualMachine::finishOp() {
   CallInfo *callInfo = L->getCI();
   StkId base = callInfo->funcRef().p + 1;
-  Instruction inst = *(callInfo->getSavedPC() - 1);  // interrupted instruction
+  Instruction inst = moonP_generic(*(callInfo->getSavedPC() - 1));  // interrupted instruction
   OpCode op = static_cast<OpCode>(InstructionView(inst).opcode());
   switch (op) {  // finish its execution
     case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
@@ -1159,7 +1417,7 @@ void VirtualMachine::finishOp() {
     }
     case OP_UNM: case OP_BNOT: case OP_LEN:
     case OP_GETTABUP: case OP_GETTABLE: case OP_GETI:
-    case OP_GETFIELD: case OP_SELF: {
+    case OP_GETFIELD: case OP_GETFORI: case OP_SELF: {
       *s2v(base + InstructionView(inst).a()) = *s2v(--L->getTop().p);
       break;
     }
@@ -1440,6 +1698,8 @@ void VirtualMachine::finishSet(const TValue *t, TValue *key, TValue *val, int hr
     const TValue *metamethod;  // '__newindex' metamethod
     if (hres != HNOTATABLE) {  // is 't' a table?
       auto *h = hvalue(t);  // save 't' table
+      if (l_unlikely(h->isFrozen()) && hres != HNOTFOUND)  // key present?
+        Table::frozenError(L);  // (absent keys may still go to '__newindex')
       metamethod = fasttm(L, h->getMetatable(), TMS::TM_NEWINDEX);  // get metamethod
       if (metamethod == nullptr) {  // no metamethod?
         sethvalue2s(L, L->getTop().p, h);  // anchor 't'
@@ -144,6 +144,17 @@ inline bool tointegerns(const TValue* o, moon_Integer* i) noexcept {
 #define intop(op,v1,v2) l_castU2S(l_castS2U(v1) op l_castS2U(v2))
 
 
+/*
+** Functions of the base library that the VM recognizes and runs
+** inline (see 'mbaselib.cpp'): OP_TFORCALL does the steps of loops
+** over 'next' and the 'ipairs' iterator, and OP_VARARG does calls
+** 'select(n, ...)'.
+*/
+MOONI_FUNC int moonB_next (moon_State *L);
+MOONI_FUNC int moonB_ipairsaux (moon_State *L);
+MOONI_FUNC int moonB_select (moon_State *L);
+
+
 // All moonV_* wrapper functions removed - use VirtualMachine methods directly
 
 #endif
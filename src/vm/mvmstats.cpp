@@ -0,0 +1,227 @@
+/*
+** Execution counters for the virtual machine
+** See Copyright Notice in lua.h
+*/
+
+#define MOON_CORE
+
+#include "mprefix.h"
+
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "moon.h"
+
+#include "mobject.h"
+#include "mopcodes.h"
+#include "mopnames.h"
+#include "mstate.h"
+#include "mstring.h"
+#include "mvmstats.h"
+
+
+#if defined(MOON_USE_VMSTATS)  // {
+
+static_assert(opnames.size() == NUM_OPCODES + 1,  // + final nullptr
+              "'opnames' out of sync");
+
+
+void moonV_newstats (moon_State *L) {
+  G(L)->setVMStats(new (std::nothrow) VMStats);  // no counters if it fails
+}
+
+
+void moonV_freestats (moon_State *L) {
+  delete G(L)->getVMStats();
+  G(L)->setVMStats(nullptr);
+}
+
+
+static FuncStats *funcstats (VMStats *vs, const Proto *p) {
+  try {
+    auto [it, isnew] = vs->live.try_emplace(p);
+    if (isnew) {
+      char buff[MOON_IDSIZE];
+      size_t len = LL("=?");
+      const char *src = (p->getSource() != nullptr)
+                      ? getStringWithLength(p->getSource(), len)
+                      : "=?";
+      moonO_chunkid(buff, src, len);
+      it->second.source = buff;
+      it->second.line = p->getLineDefined();
+    }
+    return &it->second;
+  }
+  catch (const std::bad_alloc &) {
+    return nullptr;  // do not count this function
+  }
+}
+
+
+/*
+** The Lua function at 'callInfo' starts or resumes running; it is a
+** new call if it is at its first instruction.
+*/
+void moonV_statsenter (moon_State *L, CallInfo *callInfo) {
+  VMStats *vs = G(L)->getVMStats();
+  if (vs == nullptr) return;
+  const Proto *p = callInfo->getFunc()->getProto();
+  FuncStats *s = funcstats(vs, p);
+  if (s != nullptr && callInfo->getSavedPC() == p->getCode())
+    s->calls++;
+  vs->switchto(s);
+}
+
+
+/*
+** The VM leaves the frame running 'callInfo' (returning to C); time
+** goes to the closest Lua function below it, if any.
+*/
+void moonV_statsleave (moon_State *L, CallInfo *callInfo) {
+  VMStats *vs = G(L)->getVMStats();
+  if (vs == nullptr) return;
+  CallInfo *ci = callInfo->getPrevious();
+  while (ci != nullptr && !ci->isLua())
+    ci = ci->getPrevious();
+  vs->switchto((ci != nullptr) ? funcstats(vs, ci->getFunc()->getProto())
+                               : nullptr);
+}
+
+
+// prototype 'p' is being freed; keep its counters by source and line
+void moonV_statsforget (moon_State *L, const Proto *p) {
+  VMStats *vs = G(L)->getVMStats();
+  auto it = vs->live.find(p);
+  if (it == vs->live.end()) return;
+  if (vs->current == &it->second)
+    vs->switchto(nullptr);
+  try {
+    vs->retired[{it->second.source, it->second.line}].merge(it->second);
+  }
+  catch (const std::bad_alloc &) {
+    // lose these counters
+  }
+  vs->live.erase(it);
+}
+
+
+static void setcount (moon_State *L, const char *k, std::uint64_t n) {
+  moon_pushinteger(L, static_cast<moon_Integer>(n));
+  moon_setfield(L, -2, k);
+}
+
+
+static void pushfunctions (moon_State *L, VMStats *vs) {
+  std::map<std::pair<std::string, int>, FuncStats> all(vs->retired);
+  for (const auto &[p, s] : vs->live)
+    all[{s.source, s.line}].merge(s);
+  std::vector<std::pair<const std::pair<std::string, int> *,
+                        const FuncStats *>> v;
+  for (const auto &[k, s] : all)
+    v.emplace_back(&k, &s);
+  std::stable_sort(v.begin(), v.end(), [](const auto &a, const auto &b) {
+    return a.second->instructions > b.second->instructions;
+  });
+  moon_createtable(L, static_cast<int>(v.size()), 0);
+  moon_Integer i = 0;
+  for (const auto &[k, s] : v) {
+    moon_createtable(L, 0, 5);
+    moon_pushlstring(L, k->first.data(), k->first.size());
+    moon_setfield(L, -2, "source");
+    moon_pushinteger(L, k->second);
+    moon_setfield(L, -2, "line");
+    setcount(L, "calls", s->calls);
+    setcount(L, "instructions", s->instructions);
+    moon_pushnumber(L, static_cast<moon_Number>(s->nanoseconds) / 1e9);
+    moon_setfield(L, -2, "time");
+    moon_rawseti(L, -2, ++i);
+  }
+}
+
+
+static void resetstats (VMStats *vs) {
+  std::fill_n(&vs->ops[0], NUM_OPCODES, 0);
+  std::fill_n(&vs->pairs[0][0], NUM_OPCODES * NUM_OPCODES, 0);
+  vs->switchto(nullptr);
+  vs->live.clear();
+  vs->retired.clear();
+}
+
+
+/*
+** Push a table with the VM counters: 'instructions' (total),
+** 'opcodes' (count by opcode name), 'pairs' (pairs[op1][op2] counts
+** 'op2' running right after 'op1') and 'functions' (a list of
+** {source, line, calls, instructions, time}, most busy first).
+** If 'reset', the counters restart from zero. Returns 0 (pushing
+** nothing) if the VM was built without counters.
+*/
+MOON_API int moon_vmstats (moon_State *L, int reset) {
+  VMStats *vs = G(L)->getVMStats();
+  if (vs == nullptr)
+    return 0;
+  vs->switchto(vs->current);  // bring time up to date
+  moon_createtable(L, 0, 4);
+  std::uint64_t total = 0;
+  moon_createtable(L, 0, 0);
+  for (int op = 0; op < NUM_OPCODES; op++) {
+    if (vs->ops[op] != 0) {
+      setcount(L, opnames[static_cast<size_t>(op)], vs->ops[op]);
+      total += vs->ops[op];
+    }
+  }
+  moon_setfield(L, -2, "opcodes");
+  setcount(L, "instructions", total);
+  moon_createtable(L, 0, 0);
+  for (int a = 0; a < NUM_OPCODES; a++) {
+    if (vs->ops[a] == 0) continue;
+    moon_createtable(L, 0, 0);
+    for (int b = 0; b < NUM_OPCODES; b++) {
+      if (vs->pairs[a][b] != 0)
+        setcount(L, opnames[static_cast<size_t>(b)], vs->pairs[a][b]);
+    }
+    moon_setfield(L, -2, opnames[static_cast<size_t>(a)]);
+  }
+  moon_setfield(L, -2, "pairs");
+  pushfunctions(L, vs);
+  moon_setfield(L, -2, "functions");
+  if (reset)
+    resetstats(vs);
+  return 1;
+}
+
+#else  // }{
+
+void moonV_newstats (moon_State *L) {
+  (void)L;  // no counters
+}
+
+void moonV_freestats (moon_State *L) {
+  (void)L;
+}
+
+void moonV_statsenter (moon_State *L, CallInfo *callInfo) {
+  (void)L; (void)callInfo;
+}
+
+void moonV_statsleave (moon_State *L, CallInfo *callInfo) {
+  (void)L; (void)callInfo;
+}
+
+void moonV_statsforget (moon_State *L, const Proto *p) {
+  (void)L; (void)p;
+}
+
+MOON_API int moon_vmstats (moon_State *L, int reset) {
+  (void)L; (void)reset;
+  return 0;
+}
+
+#endif  // }
+
@@ -0,0 +1,87 @@
+/*
+** Execution counters for the virtual machine
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lvmstats_h
+#define lvmstats_h
+
+
+#include "mobject.h"
+#include "mopcodes.h"
+#include "mstate.h"
+
+
+/*
+** When built with MOON_USE_VMSTATS, the VM counts how many times each
+** opcode (and each pair of consecutive opcodes) runs, and how many
+** calls, instructions and time each function takes. Time is charged to
+** the Lua function running, including the C functions it calls.
+*/
+#if defined(MOON_USE_VMSTATS)
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+
+struct FuncStats {
+  std::uint64_t calls = 0;
+  std::uint64_t instructions = 0;
+  std::uint64_t nanoseconds = 0;
+  std::string source;  // short source of the function
+  int line = 0;  // line where it was defined
+
+  void merge (const FuncStats &s) noexcept {
+    calls += s.calls;
+    instructions += s.instructions;
+    nanoseconds += s.nanoseconds;
+  }
+};
+
+
+struct VMStats {
+  using Clock = std::chrono::steady_clock;
+
+  std::uint64_t ops[NUM_OPCODES] = {};
+  std::uint64_t pairs[NUM_OPCODES][NUM_OPCODES] = {};
+  int lastop = 0;
+  FuncStats *current = nullptr;  // function running now
+  Clock::time_point since;  // when 'current' started running
+  std::unordered_map<const Proto *, FuncStats> live;
+  // functions already collected, by source and line
+  std::map<std::pair<std::string, int>, FuncStats> retired;
+
+  void count (int op) noexcept {
+    ops[op]++;
+    pairs[lastop][op]++;
+    lastop = op;
+    if (current)
+      current->instructions++;
+  }
+
+  // charge time so far to the running function and switch to 's'
+  void switchto (FuncStats *s) noexcept {
+    Clock::time_point now = Clock::now();
+    if (current)
+      current->nanoseconds += static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              now - since).count());
+    current = s;
+    since = now;
+  }
+};
+
+#endif
+
+
+MOONI_FUNC void moonV_newstats (moon_State *L);
+MOONI_FUNC void moonV_freestats (moon_State *L);
+MOONI_FUNC void moonV_statsenter (moon_State *L, CallInfo *callInfo);
+MOONI_FUNC void moonV_statsleave (moon_State *L, CallInfo *callInfo);
+MOONI_FUNC void moonV_statsforget (moon_State *L, const Proto *p);
+
+#endif
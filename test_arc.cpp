@@ -4,10 +4,13 @@
 // explicit ownership modelling (retain on store, release on drop), since the
 // VM/stack is not yet ARC-instrumented. Verifies:
 //   * an acyclic graph is reclaimed deterministically (whole subtree frees), and
-//   * a reference cycle leaks (no free) without crashing.
+//   * a reference cycle leaks (no free) without crashing, and
+//   * the heap profiler charges reclaimed objects back to their site.
 
 #include <cassert>
 #include <cstdio>
+#include <cstring>
+#include <string>
 
 #include "moon.h"
 #include "mauxlib.h"
@@ -80,6 +83,23 @@ int main() {
     expect(freed == 0, "reference cycle leaks (not reclaimed) and does not crash");
   }
 
+  // ---- Heap profiler: a reclaimed object leaves its site with no objects
+  //      in use, while the allocation itself is still reported.
+  {
+    moon_heapstart(L);
+    Table* t = Table::create(L);                 // tracked by the profiler
+    moon_heapstop(L);
+    moonC_release(*L, obj2gco(t));               // freed through ARC
+    std::string out;
+    moon_heapdump(L, [](moon_State*, const void* b, size_t sz, void* ud) {
+      static_cast<std::string*>(ud)->append(static_cast<const char*>(b), sz);
+      return 0;
+    }, &out);
+    expect(out.find("[table]") != std::string::npos, "site has a type frame");
+    expect(out.find("heap profile: 0: 0 [1: ") != std::string::npos,
+           "freed object no longer in use");
+  }
+
   moon_close(L);
 
   if (failures == 0) std::printf("ARC engine test: ALL OK\n");
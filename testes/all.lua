@@ -192,6 +192,10 @@ assert(dofile('events.lua') == 12)
 dofile('vararg.lua')
 dofile('closure.lua')
 dofile('coroutine.lua')
+dofile('parallel.lua')
+dofile('channel.lua')
+dofile('profile.lua')
+dofile('array.lua')
 dofile('goto.lua', true)
 dofile('errors.lua')
 dofile('math.lua')
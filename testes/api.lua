@@ -712,6 +712,81 @@ do   -- testing getfield/setfield with long keys
   _012345678901234567890123456789012345678901234567890123456789 = nil
 end
 
+do   -- testing key handles (getfieldk/setfieldk)
+  local t = {x = 10}
+  assert(T.testC("getfieldk 2 x; return 1", t) == 10)
+  T.testC("pushnum 20; setfieldk 2 y", t)
+  assert(t.y == 20)
+  local m = setmetatable({}, {__index = function (_, k) return k .. "!" end,
+                              __newindex = function (t, k, v)
+                                rawset(t, k, 2 * v)
+                              end})
+  assert(T.testC("getfieldk 2 abc; return 1", m) == "abc!")
+  T.testC("pushnum 5; setfieldk 2 z", m)
+  assert(rawget(m, "z") == 10)
+  collectgarbage()   -- handles are pinned
+  assert(T.testC("getfieldk 2 x; return 1", t) == 10)
+  assert(debug.getregistry()._KEYS.x == true)
+  local long = string.rep("k", 100)
+  local st, msg = pcall(T.testC, "getfieldk 2 " .. long, t)
+  assert(not st and string.find(msg, "too long"))
+  local r = T.fieldloop(10, true)
+  assert(r.id == 10 and r.score == 20 and r.count == 30)
+end
+
+do   -- testing bulk table access (setarray/getarray/setfields)
+  local t = {}
+  T.setarray(t, 1, 10, 2.5, "abc", true, false, nil, 7)
+  assert(t[1] == 10 and math.type(t[1]) == "integer" and
+         t[2] == 2.5 and t[3] == "abc" and t[4] == true and
+         t[5] == false and t[6] == nil and t[7] == 7)
+  assert(T.querytab(t) == 7)   -- one resize put all values in the array part
+  T.setarray(t, 6, 6, 7.5, "x")   -- overwrite and append
+  assert(t[6] == 6 and t[7] == 7.5 and t[8] == "x")
+  T.setarray(t, -1, "neg", "zero")   -- keys outside the array part
+  assert(t[-1] == "neg" and t[0] == "zero")
+  T.setarray(t, math.maxinteger, "max")
+  assert(t[math.maxinteger] == "max")
+  local a, b, c, d = T.getarray(t, 0, 4)
+  assert(a == "zero" and b == 10 and c == 2.5 and d == "abc")
+  local p = T.getarray(setmetatable({}, {__index = error}), 1, 1)
+  assert(p == nil)    -- raw access
+  t[2] = {}; t[3] = print
+  a, b = T.getarray(t, 2, 2)
+  assert(a == "<table>" and b == "<function>")
+  T.setarray(t, 1)   -- no values
+
+  local keys = {"x", "y", "name", 10}
+  local r = {}
+  T.setfields(r, keys, 1, 2.5, "rec", true)
+  assert(r.x == 1 and r.y == 2.5 and r.name == "rec" and r[10] == true)
+  T.setfields(r, keys, nil, 3)
+  assert(r.x == nil and r.y == 3 and r.name == "rec")
+  local mt = setmetatable({}, {__newindex = error})
+  T.setfields(mt, keys, 1)   -- raw assignment
+  assert(rawget(mt, "x") == 1)
+
+  local fr = table.freeze({1, 2})
+  assert(not pcall(T.setarray, fr, 1, 10))
+  assert(not pcall(T.setfields, fr, keys, 10))
+
+  -- values written in bulk survive collections
+  local big = {}
+  for i = 1, 100 do T.setarray(big, (i - 1) * 3 + 1, "s" .. i, i, i * 0.5) end
+  collectgarbage()
+  assert(#big == 300 and big[298] == "s100" and big[300] == 50)
+
+  local col1, col2 = T.bulkfill(1000, false), T.bulkfill(1000, true)
+  local rows1 = T.bulkfill(1000, false, true)
+  local rows2 = T.bulkfill(1000, true, true)
+  assert(#col1 == 1000 and #col2 == 1000 and #rows1 == 1000 and #rows2 == 1000)
+  for i = 1, 1000 do
+    assert(col1[i] == col2[i])
+    assert(rows1[i].id == rows2[i].id and rows1[i].score == rows2[i].score)
+    assert(rows2[i].ok == true)
+  end
+end
+
 -- testing next
 a = {}
 t = pack(T.testC("next; return *", a, nil))
@@ -1178,6 +1253,103 @@ assert(T.doremote(L1, "return a.x") == "1")
 
 T.closestate(L1)
 
+
+do   -- cloning states
+  local L = T.newstate()
+  T.loadlib(L, ~0, 0)   -- all libraries
+  T.doremote(L, [[
+    X = {10, 20, 30, name = "x", [2.5] = "f", [true] = 0}
+    X.self = X
+    setmetatable(X, {__index = function (_, k) return k .. "!" end})
+    local key = {}
+    K = {[key] = "tablekey", key = key, [print] = "print"}
+    D = {}
+    for i = 1, 100 do D["k" .. i] = i end
+    for i = 1, 50 do D["k" .. i] = nil end
+    collectgarbage()   -- leave dead keys in 'D'
+    local count = 0
+    function COUNT () count = count + 1; return count end
+    LONG = string.rep("long", 20)
+    FROZEN = table.freeze({1, 2, 3})
+    GCOBJ = setmetatable({}, {__gc = function () GCDONE = true end})
+  ]])
+  T.doremote(L, "COUNT()")
+  local L1 = T.clonestate(L)
+  local L2 = T.clonestate(L1)   -- clone of a clone
+  T.closestate(L)   -- clones are independent of their template
+  for _, C in ipairs{L1, L2} do
+    assert(T.doremote(C, "return COUNT()") == "2")
+    assert(T.doremote(C, "return COUNT()") == "3")
+    assert(T.doremote(C, [[
+      assert(X[1] == 10 and X[3] == 30 and #X == 3 and X.name == "x")
+      assert(X[2.5] == "f" and X[true] == 0 and X.self == X)
+      assert(X.missing == "missing!")
+      assert(K[K.key] == "tablekey" and K[print] == "print")
+      for i = 1, 100 do assert(D["k" .. i] == (i > 50 and i or nil)) end
+      local n = 0
+      for k in pairs(D) do n = n + 1 end
+      assert(n == 50)
+      D.k1 = 1; assert(D.k1 == 1 and D.k100 == 100)
+      assert(LONG == string.rep("long", 20))
+      assert(table.isfrozen(FROZEN) and FROZEN[3] == 3)
+      assert(not pcall(function () FROZEN[1] = 0 end))
+      assert(("ab"):rep(2) == "abab" and require"string" == string)
+      assert(debug.getinfo(COUNT, "S").linedefined > 1)
+      assert(io.write("") == io.stdout)
+      return "ok"
+    ]]) == "ok")
+  end
+  assert(T.doremote(L1, "return getmetatable(GCOBJ).__gc and 1") == "1")
+  -- the clones do not share objects
+  T.doremote(L1, "X.name = 'y'; X[1] = nil; string.extra = 1")
+  assert(T.doremote(L2, "return X.name, X[1], string.extra") == "x")
+  assert(select(2, T.doremote(L2, "return X.name, X[1]")) == "10")
+  T.closestate(L1)
+  T.closestate(L2)
+
+  -- coroutines cannot be cloned
+  L = T.newstate()
+  T.loadlib(L, 1 | 4, 0)   -- _G and 'coroutine'
+  T.doremote(L, "CO = coroutine.create(print)")
+  assert(T.clonestate(L) == nil)
+  T.doremote(L, "CO = nil")
+  L1 = T.clonestate(L)
+  assert(T.doremote(L1, "return type(coroutine.wrap)") == "function")
+  T.closestate(L1)
+  T.closestate(L)
+
+  -- neither can userdata marked with '__clone' (such as arrays)
+  L = T.newstate()
+  T.loadlib(L, ~0, 0)
+  T.doremote(L, "A = array.new('double', 4, 1.5)")
+  assert(T.clonestate(L) == nil)
+  T.doremote(L, "A = nil")
+  L1 = T.clonestate(L)
+  assert(T.doremote(L1, "return array.new('int32', 3):sum()") == "0")
+  T.closestate(L1)
+  T.closestate(L)
+
+  -- strings of a cached module outlive the template's mapping
+  local mod = os.tmpname()
+  local cache = os.tmpname(); os.remove(cache)
+  local f = assert(io.open(mod, "w"))
+  f:write(string.format("return {s = %q}", string.rep("s", 100))); f:close()
+  L = T.newstate()
+  T.loadlib(L, ~0, 0)
+  T.doremote(L, string.format([[
+    package.path = %q; package.bytecodecache = %q
+    for i = 1, 2 do   -- the second 'require' loads from the cache
+      package.loaded.m = nil; M = require"m"
+    end
+  ]], mod, cache))
+  L1 = T.clonestate(L)
+  T.closestate(L)
+  assert(T.doremote(L1, "return M.s == string.rep('s', 100) and 1") == "1")
+  T.closestate(L1)
+  os.remove(mod)
+  os.execute("rm -rf " .. cache)
+end
+
 L1 = nil
 
 print('+')
@@ -0,0 +1,144 @@
+-- $Id: testes/array.lua $
+-- See Copyright Notice in file lua.h
+
+global <const> *
+
+print "testing typed arrays"
+
+local array = require'array'
+
+local int64 <const> = (math.maxinteger >> 31) > 0   -- 64-bit integers?
+
+
+local function checkerror (msg, f, ...)
+  local s, err = pcall(f, ...)
+  assert(not s and string.find(err, msg))
+end
+
+
+do   -- creation and element access
+  for _, t in ipairs{"double", "float", "int64", "int32"} do
+    local a = array.new(t, 10)
+    assert(#a == 10 and a:type() == t)
+    assert(a[1] == 0 and a[10] == 0 and a[0] == nil and a[11] == nil)
+    assert(string.find(tostring(a), "^array<" .. t .. ">%[10%]"))
+    a[3] = 7
+    assert(a[3] == 7)
+    assert(math.type(a[3]) == ((t == "double" or t == "float") and "float"
+                                                              or "integer"))
+    checkerror("out of bounds", function () a[11] = 1 end)
+    checkerror("out of bounds", function () a[0] = 1 end)
+    checkerror("out of bounds", function () a.x = 1 end)
+    assert(a.x == nil and a[1.0] == 0 and a[1.5] == nil)
+  end
+  assert(#array.new("double", 0) == 0)
+  local a = array.new("int32", 3, -5)
+  assert(a[1] == -5 and a[3] == -5)
+  if int64 then
+    checkerror("out of range for int32", array.new, "int32", 3, 2^31)
+    checkerror("out of range for int32", array.new, "int32", 0, 2^31)
+  end
+  checkerror("number has no integer representation",
+             function () a[1] = 1.5 end)
+  checkerror("invalid option", array.new, "char", 3)
+  checkerror("size out of range", array.new, "double", -1)
+  if int64 then
+    checkerror("too large", array.new, "double", math.maxinteger)
+  end
+  a = array.new("float", 2)
+  a[1] = 0.1
+  assert(a[1] ~= 0.1 and math.abs(a[1] - 0.1) < 1e-7)
+
+  a = array.fromtable("int64", {1, 2, 3, math.mininteger})
+  assert(#a == 4 and a[4] == math.mininteger)
+  local t = a:totable()
+  assert(#t == 4 and t[2] == 2 and t[4] == math.mininteger)
+  checkerror("number expected", array.fromtable, "double", {1, "x"})
+end
+
+
+do   -- bulk operations
+  local n = 1001
+  local a, b = array.new("double", n), array.new("double", n)
+  for i = 1, n do a[i] = i; b[i] = 2 * i end
+  assert(a:sum() == n * (n + 1) / 2)
+  assert(a:dot(b) == n * (n + 1) * (2 * n + 1) / 3)
+  assert(a:min() == 1 and a:max() == n)
+  assert(a:add(b) == a and a[5] == 15)
+  a:mul(2)
+  assert(a[5] == 30)
+  a:add(-1)
+  assert(a[5] == 29)
+  a:axpy(-0.5, b)
+  assert(a[5] == 24 and a[n] == 6 * n - 1 - n)
+  a:map("neg")
+  assert(a[1] == -(6 - 1 - 1) and a:max() == -4)
+  a:map("abs"):map("sqrt")
+  assert(a[1] == 2)
+  a:fill(2.5):map("floor")
+  assert(a:sum() == 2 * n)
+  checkerror("different sizes", a.add, a, array.new("double", 3))
+  checkerror("different types", a.add, a, array.new("float", n))
+  checkerror("invalid option", a.map, a, "tanh")
+  assert(array.new("double", 0):sum() == 0)
+  assert(not array.new("int32", 0):min())
+
+  -- integer arrays wrap around
+  local i = array.new("int64", 5, math.maxinteger)
+  assert(i:sum() == math.maxinteger * 5)
+  i:add(1)
+  assert(i[1] == math.mininteger)
+  local j = array.new("int32", 4, 2^31 - 1)
+  j:add(1)
+  assert(j[1] == -2^31 and (not int64 or j:sum() == -2^33))
+  j:map("neg")
+  assert(j[1] == -2^31)   -- negating the minimum int32 wraps around
+  checkerror("not valid for integer", j.map, j, "sqrt")
+  checkerror("number has no integer representation", j.mul, j, 0.5)
+  local k = array.fromtable("int32", {3, -7, 5})
+  assert(k:min() == -7 and k:max() == 5 and k:dot(k) == 83)
+
+  -- floats accumulate in doubles
+  local f = array.new("float", 1000, 0.1)
+  assert(math.abs(f:sum() - 100) < 1e-4)
+  f = array.fromtable("float", {1, 2, 3})
+  assert(f:dot(f) == 14 and f:min() == 1 and f:max() == 3)
+
+  -- copies are independent
+  local c = f:copy()
+  c[1] = 10
+  assert(f[1] == 1 and c[1] == 10)
+end
+
+
+do   -- conversion to and from strings
+  local a = array.fromtable("double", {1.5, -2, 3e100})
+  local s = a:tostring()
+  assert(#s == 3 * 8)
+  assert(select(2, string.unpack("=d", s, 9)) == 17)
+  assert(string.unpack("=ddd", s) == 1.5)
+  local b = array.fromstring("double", s)
+  assert(#b == 3 and b[3] == 3e100 and b:sum() == a:sum())
+  assert(string.find(tostring(b), "read%-only"))
+  checkerror("read%-only", function () b[1] = 0 end)
+  checkerror("read%-only", b.add, b, 1)
+  local c = b:copy()   -- copies are writable
+  c[1] = 0
+  assert(c[1] == 0 and b[1] == 1.5)
+
+  -- a slice of the string (not aligned)
+  s = "x" .. string.pack("=i4i4i4", 10, -20, 30)
+  local i = array.fromstring("int32", s, 2)
+  assert(#i == 3 and i:sum() == 20 and i[2] == -20)
+  i = array.fromstring("int32", s, 6, 9)
+  assert(#i == 1 and i[1] == -20)
+  assert(#array.fromstring("int64", "") == 0)
+  checkerror("multiple of the element size", array.fromstring, "int64", "abc")
+  checkerror("out of bounds", array.fromstring, "int32", s, 0)
+  checkerror("out of bounds", array.fromstring, "int32", s, 2, 100)
+
+  s = string.pack("=ff", 0.5, 4)
+  assert(array.fromstring("float", s):sum() == 4.5)
+end
+
+print'ok'
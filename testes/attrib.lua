@@ -225,6 +225,132 @@ assert(require"P1" == m and m.AA == 10)
 removefiles(files)
 AA = nil
 
+
+do  print("testing 'package.bytecodecache'")
+  local debug = require"debug"
+  local cache = D"bccache"
+  package.path = D"?.lua"
+  package.bytecodecache = cache
+  local long = string.rep("x", 100)
+  local files = {["bcc.lua"] = string.format([[
+    local t = {s = %q, n = 10}
+    function t.f (a) return a .. t.s end
+    return t
+  ]], long)}
+  createfiles(files, "", "")
+
+  local function load ()
+    package.loaded.bcc = nil
+    local m, ext = require"bcc"
+    assert(ext == D"bcc.lua")
+    assert(debug.getinfo(m.f, "S").source == "@" .. D"bcc.lua")
+    return m
+  end
+
+  local m = load()   -- compiles and fills the cache
+  assert(m.n == 10 and m.f("a") == "a" .. long)
+  local entries = 0
+  for l in io.popen("ls " .. cache):lines() do entries = entries + 1 end
+  assert(entries == 1)
+  m = load()   -- loads from the cache
+  assert(m.n == 10 and m.f("a") == "a" .. long)
+
+  -- cached code is read-only; running its arithmetic must not quicken it
+  files["bcc.lua"] = [[
+    local t = {f = function () end}
+    local s = 0
+    for i = 1, 100 do s = s + i; s = s * 1.0 + 0.5 end
+    t.s = s
+    function t.add (a, b) return a + b end
+    return t
+  ]]
+  createfiles(files, "", "")
+  for _ = 1, 3 do
+    m = load()
+    assert(m.s == 5100.0 and m.add(1, 2) == 3 and m.add(1.5, 2.5) == 4.0)
+  end
+
+  -- a changed source invalidates its entry
+  files["bcc.lua"] = "return {n = 20, f = function () return 'new' end}"
+  createfiles(files, "", "")
+  m = load()
+  assert(m.n == 20 and m.f() == "new")
+  m = load()
+  assert(m.n == 20 and m.f() == "new")
+
+  -- a corrupted entry falls back to the source and is not kept mapped
+  local maps = debug.getregistry()._BCMAPS
+  local function nmaps ()
+    local n = 0
+    for _ in pairs(maps) do n = n + 1 end
+    return n
+  end
+  local entry = cache .. "/" .. io.popen("ls " .. cache):read("l")
+  local f = assert(io.open(entry, "rb"))
+  local s = f:read("a"); f:close()
+  f = assert(io.open(entry, "wb"))
+  f:write(string.sub(s, 1, -10)); f:close()   -- truncate the dump
+  local n = nmaps()
+  m = load()
+  assert(m.n == 20 and m.f() == "new")
+  assert(nmaps() == n)
+  m = load()   -- entry was rewritten
+  assert(m.n == 20 and m.f() == "new")
+  assert(nmaps() == n + 1)
+
+  -- an edit that keeps the size (probably within the same second)
+  files["bcc.lua"] = "return {n = 21, f = function () return 'new' end}"
+  createfiles(files, "", "")
+  m = load()
+  assert(m.n == 21 and m.f() == "new")
+
+  -- errors are still reported from the source
+  files["bcc.lua"] = "return {"
+  createfiles(files, "", "")
+  package.loaded.bcc = nil
+  local st, msg = pcall(require, "bcc")
+  assert(not st and string.find(msg, "error loading module 'bcc'"))
+
+  package.bytecodecache = nil
+  removefiles(files)
+  os.execute("rm -rf " .. cache)
+end
+
+do  print("testing 'package.loadmany'")
+  local files = {}
+  local names = {}
+  for i = 1, 20 do
+    local name = "lm" .. i .. ".lua"
+    files[name] = string.format("local x = ... return %d, %q, x", i,
+                                string.rep("s", i))
+    names[i] = D(name)
+  end
+  createfiles(files, "", "")
+  local fs = assert(package.loadmany(names))
+  assert(#fs == 20)
+  for i = 1, 20 do
+    local n, s, x = fs[i](i * 10)
+    assert(n == i and s == string.rep("s", i) and x == i * 10)
+    assert(require"debug".getinfo(fs[i], "S").source == "@" .. names[i])
+  end
+  assert(#package.loadmany({}) == 0)
+
+  -- the first file (in order) with an error is reported
+  files["lm5.lua"] = "return +"
+  files["lm9.lua"] = "return *"
+  createfiles(files, "", "")
+  local st, msg = package.loadmany(names)
+  assert(not st and string.find(msg, "lm5.lua:1:"))
+  names[3] = D"lm_does_not_exist.lua"
+  st, msg = package.loadmany(names)
+  assert(not st and string.find(msg, "cannot open .*lm_does_not_exist"))
+  st, msg = package.loadmany({names[1]}, "b")
+  assert(not st and string.find(msg, "text chunk"))
+  st, msg = pcall(package.loadmany, {names[1], 10})
+  assert(not st and string.find(msg, "not a string"))
+  removefiles(files)
+end
+
 package.path = ""
 assert(not pcall(require, "file_does_not_exist"))
 package.path = "??\0?"
@@ -0,0 +1,44 @@
+-- $Id: testes/bench_alloc.lua $
+-- See Copyright Notice in file lua.h
+
+-- Binary trees: lots of small, short-lived tables, to measure the
+-- recycling of small blocks. Needs a test build ('T') to switch it on
+-- and off. Not part of 'all.lua'; run with
+--   moon bench_alloc.lua [N]
+-- for trees of depth up to N.
+
+local N = tonumber(arg and arg[1]) or 16
+
+local function bottomup (d)
+  if d == 0 then return {} end
+  d = d - 1
+  return {bottomup(d), bottomup(d)}
+end
+
+local function check (t)
+  if t[1] then return 1 + check(t[1]) + check(t[2]) end
+  return 1
+end
+
+local function run (on)
+  if T then T.recycle(on) end
+  collectgarbage(); collectgarbage()
+  local c0 = os.clock()
+  local long = bottomup(N)
+  local total = 0
+  for d = 4, N, 2 do
+    for _ = 1, 2 ^ (N - d + 4) do total = total + check(bottomup(d)) end
+  end
+  assert(check(long) == 2 ^ (N + 1) - 1)
+  print(string.format("recycling %-3s: %.2f s cpu (%d nodes)",
+                      on == nil and "?" or on and "on" or "off",
+                      os.clock() - c0, total))
+end
+
+if T then
+  run(false)
+  run(true)
+else
+  print("not a test build; using the default setting")
+  run(nil)
+end
@@ -0,0 +1,28 @@
+-- $Id: testes/bench_bulk.lua $
+-- See Copyright Notice in file lua.h
+
+-- Filling tables from C: one slot per API call ('moon_rawseti',
+-- 'moon_setfield') against the bulk functions ('moon_setarray',
+-- 'moon_setfields'). Needs the test library (T). Not part of
+-- 'all.lua'; run with
+--   moon bench_bulk.lua [N]
+
+local N = tonumber(arg and arg[1]) or 1000000
+
+assert(T, "needs the test library")
+
+local function run (what, records)
+  local cpu = {}
+  for i, bulk in ipairs{false, true} do
+    collectgarbage()
+    local c0 = os.clock()
+    local t = T.bulkfill(N, bulk, records)
+    cpu[i] = math.max(os.clock() - c0, 1e-3)
+    assert(#t == N)
+  end
+  print(string.format("%-8s slots %6.2fs, bulk %6.2fs: speedup %.2fx",
+                      what, cpu[1], cpu[2], cpu[1] / cpu[2]))
+end
+
+run("array", false)
+run("records", true)
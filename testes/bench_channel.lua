@@ -0,0 +1,59 @@
+-- $Id: testes/bench_channel.lua $
+-- See Copyright Notice in file lua.h
+
+-- Channel throughput: P producer states send N messages in total to a
+-- single consumer (the main state). Not part of 'all.lua'; run with
+--   moon bench_channel.lua [N]
+
+local channel = require'channel'
+local parallel = require'parallel'
+
+local N = tonumber(arg and arg[1]) or 5000000
+
+local modfile = os.tmpname()
+do
+  local f <close> = assert(io.open(modfile, "w"))
+  f:write[[
+    local channel = require'channel'
+    return {
+      produce = function (name, n, payload)
+        local ch = channel.open(name)
+        for i = 1, n do ch:send(i, payload) end
+        return true
+      end
+    }
+  ]]
+end
+
+local oldpath = package.path
+package.path = modfile
+
+local function run (producers, payload)
+  local name = "bench." .. producers
+  local ch = channel.open(name, 1024)
+  local s <close> = parallel.scheduler(producers)
+  local per = N // producers
+  local t0 = os.time()
+  local c0 = os.clock()
+  local fs = {}
+  for i = 1, producers do
+    fs[i] = s:submit("bench", "produce", name, per, payload)
+  end
+  for _ = 1, per * producers do assert(ch:receive()) end
+  for i = 1, producers do assert(fs[i]:await()) end
+  local wall = math.max(os.difftime(os.time(), t0), 1)
+  local cpu = os.clock() - c0
+  ch:close()
+  print(string.format("%3d producer(s), %-6s payload: %10.0f msg/s (wall %ds, cpu %.1fs)",
+                      producers, #payload > 0 and #payload .. "B" or "no",
+                      per * producers / wall, wall, cpu))
+end
+
+for _, payload in ipairs{"", string.rep("x", 4096)} do
+  for _, p in ipairs{1, 4, 16} do
+    run(p, payload)
+  end
+end
+
+package.path = oldpath
+os.remove(modfile)
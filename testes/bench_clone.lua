@@ -0,0 +1,38 @@
+-- $Id: testes/bench_clone.lua $
+-- See Copyright Notice in file lua.h
+
+-- State creation: a new state that opens all standard libraries
+-- against a copy of a template state where they are already open
+-- ('moon_clonestate'). Needs the test library (T). Not part of
+-- 'all.lua'; run with
+--   moon bench_clone.lua [N]
+
+local N = tonumber(arg and arg[1]) or 2000
+
+assert(T, "needs the test library")
+
+local template = T.newstate()
+T.loadlib(template, ~0, 0)
+
+local cpu = {}
+for i, clone in ipairs{false, true} do
+  local c0 = os.clock()
+  for _ = 1, N do
+    local L
+    if clone then
+      L = T.clonestate(template)
+    else
+      L = T.newstate()
+      T.loadlib(L, ~0, 0)
+    end
+    assert(T.doremote(L, "return string.rep('a', 3)") == "aaa")
+    T.closestate(L)
+  end
+  cpu[i] = math.max(os.clock() - c0, 1e-3)
+end
+T.closestate(template)
+
+print(string.format("N = %d", N))
+print(string.format("%-20s %8.1f us/state", "new + open libs", cpu[1] / N * 1e6))
+print(string.format("%-20s %8.1f us/state", "clone", cpu[2] / N * 1e6))
+print(string.format("speedup %.2fx", cpu[1] / cpu[2]))
@@ -0,0 +1,39 @@
+-- $Id: testes/bench_gcmark.lua $
+-- See Copyright Notice in file lua.h
+
+-- Full collections of a large live heap (records, closures, strings
+-- and prototypes), to measure parallel marking. Compare against a
+-- build with serial marking (add -DMOONI_GCPARTHREADS=0 to the compiler
+-- flags). Not part of 'all.lua'; run with
+--   moon bench_gcmark.lua [N] [R]
+-- for N records and R collections.
+
+local N = tonumber(arg and arg[1]) or 2000000
+local R = tonumber(arg and arg[2]) or 20
+
+local heap = {}
+do
+  local mt = {__index = function (_, k) return k end}
+  local src = "return function (x) return x + %d end"
+  local protos = {}
+  for i = 1, 1000 do protos[i] = assert(load(string.format(src, i)))() end
+  for i = 1, N do
+    local r = setmetatable({id = i, name = "r" .. i % 1000, i * 0.5}, mt)
+    local f = protos[i % 1000 + 1]
+    heap[i] = {r, function () return f(r.id) end}
+  end
+end
+
+collectgarbage(); collectgarbage()
+print(string.format("live heap: %.1f MB; %d records; %d collections",
+                    collectgarbage("count") / 1024, N, R))
+if T then print("helper threads:", (T.markpool())) end
+
+local t0, c0 = os.time(), os.clock()
+for _ = 1, R do collectgarbage() end
+local cpu = os.clock() - c0
+local wall = os.difftime(os.time(), t0)
+print(string.format("per collection: %.1f ms wall (coarse), %.1f ms cpu",
+                    wall * 1000 / R, cpu * 1000 / R))
+
+assert(heap[N][2]() == N + N % 1000 + 1)   -- heap survived intact
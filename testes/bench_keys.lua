@@ -0,0 +1,22 @@
+-- $Id: testes/bench_keys.lua $
+-- See Copyright Notice in file lua.h
+
+-- Field access from C: 'moon_getfield'/'moon_setfield' (which intern
+-- the key string on every call) against key handles from
+-- 'moonL_internkey' with 'moon_getfieldk'/'moon_setfieldk'. Needs the
+-- test library (T). Not part of 'all.lua'; run with
+--   moon bench_keys.lua [N]
+
+local N = tonumber(arg and arg[1]) or 2000000
+
+assert(T, "needs the test library")
+
+local cpu = {}
+for i, usekeys in ipairs{false, true} do
+  local c0 = os.clock()
+  local r = T.fieldloop(N, usekeys)
+  cpu[i] = math.max(os.clock() - c0, 1e-3)
+  assert(r.id == N and r.score == 2 * N and r.count == 3 * N)
+end
+print(string.format("strings %6.2fs, handles %6.2fs: speedup %.2fx",
+                    cpu[1], cpu[2], cpu[1] / cpu[2]))
@@ -0,0 +1,38 @@
+-- $Id: testes/bench_pairs.lua $
+-- See Copyright Notice in file lua.h
+
+-- Traversals of mixed tables with 'pairs' and 'ipairs' (run inline by
+-- the VM) and with a wrapper around 'next' (a regular call per step),
+-- to measure the cost of a traversal step.
+-- Not part of 'all.lua'; run with
+--   moon bench_pairs.lua [N] [R]
+-- for R traversals of a table with N array and N hash entries.
+
+local N = tonumber(arg and arg[1]) or 1000
+local R = tonumber(arg and arg[2]) or 5000
+
+local t = {}
+for i = 1, N do t[i] = i; t["k" .. i] = i end
+
+local function run (name, f, s)
+  local c0 = os.clock()
+  local sum = 0
+  for _ = 1, R do
+    for k, v in f, s do sum = sum + v end
+  end
+  assert(sum == R * N * (N + 1))
+  print(string.format("%-12s %.2f s", name, os.clock() - c0))
+end
+
+local next = next
+run("pairs", pairs(t))
+run("next", next, t)
+run("wrapped", function (s, k) return next(s, k) end, t)
+
+local c0 = os.clock()
+local sum = 0
+for _ = 1, R do
+  for _, v in ipairs(t) do sum = sum + v end
+end
+assert(sum == R * N * (N + 1) // 2)
+print(string.format("%-12s %.2f s", "ipairs", os.clock() - c0))
@@ -0,0 +1,43 @@
+-- $Id: testes/bench_sweep.lua $
+-- See Copyright Notice in file lua.h
+
+-- Allocation-heavy loop that leaves lots of short-lived tables,
+-- closures and long strings behind, to measure background sweeping.
+-- Needs a test build ('T'), which can switch the helper on and off.
+-- Not part of 'all.lua'; run with
+--   moon bench_sweep.lua [N] [R]
+-- for R rounds of N garbage records.
+
+local N = tonumber(arg and arg[1]) or 200000
+local R = tonumber(arg and arg[2]) or 20
+
+local function round ()
+  local keep = {}
+  for i = 1, N do
+    local s = string.rep("x", 50) .. i
+    local r = {id = i, s = s, f = function () return s end}
+    if i % 100 == 0 then keep[#keep + 1] = r end
+  end
+  return keep
+end
+
+local function run (on)
+  if T then T.bgsweep(on) end
+  collectgarbage(); collectgarbage()
+  local t0, c0 = os.time(), os.clock()
+  for _ = 1, R do assert(#round() == N // 100) end
+  collectgarbage()
+  local cpu = os.clock() - c0
+  local wall = os.difftime(os.time(), t0)
+  print(string.format("background sweep %-3s: %.2f s wall (coarse), %.2f s cpu",
+                      on == nil and "?" or on and "on" or "off", wall, cpu))
+end
+
+if T then
+  run(false)
+  run(true)
+  print("objects freed by the helper:", select(2, T.bgsweep()))
+else
+  print("not a test build; using the default setting")
+  run(nil)
+end
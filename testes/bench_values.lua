@@ -0,0 +1,110 @@
+-- $Id: testes/bench_values.lua $
+-- See Copyright Notice in file lua.h
+
+-- Memory use and throughput of value-heavy code, to compare the
+-- default representation of values with the NaN-boxed one. Build the
+-- interpreter twice (the second time with -DLUA_ENABLE_NANBOXING=ON)
+-- and run both on the same input. Not part of 'all.lua'; run with
+--   moon bench_values.lua [N]
+
+local N = tonumber(arg and arg[1]) or 2000000
+
+print(string.format("integers: %d bits; N = %d",
+      math.floor(math.log(math.maxinteger, 2) + 0.5) + 1, N))
+
+
+-- memory (in KB) retained by the results of 'f'
+local function memory (name, f)
+  collectgarbage(); collectgarbage()
+  local m0 = collectgarbage("count")
+  local keep = f()
+  collectgarbage(); collectgarbage()
+  local kb = collectgarbage("count") - m0
+  print(string.format("%-28s %10.1f KB", name, kb))
+  return keep
+end
+
+local M = N // 20
+
+memory("array of floats", function ()
+  local t = {}
+  for i = 1, M do t[i] = i + 0.5 end
+  return t
+end)
+
+memory("records", function ()
+  local t = {}
+  for i = 1, M // 4 do t[i] = {x = i, y = i + 0.5, name = "p", ok = true} end
+  return t
+end)
+
+memory("functions with constants", function ()
+  local src = {"return function () return {"}
+  for i = 1, 2000 do src[#src + 1] = i + 0.25 .. ", 's" .. i .. "'," end
+  src[#src + 1] = "} end"
+  src = table.concat(src)
+  local t = {}
+  for i = 1, 20 do t[i] = assert(load(src))() end
+  return t
+end)
+
+memory("closures", function ()
+  local t = {}
+  for i = 1, M // 4 do
+    local a, b = i, i + 0.5
+    t[i] = function () return a + b end
+  end
+  return t
+end)
+
+memory("coroutine wrappers", function ()
+  local t = {}
+  for i = 1, M // 40 do t[i] = coroutine.wrap(function () end) end
+  return t
+end)
+
+
+-- throughput of 'f' (iterations per second of CPU time)
+local function speed (name, f)
+  local c0 = os.clock()
+  f(N)
+  local cpu = math.max(os.clock() - c0, 1e-3)
+  print(string.format("%-28s %10.1f Mop/s (cpu %.2fs)", name, N / cpu / 1e6, cpu))
+end
+
+speed("float arithmetic", function (n)
+  local x, y = 0.0, 1.5
+  for _ = 1, n do x = x * 0.5 + y; y = y - x * 0.25 end
+  return x
+end)
+
+speed("integer arithmetic", function (n)
+  local s = 0
+  for i = 1, n do s = (s + i * 3) & 0xFFFF end
+  return s
+end)
+
+speed("array read/write", function (n)
+  local t = {}
+  for i = 1, 1000 do t[i] = i * 0.5 end
+  local s = 0.0
+  for i = 1, n do
+    local k = i % 1000 + 1
+    s = s + t[k]
+    t[k] = s
+  end
+  return s
+end)
+
+speed("field access", function (n)
+  local p = {x = 1.0, y = 2.0, z = 3.0}
+  for _ = 1, n do p.x, p.y, p.z = p.y + p.z, p.z * 0.5, p.x end
+  return p.x
+end)
+
+speed("function calls", function (n)
+  local function f (a, b) return a + b end
+  local s = 0
+  for i = 1, n do s = f(s, i) & 0xFFFF end
+  return s
+end)
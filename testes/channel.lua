@@ -0,0 +1,134 @@
+-- $Id: testes/channel.lua $
+-- See Copyright Notice in file lua.h
+
+global <const> *
+
+print "testing channels"
+
+local channel = require'channel'
+local parallel = require'parallel'
+
+
+local function checkerror (msg, f, ...)
+  local s, err = pcall(f, ...)
+  assert(not s and string.find(err, msg))
+end
+
+
+do   -- basic use inside one state
+  local ch = channel.open("test.basic", 4)
+  assert(#ch == 0 and not ch:isclosed())
+  assert(string.find(tostring(ch), "^channel %(test.basic%)"))
+  assert(channel.open("test.basic") ~= ch)   -- new handle...
+  channel.open("test.basic"):send(1, 2)      -- ...to the same channel
+  assert(#ch == 1)
+  local ok, a, b = ch:receive()
+  assert(ok and a == 1 and b == 2)
+  assert(not ch:tryreceive())
+
+  -- messages keep their values
+  local long = string.rep("x", 1000)
+  ch:send(nil, false, 1.5, math.mininteger, "hi\0", long,
+          {10, 20, k = {long, "y"}})
+  local r = table.pack(ch:receive())
+  assert(r.n == 8 and r[1] == true and r[2] == nil and r[3] == false)
+  assert(r[4] == 1.5 and r[5] == math.mininteger and r[6] == "hi\0")
+  assert(r[7] == long and r[8][2] == 20 and r[8].k[1] == long)
+  ch:send()   -- empty message
+  assert(select('#', ch:receive()) == 1)
+
+  -- bounded capacity
+  for i = 1, 4 do assert(ch:trysend(i)) end
+  assert(#ch == 4 and not ch:trysend(5))
+  for i = 1, 4 do
+    local ok, v = ch:tryreceive()
+    assert(ok and v == i)
+  end
+
+  -- untransferable values
+  checkerror("cannot transfer a function", ch.send, ch, print)
+  checkerror("cannot transfer a userdata", ch.send, ch, io.stdout)
+  assert(#ch == 0)
+
+  -- closing
+  ch:send("last")
+  ch:close()
+  assert(ch:isclosed() and string.find(tostring(ch), "closed"))
+  checkerror("channel is closed", ch.send, ch, 1)
+  assert(not ch:trysend(1))
+  assert(select(2, ch:receive()) == "last")   -- pending messages remain
+  assert(not ch:receive())   -- closed and empty
+  local ch2 = channel.open("test.basic")   -- a fresh channel
+  assert(not ch2:isclosed())
+  ch2:close()
+
+  checkerror("out of range", channel.open, "x", 0)
+end
+
+
+-- module run by the workers
+local modfile = os.tmpname()
+do
+  local f <close> = assert(io.open(modfile, "w"))
+  f:write[[
+    local channel = require'channel'
+    local M = {}
+    function M.produce (name, from, to, s)
+      local ch = channel.open(name)
+      for i = from, to do ch:send(i, s) end
+      return true
+    end
+    function M.echo (inname, outname)
+      local cin, cout = channel.open(inname), channel.open(outname)
+      while true do
+        local ok, v = cin:receive()
+        if not ok then break end
+        cout:send(v)
+      end
+      cout:close()
+      return true
+    end
+    return M
+  ]]
+end
+
+local oldpath = package.path
+package.path = modfile
+
+do   -- several producers in other states
+  local ch = channel.open("test.multi", 8)
+  local s <close> = parallel.scheduler(4)
+  local long = string.rep("abc", 100)
+  local fs = {}
+  for i = 1, 4 do
+    fs[i] = s:submit("m", "produce", "test.multi", i * 1000 + 1, i * 1000 + 250, long)
+  end
+  local seen, n = {}, 0
+  while n < 1000 do
+    local ok, v, str = ch:receive()
+    assert(ok and str == long and not seen[v])
+    seen[v] = true; n = n + 1
+  end
+  for i = 1, 4 do assert(fs[i]:await()) end
+  assert(#ch == 0)
+  ch:close()
+
+  -- round trip through another state
+  local cin, cout = channel.open("test.in", 2), channel.open("test.out", 128)
+  local f = s:submit("m", "echo", "test.in", "test.out")
+  for i = 1, 100 do cin:send({i}) end   -- blocks while 'cin' is full
+  cin:close()
+  local i = 0
+  while true do
+    local ok, v = cout:receive()
+    if not ok then break end
+    i = i + 1
+    assert(v[1] == i)
+  end
+  assert(i == 100 and f:await())
+end
+
+package.path = oldpath
+os.remove(modfile)
+
+print'ok'
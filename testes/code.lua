@@ -368,9 +368,44 @@ check(function (x) return x & 2.0 end, 'LOADF', 'BAND', 'MMBIN', 'RETURN1')
 
 -- basic 'for' loops
 check(function () for i = -10, 10.5 do end end,
-'LOADI', 'LOADK', 'LOADI', 'FORPREP', 'FORLOOP', 'RETURN0')
+'LOADI', 'LOADK', 'LOADI', 'FORPREP', 'FORLOOPI', 'RETURN0')
 check(function () for i = 0xfffffff, 10.0, 1 do end end,
-'LOADK', 'LOADF', 'LOADI', 'FORPREP', 'FORLOOP', 'RETURN0')
+'LOADK', 'LOADF', 'LOADI', 'FORPREP', 'FORLOOPI', 'RETURN0')
+check(function () for i = 1.0, 10 do end end,
+'LOADF', 'LOADI', 'LOADI', 'FORPREP', 'FORLOOP', 'RETURN0')
+check(function (x) for i = x, 10 do end end,
+'MOVE', 'LOADI', 'LOADI', 'FORPREP', 'FORLOOP', 'RETURN0')
+check(function (x) for i = 1, 10, x do end end,
+'LOADI', 'LOADI', 'MOVE', 'FORPREP', 'FORLOOP', 'RETURN0')
+
+-- indexing with the control variable of an integer loop
+check(function (t) for i = 1, #t do local v = t[i] end end,
+'LOADI', 'LEN', 'LOADI', 'FORPREP', 'GETFORI', 'FORLOOPI', 'RETURN0')
+check(function (t) for i = 1.0, #t do local v = t[i] end end,
+'LOADF', 'LEN', 'LOADI', 'FORPREP', 'GETTABLE', 'FORLOOP', 'RETURN0')
+check(function (t, x) for i = 1, #t do local v = t[x] end end,
+'LOADI', 'LEN', 'LOADI', 'FORPREP', 'GETTABLE', 'FORLOOPI', 'RETURN0')
+do
+  local t = setmetatable({10, 20, 30, [5] = 50}, {__index = function (_, k)
+    return -k
+  end})
+  local s = {}
+  for i = 0, 6 do s[#s + 1] = t[i] end
+  assert(table.concat(s, " ") == "0 10 20 30 -4 50 -6")
+  -- error names the indexed variable ('all.lua' strips this file, so
+  -- use a chunk of its own with debug information)
+  local src = "local x = 1; for i = 1, 2 do local _ = x[i] end"
+  local st, msg = pcall(load(src))
+  assert(not st and string.find(msg, "index a number value %(local 'x'%)"))
+  st, msg = pcall(load(string.dump(load(src), true)))   -- stripped
+  assert(not st and string.find(msg, "index a number value") and
+         not string.find(msg, "local 'x'"))
+  local n = 0
+  for i = math.maxinteger - 2, math.maxinteger do n = n + 1 end
+  assert(n == 3)
+  for i = 3, 1, -1 do n = n + i end
+  assert(n == 9)
+end
 
 -- bug in constant folding for 5.1
 check(function () return -nil end, 'LOADNIL', 'UNM', 'RETURN1')
@@ -500,5 +535,179 @@ do   print("testing code for integer limits")
 
 end
 
+do   print("testing the bytecode optimizer")
+  local function opt (src)
+    return assert(load(src, "=opt", "tO")), assert(load(src, "=opt", "t"))
+  end
+
+  -- constants propagate through locals and arithmetic
+  local f = opt[[
+    local a = 10
+    local b = a + 5
+    return b * 2
+  ]]
+  check(f, 'VARARGPREP', 'LOADI', 'RETURN')
+  assert(f() == 30)
+
+  -- tests with a known outcome disappear with their dead branch
+  f = opt[[
+    local x = 3.5
+    if x < 2.0 then return "small" end
+    return "big"
+  ]]
+  check(f, 'VARARGPREP', 'LOADK', 'RETURN')
+  assert(f() == "big")
+
+  -- jump chains are threaded
+  f = opt[[
+    local a = ...
+    while a do
+      if a > 10 then break end
+      a = a + 1
+    end
+    return a
+  ]]
+  local code = T.listcode(f)
+  for pc, l in ipairs(code) do
+    local j = tonumber(string.match(l, "JMP%s+(%-?%d+)"))
+    if j then   -- no jump leads to another jump
+      assert(not string.find(code[pc + j + 1], "JMP"))
+    end
+  end
+  assert(f(1) == 11 and f(false) == false)
+
+  -- copies are read from their source and dead stores of constants go
+  -- away; stores that take or drop references stay, as the collector
+  -- sees them
+  f = opt[[
+    local a = ...
+    local b = a
+    local c = b
+    return c + 1
+  ]]
+  check(f, 'VARARGPREP', 'VARARG', 'MOVE', 'MOVE', 'ADDI', 'MMBINI', 'RETURN')
+  assert(f(41) == 42)
+  local fo, fu = opt"local a, b, c = 1, 2, 3; return a + b + c"
+  assert(fo() == 6 and fu() == 6)
+  assert(#T.listcode(fo) < #T.listcode(fu))
+  fo, fu = opt[[
+    local t = setmetatable({}, {__mode = "v"})
+    local a = {}
+    t[1] = a
+    a = nil
+    collectgarbage()
+    return t[1]
+  ]]
+  assert(fo() == nil and fu() == nil)
+
+  -- values that escape into closures or to-be-closed variables stay
+  f = opt[[
+    local a = 1
+    local function inc () a = a + 1 end
+    inc()
+    if a == 1 then return "wrong" end
+    return a
+  ]]
+  assert(f() == 2)
+  f = opt[[
+    local log = {}
+    do
+      local x <close> = setmetatable({}, {__close = function ()
+                                           log[#log + 1] = "closed" end})
+    end
+    return log[1]
+  ]]
+  assert(f() == "closed")
+
+  -- optimized and plain code agree
+  local progs = {
+    "local s = 0; for i = 1, 100 do if i % 3 == 0 then s = s + i end end; return s",
+    "local t = {}; for k, v in pairs{a = 1, b = 2} do t[#t + 1] = k .. v end; table.sort(t); return table.concat(t)",
+    "local a, b = 1, nil; local c = a and b or 'x'; return c",
+    "local x = -0.0; return 1/x",
+    "local x = 2^53; return x + 1 == x",
+    "local a = 3 // 0.0; local b = 1 % math.huge; return a, b",
+    "local a = 'x'; local b = a .. a; return b, #b",
+    "local n = 0; repeat n = n + 1 until n >= 10; return n",
+    "local a = not nil; local b = not 0; return a, b",
+    "local function f (...) return select('#', ...) end; return f(1, nil, 3)",
+  }
+  for _, src in ipairs(progs) do
+    local fo, fu = opt(src)
+    local ro, ru = table.pack(fo()), table.pack(fu())
+    assert(ro.n == ru.n)
+    for i = 1, ro.n do
+      assert(ro[i] == ru[i] and math.type(ro[i]) == math.type(ru[i]))
+    end
+  end
+
+  -- line information stays consistent
+  f = opt"local a = 1\n\nlocal b = a + 1\n\nerror('x' .. b)"
+  local _, msg = pcall(f)
+  assert(string.find(msg, "^opt:5:"))
+
+  -- optimized functions survive a dump
+  f = load(string.dump(opt"local a = 4; return a * a"))
+  assert(f() == 16)
+end
+
+do   print("testing quickening")
+  local function ops (f)
+    local t = {}
+    for _, l in ipairs(T.listcode(f)) do
+      t[#t + 1] = string.match(l, "%d+ %- ([%u_]+)")
+    end
+    return table.concat(t, " ")
+  end
+  local function checkvalues (t1, t2)
+    assert(#t1 == #t2)
+    for i = 1, #t1 do
+      assert(t1[i] == t2[i] and math.type(t1[i]) == math.type(t2[i]))
+    end
+  end
+  local function f (a, b) return a + b, a - b, a * b, a < b, a <= b end
+  local generic = ops(f)
+  assert(generic == "ADD MMBIN SUB MMBIN MUL MMBIN LT JMP LFALSESKIP " ..
+                    "LOADTRUE LE JMP LFALSESKIP LOADTRUE RETURN RETURN")
+  checkvalues({f(3, 4)}, {7, -1, 12, true, true})
+  assert(ops(f) == "ADD_II MMBIN SUB_II MMBIN MUL_II MMBIN LT_II JMP " ..
+                   "LFALSESKIP LOADTRUE LE_II JMP LFALSESKIP LOADTRUE " ..
+                   "RETURN RETURN")
+  -- quickened code is never dumped
+  assert(ops(load(string.dump(f))) == generic)
+  -- a failed guard goes back to the generic form (and gets it right)
+  checkvalues({f(3.5, 4.0)}, {7.5, -0.5, 14.0, true, true})
+  assert(ops(f) == generic)
+  checkvalues({f(3.5, 4.0)}, {7.5, -0.5, 14.0, true, true})
+  assert(string.find(ops(f), "^ADD_FF MMBIN SUB_FF MMBIN MUL_FF"))
+  checkvalues({f(1, 2.5)}, {3.5, -1.5, 2.5, true, true})
+  assert(ops(f) == generic)
+  checkvalues({f(1, 2.5)}, {3.5, -1.5, 2.5, true, true})
+  assert(ops(f) == generic)   -- mixed operands keep the generic form
+  f(1, 2)
+  local mt = {__add = function () return "add" end,
+              __sub = function () return "sub" end,
+              __mul = function () return "mul" end,
+              __lt = function () return true end,
+              __le = function () return false end}
+  local o = setmetatable({}, mt)
+  assert(f(o, 1) == "add" and select(4, f(0, o)) and not select(5, f(o, 0)))
+  f(1, 2)
+  local st, msg = pcall(f, 1, {})
+  assert(not st and string.find(msg, "arithmetic on a table value"))
+  f(1, 2)
+  st, msg = pcall(function (a, b) return a < b end, 1, {})
+  assert(not st and string.find(msg, "compare number with table"))
+  -- integer overflow wraps around in the quickened form too
+  local function add (a, b) return a + b end
+  add(1, 2)
+  assert(add(math.maxinteger, 1) == math.mininteger)
+  -- NaN compares false in the float forms
+  local function lt (a, b) return a < b, a <= b end
+  lt(1.0, 2.0)
+  local x, y = lt(0/0, 1.0)
+  assert(not x and not y)
+end
+
 print 'OK'
 
@@ -19,6 +19,31 @@ assert(not pcall(coroutine.resume, 0))
 assert(not pcall(coroutine.status, 0))
 
 
+-- creation hints
+do
+  local function deep (n) if n > 0 then return deep(n - 1) + 1 end return 0 end
+  local co = coroutine.create(deep, {stacksize = 5000})
+  assert(coroutine.status(co) == "suspended")
+  local st, res = coroutine.resume(co, 1000)
+  assert(st and res == 1000)
+  co = coroutine.wrap(function (a) return coroutine.yield(a) * 2 end, {})
+  assert(co(10) == 10 and co(21) == 42)
+  local function checkerror (msg, ...)
+    local st, err = pcall(coroutine.create, ...)
+    assert(not st and string.find(err, msg))
+  end
+  checkerror("table expected", print, 10)
+  checkerror("non%-negative integer", print, {stacksize = -1})
+  checkerror("non%-negative integer", print, {stacksize = "x"})
+  checkerror("too large", print, {stacksize = math.maxinteger})
+  -- many short-lived coroutines (recycled through the thread pool)
+  for i = 1, 1000 do
+    local co = coroutine.wrap(function (x) return x + 1 end)
+    assert(co(i) == i + 1)
+  end
+end
+
+
 -- tests for multiple yield/resume arguments
 
 local function eqtab (t1, t2)
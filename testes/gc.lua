@@ -646,7 +646,8 @@ if T then
   assert(T.totalmem("function") == t + 1)
   t = T.totalmem("thread")
   a = coroutine.create(function () end)   -- create 1 new coroutine
-  assert(T.totalmem("thread") == t + 1)
+  -- (unless it reuses a dead one from the thread pool)
+  assert(T.totalmem("thread") == t + 1 or T.totalmem("thread") == t)
 end
 
 
@@ -692,6 +693,163 @@ if T then
   end
 end
 
+do   print("parallel marking")
+  -- a graph with all kinds of objects, to be shared among the
+  -- marking threads (when there are any)
+  local function check (mode)
+    local old = collectgarbage(mode)
+    local N = 2000
+    local mt = {__index = function (_, k) return k * 2 end}
+    local wk = setmetatable({}, {__mode = "k"})
+    local wv = setmetatable({}, {__mode = "v"})
+    local objs = {}
+    for i = 1, N do
+      local t = setmetatable({i, tostring(i), {i}}, mt)
+      local function f () return t, i end
+      local co = coroutine.wrap(function () coroutine.yield(t); return i end)
+      assert(co() == t)   -- keep 't' only in a suspended stack, too
+      objs[i] = {t = t, f = f, co = co, s = string.rep("x", i % 50) .. i}
+      wk[t] = f
+      wv[i] = {}   -- not referenced anywhere else
+    end
+    collectgarbage()
+    assert(next(wv) == nil)
+    local n = 0
+    for k, v in pairs(wk) do n = n + 1; assert(v() == k) end
+    assert(n == N)
+    for i = 1, N do
+      local o = objs[i]
+      local t, j = o.f()
+      assert(t == o.t and j == i and t[100] == 200)
+      assert(t[1] == i and t[2] == tostring(i) and t[3][1] == i)
+      assert(o.s == string.rep("x", i % 50) .. i and o.co() == i)
+    end
+    if T then
+      local nh, nd = T.markpool()
+      assert(nh == 0 or nd > 0)
+    end
+    objs = nil
+    collectgarbage()
+    assert(next(wk) == nil)
+    collectgarbage(old)
+  end
+  check("incremental")
+  check("generational")
+end
+
+
+if T then   print("background sweeping")
+  local old = T.bgsweep(true)
+  local function check (mode)
+    local oldmode = collectgarbage(mode)
+    local _, n0 = T.bgsweep()
+    local live = {}
+    for i = 1, 100 do live[i] = {i, string.rep("y", 100) .. i} end
+    local m0 = T.totalmem()
+    local garbage = {}
+    for i = 1, 5000 do
+      local s = string.rep("x", 60) .. i      -- long string
+      garbage[i] = {s, function () return s end, {i}}
+    end
+    assert(T.totalmem() > m0)
+    garbage = nil
+    collectgarbage(); collectgarbage()
+    local _, n1 = T.bgsweep()
+    assert(n1 - n0 >= 5000)       -- most garbage freed by the helper
+    assert(T.totalmem() <= m0 + 1000)
+    for i = 1, 100 do
+      assert(live[i][1] == i and live[i][2] == string.rep("y", 100) .. i)
+    end
+    collectgarbage(oldmode)
+  end
+  check("incremental")
+  check("generational")
+  -- turning it off stops the helper; the state keeps working
+  assert(T.bgsweep(false) == true)
+  local t = {}
+  for i = 1, 1000 do t[i] = {} end
+  t = nil
+  collectgarbage()
+  assert(select(2, T.bgsweep()) == 0)
+  T.bgsweep(old)
+end
+
+
+if T then   print("recycling of small blocks")
+  local old = T.recycle(true)
+  local function check (mode)
+    local oldmode = collectgarbage(mode)
+    collectgarbage()
+    assert(select(2, T.recycle()) == 0)   -- full collections empty it
+    local live = {}
+    for i = 1, 20000 do
+      local t = {i, i + 1}                  -- small blocks, mostly garbage
+      local f = function () return t end
+      if i % 100 == 0 then live[#live + 1] = f end
+    end
+    if mode == "incremental" then
+      repeat until collectgarbage("step")   -- finish a cycle step by step
+    else
+      collectgarbage("step")   -- a minor collection
+    end
+    local _, n = T.recycle()
+    assert(n > 0)   -- blocks freed by the steps are kept for reuse
+    T.checkmemory()
+    for i = 1, #live do
+      local t = live[i]()
+      assert(t[1] == i * 100 and t[2] == i * 100 + 1)
+    end
+    collectgarbage()
+    assert(select(2, T.recycle()) == 0)
+    T.checkmemory()
+    collectgarbage(oldmode)
+  end
+  check("incremental")
+  check("generational")
+  assert(T.recycle(false) == true)
+  for i = 1, 1000 do local t = {i} end
+  assert(select(2, T.recycle()) == 0)
+  T.recycle(old)
+end
+
+
+if T then   print("reference-counted reclamation")
+  -- each graph has 3 objects, all freed by one drain
+  local function check (mode)
+    local oldmode = collectgarbage(mode)
+    collectgarbage()
+    assert(T.arcfree(1) == 3)
+    assert(T.arcfree(1000) == 3000)
+    T.checkmemory()
+    if mode == "incremental" then
+      -- drain in the middle of a sweep
+      local a = {}
+      for i = 1, 5000 do a[i] = {} end
+      a = nil
+      T.gcstate("sweepallgc")
+      assert(T.arcfree(1000) == 3000)
+      T.checkmemory()
+    end
+    collectgarbage()
+    T.checkmemory()
+    collectgarbage(oldmode)
+  end
+  check("incremental")
+  check("generational")
+
+  -- objects queued by ARC but freed by the collector before a drain
+  for _ = 1, 100 do
+    local t = {}
+    t.x = {}
+    rawset(t, "x", 1)   -- drops the count of the old value
+    collectgarbage(); collectgarbage()
+    local a = {}
+    for i = 1, 100 do a[i] = {i} end
+    assert(T.arcfree(1) == 3)
+  end
+end
+
+
 -- just to make sure
 assert(collectgarbage'isrunning')
 
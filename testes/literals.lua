@@ -342,4 +342,31 @@ malformednum("0xe-", "near <eof>")
 malformednum("0xep-p", "malformed number")
 malformednum("1print()", "malformed number")
 
+
+-- long runs of names, strings, and comments split across reader chunks
+do
+  local function chunks (s, n)
+    local i = 1
+    return function ()
+      local r = string.sub(s, i, i + n - 1)
+      i = i + n
+      return r
+    end
+  end
+  local name = string.rep("x", 40) .. "_1"
+  local long = string.rep("abc\n", 20) .. "]=]" .. string.rep("y", 30)
+  local src = "local " .. name .. " = '" .. string.rep("q", 50) .. "\\n'\n" ..
+              "-- " .. string.rep("c", 50) .. "\n" ..
+              "--[[ " .. string.rep("c\n", 20) .. "\n\r\r\n ]]\n" ..
+              "local s = [==[" .. long .. "]==]\n" ..
+              "return " .. name .. ", s, debug.getinfo(1, 'l').currentline"
+  local env = {debug = require"debug"}
+  local n, s, line = load(src, "=src", "t", env)()
+  assert(n == string.rep("q", 50) .. "\n" and s == long and line == 47)
+  for _, size in ipairs{1, 2, 3, 7, 16, 17} do
+    local n1, s1, line1 = load(chunks(src, size), "=src", "t", env)()
+    assert(n1 == n and s1 == s and line1 == line)
+  end
+end
+
 print('OK')
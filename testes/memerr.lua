@@ -261,6 +261,46 @@ end)
 -- }==================================================================
 
 
+do   print("per-state memory limit")
+  collectgarbage()
+  T.memusage(true)   -- restart the peak
+  local inuse, peak = T.memusage()
+  assert(inuse == collectgarbage("count") * 1024 and peak == inuse)
+  local limit = inuse + 200000
+  assert(T.memlimit(limit) == 0)
+
+  -- garbage does not hit the limit (emergency collections free it)
+  for i = 1, 100 do local t = {}; for j = 1, 1000 do t[j] = j end end
+
+  -- live data does
+  local a = {}
+  checkerr(MEMERRMSG, function ()
+    for i = 1, math.huge do a[i] = {i} end
+  end)
+  local n = #a
+  assert(n > 100)
+  inuse, peak = T.memusage()
+  assert(inuse <= peak and peak <= limit)
+
+  -- the state keeps working after the error
+  a = nil
+  collectgarbage()
+  local t = {}
+  for i = 1, n do t[i] = {i} end
+  assert(#t == n)
+  t = nil
+
+  assert(T.memlimit(0) == limit)    -- remove the limit
+  local big = {}
+  for i = 1, 2 * n do big[i] = {i} end
+  inuse, peak = T.memusage()
+  assert(inuse > limit and peak >= inuse)
+  big = nil
+  collectgarbage()
+  assert(T.memusage() < inuse and select(2, T.memusage()) == peak)
+end
+
+
 print "Ok"
 
 
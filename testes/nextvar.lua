@@ -949,4 +949,175 @@ do
 
 end
 
+do   print("testing frozen tables")
+  local t = {10, 20, 30, x = 1, y = {}}
+  for i = 4, 100 do t[i] = i end
+  for i = 4, 100 do t[i] = nil end   -- leave slack in the array part
+  t.z = 1; t.z = nil                 -- and a deleted entry in the hash
+  assert(not table.isfrozen(t))
+  assert(table.freeze(t) == t and table.isfrozen(t))
+  check(t, 4, 2)   -- shrunk to fit
+  assert(t[1] == 10 and t[3] == 30 and t.x == 1 and #t == 3)
+  assert(table.freeze(t) == t)   -- freezing again is harmless
+
+  -- every kind of write fails
+  checkerror("frozen table", function () t[1] = 0 end)
+  checkerror("frozen table", function () t[4] = 0 end)
+  checkerror("frozen table", function () t.x = 2 end)
+  checkerror("frozen table", function () t.w = 2 end)
+  checkerror("frozen table", function () t[1.5] = 2 end)
+  checkerror("frozen table", function () t[string.rep("k", 50)] = 2 end)
+  checkerror("frozen table", rawset, t, "x", 3)
+  checkerror("frozen table", rawset, t, 2, 3)
+  checkerror("frozen table", table.insert, t, 40)
+  checkerror("frozen table", table.remove, t)
+  checkerror("frozen table", table.sort, t, function (a, b) return a > b end)
+  checkerror("frozen table", setmetatable, t, {})
+  assert(t[1] == 10 and t[2] == 20 and t.x == 1 and t.w == nil)
+
+  -- contents are not frozen
+  t.y.a = 1
+  assert(t.y.a == 1 and not table.isfrozen(t.y))
+
+  -- traversal still works
+  local n = 0
+  for k, v in pairs(t) do n = n + 1 end
+  assert(n == 5)
+
+  -- absent keys still go to '__newindex'
+  local log = {}
+  local p = table.freeze(setmetatable({}, {__newindex = log, __index = log}))
+  p.a = 1
+  assert(log.a == 1 and p.a == 1 and rawget(p, "a") == nil)
+  local q = table.freeze(setmetatable({k = 1}, {__newindex = log}))
+  checkerror("frozen table", function () q.k = 2 end)
+
+  table.freeze({})
+  checkerror("table expected", table.freeze, 1)
+  assert(not table.isfrozen(setmetatable({}, {})))
+end
+
+
+do   print("testing inline traversal of 'pairs' loops")
+  local debug = require"debug"
+  local t = {10, 20, 30, x = 1, y = 2, [2.5] = 3, [{}] = 4}
+  for i = 100, 120 do t[i] = i end
+
+  -- same order as explicit calls to 'next'
+  local keys = {}
+  local k = next(t)
+  while k ~= nil do keys[#keys + 1] = k; k = next(t, k) end
+  local n = 0
+  for k, v in pairs(t) do
+    n = n + 1
+    assert(k == keys[n] and v == t[k])
+  end
+  assert(n == #keys)
+  n = 0
+  for k in next, t do n = n + 1; assert(k == keys[n]) end   -- one variable
+  assert(n == #keys)
+  n = 0
+  for k, v, a, b in pairs(t) do   -- extra variables are nil
+    n = n + 1; assert(a == nil and b == nil)
+  end
+  assert(n == #keys)
+
+  -- changing and erasing fields in the middle of a traversal
+  local c = {}
+  for i = 1, 50 do c[i] = i; c["k" .. i] = i end
+  n = 0
+  for k, v in pairs(c) do
+    n = n + 1
+    if v % 2 == 0 then c[k] = nil else c[k] = -v end
+    collectgarbage("step")
+  end
+  assert(n == 100)
+  for k, v in pairs(c) do assert(v < 0 and v % 2 == 1) end
+
+  -- hidden position changed behind the loop's back
+  n = 0
+  for k, v in pairs(t) do
+    n = n + 1
+    assert(k == keys[n])
+    local i = 1
+    while true do
+      local name = debug.getlocal(1, i)
+      if name == nil then break end
+      if name == "(for state)" then debug.setlocal(1, i + 2, 12345); break end
+      i = i + 1
+    end
+  end
+  assert(n == #keys)
+
+  -- with a call hook, 'next' is really called
+  local calls = 0
+  debug.sethook(function ()
+    if debug.getinfo(2, "f").func == next then calls = calls + 1 end
+  end, "c")
+  n = 0
+  for k in pairs(t) do n = n + 1 end
+  debug.sethook()
+  assert(n == #keys and calls == n + 1)
+
+  -- errors
+  checkerror("invalid key", function () for k in next, {10, 20}, 3 do end end)
+  checkerror("table expected",
+             function () for k in next, "abc" do end end)
+end
+
+
+do   print("testing inline 'ipairs' loops")
+  local debug = require"debug"
+  local t = {10, 20, 30, nil, 50}
+  local n = 0
+  for i, v in ipairs(t) do n = n + 1; assert(i == n and v == t[i]) end
+  assert(n == 3)
+
+  -- hash part, and values changed during the loop
+  t = {}
+  for i = 10, 1, -1 do t[i] = i end   -- (built backwards, in the hash)
+  n = 0
+  for i, v, x in ipairs(t) do
+    n = n + 1; assert(i == v and x == nil)
+    t[i + 1] = nil   -- cut the sequence
+  end
+  assert(n == 1)
+
+  -- '__index' is honored for absent entries
+  local p = setmetatable({1, 2}, {__index = function (_, i)
+    if i <= 5 then return i * 10 end
+  end})
+  n = 0
+  for i, v in ipairs(p) do n = n + 1; assert(v == (i <= 2 and i or i * 10)) end
+  assert(n == 5)
+
+  -- other metamethods do not matter
+  p = setmetatable({1, 2, 3}, {__newindex = error, __len = error})
+  n = 0
+  for i in ipairs(p) do n = n + 1 end
+  assert(n == 3)
+
+  -- chained '__index', and a state that is not a table
+  p = setmetatable({}, {__index = function (_, i) return i <= 4 or nil end})
+  local u = setmetatable({}, {__index = p})
+  n = 0
+  for i in ipairs(u) do n = n + 1 end
+  assert(n == 4)
+  n = 0
+  for i in ipairs("abc") do n = n + 1 end
+  assert(n == 0)
+
+  -- with a call hook, the iterator is really called
+  local calls = 0
+  local iter = ipairs({})
+  debug.sethook(function ()
+    if debug.getinfo(2, "f").func == iter then calls = calls + 1 end
+  end, "c")
+  n = 0
+  for i in ipairs({1, 2, 3}) do n = n + 1 end
+  debug.sethook()
+  assert(n == 3 and calls == 4)
+end
+
+
 print"OK"
@@ -0,0 +1,131 @@
+-- $Id: testes/parallel.lua $
+-- See Copyright Notice in file lua.h
+
+global <const> *
+
+print "testing parallel library"
+
+local parallel = require'parallel'
+
+
+local function checkerror (msg, f, ...)
+  local s, err = pcall(f, ...)
+  assert(not s and string.find(err, msg))
+end
+
+
+-- module run by the workers
+local modfile = os.tmpname()
+do
+  local f <close> = assert(io.open(modfile, "w"))
+  f:write[[
+    local M = {}
+    function M.add (a, b) return a + b end
+    function M.sum (t)
+      local s = 0
+      for i = 1, #t do s = s + t[i] end
+      return s, #t
+    end
+    function M.echo (...) return ... end
+    function M.fail (msg) error(msg, 0) end
+    function M.fib (n)
+      if n < 2 then return n end
+      return M.fib(n - 1) + M.fib(n - 2)
+    end
+    return M
+  ]]
+end
+
+-- a template without '?' matches any module name
+local oldpath = package.path
+package.path = modfile
+
+do
+  local s <close> = parallel.scheduler(4)
+  assert(s:size() == 4)
+  assert(string.find(tostring(s), "^scheduler %("))
+
+  -- simple calls
+  assert(s:submit("m", "add", 10, 20):await() == 30)
+  local t = {}
+  for i = 1, 100 do t[i] = i end
+  local sum, n = s:submit("m", "sum", t):await()
+  assert(sum == 5050 and n == 100)
+
+  -- values are copied across states
+  local a, b, c, d, e = s:submit("m", "echo", nil, true, 1.5, "hi\0x",
+                                 {x = {1, 2, {y = false}}}):await()
+  assert(a == nil and b == true and c == 1.5 and d == "hi\0x")
+  assert(e.x[1] == 1 and e.x[2] == 2 and e.x[3].y == false)
+  assert(math.type(s:submit("m", "echo", 3):await()) == "integer")
+  assert(select('#', s:submit("m", "echo"):await()) == 0)
+
+  -- errors are raised by 'await'
+  local f = s:submit("m", "fail", "boom")
+  checkerror("^boom$", f.await, f)
+  f = s:submit("m", "nofunc")
+  checkerror("no function 'nofunc'", f.await, f)
+  f = s:submit("m", "fail", {})
+  checkerror("error object is not a string", f.await, f)
+
+  -- values that cannot be transferred
+  checkerror("cannot transfer a function", s.submit, s, "m", "echo", print)
+
+  -- shared subtables and cycles keep their shape
+  local sub = {10}
+  local r = {sub, sub, {sub}}; r.self = r
+  local t, t2 = s:submit("m", "echo", r, sub):await()
+  assert(t[1] == t[2] and t[3][1] == t[1] and t.self == t and t2 == t[1])
+  assert(t[1] ~= sub and t[1][1] == 10)
+  local dag = {}
+  for _ = 1, 60 do dag = {dag, dag} end   -- 2^60 paths, 61 tables
+  t = s:submit("m", "echo", dag):await()
+  assert(t[1] == t[2] and t[1][1] == t[1][2])
+
+  -- many tasks at once
+  local fs = {}
+  for i = 1, 200 do fs[i] = s:submit("m", "fib", i % 20) end
+  local function fib (n) if n < 2 then return n else return fib(n-1) + fib(n-2) end end
+  for i = 1, 200 do assert(fs[i]:await() == fib(i % 20)) end
+
+  -- 'await' inside a coroutine yields while the task is pending
+  local co = coroutine.wrap(function ()
+    local f = s:submit("m", "fib", 25)
+    return f:await()
+  end)
+  local res = co()
+  while res ~= 75025 do
+    assert(getmetatable(res) == getmetatable(f))  -- yielded the future
+    res = co()
+  end
+  assert(res == 75025)
+
+  -- 'ready' eventually becomes true
+  f = s:submit("m", "add", 1, 2)
+  f:await()
+  assert(f:ready())
+end
+
+-- closed schedulers
+do
+  local s = parallel.scheduler(1)
+  local f = s:submit("m", "fib", 15)
+  s:close()
+  assert(f:ready() and f:await() == 610)   -- closing drains pending tasks
+  s:close()   -- closing twice is harmless
+  checkerror("closed scheduler", s.submit, s, "m", "add", 1, 2)
+  assert(tostring(s) == "scheduler (closed)")
+end
+
+-- preloaded modules and argument checks
+do
+  local s <close> = parallel.scheduler(2, {"m"})
+  assert(s:submit("m", "add", 1, 1):await() == 2)
+  checkerror("out of range", parallel.scheduler, 0)
+  checkerror("table expected", parallel.scheduler, 1, 10)
+end
+
+package.path = oldpath
+os.remove(modfile)
+
+print'ok'
@@ -0,0 +1,175 @@
+-- $Id: testes/profile.lua $
+-- See Copyright Notice in file lua.h
+
+global <const> *
+
+print "testing sampling profiler"
+
+local profile = require'profile'
+local debug = require'debug'
+
+
+local function checkerror (msg, f, ...)
+  local s, err = pcall(f, ...)
+  assert(not s and string.find(err, msg))
+end
+
+
+do   -- VM counters (only in interpreters built with them)
+  local function sum (n)
+    local s = 0
+    for i = 1, n do s = s + i end
+    return s
+  end
+  local stats = debug.vmstats(true)
+  if not stats then
+    (Message or print)('\n >>> VM counters not available <<<\n')
+  else
+    for _ = 1, 10 do sum(100) end
+    stats = debug.vmstats()
+    -- the first execution quickens the 'ADD' into 'ADD_II'
+    assert(stats.opcodes.ADD_II >= 999 and stats.opcodes.FORLOOPI >= 1000)
+    assert(stats.pairs.ADD_II.FORLOOPI >= 999)
+    assert(stats.instructions >= 2000)
+    local line = debug.getinfo(sum, "S").linedefined
+    local found
+    for i, e in ipairs(stats.functions) do
+      if i > 1 then   -- sorted by instructions
+        assert(e.instructions <= stats.functions[i - 1].instructions)
+      end
+      if e.line == line and string.find(e.source, "profile.lua") then
+        assert(e.calls == 10 and e.instructions >= 2000 and e.time >= 0)
+        found = true
+      end
+    end
+    assert(found)
+    debug.vmstats(true)
+    stats = debug.vmstats()
+    assert(not stats.opcodes.ADD)   -- counters were reset
+  end
+end
+
+do   -- heap profiler
+  local function alloc (n)
+    local t = {}
+    for i = 1, n do t[i] = {} end
+    return t
+  end
+  checkerror("invalid option", debug.heapprofile, "xuxu")
+  debug.heapprofile("start")
+  local keep = alloc(100)
+  debug.heapprofile("stop")
+  alloc(10)   -- not recorded
+  local out = debug.heapprofile()
+  assert(debug.heapprofile("dump") == out)
+  local syms, header, body = string.match(out,
+      "^%-%-%- symbol\nbinary=[^\n]*\n(.-)%-%-%-\n%-%-%- heap\n([^\n]*)\n(.*)$")
+  assert(syms and header and body)
+  local labels = {}
+  for addr, label in string.gmatch(syms, "(0x%x+) ([^\n]*)\n") do
+    labels[addr] = label
+  end
+  local line = debug.getinfo(alloc, "S").linedefined + 2
+  local total, found = 0, false
+  for inuse, allocs, stack in string.gmatch(body,
+                             "(%d+): %d+ %[(%d+): %d+%] @([^\n]*)\n") do
+    assert(tonumber(inuse) <= tonumber(allocs))
+    total = total + tonumber(allocs)
+    local frames = {}
+    for addr in string.gmatch(stack, "0x%x+") do
+      frames[#frames + 1] = assert(labels[addr])
+    end
+    if frames[1] == "[table]" and
+       string.find(frames[2], "^alloc %(.*profile.lua:%d+%):" .. line .. "$") then
+      assert(tonumber(allocs) == 100)
+      found = true
+    end
+  end
+  assert(found)
+  local htotal = string.match(header, "^heap profile: %d+: %d+ %[(%d+): %d+%]")
+  assert(tonumber(htotal) == total)
+  debug.heapprofile("start")   -- discards previous sites
+  assert(not string.find(debug.heapprofile(), "alloc"))
+  debug.heapprofile("stop")
+end
+
+
+checkerror("out of range", profile.start, -1)
+checkerror("invalid option", profile.dump, nil, "xuxu")
+
+if not pcall(profile.start) then
+  (Message or print)('\n >>> profiler not available <<<\n')
+  return
+end
+profile.stop()
+
+
+local function busy ()
+  local s = 0
+  for i = 1, 10000 do s = s + i % 3 end
+  return s
+end
+
+-- samples are taken inside coroutines, too
+local co = coroutine.wrap(function ()
+  while true do busy(); coroutine.yield() end
+end)
+
+profile.start(500)
+local t = os.clock()
+repeat
+  co()
+until os.clock() - t > 0.5 and string.find(profile.dump(), "busy")
+profile.stop()
+
+local out = profile.dump()
+assert(profile.dump() == out)   -- stopped
+local total = 0
+for l in string.gmatch(out, "[^\n]+") do
+  local stack, n = string.match(l, "^(.*) (%d+)$")
+  assert(stack and not string.find(stack, ";;"))
+  total = total + tonumber(n)
+end
+assert(total > 0)
+assert(string.find(out, "busy %(profile.lua:%d+%)"))
+
+-- per-line frames
+local lines = profile.dump(nil, "line")
+for l in string.gmatch(lines, "[^\n]+") do
+  local stack = string.match(l, "^(.*) %d+$")
+  for frame in string.gmatch(stack, "[^;]+") do
+    assert(string.find(frame, "%):[%d?]+$"))
+  end
+end
+
+-- dump to a file
+local fname = os.tmpname()
+assert(profile.dump(fname) == true)
+local f <close> = assert(io.open(fname))
+assert(f:read("a") == out)
+os.remove(fname)
+assert(not profile.dump("/non-existent-dir/x"))
+
+
+-- only one state per process can be profiled at a time
+local parallel = require'parallel'
+local modfile = os.tmpname()
+do
+  local f <close> = assert(io.open(modfile, "w"))
+  f:write[[
+    return {start = function () return pcall(require'profile'.start) end}
+  ]]
+end
+local oldpath = package.path
+package.path = modfile
+do
+  local s <close> = parallel.scheduler(1)
+  profile.start()
+  assert(not s:submit("m", "start"):await())
+  profile.stop()
+  assert(s:submit("m", "start"):await())   -- left running in the worker
+end
+package.path = oldpath
+os.remove(modfile)
+
+print'ok'
@@ -147,5 +147,58 @@ do
   local a, b = g()
   assert(a == nil and b == 2)
 end
-print('OK')
+do   print("testing 'select' over varargs")
+  local debug = require"debug"
+  local function checkerror (msg, f, ...)
+    local st, err = pcall(f, ...)
+    assert(not st and string.find(err, msg))
+  end
+  local function count (...) return select('#', ...) end
+  local function countx (...) local n = select("#x", ...); return n end
+  local function sel (i, ...) return select(i, ...) end
+  local function sel2 (i, ...) local a, b = select(i, ...); return a, b end
+  local function pack (i, ...) return {n = select('#', select(i, ...)),
+                                       select(i, ...)} end
+  assert(count() == 0 and count(nil, nil) == 2 and countx(1, 2, 3) == 3)
+  assert(sel(1, 10, 20, 30) == 10 and select('#', sel(1, 10, 20, 30)) == 3)
+  assert(select('#', sel(3, 10, 20, 30)) == 1)
+  assert(select('#', sel(4, 10, 20, 30)) == 0)
+  assert(select('#', sel(math.maxinteger, 10, 20)) == 0)
+  assert(sel(-1, 10, 20, 30) == 30 and select('#', sel(-3, 10, 20, 30)) == 3)
+  local a, b = sel2(2, 10, 20, 30); assert(a == 20 and b == 30)
+  a, b = sel2(3, 10, 20, 30); assert(a == 30 and b == nil)
+  a, b = sel2(-1, 10, nil); assert(a == nil and b == nil)
+  local t = pack(2, 1, 2, 3, 4)
+  assert(t.n == 3 and t[1] == 2 and t[3] == 4)
+  t = pack(2.0, 1, 2, 3)   -- not an integer: real call
+  assert(t.n == 2 and t[1] == 2)
+  t = pack("2", 1, 2, 3)
+  assert(t.n == 2 and t[2] == 3)
+  -- many results
+  local l = {}
+  for i = 1, 300 do l[i] = i end
+  t = pack(100, table.unpack(l))
+  assert(t.n == 201 and t[1] == 100 and t[201] == 300)
+  -- errors come from 'select'
+  checkerror("index out of range", sel, 0, 1, 2)
+  checkerror("index out of range", sel, -3, 1, 2)
+  checkerror("index out of range", sel, math.mininteger, 1, 2)
+  checkerror("index out of range", sel, math.mininteger)
+  checkerror("number expected", sel, {}, 1, 2)
+  -- a redefined 'select' is called
+  do
+    local select = function (...) return "x" end
+    local function f (...) return select('#', ...) end
+    assert(f(1, 2) == "x")
+  end
+  -- with hooks on, 'select' is really called
+  local calls = 0
+  debug.sethook(function ()
+    if debug.getinfo(2, "f").func == select then calls = calls + 1 end
+  end, "c")
+  local n = count(1, 2)
+  debug.sethook()
+  assert(n == 2 and calls == 1)
+end
 
+print('OK')